@@ -30,34 +30,131 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <libias/array.h>
 #include <libias/flow.h>
-#include <libias/map.h>
+#include <libias/mem.h>
 #include <libias/mempool.h>
+#include <libias/set.h>
 #include <libias/stack.h>
 #include <libias/str.h>
 #include <libias/trait/compare.h>
 
 #include "ast.h"
+#include "intern.h"
+#include "stats.h"
+
+// Nodes and their strings are bump allocated from chunks owned by
+// the tree's pool instead of one allocation each.  Nodes end up
+// next to each other in creation order which for parsed trees is
+// pre-order, so walks touch memory mostly sequentially.  Nodes
+// removed by ast_compact() are kept on a free list, linked through
+// their parent pointer, and handed out again first.
+struct ASTArena {
+	struct Mempool *pool;
+	struct AST *nodes;
+	size_t nodes_left;
+	struct AST *free_nodes;
+	size_t deleted;
+	char *strings;
+	size_t strings_left;
+};
+
+struct ASTCompact {
+	struct ASTArena *arena;
+	struct Array *removed;
+	struct Set *pinned;
+};
 
 // Prototypes
-static struct AST *ast_clone_helper(struct Mempool *, struct Map *, struct AST *, struct AST *);
+static struct ASTArena *ast_arena_new(struct Mempool *);
+static struct AST *ast_arena_node(struct ASTArena *);
+static char *ast_arena_strdup(struct ASTArena *, const char *);
+static void ast_compact_body(struct ASTCompact *, struct Array *);
+static enum ASTWalkState ast_compact_walker(struct AST *, void *);
+static struct AST *ast_clone_helper(struct ASTArena *, struct AST *, struct AST *);
+static const char *ast_clone_str(struct ASTArena *, struct AST *, const char *);
 static struct Array *ast_siblings_helper(struct AST *);
 static void ast_print_words(const char *, struct Array *, FILE *);
 static void ast_print_word(const char *, const char *, FILE *);
 static enum ASTWalkState ast_print_helper(struct AST *, FILE *, size_t);
 static void ast_balance_comments_join(struct Array *);
 static enum ASTWalkState ast_balance_comments_walker(struct AST *, struct Array *);
+static enum ASTWalkState ast_shift_line_ranges_walker(struct AST *, void *);
+static struct AST *ast_walk_child(struct AST *, size_t);
+static size_t *ast_cursor_stack(struct ASTCursor *);
+static void ast_cursor_push(struct ASTCursor *, size_t);
+
+// Constants
+static const size_t AST_ARENA_NODES = 256;
+static const size_t AST_ARENA_STRINGS = 16384;
+
+struct ASTArena *
+ast_arena_new(struct Mempool *pool)
+{
+	struct ASTArena *arena = mempool_alloc(pool, sizeof(struct ASTArena));
+	arena->pool = pool;
+	return arena;
+}
 
 struct AST *
-ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, void *value)
+ast_arena_node(struct ASTArena *arena)
+{
+	if (arena->free_nodes) {
+		struct AST *node = arena->free_nodes;
+		arena->free_nodes = node->parent;
+		memset(node, 0, sizeof(struct AST));
+		return node;
+	}
+
+	unless (arena->nodes_left) {
+		arena->nodes = mempool_alloc(arena->pool, AST_ARENA_NODES * sizeof(struct AST));
+		arena->nodes_left = AST_ARENA_NODES;
+	}
+	arena->nodes_left--;
+	return arena->nodes++;
+}
+
+char *
+ast_arena_strdup(struct ASTArena *arena, const char *s)
 {
-	struct AST *node = mempool_alloc(pool, sizeof(struct AST));
+	size_t len = strlen(s) + 1;
+	if (len > AST_ARENA_STRINGS / 8) {
+		return str_dup(arena->pool, s);
+	}
+	if (len > arena->strings_left) {
+		arena->strings = mempool_alloc(arena->pool, AST_ARENA_STRINGS);
+		arena->strings_left = AST_ARENA_STRINGS;
+	}
+	char *retval = memcpy(arena->strings, s, len);
+	arena->strings += len;
+	arena->strings_left -= len;
+	return retval;
+}
+
+struct AST *
+ast_new(struct AST *tree, enum ASTType type, struct ASTLineRange *lines, void *value)
+// Create a new node in the same arena as tree.  The node still needs
+// to be attached to a parent.  New trees are started by passing NULL
+// together with AST_ROOT.
+{
+	struct ASTArena *arena;
+	if (tree) {
+		arena = tree->arena;
+	} else if (type == AST_ROOT) {
+		arena = ast_arena_new(mempool_new());
+	} else {
+		panic("cannot create orphaned node");
+	}
+	struct Mempool *pool = arena->pool;
+	struct AST *node = ast_arena_node(arena);
 	node->pool = pool;
+	node->arena = arena;
+	node->dirty = true;
 	if (lines) {
 		node->line_start = *lines;
 		node->line_end = *lines;
@@ -78,7 +175,7 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->comment.lines = mempool_array(pool);
 		if (comment->lines) {
 			ARRAY_FOREACH(comment->lines, const char *, line) {
-				array_append(node->comment.lines, str_dup(pool, line));
+				array_append(node->comment.lines, ast_arena_strdup(arena, line));
 			}
 		}
 		break;
@@ -89,7 +186,7 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->expr.indent = expr->indent;
 		if (expr->words) {
 			ARRAY_FOREACH(expr->words, const char *, word) {
-				array_append(node->expr.words, str_dup(pool, word));
+				array_append(node->expr.words, ast_arena_strdup(arena, word));
 			}
 		}
 		break;
@@ -101,12 +198,12 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->forexpr.indent = forexpr->indent;
 		if (forexpr->bindings) {
 			ARRAY_FOREACH(forexpr->bindings, const char *, t) {
-				array_append(node->forexpr.bindings, str_dup(pool, t));
+				array_append(node->forexpr.bindings, ast_arena_strdup(arena, t));
 			}
 		}
 		if (forexpr->words) {
 			ARRAY_FOREACH(forexpr->words, const char *, t) {
-				array_append(node->forexpr.words, str_dup(pool, t));
+				array_append(node->forexpr.words, ast_arena_strdup(arena, t));
 			}
 		}
 		break;
@@ -120,7 +217,7 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->ifexpr.ifparent = ifexpr->ifparent;
 		if (ifexpr->test) {
 			ARRAY_FOREACH(ifexpr->test, const char *, word) {
-				array_append(node->ifexpr.test, str_dup(pool, word));
+				array_append(node->ifexpr.test, ast_arena_strdup(arena, word));
 			}
 		}
 		break;
@@ -132,7 +229,7 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->include.loaded = include->loaded;
 		node->include.indent = include->indent;
 		if (include->path) {
-			node->include.path = str_dup(pool, include->path);
+			node->include.path = ast_arena_strdup(arena, include->path);
 		}
 		if (include->body) {
 			ARRAY_FOREACH(include->body, struct AST *, node) {
@@ -148,12 +245,12 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->target.body = mempool_array(pool);
 		if (target->sources) {
 			ARRAY_FOREACH(target->sources, const char *, source) {
-				array_append(node->target.sources, str_dup(pool, source));
+				array_append(node->target.sources, intern(source));
 			}
 		}
 		if (target->dependencies) {
 			ARRAY_FOREACH(target->dependencies, const char *, dependency) {
-				array_append(node->target.dependencies, str_dup(pool, dependency));
+				array_append(node->target.dependencies, intern(dependency));
 			}
 		}
 		break;
@@ -164,18 +261,18 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 		node->targetcommand.flags = targetcommand->flags;
 		if (targetcommand->words) {
 			ARRAY_FOREACH(targetcommand->words, const char *, word) {
-				array_append(node->targetcommand.words, str_dup(pool, word));
+				array_append(node->targetcommand.words, ast_arena_strdup(arena, word));
 			}
 		}
 		break;
 	} case AST_VARIABLE: {
 		struct ASTVariable *variable = value;
-		node->variable.name = str_dup(pool, variable->name);
+		node->variable.name = intern(variable->name);
 		node->variable.modifier = variable->modifier;
 		node->variable.words = mempool_array(pool);
 		if (variable->words) {
 			ARRAY_FOREACH(variable->words, const char *, t) {
-				array_append(node->variable.words, str_dup(pool, t));
+				array_append(node->variable.words, ast_arena_strdup(arena, t));
 			}
 		}
 		break;
@@ -185,13 +282,27 @@ ast_new(struct Mempool *pool, enum ASTType type, struct ASTLineRange *lines, voi
 	return node;
 }
 
+const char *
+ast_clone_str(struct ASTArena *arena, struct AST *template, const char *s)
+{
+	// Strings are never modified after they were added to a node
+	// and live as long as the tree does.
+	if (template->arena == arena) {
+		return s;
+	} else {
+		return ast_arena_strdup(arena, s);
+	}
+}
+
 struct AST *
-ast_clone_helper(struct Mempool *pool, struct Map *ptrmap, struct AST *template, struct AST *parent)
+ast_clone_helper(struct ASTArena *arena, struct AST *template, struct AST *parent)
 {
-	struct AST *node = mempool_alloc(pool, sizeof(struct AST));
-	map_add(ptrmap, template, node);
+	struct Mempool *pool = arena->pool;
+	struct AST *node = ast_arena_node(arena);
 	node->pool = pool;
+	node->arena = arena;
 	node->parent = parent;
+	node->dirty = true;
 
 	node->type = template->type;
 	node->line_start = template->line_start;
@@ -203,123 +314,129 @@ ast_clone_helper(struct Mempool *pool, struct Map *ptrmap, struct AST *template,
 	case AST_ROOT:
 		node->root.body = mempool_array(pool);
 		ARRAY_FOREACH(template->root.body, struct AST *, child) {
-			array_append(node->root.body, ast_clone_helper(pool, ptrmap, child, node));
+			array_append(node->root.body, ast_clone_helper(arena, child, node));
 		}
 		break;
 	case AST_DELETED:
 		break;
 	case AST_FOR:
 		if (template->forexpr.comment) {
-			node->forexpr.comment = str_dup(pool, template->forexpr.comment);
+			node->forexpr.comment = ast_clone_str(arena, template, template->forexpr.comment);
 		}
 		if (template->forexpr.end_comment) {
-			node->forexpr.end_comment = str_dup(pool, template->forexpr.end_comment);
+			node->forexpr.end_comment = ast_clone_str(arena, template, template->forexpr.end_comment);
 		}
 		node->forexpr.indent = template->forexpr.indent;
 		node->forexpr.bindings = mempool_array(pool);
 		ARRAY_FOREACH(template->forexpr.bindings, const char *, binding) {
-			array_append(node->forexpr.bindings, str_dup(pool, binding));
+			array_append(node->forexpr.bindings, ast_clone_str(arena, template, binding));
 		}
 		node->forexpr.words = mempool_array(pool);
 		ARRAY_FOREACH(template->forexpr.words, const char *, word) {
-			array_append(node->forexpr.words, str_dup(pool, word));
+			array_append(node->forexpr.words, ast_clone_str(arena, template, word));
 		}
 		node->forexpr.body = mempool_array(pool);
 		ARRAY_FOREACH(template->forexpr.body, struct AST *, child) {
-			array_append(node->forexpr.body, ast_clone_helper(pool, ptrmap, child, node));
+			array_append(node->forexpr.body, ast_clone_helper(arena, child, node));
 		}
 		break;
 	case AST_IF:
 		if (template->ifexpr.comment) {
-			node->ifexpr.comment = str_dup(pool, template->ifexpr.comment);
+			node->ifexpr.comment = ast_clone_str(arena, template, template->ifexpr.comment);
 		}
 		if (template->ifexpr.end_comment) {
-			node->ifexpr.end_comment = str_dup(pool, template->ifexpr.end_comment);
+			node->ifexpr.end_comment = ast_clone_str(arena, template, template->ifexpr.end_comment);
 		}
 		node->ifexpr.indent = template->ifexpr.indent;
-		node->ifexpr.ifparent = ((struct AST *)map_get(ptrmap, template))->ifexpr.ifparent;
+		// .elif and .else nodes are always in the orelse body
+		// of their ifparent.
+		if (template->ifexpr.ifparent && template->ifexpr.ifparent == template->parent) {
+			node->ifexpr.ifparent = parent;
+		}
 		node->ifexpr.test = mempool_array(pool);
 		ARRAY_FOREACH(template->ifexpr.test, const char *, word) {
-			array_append(node->ifexpr.test, str_dup(pool, word));
+			array_append(node->ifexpr.test, ast_clone_str(arena, template, word));
 		}
 		node->ifexpr.body = mempool_array(pool);
 		ARRAY_FOREACH(template->ifexpr.body, struct AST *, child) {
-			array_append(node->ifexpr.body, ast_clone_helper(pool, ptrmap, child, node));
+			array_append(node->ifexpr.body, ast_clone_helper(arena, child, node));
 		}
 		node->ifexpr.orelse = mempool_array(pool);
 		ARRAY_FOREACH(template->ifexpr.orelse, struct AST *, child) {
-			array_append(node->ifexpr.orelse, ast_clone_helper(pool, ptrmap, child, node));
+			array_append(node->ifexpr.orelse, ast_clone_helper(arena, child, node));
 		}
 		break;
 	case AST_INCLUDE:
 		if (template->include.comment) {
-			node->include.comment = str_dup(pool, template->include.comment);
+			node->include.comment = ast_clone_str(arena, template, template->include.comment);
 		}
-		node->include.path = str_dup(pool, template->include.path);
+		node->include.path = ast_clone_str(arena, template, template->include.path);
 		node->include.indent = template->include.indent;
 		node->include.sys = template->include.sys;
 		node->include.loaded = template->include.loaded;
 		node->include.body = mempool_array(pool);
 		ARRAY_FOREACH(template->include.body, struct AST *, child) {
-			array_append(node->include.body, ast_clone_helper(pool, ptrmap, child, node));
+			array_append(node->include.body, ast_clone_helper(arena, child, node));
 		}
 		break;
 	case AST_TARGET:
 		node->target.type = template->target.type;
 		if (template->target.comment) {
-			node->target.comment = str_dup(pool, template->target.comment);
+			node->target.comment = ast_clone_str(arena, template, template->target.comment);
 		}
 		node->target.sources = mempool_array(pool);
 		ARRAY_FOREACH(template->target.sources, const char *, source) {
-			array_append(node->target.sources, str_dup(pool, source));
+			array_append(node->target.sources, intern(source));
 		}
 		node->target.dependencies = mempool_array(pool);
 		ARRAY_FOREACH(template->target.dependencies, const char *, dependency) {
-			array_append(node->target.dependencies, str_dup(pool, dependency));
+			array_append(node->target.dependencies, intern(dependency));
 		}
 		node->target.body = mempool_array(pool);
 		ARRAY_FOREACH(template->target.body, struct AST *, child) {
-			array_append(node->target.body, ast_clone_helper(pool, ptrmap, child, node));
+			array_append(node->target.body, ast_clone_helper(arena, child, node));
 		}
 		break;
 	case AST_COMMENT:
 		node->comment.type = template->comment.type;
 		node->comment.lines = mempool_array(pool);
 		ARRAY_FOREACH(template->comment.lines, const char *, line) {
-			array_append(node->comment.lines, str_dup(pool, line));
+			array_append(node->comment.lines, ast_clone_str(arena, template, line));
 		}
 		break;
 	case AST_EXPR:
 		node->expr.type = template->expr.type;
 		node->expr.indent = template->expr.indent;
 		if (template->expr.comment) {
-			node->expr.comment = str_dup(pool, template->expr.comment);
+			node->expr.comment = ast_clone_str(arena, template, template->expr.comment);
 		}
 		node->expr.words = mempool_array(pool);
 		ARRAY_FOREACH(template->expr.words, const char *, word) {
-			array_append(node->expr.words, str_dup(pool, word));
+			array_append(node->expr.words, ast_clone_str(arena, template, word));
 		}
 		break;
 	case AST_TARGET_COMMAND:
-		node->targetcommand.target = &((struct AST *)map_get(ptrmap, template))->target;
+		if (parent && parent->type == AST_TARGET) {
+			node->targetcommand.target = &parent->target;
+		}
 		if (template->targetcommand.comment) {
-			node->targetcommand.comment = str_dup(pool, template->targetcommand.comment);
+			node->targetcommand.comment = ast_clone_str(arena, template, template->targetcommand.comment);
 		}
 		node->targetcommand.flags = template->targetcommand.flags;
 		node->targetcommand.words = mempool_array(pool);
 		ARRAY_FOREACH(template->targetcommand.words, const char *, word) {
-			array_append(node->targetcommand.words, str_dup(pool, word));
+			array_append(node->targetcommand.words, ast_clone_str(arena, template, word));
 		}
 		break;
 	case AST_VARIABLE:
-		node->variable.name = str_dup(pool, template->variable.name);
+		node->variable.name = intern(template->variable.name);
 		node->variable.modifier = template->variable.modifier;
 		if (template->variable.comment) {
-			node->variable.comment = str_dup(pool, template->variable.comment);
+			node->variable.comment = ast_clone_str(arena, template, template->variable.comment);
 		}
 		node->variable.words = mempool_array(pool);
 		ARRAY_FOREACH(template->variable.words, const char *, word) {
-			array_append(node->variable.words, str_dup(pool, word));
+			array_append(node->variable.words, ast_clone_str(arena, template, word));
 		}
 		break;
 	}
@@ -328,11 +445,15 @@ ast_clone_helper(struct Mempool *pool, struct Map *ptrmap, struct AST *template,
 }
 
 struct AST *
-ast_clone(struct Mempool *extpool, struct AST *template)
+ast_clone(struct AST *tree, struct AST *template)
+// Deep copy template into the arena of tree.  The copy still needs
+// to be attached to a parent.  Every node and word list is copied
+// since edits change them in place through plain pointers, so the
+// copy never shares structure with template.  Only strings are
+// shared, and only when template is part of the same tree, otherwise
+// they are copied into the arena too.
 {
-	SCOPE_MEMPOOL(pool);
-	struct Map *ptrmap = mempool_map(pool, id_compare);
-	return ast_clone_helper(extpool, ptrmap, template, NULL);
+	return ast_clone_helper(tree->arena, template, NULL);
 }
 
 void
@@ -377,6 +498,7 @@ ast_parent_append_sibling(struct AST *parent, struct AST *node, bool orelse)
 		panic("cannot add child to AST_VARIABLE");
 		break;
 	}
+	ast_mark_dirty(parent);
 }
 
 struct Array *
@@ -441,6 +563,22 @@ ast_parent_insert_before_sibling(struct AST *node, struct AST *new_sibling)
 	}
 	array_insert(nodelist, index, new_sibling);
 	new_sibling->parent = node->parent;
+	ast_mark_dirty(node->parent);
+}
+
+void
+ast_mark_dirty(struct AST *node)
+// Mark node and its ancestors as changed so that the next
+// ast_balance() revisits them.  Needs to be called on the parent
+// whenever a body is changed without the ast_parent_* functions.
+{
+	while (node && !node->dirty) {
+		node->dirty = true;
+		if (node->parent == node) {
+			break;
+		}
+		node = node->parent;
+	}
 }
 
 char *
@@ -621,6 +759,223 @@ ast_print(struct AST *node, FILE *f)
 	ast_print_helper(node, f, 0);
 }
 
+#if PORTFMT_STATS
+void
+ast_walk_visit()
+{
+	STATS_COUNT(STATS_COUNTER_AST_NODES_VISITED);
+}
+#endif
+
+struct AST *
+ast_walk_child(struct AST *node, size_t index)
+{
+	struct Array *body = NULL;
+	switch (node->type) {
+	case AST_ROOT:
+		body = node->root.body;
+		break;
+	case AST_FOR:
+		body = node->forexpr.body;
+		break;
+	case AST_IF:
+		if (index < array_len(node->ifexpr.body)) {
+			body = node->ifexpr.body;
+		} else {
+			index -= array_len(node->ifexpr.body);
+			body = node->ifexpr.orelse;
+		}
+		break;
+	case AST_INCLUDE:
+		body = node->include.body;
+		break;
+	case AST_TARGET:
+		body = node->target.body;
+		break;
+	case AST_DELETED:
+	case AST_COMMENT:
+	case AST_EXPR:
+	case AST_TARGET_COMMAND:
+	case AST_VARIABLE:
+		return NULL;
+	}
+
+	if (index < array_len(body)) {
+		return array_get(body, index);
+	} else {
+		return NULL;
+	}
+}
+
+enum ASTWalkState
+ast_walk(struct AST *root, struct ASTWalker *walker)
+// Each stack frame is a container node and the index of its next
+// child.  The index is looked up again on every step, so like with
+// ARRAY_FOREACH callbacks may append to or delete from the body of
+// the node they are called for.  The first frames live on the C
+// stack and only unusually deep trees need a heap allocation.
+{
+	struct ASTWalkFrame {
+		struct AST *node;
+		size_t index;
+	};
+	struct ASTWalkFrame frames[32];
+	struct ASTWalkFrame *stack = frames;
+	size_t cap = nitems(frames);
+	size_t depth = 0;
+	enum ASTWalkState state = AST_WALK_CONTINUE;
+
+	struct AST *node = root;
+	while (node) {
+		bool selected = walker->types == 0 || (walker->types & AST_WALK_TYPE(node->type));
+		enum ASTWalkState pre = AST_WALK_CONTINUE;
+		if (selected && walker->pre) {
+			pre = walker->pre(node, walker->userdata);
+		}
+		if (pre == AST_WALK_STOP) {
+			state = AST_WALK_STOP;
+			break;
+		} else if (pre == AST_WALK_CONTINUE && ast_walk_child(node, 0)) {
+			if (depth == cap) {
+				size_t newcap = 2 * cap;
+				if (stack == frames) {
+					stack = xrecallocarray(NULL, 0, newcap, sizeof(struct ASTWalkFrame));
+					memcpy(stack, frames, sizeof(frames));
+				} else {
+					stack = xrecallocarray(stack, cap, newcap, sizeof(struct ASTWalkFrame));
+				}
+				cap = newcap;
+			}
+			stack[depth++] = (struct ASTWalkFrame){ node, 0 };
+		} else if (pre == AST_WALK_CONTINUE && selected && walker->post) {
+			if (walker->post(node, walker->userdata) == AST_WALK_STOP) {
+				state = AST_WALK_STOP;
+				break;
+			}
+		}
+
+		// Find the next node: the next child of the innermost
+		// container that has one left, leaving all exhausted
+		// containers on the way.
+		node = NULL;
+		while (depth > 0) {
+			struct ASTWalkFrame *frame = &stack[depth - 1];
+			if ((node = ast_walk_child(frame->node, frame->index++))) {
+				AST_WALK_VISIT();
+				break;
+			}
+			depth--;
+			if (walker->post && (walker->types == 0 || (walker->types & AST_WALK_TYPE(frame->node->type)))) {
+				if (walker->post(frame->node, walker->userdata) == AST_WALK_STOP) {
+					state = AST_WALK_STOP;
+					depth = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	if (stack != frames) {
+		free(stack);
+	}
+
+	return state;
+}
+
+void
+ast_cursor_init(struct ASTCursor *cursor, struct AST *root, unsigned int types)
+{
+	cursor->root = root;
+	cursor->node = NULL;
+	cursor->types = types;
+	cursor->skip = false;
+	cursor->depth = 0;
+	cursor->cap = nitems(cursor->index);
+	cursor->heap = NULL;
+}
+
+void
+ast_cursor_finish(struct ASTCursor *cursor)
+{
+	free(cursor->heap);
+	ast_cursor_init(cursor, NULL, cursor->types);
+}
+
+void
+ast_cursor_skip(struct ASTCursor *cursor)
+{
+	cursor->skip = true;
+}
+
+size_t *
+ast_cursor_stack(struct ASTCursor *cursor)
+{
+	if (cursor->heap) {
+		return cursor->heap;
+	} else {
+		return cursor->index;
+	}
+}
+
+void
+ast_cursor_push(struct ASTCursor *cursor, size_t index)
+{
+	if (cursor->depth == cursor->cap) {
+		size_t newcap = 2 * cursor->cap;
+		if (cursor->heap) {
+			cursor->heap = xrecallocarray(cursor->heap, cursor->cap, newcap, sizeof(size_t));
+		} else {
+			cursor->heap = xrecallocarray(NULL, 0, newcap, sizeof(size_t));
+			memcpy(cursor->heap, cursor->index, sizeof(cursor->index));
+		}
+		cursor->cap = newcap;
+	}
+	ast_cursor_stack(cursor)[cursor->depth++] = index;
+}
+
+struct AST *
+ast_cursor_next(struct ASTCursor *cursor)
+// The stack holds the child index of each level.  cursor->root is
+// cleared once the walk is over.
+{
+	struct AST *node = cursor->node;
+	for (;;) {
+		struct AST *child;
+		if (node == NULL) {
+			unless (cursor->root) {
+				return NULL;
+			}
+			node = cursor->root;
+		} else if (!cursor->skip && (child = ast_walk_child(node, 0))) {
+			ast_cursor_push(cursor, 0);
+			node = child;
+		} else {
+			for (;;) {
+				if (node == cursor->root) {
+					ast_cursor_finish(cursor);
+					return NULL;
+				}
+				struct AST *parent = node->parent;
+				size_t index = ast_cursor_stack(cursor)[--cursor->depth];
+				struct AST *sibling = ast_walk_child(parent, index + 1);
+				if (sibling) {
+					ast_cursor_push(cursor, index + 1);
+					node = sibling;
+					break;
+				}
+				node = parent;
+			}
+		}
+
+		AST_WALK_VISIT();
+		cursor->skip = false;
+		if (cursor->types == 0 || (cursor->types & AST_WALK_TYPE(node->type))) {
+			cursor->node = node;
+			return node;
+		}
+	}
+}
+
 void
 ast_balance_comments_join(struct Array *comments)
 {
@@ -635,7 +990,7 @@ ast_balance_comments_join(struct Array *comments)
 			array_append(node->comment.lines, line);
 			node->edited = true;
 		}
-		sibling->type = AST_DELETED;
+		ast_delete(sibling);
 	}
 
 	array_truncate(comments);
@@ -644,6 +999,23 @@ ast_balance_comments_join(struct Array *comments)
 enum ASTWalkState
 ast_balance_comments_walker(struct AST *node, struct Array *comments)
 {
+	switch (node->type) {
+	case AST_ROOT:
+	case AST_FOR:
+	case AST_IF:
+	case AST_INCLUDE:
+	case AST_TARGET:
+		// Bodies of clean nodes were balanced before and have
+		// not changed since.
+		unless (node->dirty) {
+			ast_balance_comments_join(comments);
+			return AST_WALK_CONTINUE;
+		}
+		break;
+	default:
+		break;
+	}
+
 	switch (node->type) {
 	case AST_DELETED:
 		break;
@@ -696,6 +1068,10 @@ ast_balance_comments_walker(struct AST *node, struct Array *comments)
 		break;
 	}
 
+	// Cleared last so that comments joined in this body do
+	// not mark it again.
+	node->dirty = false;
+
 	return AST_WALK_CONTINUE;
 }
 
@@ -704,7 +1080,7 @@ ast_balance(struct AST *node)
 // Clean up the AST.  This function should be called after editing the AST.
 // We might have some artifacts like two consecutive AST_COMMENT
 // siblings that should be merge into one for easier editing down
-// the line.
+// the line.  Only subtrees marked with ast_mark_dirty() are visited.
 {
 	SCOPE_MEMPOOL(pool);
 	struct Array *comments = mempool_array(pool);
@@ -712,6 +1088,152 @@ ast_balance(struct AST *node)
 	ast_balance_comments_join(comments);
 }
 
+enum ASTWalkState
+ast_shift_line_ranges_walker(struct AST *node, void *userdata)
+{
+	ssize_t delta = *(ssize_t *)userdata;
+	if (node->line_start.a > 0) {
+		node->line_start.a += delta;
+		node->line_start.b += delta;
+	}
+	if (node->line_end.a > 0) {
+		node->line_end.a += delta;
+		node->line_end.b += delta;
+	}
+
+	return AST_WALK_CONTINUE;
+}
+
+void
+ast_shift_line_ranges(struct AST *node, ssize_t delta)
+// Move node and all its children by delta lines.  Nodes without line
+// information are left alone.
+{
+	ast_walk(node, &(struct ASTWalker){
+		.pre = ast_shift_line_ranges_walker,
+		.userdata = &delta,
+	});
+}
+
+void
+ast_delete(struct AST *node)
+// Mark node as deleted.  It stays in its parent's body and is
+// skipped by walkers until the next ast_compact().  The deletion is
+// counted by the root of the tree the node is in since that is what
+// ast_compact() is called on.  Nodes of included files come from the
+// arena of their own tree.
+{
+	node->type = AST_DELETED;
+	struct AST *root = node;
+	while (root->parent && root->parent != root) {
+		root = root->parent;
+	}
+	root->arena->deleted++;
+	ast_mark_dirty(node->parent);
+}
+
+size_t
+ast_deleted_nodes(struct AST *node)
+{
+	return node->arena->deleted;
+}
+
+void
+ast_compact_body(struct ASTCompact *this, struct Array *body)
+{
+	size_t deleted = 0;
+	ARRAY_FOREACH(body, struct AST *, child) {
+		if (child->type == AST_DELETED) {
+			deleted++;
+		}
+	}
+	unless (deleted) {
+		return;
+	}
+
+	SCOPE_MEMPOOL(pool);
+	struct Array *live = mempool_array(pool);
+	ARRAY_FOREACH(body, struct AST *, child) {
+		if (child->type != AST_DELETED) {
+			array_append(live, child);
+		} else if (child->arena == this->arena) {
+			// Nodes of included files belong to another
+			// tree and cannot be recycled here.
+			array_append(this->removed, child);
+		}
+	}
+	array_truncate(body);
+	ARRAY_JOIN(body, live);
+}
+
+enum ASTWalkState
+ast_compact_walker(struct AST *node, void *userdata)
+{
+	struct ASTCompact *this = userdata;
+	switch (node->type) {
+	case AST_ROOT:
+		ast_compact_body(this, node->root.body);
+		break;
+	case AST_FOR:
+		ast_compact_body(this, node->forexpr.body);
+		break;
+	case AST_IF:
+		ast_compact_body(this, node->ifexpr.body);
+		ast_compact_body(this, node->ifexpr.orelse);
+		if (node->ifexpr.ifparent && node->ifexpr.ifparent->type == AST_DELETED) {
+			set_add(this->pinned, node->ifexpr.ifparent);
+		}
+		break;
+	case AST_INCLUDE:
+		ast_compact_body(this, node->include.body);
+		break;
+	case AST_TARGET:
+		ast_compact_body(this, node->target.body);
+		break;
+	case AST_TARGET_COMMAND:
+		if (node->targetcommand.target) {
+			struct AST *target = (struct AST *)((char *)node->targetcommand.target - offsetof(struct AST, target));
+			if (target->type == AST_DELETED) {
+				set_add(this->pinned, target);
+			}
+		}
+		break;
+	case AST_COMMENT:
+	case AST_DELETED:
+	case AST_EXPR:
+	case AST_VARIABLE:
+		break;
+	}
+
+	return AST_WALK_CONTINUE;
+}
+
+void
+ast_compact(struct AST *node)
+// Remove all deleted nodes from the tree and reuse their storage
+// for new nodes.  Pointers to deleted nodes are invalid afterwards.
+// Deleted nodes that live nodes still refer to as their
+// ifexpr.ifparent or targetcommand.target are kept as they are.
+{
+	SCOPE_MEMPOOL(pool);
+	struct ASTCompact this = {
+		.arena = node->arena,
+		.removed = mempool_array(pool),
+		.pinned = mempool_set(pool, id_compare),
+	};
+	ast_walk(node, &(struct ASTWalker){
+		.pre = ast_compact_walker,
+		.userdata = &this,
+	});
+	ARRAY_FOREACH(this.removed, struct AST *, child) {
+		unless (set_contains(this.pinned, child)) {
+			child->parent = this.arena->free_nodes;
+			this.arena->free_nodes = child;
+		}
+	}
+	node->arena->deleted = 0;
+}
+
 void
 ast_free(struct AST *node)
 // This will free the entire tree not just this particular node
@@ -119,10 +119,48 @@ const char *ASTVariableModifier_tostring(enum ASTVariableModifier);
 enum ASTWalkState {
 	AST_WALK_CONTINUE,
 	AST_WALK_STOP,
+	AST_WALK_SKIP,
 };
 
 const char *ASTWalkState_tostring(enum ASTWalkState);
 
+// ast_walk() traverses a tree with an explicit stack instead of
+// recursion.  pre is called before a node's children are visited and
+// post after them.  Both are optional and only called for nodes whose
+// type is in types (a mask of AST_WALK_TYPE() bits; 0 selects all
+// nodes).  Children are visited regardless of the mask.  pre can
+// return AST_WALK_SKIP to skip the node's children and its post call.
+// AST_WALK_STOP from either callback ends the walk.
+#define AST_WALK_TYPE(t) (1U << (t))
+
+struct AST;
+
+struct ASTWalker {
+	unsigned int types;
+	enum ASTWalkState (*pre)(struct AST *, void *);
+	enum ASTWalkState (*post)(struct AST *, void *);
+	void *userdata;
+};
+
+// ast_cursor_next() returns the nodes of a tree in the same order as
+// ast_walk() but is driven by the caller.  Only nodes whose type is
+// in types are returned.  ast_cursor_skip() skips the children of the
+// node that was returned last.  The tree must not be changed while a
+// cursor is used.  Like with ast_walk() the child indexes of the first
+// levels are kept in the cursor itself and only unusually deep trees
+// need a heap allocation, which is released once ast_cursor_next()
+// returns NULL or by ast_cursor_finish() when stopping early.
+struct ASTCursor {
+	struct AST *root;
+	struct AST *node;
+	unsigned int types;
+	bool skip;
+	size_t depth;
+	size_t cap;
+	size_t *heap;
+	size_t index[16];
+};
+
 struct ASTComment {
 	enum ASTCommentType type;
 	struct Array *lines;
@@ -230,9 +268,11 @@ struct AST {
 	enum ASTType type;
 	struct AST *parent;
 	struct Mempool *pool;
+	struct ASTArena *arena;
 	struct ASTLineRange line_start;
 	struct ASTLineRange line_end;
 	bool edited;
+	bool dirty;
 	struct {
 		size_t goalcol;
 	} meta;
@@ -250,18 +290,37 @@ struct AST {
 };
 
 void ast_free(struct AST *);
-struct AST *ast_new(struct Mempool *, enum ASTType, struct ASTLineRange *, void *);
-struct AST *ast_clone(struct Mempool *, struct AST *);
+struct AST *ast_new(struct AST *, enum ASTType, struct ASTLineRange *, void *);
+struct AST *ast_clone(struct AST *, struct AST *);
 struct Array *ast_siblings(struct Mempool *, struct AST *);
 void ast_parent_append_sibling(struct AST *, struct AST *, bool);
 void ast_parent_insert_before_sibling(struct AST *, struct AST *);
 void ast_print(struct AST *, FILE *);
 void ast_balance(struct AST *);
+void ast_compact(struct AST *);
+void ast_delete(struct AST *);
+void ast_mark_dirty(struct AST *);
+size_t ast_deleted_nodes(struct AST *);
+void ast_shift_line_ranges(struct AST *, ssize_t);
+enum ASTWalkState ast_walk(struct AST *, struct ASTWalker *);
+void ast_cursor_init(struct ASTCursor *, struct AST *, unsigned int);
+void ast_cursor_finish(struct ASTCursor *);
+struct AST *ast_cursor_next(struct ASTCursor *);
+void ast_cursor_skip(struct ASTCursor *);
 
 char *ast_line_range_tostring(struct ASTLineRange *, bool, struct Mempool *);
 
+// Walked nodes are counted for tests/perf when built with the
+// stats feature
+#if PORTFMT_STATS
+void ast_walk_visit(void);
+# define AST_WALK_VISIT() ast_walk_visit()
+#else
+# define AST_WALK_VISIT() ((void)0)
+#endif
+
 #define AST_WALK_RECUR(x) \
-	if ((x) == AST_WALK_STOP) { \
+	if ((AST_WALK_VISIT(), (x)) == AST_WALK_STOP) { \
 		return AST_WALK_STOP; \
 	}
 
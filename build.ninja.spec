@@ -7,6 +7,11 @@ if subpackages
 	CPPFLAGS += -DPORTFMT_SUBPACKAGES=1
 if !subpackages
 	CPPFLAGS += -DPORTFMT_SUBPACKAGES=0
+if stats
+	CPPFLAGS += -DPORTFMT_STATS=1
+	LDFLAGS += -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc -Wl,--wrap=free -Wl,--wrap=mempool_new
+if !stats
+	CPPFLAGS += -DPORTFMT_STATS=0
 
 bundle libias.a
 	subdir = $srcdir/libias
@@ -34,7 +39,9 @@ bundle libias.a
 
 bundle libportfmt.a
 	ast.c
+	$builddir/build_id.c
 	constants.c
+	intern.c
 	io/dir.c
 	io/file.c
 	mainutils.c
@@ -45,6 +52,8 @@ bundle libportfmt.a
 	parser/astbuilder/target.c
 	parser/astbuilder/token.c
 	parser/astbuilder/variable.c
+	parser/cache.c
+	parser/edits.c
 	parser/edits/edit/bump_revision.c
 	parser/edits/edit/merge.c
 	parser/edits/edit/set_version.c
@@ -66,8 +75,30 @@ bundle libportfmt.a
 	parser/edits/refactor/sanitize_comments.c
 	parser/edits/refactor/sanitize_eol_comments.c
 	parser/tokenizer.c
+	profile.c
 	regexp.c
 	rules.c
+	stats.c
+	trace.c
+
+gen $builddir/build_id.c $srcdir/scripts/build_id.awk
+	ast.c
+	ast.h
+	intern.c
+	parser/astbuilder.c
+	parser/astbuilder.h
+	parser/astbuilder/conditional.c
+	parser/astbuilder/conditional.h
+	parser/astbuilder/enum.h
+	parser/astbuilder/target.c
+	parser/astbuilder/target.h
+	parser/astbuilder/token.c
+	parser/astbuilder/token.h
+	parser/astbuilder/variable.c
+	parser/astbuilder/variable.h
+	parser/cache.c
+	parser/tokenizer.c
+	parser/tokenizer.h
 
 gen $builddir/enum.c $srcdir/scripts/enum.awk
 	ast.h
@@ -76,7 +107,9 @@ gen $builddir/enum.c $srcdir/scripts/enum.awk
 	parser/astbuilder/enum.h
 	portscan/log.h
 	portscan/status.h
+	profile.h
 	rules.h
+	stats.h
 
 bin portclippy
 	libias.a
@@ -92,6 +125,7 @@ bin portfmt
 	libias.a
 	libportfmt.a
 	portfmt.c
+	portfmt/server.c
 
 bin portscan
 	LDFLAGS += -pthread
@@ -101,8 +135,19 @@ bin portscan
 	portscan/log.c
 	portscan/status.c
 
+tool tests/bench/bench
+	libias.a
+	libportfmt.a
+	tests/bench/bench.c
+
+tool tests/bench/rules_bench
+	libias.a
+	libportfmt.a
+	tests/bench/rules_bench.c
+
 tool tests/split_test
 	libias.a
+	libportfmt.a
 	tests/split_test.c
 
 install-man
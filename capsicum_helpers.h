@@ -48,6 +48,8 @@ enum CapsicumHelperFlags {
 	CAPH_CREATE = 1 << 5,
 	CAPH_READDIR = 1 << 6,
 	CAPH_SYMLINK = 1 << 7,
+	CAPH_RENAME = 1 << 8,
+	CAPH_MMAP = 1 << 9,
 };
 
 static __inline int
@@ -73,6 +75,12 @@ caph_limit_stream(int fd, int flags)
 		cap_rights_set(&rights, CAP_FSTATFS, CAP_LOOKUP, CAP_READ);
 	if ((flags & CAPH_SYMLINK) != 0)
 		cap_rights_set(&rights, CAP_SYMLINKAT | CAP_UNLINKAT);
+	if ((flags & CAPH_RENAME) != 0)
+		cap_rights_set(&rights, CAP_CREATE, CAP_LOOKUP, CAP_WRITE,
+		    CAP_FCHMOD, CAP_FCHOWN, CAP_FSTATAT, CAP_FSYNC,
+		    CAP_RENAMEAT_SOURCE, CAP_RENAMEAT_TARGET, CAP_UNLINKAT);
+	if ((flags & CAPH_MMAP) != 0)
+		cap_rights_set(&rights, CAP_MMAP_R);
 
 	if (cap_rights_limit(fd, &rights) < 0 && errno != ENOSYS) {
 		if (errno == EBADF && (flags & CAPH_IGNORE_EBADF) != 0)
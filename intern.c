@@ -0,0 +1,216 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libias/mem.h>
+
+#include "intern.h"
+
+struct InternEntry {
+	uint64_t hash;
+	size_t len;
+	char str[];
+};
+
+struct InternTable {
+	size_t cap;
+	_Atomic(struct InternEntry *) entries[];
+};
+
+// Inserts are serialized per shard with a spinlock.  The critical
+// section only copies a short string, so contention stays low even
+// with portscan's worker threads all interning the same names.
+struct InternShard {
+	atomic_bool lock;
+	_Atomic(struct InternTable *) table;
+	size_t len;
+	char *chunk;
+	size_t chunk_left;
+};
+
+// Prototypes
+static struct InternEntry *intern_alloc(struct InternShard *, size_t);
+static uint64_t intern_hash(const char *, size_t);
+static const char *intern_lookup(struct InternTable *, uint64_t, const char *, size_t);
+static struct InternTable *intern_table_new(size_t);
+static void intern_table_insert(struct InternTable *, struct InternEntry *);
+
+// Constants
+#define INTERN_SHARDS 64
+#define INTERN_TABLE_INITIAL_CAP 256
+#define INTERN_CHUNK_SIZE 65536
+
+static struct InternShard intern_shards[INTERN_SHARDS];
+
+uint64_t
+intern_hash(const char *s, size_t len)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)s[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+struct InternTable *
+intern_table_new(size_t cap)
+{
+	struct InternTable *table = xmalloc(sizeof(struct InternTable) + cap * sizeof(table->entries[0]));
+	table->cap = cap;
+	for (size_t i = 0; i < cap; i++) {
+		atomic_init(&table->entries[i], NULL);
+	}
+	return table;
+}
+
+const char *
+intern_lookup(struct InternTable *table, uint64_t hash, const char *s, size_t len)
+{
+	if (table == NULL) {
+		return NULL;
+	}
+
+	// The low bits of the hash select the shard, so probe with
+	// the remaining ones.
+	size_t mask = table->cap - 1;
+	for (size_t i = (hash / INTERN_SHARDS) & mask;; i = (i + 1) & mask) {
+		struct InternEntry *entry = atomic_load_explicit(&table->entries[i], memory_order_acquire);
+		if (entry == NULL) {
+			return NULL;
+		} else if (entry->hash == hash && entry->len == len && memcmp(entry->str, s, len) == 0) {
+			return entry->str;
+		}
+	}
+}
+
+void
+intern_table_insert(struct InternTable *table, struct InternEntry *entry)
+{
+	size_t mask = table->cap - 1;
+	size_t i = (entry->hash / INTERN_SHARDS) & mask;
+	while (atomic_load_explicit(&table->entries[i], memory_order_relaxed)) {
+		i = (i + 1) & mask;
+	}
+	atomic_store_explicit(&table->entries[i], entry, memory_order_release);
+}
+
+struct InternEntry *
+intern_alloc(struct InternShard *shard, size_t len)
+{
+	size_t size = sizeof(struct InternEntry) + len + 1;
+	size = (size + alignof(struct InternEntry) - 1) & ~(alignof(struct InternEntry) - 1);
+	if (size > INTERN_CHUNK_SIZE / 4) {
+		return xmalloc(size);
+	}
+
+	if (size > shard->chunk_left) {
+		shard->chunk = xmalloc(INTERN_CHUNK_SIZE);
+		shard->chunk_left = INTERN_CHUNK_SIZE;
+	}
+	struct InternEntry *entry = (struct InternEntry *)shard->chunk;
+	shard->chunk += size;
+	shard->chunk_left -= size;
+	return entry;
+}
+
+const char *
+intern(const char *s)
+{
+	if (s == NULL) {
+		return NULL;
+	}
+	return intern_n(s, strlen(s));
+}
+
+const char *
+intern_find(const char *s)
+{
+	size_t len = strlen(s);
+	uint64_t hash = intern_hash(s, len);
+	struct InternShard *shard = &intern_shards[hash % INTERN_SHARDS];
+	return intern_lookup(atomic_load_explicit(&shard->table, memory_order_acquire), hash, s, len);
+}
+
+const char *
+intern_n(const char *s, size_t len)
+{
+	uint64_t hash = intern_hash(s, len);
+	struct InternShard *shard = &intern_shards[hash % INTERN_SHARDS];
+
+	const char *retval = intern_lookup(atomic_load_explicit(&shard->table, memory_order_acquire), hash, s, len);
+	if (retval) {
+		return retval;
+	}
+
+	while (atomic_exchange_explicit(&shard->lock, true, memory_order_acquire));
+
+	// Somebody else might have inserted it while we were waiting
+	// for the lock.
+	struct InternTable *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	retval = intern_lookup(table, hash, s, len);
+	if (retval == NULL) {
+		// Keep the load factor below 1/2.  Readers might still
+		// be probing the old table, so it is never freed.
+		if (table == NULL || (shard->len + 1) * 2 > table->cap) {
+			struct InternTable *grown = intern_table_new(table ? table->cap * 2 : INTERN_TABLE_INITIAL_CAP);
+			if (table) {
+				for (size_t i = 0; i < table->cap; i++) {
+					struct InternEntry *entry = atomic_load_explicit(&table->entries[i], memory_order_relaxed);
+					if (entry) {
+						intern_table_insert(grown, entry);
+					}
+				}
+			}
+			table = grown;
+			atomic_store_explicit(&shard->table, table, memory_order_release);
+		}
+
+		struct InternEntry *entry = intern_alloc(shard, len);
+		entry->hash = hash;
+		entry->len = len;
+		memcpy(entry->str, s, len);
+		entry->str[len] = 0;
+		intern_table_insert(table, entry);
+		shard->len++;
+		retval = entry->str;
+	}
+
+	atomic_store_explicit(&shard->lock, false, memory_order_release);
+	return retval;
+}
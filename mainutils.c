@@ -44,16 +44,26 @@
 #include <unistd.h>
 
 #include <libias/array.h>
+#include <libias/mem.h>
 #include <libias/mempool.h>
 #include <libias/mempool/file.h>
 #include <libias/str.h>
 
+#include "ast.h"
 #include "capsicum_helpers.h"
 #include "mainutils.h"
 #include "parser.h"
 
 // Prototypes
 static FILE *open_file_helper(struct Mempool *, const char *, const char *, const char **);
+static int open_file_dir(const char *);
+static void close_file_dir(void *);
+
+#if HAVE_PLEDGE
+static const char *pledge_promises = "stdio";
+// Both the AST cache and -i write files next to others
+static const char *pledge_promises_files = "stdio rpath wpath cpath fattr chown";
+#endif
 
 void
 enter_sandbox()
@@ -68,76 +78,127 @@ enter_sandbox()
 	}
 #endif
 #if HAVE_PLEDGE
-	if (pledge("stdio", NULL) == -1) {
+	if (pledge(pledge_promises, NULL) == -1) {
 		err(1, "pledge");
 	}
 #endif
 }
 
+int
+open_cache_dir()
+// Open the AST cache directory given in PORTFMT_CACHE_DIR for use
+// as ParserSettings.cache_dir.  Has to be called before
+// enter_sandbox().  Returns -1 if the cache is disabled.
+{
+	const char *path = getenv("PORTFMT_CACHE_DIR");
+	if (path == NULL || *path == 0) {
+		return -1;
+	}
+
+	int dir = open(path, O_DIRECTORY | O_CLOEXEC);
+	if (dir < 0) {
+		warn("open: %s", path);
+		return -1;
+	}
+#if HAVE_CAPSICUM
+	if (caph_limit_stream(dir, CAPH_READ | CAPH_MMAP | CAPH_RENAME) < 0) {
+		close(dir);
+		return -1;
+	}
+#endif
+#if HAVE_PLEDGE
+	pledge_promises = pledge_promises_files;
+#endif
+
+	return dir;
+}
+
 bool
-read_common_args(int *argc, char ***argv, struct ParserSettings *settings, const char *optstr, struct Mempool *pool, struct Array *expressions)
+read_common_arg(struct ParserSettings *settings, int ch, const char *arg, struct Mempool *pool, struct Array *expressions)
+// Apply one option returned by getopt().  Returns false for unknown
+// options.
 {
-	int ch;
-	while ((ch = getopt(*argc, *argv, optstr)) != -1) {
-		switch (ch) {
-		case 'D':
-			settings->behavior |= PARSER_OUTPUT_DIFF;
-			if (optarg) {
-				const char *errstr = NULL;
-				settings->diff_context = strtonum(optarg, 0, INT_MAX, &errstr);
-				if (errstr != NULL) {
-					errx(1, "-D%s is %s", optarg, errstr);
-				}
-			}
-			break;
-		case 'd':
-			settings->behavior |= PARSER_OUTPUT_DUMP_TOKENS;
-			settings->debug_level++;
-			break;
-		case 'e':
-			if (expressions && optarg) {
-				array_append(expressions, str_dup(pool, optarg));
-			} else {
-				return false;
+	switch (ch) {
+	case 'c':
+		settings->behavior |= PARSER_OUTPUT_CHECK;
+		break;
+	case 'D':
+		settings->behavior |= PARSER_OUTPUT_DIFF;
+		if (arg) {
+			const char *errstr = NULL;
+			settings->diff_context = strtonum(arg, 0, INT_MAX, &errstr);
+			if (errstr != NULL) {
+				errx(1, "-D%s is %s", arg, errstr);
 			}
-			break;
-		case 'i':
-			settings->behavior |= PARSER_OUTPUT_INPLACE;
-			break;
-		case 't':
-			settings->behavior |= PARSER_FORMAT_TARGET_COMMANDS;
-			break;
-		case 'u':
-			settings->behavior |= PARSER_UNSORTED_VARIABLES;
-			break;
-		case 'U':
-			settings->behavior |= PARSER_ALWAYS_SORT_VARIABLES;
-			break;
-		case 'w':
-			if (optarg) {
-				const char *errstr = NULL;
-				settings->variable_wrapcol = strtonum(optarg, -1, INT_MAX, &errstr);
-				settings->if_wrapcol = settings->variable_wrapcol;
-				settings->for_wrapcol = settings->variable_wrapcol;
-				if (errstr != NULL) {
-					errx(1, "-w%s is %s", optarg, errstr);
-				}
-			} else {
-				return false;
+		}
+		break;
+	case 'd':
+		settings->behavior |= PARSER_OUTPUT_DUMP_TOKENS;
+		settings->debug_level++;
+		break;
+	case 'e':
+		if (expressions && arg) {
+			array_append(expressions, str_dup(pool, arg));
+		} else {
+			return false;
+		}
+		break;
+	case 'i':
+		settings->behavior |= PARSER_OUTPUT_INPLACE;
+		break;
+	case 't':
+		settings->behavior |= PARSER_FORMAT_TARGET_COMMANDS;
+		break;
+	case 'u':
+		settings->behavior |= PARSER_UNSORTED_VARIABLES;
+		break;
+	case 'U':
+		settings->behavior |= PARSER_ALWAYS_SORT_VARIABLES;
+		break;
+	case 'w':
+		if (arg) {
+			const char *errstr = NULL;
+			settings->variable_wrapcol = strtonum(arg, -1, INT_MAX, &errstr);
+			settings->if_wrapcol = settings->variable_wrapcol;
+			settings->for_wrapcol = settings->variable_wrapcol;
+			if (errstr != NULL) {
+				errx(1, "-w%s is %s", arg, errstr);
 			}
-			break;
-		default:
+		} else {
 			return false;
 		}
+		break;
+	default:
+		return false;
 	}
-	*argc -= optind;
-	*argv += optind;
 
+	return true;
+}
+
+void
+finish_common_args(struct ParserSettings *settings)
+{
 	if ((settings->behavior & PARSER_OUTPUT_DUMP_TOKENS) ||
 	    (settings->behavior & PARSER_OUTPUT_DIFF) ||
+	    (settings->behavior & PARSER_OUTPUT_CHECK) ||
 	    (settings->behavior & PARSER_OUTPUT_RAWLINES)) {
 		settings->behavior &= ~PARSER_OUTPUT_INPLACE;
 	}
+}
+
+bool
+read_common_args(int *argc, char ***argv, struct ParserSettings *settings, const char *optstr, struct Mempool *pool, struct Array *expressions)
+{
+	int ch;
+	while ((ch = getopt(*argc, *argv, optstr)) != -1) {
+		if (!read_common_arg(settings, ch, optarg, pool, expressions)) {
+			return false;
+		}
+	}
+	*argc -= optind;
+	*argv += optind;
+
+	finish_common_args(settings);
 
 	return true;
 }
@@ -178,8 +239,32 @@ open_file_helper(struct Mempool *extpool, const char *path, const char *mode, co
 	return mempool_add(extpool, mempool_forget(pool, f), fclose);
 }
 
+int
+open_file_dir(const char *filename)
+{
+	SCOPE_MEMPOOL(pool);
+
+	const char *dir = ".";
+	const char *slash = strrchr(filename, '/');
+	if (slash == filename) {
+		dir = "/";
+	} else if (slash) {
+		dir = str_ndup(pool, filename, slash - filename);
+	}
+
+	return open(dir, O_DIRECTORY | O_CLOEXEC);
+}
+
+void
+close_file_dir(void *p)
+{
+	int *dir = p;
+	close(*dir);
+	free(dir);
+}
+
 bool
-open_file(enum MainutilsOpenFileBehavior behavior, int *argc, char ***argv, struct Mempool *pool, FILE **fp_in, FILE **fp_out, const char **filename)
+open_file(enum MainutilsOpenFileBehavior behavior, int *argc, char ***argv, struct Mempool *pool, FILE **fp_in, FILE **fp_out, const char **filename, int *dir)
 {
 #if HAVE_CAPSICUM
 	closefrom(STDERR_FILENO + 1);
@@ -204,6 +289,25 @@ open_file(enum MainutilsOpenFileBehavior behavior, int *argc, char ***argv, stru
 				return false;
 			}
 #endif
+			if (dir) {
+				// The output is written to a temporary file
+				// next to the original and renamed over it.
+				*dir = open_file_dir(*filename);
+				if (*dir < 0) {
+					return false;
+				}
+				int *dirp = xmalloc(sizeof(*dirp));
+				*dirp = *dir;
+				mempool_add(pool, dirp, close_file_dir);
+#if HAVE_CAPSICUM
+				if (caph_limit_stream(*dir, CAPH_RENAME) < 0) {
+					return false;
+				}
+#endif
+#if HAVE_PLEDGE
+				pledge_promises = pledge_promises_files;
+#endif
+			}
 		} else  {
 			if (!(behavior & MAINUTILS_OPEN_FILE_KEEP_STDIN)) {
 				close(STDIN_FILENO);
@@ -40,5 +40,8 @@ enum MainutilsOpenFileBehavior {
 const char *MainutilsOpenFileBehavior_tostring(enum MainutilsOpenFileBehavior);
 
 void enter_sandbox(void);
-bool open_file(enum MainutilsOpenFileBehavior, int *, char ***, struct Mempool *, FILE **, FILE **, const char **filename);
+int open_cache_dir(void);
+bool open_file(enum MainutilsOpenFileBehavior, int *, char ***, struct Mempool *, FILE **, FILE **, const char **filename, int *dir);
+bool read_common_arg(struct ParserSettings *, int, const char *, struct Mempool *, struct Array *);
+void finish_common_args(struct ParserSettings *);
 bool read_common_args(int *, char ***, struct ParserSettings *, const char *, struct Mempool *, struct Array *);
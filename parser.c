@@ -29,8 +29,10 @@
 #include "config.h"
 
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdbool.h>
@@ -57,12 +59,38 @@
 
 #include "ast.h"
 #include "constants.h"
+#include "intern.h"
 #include "io/file.h"
 #include "parser.h"
 #include "parser/astbuilder.h"
+#include "parser/cache.h"
 #include "parser/edits.h"
 #include "parser/tokenizer.h"
+#include "profile.h"
 #include "rules.h"
+#include "stats.h"
+#include "trace.h"
+
+// Output is collected in one growable buffer.  lines holds the
+// offset just past each newline in buf, i.e., one entry per
+// complete line.  With PARSER_OUTPUT_CHECK complete lines are
+// compared against the input and dropped right away; checked
+// counts them.
+struct ParserOutput {
+	char *buf;
+	size_t len;
+	size_t cap;
+	size_t *lines;
+	size_t lines_len;
+	size_t lines_cap;
+	size_t checked;
+};
+
+// A line of the input or the output for parser_output_diff()
+struct ParserDiffLine {
+	uint64_t hash;
+	const char *line;
+};
 
 struct Parser {
 	struct ParserSettings settings;
@@ -75,28 +103,69 @@ struct Parser {
 
 	struct Mempool *pool;
 	struct AST *ast;
-	struct Array *result;
+	struct ParserOutput result;
 	struct Mempool *metadata_pool;
 	void *metadata[PARSER_METADATA_USES + 1];
 	bool metadata_valid[PARSER_METADATA_USES + 1];
 
+	// Line ranges of all nodes sorted by their first line for
+	// parser_lookup_line().  Rebuilt on first use after the AST
+	// changed.
+	struct Mempool *line_index_pool;
+	struct Array *line_index;
+
+	// Lines read by parser_read_from_file() that were not fed to
+	// the tokenizer yet because they might be in the AST cache
+	bool cache_pending;
+
+	// Set for the windows parsed by parser_apply_text_edit().  The
+	// whole-file refactorings only run on the spliced AST.
+	bool skip_refactors;
+
+	// Number of parser_edit() calls in progress.  Edits may call
+	// parser_edit() themselves and still hold nodes while they do.
+	size_t edit_depth;
+
 	bool read_finished;
 };
 
+struct ParserLineIndexEntry {
+	struct ASTLineRange *range;
+	struct AST *node;
+	size_t depth;
+	// Largest range->b of this and all previous entries
+	size_t max_b;
+};
+
+struct ParserLineIndexState {
+	struct Array *entries;
+	struct Mempool *pool;
+	size_t depth;
+};
+
 struct ParserFindGoalcolsState {
 	struct Parser *parser;
 	uint32_t moving_goalcol;
 	struct Array *nodes;
 };
 
+struct ParserLookupTargetState {
+	const char *name;
+	struct AST *retval;
+};
+
 // Prototypes
-static enum ASTWalkState parser_is_category_makefile_walker(struct AST *, bool *);
+static enum ASTWalkState parser_is_category_makefile_walker(struct AST *, void *);
 static bool parser_is_category_makefile(struct Parser *);
 static void parser_propagate_goalcol(struct ParserFindGoalcolsState *);
-static enum ASTWalkState parser_find_goalcols_walker(struct AST *, struct ParserFindGoalcolsState *);
+static enum ASTWalkState parser_find_goalcols_walker(struct AST *, void *);
 static void parser_find_goalcols(struct Parser *);
 static void print_newline_array(struct Parser *, struct AST *, struct Array *);
 static void print_token_array(struct Parser *, struct AST *, struct Array *);
+static void parser_output_append(struct ParserOutput *, const char *, size_t);
+static void parser_output_free(struct ParserOutput *);
+static void parser_output_check(struct Parser *);
+static void parser_output_check_finish(struct Parser *);
 static void parser_output_print_rawlines(struct Parser *, struct ASTLineRange *);
 static void parser_output_print_target_command(struct Parser *, struct AST *);
 static void parser_output_prepare(struct Parser *);
@@ -110,23 +179,43 @@ static void parser_output_print_variable(struct Parser *, struct Mempool *, stru
 static void parser_output_category_makefile_reformatted(struct Parser *, struct AST *);
 static enum ASTWalkState parser_output_reformatted_walker(struct Parser *, struct AST *);
 static void parser_output_reformatted(struct Parser *);
+static void parser_output_diff_line(struct ParserDiffLine *, const char *);
+static bool parser_output_diff_line_equal(const struct ParserDiffLine *, const struct ParserDiffLine *);
+static DECLARE_COMPARE(compare_diff_line);
 static void parser_output_diff(struct Parser *);
 static void parser_output_dump_tokens(struct Parser *);
+static bool parser_output_unchanged(struct Parser *, int);
+static bool parser_output_rename_into_place(struct Parser *, int);
 static const char *process_include(struct Parser *, struct Mempool *, const char *, const char *);
-static enum ASTWalkState parser_load_includes_walker(struct AST *, struct Parser *, int);
+static enum ASTWalkState parser_load_includes_walker(struct AST *, void *);
 static enum ParserError parser_load_includes(struct Parser *);
-static void parser_meta_values_helper(struct Parser *, struct Set *, const char *, char *);
+static enum ParserError parser_read_finish_helper(struct Parser *);
+static enum ParserError parser_read_finish_refactor(struct Parser *);
+static enum ParserError parser_cache_flush(struct Parser *);
+static enum ParserError parser_reparse(struct Parser *);
+static bool parser_text_edit_only_comments(struct Array *, size_t, size_t);
+static bool parser_text_edit_collapse_at(struct Array *, size_t);
+static enum ParserError parser_text_edit_refactor_nodes(struct Parser *, ParserEditFn, size_t, size_t);
+static enum ParserError parser_text_edit_refactor(struct Parser *, size_t, size_t);
+static void parser_meta_values_helper(struct Parser *, struct Set *, const char *, const char *);
 static void parser_meta_values(struct Parser *, const char *, struct Set *);
 static void parser_port_options_add_from_group(struct Parser *, const char *);
 static void parser_port_options_add_from_var(struct Parser *, const char *);
 static void parser_metadata_port_options(struct Parser *);
 static void parser_metadata_alloc(struct Parser *);
-static enum ASTWalkState parser_lookup_target_walker(struct AST *, const char *, struct AST **);
-static enum ASTWalkState parser_lookup_variable_walker(struct AST *, struct Mempool *, const char *, enum ParserLookupVariableBehavior, struct Array *, struct Array *, struct AST **);
+static enum ASTWalkState parser_line_index_walker(struct AST *, void *);
+static enum ASTWalkState parser_line_index_leave(struct AST *, void *);
+static DECLARE_COMPARE(compare_line_index_entry);
+static struct Array *parser_line_index(struct Parser *);
+static enum ASTWalkState parser_lookup_target_walker(struct AST *, void *);
+
+// Constants
+static const size_t PARSER_COMPACT_THRESHOLD = 32;
 
 enum ASTWalkState
-parser_is_category_makefile_walker(struct AST *node, bool *is_category)
+parser_is_category_makefile_walker(struct AST *node, void *userdata)
 {
+	bool *is_category = userdata;
 	switch (node->type) {
 	case AST_INCLUDE:
 		if (node->include.type == AST_INCLUDE_BMAKE && node->include.sys &&
@@ -139,7 +228,6 @@ parser_is_category_makefile_walker(struct AST *node, bool *is_category)
 		break;
 	}
 
-	AST_WALK_DEFAULT(parser_is_category_makefile_walker, node, is_category);
 	return AST_WALK_CONTINUE;
 }
 
@@ -151,7 +239,11 @@ parser_is_category_makefile(struct Parser *parser)
 	}
 
 	bool is_category = false;
-	parser_is_category_makefile_walker(parser->ast, &is_category);
+	ast_walk(parser->ast, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_INCLUDE),
+		.pre = parser_is_category_makefile_walker,
+		.userdata = &is_category,
+	});
 	return is_category;
 }
 
@@ -160,6 +252,8 @@ parser_init_settings(struct ParserSettings *settings)
 {
 	settings->filename = NULL;
 	settings->portsdir = -1;
+	settings->inplace_dir = -1;
+	settings->cache_dir = -1;
 	settings->behavior = PARSER_DEFAULT;
 	settings->diff_context = 3;
 	settings->if_wrapcol = 80;
@@ -168,6 +262,7 @@ parser_init_settings(struct ParserSettings *settings)
 	settings->target_command_format_wrapcol = 65;
 	settings->variable_wrapcol = 80;
 	settings->debug_level = 0;
+	settings->profile = NULL;
 }
 
 struct Parser *
@@ -178,7 +273,7 @@ parser_new(struct Mempool *extpool, struct ParserSettings *settings)
 	parser->pool = mempool_new();
 	parser->metadata_pool = mempool_new();
 	parser->rawlines = array_new();
-	parser->result = array_new();
+	parser->line_index_pool = mempool_new();
 	parser_metadata_alloc(parser);
 	parser->error = PARSER_ERROR_OK;
 	parser->error_msg = NULL;
@@ -195,6 +290,7 @@ parser_new(struct Mempool *extpool, struct ParserSettings *settings)
 
 	if ((settings->behavior & PARSER_OUTPUT_DUMP_TOKENS) ||
 	    (settings->behavior & PARSER_OUTPUT_DIFF) ||
+	    (settings->behavior & PARSER_OUTPUT_CHECK) ||
 	    (settings->behavior & PARSER_OUTPUT_RAWLINES)) {
 		settings->behavior &= ~PARSER_OUTPUT_INPLACE;
 	}
@@ -212,10 +308,7 @@ parser_free(struct Parser *parser)
 		return;
 	}
 
-	ARRAY_FOREACH(parser->result, void *, x) {
-		free(x);
-	}
-	array_free(parser->result);
+	parser_output_free(&parser->result);
 
 	ARRAY_FOREACH(parser->rawlines, char *, line) {
 		free(line);
@@ -224,6 +317,7 @@ parser_free(struct Parser *parser)
 
 	mempool_free(parser->pool);
 	mempool_free(parser->metadata_pool);
+	mempool_free(parser->line_index_pool);
 	free(parser->error_msg);
 
 	parser_tokenizer_free(parser->tokenizer);
@@ -260,7 +354,80 @@ void
 parser_enqueue_output(struct Parser *parser, const char *s)
 {
 	panic_unless(s, "parser_enqueue_output() is not NULL-safe");
-	array_append(parser->result, str_dup(NULL, s));
+	parser_output_append(&parser->result, s, strlen(s));
+	if (parser->settings.behavior & PARSER_OUTPUT_CHECK) {
+		parser_output_check(parser);
+	}
+}
+
+void
+parser_output_append(struct ParserOutput *output, const char *s, size_t len)
+{
+	if (output->len + len > output->cap) {
+		size_t cap = MAX(MAX(output->cap * 2, output->len + len), 4096);
+		output->buf = xrecallocarray(output->buf, output->cap, cap, 1);
+		output->cap = cap;
+	}
+	memcpy(output->buf + output->len, s, len);
+
+	for (const char *nl = memchr(s, '\n', len); nl; nl = memchr(nl + 1, '\n', len - (nl + 1 - s))) {
+		if (output->lines_len == output->lines_cap) {
+			size_t cap = MAX(output->lines_cap * 2, 128);
+			output->lines = xrecallocarray(output->lines, output->lines_cap, cap, sizeof(size_t));
+			output->lines_cap = cap;
+		}
+		output->lines[output->lines_len++] = output->len + (nl - s) + 1;
+	}
+
+	output->len += len;
+}
+
+void
+parser_output_free(struct ParserOutput *output)
+{
+	free(output->buf);
+	free(output->lines);
+}
+
+void
+parser_output_check(struct Parser *parser)
+// Compare the complete lines of the output with the input and drop
+// them.  The first mismatch sets PARSER_ERROR_DIFFERENCES_FOUND which
+// stops parser_output_reformatted_walker().
+{
+	struct ParserOutput *output = &parser->result;
+	if (output->lines_len == 0 || parser->error != PARSER_ERROR_OK) {
+		return;
+	}
+
+	size_t start = 0;
+	for (size_t i = 0; i < output->lines_len; i++) {
+		const char *rawline = array_get(parser->rawlines, output->checked + i);
+		size_t len = output->lines[i] - start - 1;
+		unless (rawline && strlen(rawline) == len && memcmp(rawline, output->buf + start, len) == 0) {
+			parser_set_error(parser, PARSER_ERROR_DIFFERENCES_FOUND, NULL);
+			return;
+		}
+		start = output->lines[i];
+	}
+
+	output->checked += output->lines_len;
+	memmove(output->buf, output->buf + start, output->len - start);
+	output->len -= start;
+	output->lines_len = 0;
+}
+
+void
+parser_output_check_finish(struct Parser *parser)
+{
+	if (parser->error == PARSER_ERROR_OK &&
+	    parser->result.checked != array_len(parser->rawlines)) {
+		parser_set_error(parser, PARSER_ERROR_DIFFERENCES_FOUND, NULL);
+	}
+
+	// Nothing is output in check mode
+	parser->result.len = 0;
+	parser->result.lines_len = 0;
 }
 
 void
@@ -276,8 +443,9 @@ parser_propagate_goalcol(struct ParserFindGoalcolsState *this)
 }
 
 enum ASTWalkState
-parser_find_goalcols_walker(struct AST *node, struct ParserFindGoalcolsState *this)
+parser_find_goalcols_walker(struct AST *node, void *userdata)
 {
+	struct ParserFindGoalcolsState *this = userdata;
 	if (this->parser->error != PARSER_ERROR_OK) {
 		return AST_WALK_STOP;
 	}
@@ -308,7 +476,6 @@ parser_find_goalcols_walker(struct AST *node, struct ParserFindGoalcolsState *th
 		break;
 	}
 
-	AST_WALK_DEFAULT(parser_find_goalcols_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -321,7 +488,11 @@ parser_find_goalcols(struct Parser *parser)
 		.moving_goalcol = 0,
 		.nodes = mempool_array(pool),
 	};
-	parser_find_goalcols_walker(parser->ast, &this);
+	ast_walk(parser->ast, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_COMMENT) | AST_WALK_TYPE(AST_VARIABLE),
+		.pre = parser_find_goalcols_walker,
+		.userdata = &this,
+	});
 	parser_propagate_goalcol(&this);
 }
 
@@ -630,7 +801,9 @@ parser_output_prepare(struct Parser *parser)
 		parser_output_reformatted(parser);
 	}
 
-	if (parser->settings.behavior & PARSER_OUTPUT_DIFF) {
+	if (parser->settings.behavior & PARSER_OUTPUT_CHECK) {
+		parser_output_check_finish(parser);
+	} else if (parser->settings.behavior & PARSER_OUTPUT_DIFF) {
 		parser_output_diff(parser);
 	}
 }
@@ -983,6 +1156,11 @@ parser_output_reformatted_walker(struct Parser *parser, struct AST *node)
 {
 	SCOPE_MEMPOOL(pool);
 
+	// Stop early when PARSER_OUTPUT_CHECK found a difference
+	if (parser->error != PARSER_ERROR_OK) {
+		return AST_WALK_STOP;
+	}
+
 	bool edited = node->edited || (!(parser->settings.behavior & PARSER_OUTPUT_EDITED) && (parser->settings.behavior & PARSER_OUTPUT_REFORMAT));
 	switch (node->type) {
 	case AST_ROOT:
@@ -1167,8 +1345,43 @@ parser_output_reformatted(struct Parser *parser)
 	}
 }
 
+void
+parser_output_diff_line(struct ParserDiffLine *line, const char *s)
+{
+	// FNV-1a
+	uint64_t hash = UINT64_C(14695981039346656037);
+	for (const char *c = s; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= UINT64_C(1099511628211);
+	}
+	line->hash = hash;
+	line->line = s;
+}
+
+bool
+parser_output_diff_line_equal(const struct ParserDiffLine *a, const struct ParserDiffLine *b)
+{
+	return a->hash == b->hash && strcmp(a->line, b->line) == 0;
+}
+
+DEFINE_COMPARE(compare_diff_line, struct ParserDiffLine, void)
+{
+	if (a->hash < b->hash) {
+		return -1;
+	} else if (a->hash > b->hash) {
+		return 1;
+	} else {
+		return strcmp(a->line, b->line);
+	}
+}
+
 void
 parser_output_diff(struct Parser *parser)
+// Most of the time only a few lines change.  Lines are compared by
+// their hash and only the lines between the common prefix and suffix
+// are passed to array_diff().  The common lines are then put back
+// into the edit script around the window, so diff_to_patch() gets the
+// same script as for a diff of the two complete files.
 {
 	SCOPE_MEMPOOL(pool);
 
@@ -1176,23 +1389,111 @@ parser_output_diff(struct Parser *parser)
 		return;
 	}
 
-	// Normalize result: one element = one line like parser->rawlines
-	struct Array *lines = str_split(pool, str_join(pool, parser->result, ""), "\n");
-	array_pop(lines);
+	struct ParserOutput *output = &parser->result;
+	size_t alen = array_len(parser->rawlines);
+	size_t blen = output->lines_len;
+
+	// Normalize result: one element = one line like parser->rawlines.
+	// The lines point into a single copy of the buffer.  The edit
+	// script refers to the slots in a and b.
+	const char **a = mempool_alloc(pool, (alen + 1) * sizeof(*a));
+	const char **b = mempool_alloc(pool, (blen + 1) * sizeof(*b));
+	struct ParserDiffLine *alines = mempool_alloc(pool, (alen + 1) * sizeof(*alines));
+	struct ParserDiffLine *blines = mempool_alloc(pool, (blen + 1) * sizeof(*blines));
+	ARRAY_FOREACH(parser->rawlines, const char *, rawline) {
+		a[rawline_index] = rawline;
+		parser_output_diff_line(&alines[rawline_index], rawline);
+	}
+	char *buf = NULL;
+	if (output->len > 0) {
+		buf = str_ndup(pool, output->buf, output->len);
+	}
+	for (size_t i = 0; i < blen; i++) {
+		size_t start = i > 0 ? output->lines[i - 1] : 0;
+		buf[output->lines[i] - 1] = 0;
+		b[i] = buf + start;
+		parser_output_diff_line(&blines[i], b[i]);
+	}
+
+	output->len = 0;
+	output->lines_len = 0;
+
+	size_t prefix = 0;
+	while (prefix < alen && prefix < blen && parser_output_diff_line_equal(&alines[prefix], &blines[prefix])) {
+		prefix++;
+	}
+	size_t suffix = 0;
+	while (suffix < alen - prefix && suffix < blen - prefix &&
+	       parser_output_diff_line_equal(&alines[alen - suffix - 1], &blines[blen - suffix - 1])) {
+		suffix++;
+	}
+	if (prefix == alen && prefix == blen) {
+		return;
+	}
 
-	struct diff *p = array_diff(parser->rawlines, lines, pool, str_compare);
+	struct Array *awindow = mempool_array(pool);
+	for (size_t i = prefix; i < alen - suffix; i++) {
+		array_append(awindow, &alines[i]);
+	}
+	struct Array *bwindow = mempool_array(pool);
+	for (size_t i = prefix; i < blen - suffix; i++) {
+		array_append(bwindow, &blines[i]);
+	}
+	struct diff *p = array_diff(awindow, bwindow, pool, &(struct CompareTrait){compare_diff_line, NULL});
 	if (p == NULL) {
 		parser_set_error(parser, PARSER_ERROR_UNSPECIFIED,
 				 str_printf(pool, "could not create diff"));
 		return;
 	}
 
-	ARRAY_FOREACH(parser->result, char *, line) {
-		free(line);
+	// The first entry of an edit script always consumes the first line
+	// of one side, which tells us what diff() starts counting at.
+	size_t base = 0;
+	if (p->sessz > 0) {
+		if (p->ses[0].type == DIFF_ADD) {
+			base = p->ses[0].modifiedIdx;
+		} else {
+			base = p->ses[0].originIdx;
+		}
+	}
+
+	struct diff d = *p;
+	d.sessz = prefix + p->sessz + suffix;
+	d.ses = mempool_alloc(pool, (d.sessz + 1) * sizeof(*d.ses));
+	size_t n = 0;
+	for (size_t i = 0; i < prefix; i++, n++) {
+		d.ses[n].originIdx = base + i;
+		d.ses[n].modifiedIdx = base + i;
+		d.ses[n].type = DIFF_COMMON;
+		d.ses[n].e = &a[i];
+	}
+	size_t ai = prefix;
+	size_t bi = prefix;
+	for (size_t i = 0; i < p->sessz; i++, n++) {
+		d.ses[n].originIdx = p->ses[i].originIdx + prefix;
+		d.ses[n].modifiedIdx = p->ses[i].modifiedIdx + prefix;
+		d.ses[n].type = p->ses[i].type;
+		switch (p->ses[i].type) {
+		case DIFF_ADD:
+			d.ses[n].e = &b[bi++];
+			break;
+		case DIFF_DELETE:
+			d.ses[n].e = &a[ai++];
+			break;
+		case DIFF_COMMON:
+			d.ses[n].e = &a[ai++];
+			bi++;
+			break;
+		}
+	}
+	for (size_t i = 0; i < suffix; i++, n++) {
+		d.ses[n].originIdx = base + ai + i;
+		d.ses[n].modifiedIdx = base + bi + i;
+		d.ses[n].type = DIFF_COMMON;
+		d.ses[n].e = &a[ai + i];
 	}
-	array_truncate(parser->result);
 
-	if (p->editdist > 0) {
+	if (d.editdist > 0) {
 		const char *filename = parser->settings.filename;
 		if (filename == NULL) {
 			filename = "Makefile";
@@ -1206,9 +1507,10 @@ parser_output_diff(struct Parser *parser)
 			color_delete = "";
 			color_reset = "";
 		}
-		char *buf = str_printf(NULL, "%s--- %s\n%s+++ %s%s\n", color_delete, filename, color_add, filename, color_reset);
-		array_append(parser->result, buf);
-		array_append(parser->result, diff_to_patch(p, NULL, NULL, NULL, parser->settings.diff_context, !nocolor));
+		parser_enqueue_output(parser, str_printf(pool, "%s--- %s\n%s+++ %s%s\n", color_delete, filename, color_add, filename, color_reset));
+		char *patch = diff_to_patch(&d, NULL, NULL, NULL, parser->settings.diff_context, !nocolor);
+		parser_enqueue_output(parser, patch);
+		free(patch);
 		parser_set_error(parser, PARSER_ERROR_DIFFERENCES_FOUND, NULL);
 	}
 }
@@ -1249,15 +1551,34 @@ parser_read_from_file(struct Parser *parser, FILE *fp)
 		return parser->error;
 	}
 
+	// Only whole files can be looked up in the cache.  The
+	// tokenizer is fed in parser_read_finish() on a miss.
+	if (parser->settings.cache_dir >= 0 && array_len(parser->rawlines) == 0 &&
+	    !(parser->settings.behavior & PARSER_OUTPUT_DUMP_TOKENS)) {
+		uint64_t start = profile_clock();
+		LINE_FOREACH(fp, line) {
+			array_append(parser->rawlines, str_ndup(NULL, line, line_len));
+		}
+		parser->cache_pending = true;
+		profile_sample_add(parser->settings.profile, PROFILE_PHASE_READ, NULL, profile_clock() - start);
+		return parser->error;
+	}
+
+	parser_cache_flush(parser);
+
+	TRACE_BEGIN("tokenizer", parser->settings.filename);
+	uint64_t start = profile_clock();
 	LINE_FOREACH(fp, line) {
 		parser_tokenizer_feed_line(parser->tokenizer, line, line_len);
 		if (parser->error != PARSER_ERROR_OK) {
-			return parser->error;
+			break;
 		}
 		array_append(parser->rawlines, str_ndup(NULL, line, line_len));
 	}
+	profile_sample_add(parser->settings.profile, PROFILE_PHASE_READ, NULL, profile_clock() - start);
+	TRACE_END("tokenizer", parser->settings.filename);
 
-	return PARSER_ERROR_OK;
+	return parser->error;
 }
 
 enum ParserError
@@ -1265,23 +1586,71 @@ parser_read_finish(struct Parser *parser)
 {
 	panic_if(parser->read_finished, "parser_read_finish() called multiple times");
 
+	// Include loading is accounted for separately
+	struct ProfileSample *profile = parser->settings.profile;
+	uint64_t start = profile_clock();
+	uint64_t includes = profile_sample_get(profile, PROFILE_PHASE_INCLUDES);
+	enum ParserError error = parser_read_finish_helper(parser);
+	uint64_t elapsed = profile_clock() - start;
+	includes = profile_sample_get(profile, PROFILE_PHASE_INCLUDES) - includes;
+	profile_sample_add(profile, PROFILE_PHASE_FINISH, NULL, elapsed - includes);
+
+	return error;
+}
+
+enum ParserError
+parser_read_finish_helper(struct Parser *parser)
+{
 	if (parser->error != PARSER_ERROR_OK) {
 		return parser->error;
 	}
 
-	if (parser_tokenizer_finish(parser->tokenizer) != PARSER_ERROR_OK) {
-		return parser->error;
+	uint64_t cache_key = 0;
+	struct AST *cached = NULL;
+	if (parser->cache_pending) {
+		TRACE_BEGIN("cache", parser->settings.filename);
+		cache_key = parser_cache_key(parser->rawlines, parser->settings.behavior);
+		cached = parser_cache_load(parser->settings.cache_dir, cache_key, array_len(parser->rawlines));
+		TRACE_END("cache", parser->settings.filename);
+		if (cached) {
+			parser->cache_pending = false;
+		} else if (PARSER_ERROR_OK != parser_cache_flush(parser)) {
+			return parser->error;
+		}
+	}
+
+	unless (cached) {
+		TRACE_BEGIN("tokenizer", parser->settings.filename);
+		enum ParserError error = parser_tokenizer_finish(parser->tokenizer);
+		TRACE_END("tokenizer", parser->settings.filename);
+		if (error != PARSER_ERROR_OK) {
+			return parser->error;
+		}
 	}
 
 	for (size_t i = 0; i <= PARSER_METADATA_USES; i++) {
 		parser->metadata_valid[i] = false;
 	}
+	parser->line_index = NULL;
 
 	parser->read_finished = true;
 	ast_free(parser->ast);
-	parser->ast = parser_astbuilder_finish(parser->builder);
-	if (parser->error != PARSER_ERROR_OK) {
-		return parser->error;
+	if (cached) {
+		parser->ast = cached;
+	} else {
+		TRACE_BEGIN("astbuilder", parser->settings.filename);
+		parser->ast = parser_astbuilder_finish(parser->builder);
+		TRACE_END("astbuilder", parser->settings.filename);
+		if (parser->error != PARSER_ERROR_OK) {
+			return parser->error;
+		}
+		// The AST is cached as built.  Includes and the
+		// refactorings below are applied again on every load.
+		if (cache_key) {
+			TRACE_BEGIN("cache", parser->settings.filename);
+			parser_cache_store(parser->settings.cache_dir, cache_key, array_len(parser->rawlines), parser->ast);
+			TRACE_END("cache", parser->settings.filename);
+		}
 	}
 	parser_tokenizer_free(parser->tokenizer);
 	parser->tokenizer = NULL;
@@ -1291,6 +1660,16 @@ parser_read_finish(struct Parser *parser)
 		return parser->error;
 	}
 
+	if (parser->skip_refactors) {
+		return parser->error;
+	}
+
+	return parser_read_finish_refactor(parser);
+}
+
+enum ParserError
+parser_read_finish_refactor(struct Parser *parser)
+{
 	if ((parser->settings.behavior & PARSER_OUTPUT_DUMP_TOKENS) &&
 	    parser->settings.debug_level > 2) {
 		return parser->error;
@@ -1332,6 +1711,345 @@ parser_read_finish(struct Parser *parser)
 	return parser->error;
 }
 
+enum ParserError
+parser_cache_flush(struct Parser *parser)
+// Feed lines held back for the AST cache to the tokenizer
+{
+	unless (parser->cache_pending) {
+		return parser->error;
+	}
+	parser->cache_pending = false;
+
+	TRACE_BEGIN("tokenizer", parser->settings.filename);
+	uint64_t start = profile_clock();
+	ARRAY_FOREACH(parser->rawlines, const char *, line) {
+		parser_tokenizer_feed_line(parser->tokenizer, line, strlen(line));
+		if (parser->error != PARSER_ERROR_OK) {
+			break;
+		}
+	}
+	profile_sample_add(parser->settings.profile, PROFILE_PHASE_READ, NULL, profile_clock() - start);
+	TRACE_END("tokenizer", parser->settings.filename);
+
+	return parser->error;
+}
+
+enum ParserError
+parser_reparse(struct Parser *parser)
+// Throw away the AST and parse the raw lines again
+{
+	struct Array *rawlines = parser->rawlines;
+	parser->rawlines = array_new();
+	parser_tokenizer_free(parser->tokenizer);
+	parser_astbuilder_free(parser->builder);
+	parser->builder = parser_astbuilder_new(parser);
+	parser->tokenizer = parser_tokenizer_new(parser, &parser->error, parser->builder);
+	parser->read_finished = false;
+	parser_set_error(parser, PARSER_ERROR_OK, NULL);
+
+	ARRAY_FOREACH(rawlines, char *, line) {
+		if (parser->error == PARSER_ERROR_OK) {
+			parser_tokenizer_feed_line(parser->tokenizer, line, strlen(line));
+		}
+		array_append(parser->rawlines, line);
+	}
+	array_free(rawlines);
+
+	return parser_read_finish(parser);
+}
+
+bool
+parser_text_edit_only_comments(struct Array *nodes, size_t first, size_t last)
+{
+	for (size_t i = first; i <= last && i < array_len(nodes); i++) {
+		struct AST *node = array_get(nodes, i);
+		if (node->type != AST_COMMENT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+parser_text_edit_collapse_at(struct Array *nodes, size_t i)
+// Whether refactor_collapse_adjacent_variables() might merge the
+// top-level nodes i - 1 and i
+{
+	if (i == 0 || i >= array_len(nodes)) {
+		return false;
+	}
+	struct AST *prev = array_get(nodes, i - 1);
+	struct AST *node = array_get(nodes, i);
+	if (prev->type != AST_VARIABLE || node->type != AST_VARIABLE) {
+		return false;
+	}
+	switch (node->variable.modifier) {
+	case AST_VARIABLE_MODIFIER_APPEND:
+	case AST_VARIABLE_MODIFIER_ASSIGN:
+		return strcmp(prev->variable.name, node->variable.name) == 0;
+	default:
+		return false;
+	}
+}
+
+enum ParserError
+parser_text_edit_refactor_nodes(struct Parser *parser, ParserEditFn f, size_t first, size_t last)
+{
+	SCOPE_MEMPOOL(pool);
+
+	struct Array *body = parser->ast->root.body;
+	for (size_t i = first; i < last; i++) {
+		f(parser, array_get(body, i), NULL, NULL);
+		if (parser->error != PARSER_ERROR_OK) {
+			parser_set_error(parser, PARSER_ERROR_EDIT_FAILED, parser_error_tostring(parser, pool));
+			return parser->error;
+		}
+	}
+
+	return parser->error;
+}
+
+enum ParserError
+parser_text_edit_refactor(struct Parser *parser, size_t first, size_t last)
+// Run the refactorings of parser_read_finish_refactor() on the
+// top-level nodes [first,last) that parser_apply_text_edit() spliced
+// in.  The rest of the AST has already been refactored.  Only the
+// refactorings that look past the spliced nodes run over the whole
+// AST: sanitizing += depends on all variables before a node,
+// collapsing adjacent variables on the nodes next to the spliced
+// ones, and removing empty lines on whether a node starts the file.
+{
+	if ((parser->settings.behavior & PARSER_OUTPUT_DUMP_TOKENS) &&
+	    parser->settings.debug_level > 2) {
+		return parser->error;
+	}
+
+	if (parser->settings.behavior & PARSER_SANITIZE_COMMENTS &&
+	    PARSER_ERROR_OK != parser_text_edit_refactor_nodes(parser, refactor_sanitize_comments, first, last)) {
+		return parser->error;
+	}
+
+	if (parser->settings.behavior & PARSER_SANITIZE_CMAKE_ARGS &&
+	    PARSER_ERROR_OK != parser_text_edit_refactor_nodes(parser, refactor_sanitize_cmake_args, first, last)) {
+		return parser->error;
+	}
+
+	if (parser->settings.behavior & PARSER_COLLAPSE_ADJACENT_VARIABLES) {
+		struct Array *body = parser->ast->root.body;
+		bool global = false;
+		for (size_t i = first; i <= last && !global; i++) {
+			global = parser_text_edit_collapse_at(body, i);
+		}
+		if (global) {
+			if (PARSER_ERROR_OK != parser_edit(parser, NULL, refactor_collapse_adjacent_variables, NULL)) {
+				return parser->error;
+			}
+		} else if (PARSER_ERROR_OK != parser_text_edit_refactor_nodes(parser, refactor_collapse_adjacent_variables, first, last)) {
+			return parser->error;
+		}
+	}
+
+	if (parser->settings.behavior & PARSER_SANITIZE_APPEND &&
+	    PARSER_ERROR_OK != parser_edit(parser, NULL, refactor_sanitize_append_modifier, NULL)) {
+		return parser->error;
+	}
+
+	if (parser->settings.behavior & PARSER_DEDUP_TOKENS &&
+	    PARSER_ERROR_OK != parser_text_edit_refactor_nodes(parser, refactor_dedup_tokens, first, last)) {
+		return parser->error;
+	}
+
+	if (first == 0) {
+		if (PARSER_ERROR_OK != parser_edit(parser, NULL, refactor_remove_consecutive_empty_lines, NULL)) {
+			return parser->error;
+		}
+	} else if (PARSER_ERROR_OK != parser_text_edit_refactor_nodes(parser, refactor_remove_consecutive_empty_lines, first, last)) {
+		return parser->error;
+	}
+
+	ast_balance(parser->ast);
+
+	return parser->error;
+}
+
+enum ParserError
+parser_apply_text_edit(struct Parser *parser, size_t a, size_t b, const char *text)
+// Replace the raw lines [a,b) with text and update the AST.  Line
+// numbers start at 1 like in struct ASTLineRange and a == b inserts
+// text before line a.  Only the top-level nodes that contain the
+// edited lines and their direct neighbors are parsed again, so that
+// continuation lines, comment blocks and target commands that now
+// belong to a neighbor are picked up.  The windows are parsed without
+// the refactorings of parser_read_finish(), which then only run on the
+// new nodes, see parser_text_edit_refactor().  Apart from those
+// refactorings only read-only edits (see parser_edits_read_only()) may
+// have been applied with parser_edit() since then, otherwise the AST
+// would not match the raw lines anymore.
+{
+	SCOPE_MEMPOOL(pool);
+	panic_unless(parser->read_finished, "parser_apply_text_edit() called before parser_read_finish()");
+
+	if (parser->error != PARSER_ERROR_OK) {
+		return parser->error;
+	}
+
+	size_t rawlines_len = array_len(parser->rawlines);
+	if (a < 1 || a > b || b > rawlines_len + 1) {
+		parser_set_error(parser, PARSER_ERROR_INVALID_ARGUMENT,
+				 str_printf(pool, "invalid line range [%zu,%zu)", a, b));
+		return parser->error;
+	}
+
+	struct Array *lines = mempool_array(pool);
+	for (const char *line = text; *line;) {
+		const char *nl = strchr(line, '\n');
+		size_t len = nl ? (size_t)(nl - line) : strlen(line);
+		array_append(lines, str_ndup(NULL, line, len));
+		line += len + (nl ? 1 : 0);
+	}
+
+	// Splice the new lines into the raw lines
+	struct Array *rawlines = array_new();
+	ARRAY_FOREACH(parser->rawlines, char *, line) {
+		if (line_index + 1 == a) {
+			ARRAY_FOREACH(lines, char *, newline) {
+				array_append(rawlines, newline);
+			}
+		}
+		if (line_index + 1 >= a && line_index + 1 < b) {
+			free(line);
+		} else {
+			array_append(rawlines, line);
+		}
+	}
+	if (a == rawlines_len + 1) {
+		ARRAY_FOREACH(lines, char *, newline) {
+			array_append(rawlines, newline);
+		}
+	}
+	array_free(parser->rawlines);
+	parser->rawlines = rawlines;
+
+	// Included files and category Makefiles depend on more than
+	// the edited lines
+	if ((parser->settings.behavior & PARSER_LOAD_LOCAL_INCLUDES) ||
+	    parser_is_category_makefile(parser)) {
+		return parser_reparse(parser);
+	}
+
+	// Find the top-level nodes that contain the edited lines
+	if (ast_deleted_nodes(parser->ast) > 0) {
+		ast_compact(parser->ast);
+		parser->line_index = NULL;
+	}
+	struct Array *body = parser->ast->root.body;
+	size_t nodes_len = array_len(body);
+	size_t first = 0;
+	size_t last = 0;
+	bool found = false;
+	ARRAY_FOREACH(body, struct AST *, node) {
+		if (node->line_start.a == 0) {
+			continue;
+		}
+		if (node->line_start.a <= a) {
+			first = node_index;
+		}
+		if (node->line_start.a < MAX(b, a + 1)) {
+			last = node_index;
+			found = true;
+		}
+	}
+	if (first > 0) {
+		first--;
+	}
+	// Nodes added by refactorings have no line information.  Start
+	// the window at a node before them that has.
+	while (first > 0) {
+		struct AST *node = array_get(body, first);
+		if (node->line_start.a > 0) {
+			break;
+		}
+		first--;
+	}
+	if (found && last + 1 < nodes_len) {
+		last++;
+	}
+	while (last + 1 < nodes_len) {
+		struct AST *next = array_get(body, last + 1);
+		unless (next->type == AST_TARGET && next->target.type == AST_TARGET_UNASSOCIATED) {
+			break;
+		}
+		last++;
+	}
+
+	// The window of raw lines covered by these nodes after the edit
+	ssize_t delta = (ssize_t)array_len(lines) - (ssize_t)(b - a);
+	size_t wa = 1;
+	size_t wb = array_len(parser->rawlines) + 1;
+	if (nodes_len > 0 && first > 0) {
+		struct AST *node = array_get(body, first);
+		wa = node->line_start.a;
+	}
+	for (size_t i = last + 1; i < nodes_len; i++) {
+		struct AST *node = array_get(body, i);
+		if (node->line_start.a > 0) {
+			wb = node->line_start.a + delta;
+			break;
+		}
+	}
+
+	struct Array *window = mempool_array(pool);
+	for (size_t i = wa; i < wb; i++) {
+		array_append(window, array_get(parser->rawlines, i - 1));
+	}
+	struct ParserSettings settings = parser->settings;
+	settings.profile = NULL;
+	struct Parser *subparser = parser_new(pool, &settings);
+	subparser->skip_refactors = true;
+	const char *buf = str_join(pool, window, "\n");
+	if (array_len(window) > 0 &&
+	    (parser_read_from_buffer(subparser, buf, strlen(buf)) != PARSER_ERROR_OK ||
+	     parser_read_finish(subparser) != PARSER_ERROR_OK)) {
+		// Let the full parse report the error with correct line
+		// numbers
+		return parser_reparse(parser);
+	}
+
+	bool only_comments = nodes_len == 0 || parser_text_edit_only_comments(body, first, last);
+	struct Array *tail = mempool_array(pool);
+	ARRAY_FOREACH_SLICE(body, last + 1, -1, struct AST *, node) {
+		ast_shift_line_ranges(node, delta);
+		array_append(tail, node);
+	}
+	if (nodes_len > 0) {
+		array_truncate_at(body, first);
+	}
+	if (array_len(window) > 0) {
+		struct AST *root = parser_ast(subparser);
+		only_comments = only_comments && parser_text_edit_only_comments(root->root.body, 0, SIZE_MAX);
+		ARRAY_FOREACH(root->root.body, struct AST *, child) {
+			struct AST *node = ast_clone(parser->ast, child);
+			node->parent = parser->ast;
+			ast_shift_line_ranges(node, wa - 1);
+			array_append(body, node);
+		}
+	}
+	size_t spliced_end = array_len(body);
+	ARRAY_FOREACH(tail, struct AST *, node) {
+		array_append(body, node);
+	}
+	ast_mark_dirty(parser->ast);
+
+	unless (only_comments) {
+		for (size_t i = 0; i <= PARSER_METADATA_USES; i++) {
+			parser->metadata_valid[i] = false;
+		}
+	}
+	parser->line_index = NULL;
+
+	return parser_text_edit_refactor(parser, first, spliced_end);
+}
+
 struct AST *
 parser_ast(struct Parser *parser)
 {
@@ -1343,6 +2061,108 @@ parser_ast(struct Parser *parser)
 	}
 }
 
+bool
+parser_output_unchanged(struct Parser *parser, int fd)
+{
+	struct stat sb;
+	if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) ||
+	    (size_t)sb.st_size != parser->result.len) {
+		return false;
+	}
+
+	char buf[8192];
+	size_t off = 0;
+	while (off < parser->result.len) {
+		ssize_t n = pread(fd, buf, MIN(sizeof(buf), parser->result.len - off), off);
+		if (n <= 0 || memcmp(buf, parser->result.buf + off, n) != 0) {
+			return false;
+		}
+		off += n;
+	}
+
+	return true;
+}
+
+bool
+parser_output_rename_into_place(struct Parser *parser, int fd)
+// Returns false if the file has to be rewritten in place instead.
+// Renaming a new file over a symlink or a file with several hard
+// links would replace the link instead of the file it points to.
+{
+	SCOPE_MEMPOOL(pool);
+
+	const char *name = strrchr(parser->settings.filename, '/');
+	if (name) {
+		name++;
+	} else {
+		name = parser->settings.filename;
+	}
+
+	int dir = parser->settings.inplace_dir;
+	struct stat sb;
+	struct stat lsb;
+	if (fstat(fd, &sb) < 0 || sb.st_nlink != 1 ||
+	    fstatat(dir, name, &lsb, AT_SYMLINK_NOFOLLOW) < 0 ||
+	    !S_ISREG(lsb.st_mode) || lsb.st_dev != sb.st_dev ||
+	    lsb.st_ino != sb.st_ino) {
+		return false;
+	}
+
+	const char *tmpname = str_printf(pool, ".%s.portfmt.%ld", name, (long)getpid());
+	int tmpfd = openat(dir, tmpname, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (tmpfd < 0) {
+		parser_set_error(parser, PARSER_ERROR_IO,
+				 str_printf(pool, "openat: %s: %s", tmpname, strerror(errno)));
+		return true;
+	}
+
+	// We might not be allowed to hand the file to its owner
+	if (fchown(tmpfd, sb.st_uid, sb.st_gid) < 0) {
+		close(tmpfd);
+		unlinkat(dir, tmpname, 0);
+		return false;
+	}
+
+	const char *errfn = NULL;
+	for (size_t off = 0; off < parser->result.len;) {
+		ssize_t n = write(tmpfd, parser->result.buf + off, parser->result.len - off);
+		if (n < 0) {
+			errfn = "write";
+			break;
+		}
+		off += n;
+	}
+	if (errfn == NULL && fchmod(tmpfd, sb.st_mode & 07777) < 0) {
+		errfn = "fchmod";
+	}
+	if (errfn == NULL && fsync(tmpfd) < 0) {
+		errfn = "fsync";
+	}
+	if (close(tmpfd) < 0 && errfn == NULL) {
+		errfn = "close";
+	}
+	if (errfn == NULL && renameat(dir, tmpname, dir, name) < 0) {
+		errfn = "renameat";
+	}
+	if (errfn) {
+		int saved_errno = errno;
+		unlinkat(dir, tmpname, 0);
+		parser_set_error(parser, PARSER_ERROR_IO,
+				 str_printf(pool, "%s: %s", errfn, strerror(saved_errno)));
+		return true;
+	}
+	if (fsync(dir) < 0) {
+		parser_set_error(parser, PARSER_ERROR_IO,
+				 str_printf(pool, "fsync: %s", strerror(errno)));
+		return true;
+	}
+
+	parser->result.len = 0;
+	parser->result.lines_len = 0;
+
+	return true;
+}
+
 enum ParserError
 parser_output_write_to_file(struct Parser *parser, FILE *fp)
 {
@@ -1357,6 +2177,14 @@ parser_output_write_to_file(struct Parser *parser, FILE *fp)
 
 	if (parser->settings.behavior & PARSER_OUTPUT_INPLACE) {
 		int fd = fileno(fp);
+		if (parser_output_unchanged(parser, fd)) {
+			parser->result.len = 0;
+			parser->result.lines_len = 0;
+			return parser->error;
+		} else if (parser->settings.inplace_dir >= 0 &&
+			   parser_output_rename_into_place(parser, fd)) {
+			return parser->error;
+		}
 		if (lseek(fd, 0, SEEK_SET) < 0) {
 			parser_set_error(parser, PARSER_ERROR_IO,
 					 str_printf(pool, "lseek: %s", strerror(errno)));
@@ -1369,15 +2197,14 @@ parser_output_write_to_file(struct Parser *parser, FILE *fp)
 		}
 	}
 
-	ARRAY_FOREACH(parser->result, char *, line) {
-		if (fputs(line, fp) == EOF) {
-			parser_set_error(parser, PARSER_ERROR_IO,
-					 str_printf(pool, "fputs: %s", strerror(errno)));
-			return parser->error;
-		}
-		free(line);
+	if (parser->result.len > 0 &&
+	    fwrite(parser->result.buf, 1, parser->result.len, fp) != parser->result.len) {
+		parser_set_error(parser, PARSER_ERROR_IO,
+				 str_printf(pool, "fwrite: %s", strerror(errno)));
+		return parser->error;
 	}
-	array_truncate(parser->result);
+	parser->result.len = 0;
+	parser->result.lines_len = 0;
 
 	return parser->error;
 }
@@ -1391,6 +2218,10 @@ parser_read_from_buffer(struct Parser *parser, const char *input, size_t len)
 		return parser->error;
 	}
 
+	parser_cache_flush(parser);
+
+	TRACE_BEGIN("tokenizer", parser->settings.filename);
+	uint64_t start = profile_clock();
 	ARRAY_FOREACH(str_nsplit(pool, input, len, "\n"), const char *, line) {
 		array_append(parser->rawlines, str_dup(NULL, line));
 		parser_tokenizer_feed_line(parser->tokenizer, line, strlen(line));
@@ -1398,6 +2229,8 @@ parser_read_from_buffer(struct Parser *parser, const char *input, size_t len)
 			break;
 		}
 	}
+	profile_sample_add(parser->settings.profile, PROFILE_PHASE_READ, NULL, profile_clock() - start);
+	TRACE_END("tokenizer", parser->settings.filename);
 
 	return parser->error;
 }
@@ -1455,13 +2288,13 @@ process_include(struct Parser *parser, struct Mempool *extpool, const char *curd
 }
 
 enum ASTWalkState
-parser_load_includes_walker(struct AST *node, struct Parser *parser, int portsdir)
+parser_load_includes_walker(struct AST *node, void *userdata)
 {
-	SCOPE_MEMPOOL(pool);
-
+	struct Parser *parser = userdata;
 	switch (node->type) {
 	case AST_INCLUDE:
 		if (node->include.type == AST_INCLUDE_BMAKE && !node->include.loaded && !node->include.sys) {
+			SCOPE_MEMPOOL(pool);
 			struct Array *components = path_split(pool, parser->settings.filename);
 			if (array_len(components) > 0) {
 				array_truncate_at(components, array_len(components) - 1);
@@ -1472,7 +2305,7 @@ parser_load_includes_walker(struct AST *node, struct Parser *parser, int portsdi
 				parser_set_error(parser, PARSER_ERROR_IO, str_printf(pool, "cannot open include: %s", node->include.path));
 				return AST_WALK_STOP;
 			}
-			FILE *f = fileopenat(pool, portsdir, path);
+			FILE *f = fileopenat(pool, parser->settings.portsdir, path);
 			if (f == NULL) {
 				parser_set_error(parser, PARSER_ERROR_IO, str_printf(pool, "cannot open include: %s: %s", path, strerror(errno)));
 				return AST_WALK_STOP;
@@ -1480,6 +2313,7 @@ parser_load_includes_walker(struct AST *node, struct Parser *parser, int portsdi
 			struct ParserSettings settings = parser->settings;
 			settings.behavior &= ~PARSER_LOAD_LOCAL_INCLUDES;
 			settings.filename = path;
+			settings.profile = NULL;
 			struct Parser *incparser = parser_new(pool, &settings);
 			if (PARSER_ERROR_OK != parser_read_from_file(incparser, f)) {
 				parser_set_error(parser, PARSER_ERROR_IO, str_printf(pool, "cannot open include: %s: %s", path, strerror(errno)));
@@ -1499,14 +2333,15 @@ parser_load_includes_walker(struct AST *node, struct Parser *parser, int portsdi
 				child->parent = node;
 				array_append(node->include.body, child);
 			}
+			ast_mark_dirty(node);
 			node->edited = true;
 			node->include.loaded = true;
 		}
-		return AST_WALK_CONTINUE;
+		return AST_WALK_SKIP;
 	case AST_FOR:
 	case AST_IF:
 		// Shorten the walk; we only care about top level includes for now
-		return AST_WALK_CONTINUE;
+		return AST_WALK_SKIP;
 	case AST_TARGET:
 	case AST_ROOT:
 	case AST_COMMENT:
@@ -1517,7 +2352,6 @@ parser_load_includes_walker(struct AST *node, struct Parser *parser, int portsdi
 		break;
 	}
 
-	AST_WALK_DEFAULT(parser_load_includes_walker, node, parser, portsdir);
 	return AST_WALK_CONTINUE;
 }
 
@@ -1536,13 +2370,22 @@ parser_load_includes(struct Parser *parser)
 		return parser->error;
 	}
 
-	parser_load_includes_walker(parser->ast, parser, parser->settings.portsdir);
+	TRACE_BEGIN("parser_load_includes", parser->settings.filename);
+	uint64_t start = profile_clock();
+	ast_walk(parser->ast, &(struct ASTWalker){
+		.pre = parser_load_includes_walker,
+		.userdata = parser,
+	});
+	profile_sample_add(parser->settings.profile, PROFILE_PHASE_INCLUDES, NULL, profile_clock() - start);
+	TRACE_END("parser_load_includes", parser->settings.filename);
+
 	return parser->error;
 }
 
 enum ParserError
 parser_edit(struct Parser *parser, struct Mempool *extpool, ParserEditFn f, void *userdata)
 {
+	STATS_SCOPE(STATS_EDITS);
 	SCOPE_MEMPOOL(pool);
 	panic_unless(parser->read_finished, "parser_edit() called before parser_read_finish()");
 
@@ -1550,12 +2393,30 @@ parser_edit(struct Parser *parser, struct Mempool *extpool, ParserEditFn f, void
 		return parser->error;
 	}
 
+	TRACE_BEGIN("parser_edit", parser->settings.filename);
+	parser->edit_depth++;
 	f(parser, parser->ast, extpool, userdata);
+	parser->edit_depth--;
+	// Edits that only inspect the AST keep the line index valid
+	unless (parser_edits_read_only(f)) {
+		parser->line_index = NULL;
+	}
 	if (parser->error != PARSER_ERROR_OK) {
 		parser_set_error(parser, PARSER_ERROR_EDIT_FAILED, parser_error_tostring(parser, pool));
 	}
 
 	ast_balance(parser->ast);
+	// Edits only mark nodes as deleted.  Drop them once enough
+	// have piled up so that later walks stop visiting them, but only
+	// once the outermost edit returned and nothing holds them anymore.
+	// The line index might point at them regardless of whether the
+	// edit itself was read-only.
+	if (parser->edit_depth == 0 &&
+	    ast_deleted_nodes(parser->ast) >= PARSER_COMPACT_THRESHOLD) {
+		ast_compact(parser->ast);
+		parser->line_index = NULL;
+	}
+	TRACE_END("parser_edit", parser->settings.filename);
 
 	return parser->error;
 }
@@ -1566,10 +2427,10 @@ struct ParserSettings parser_settings(struct Parser *parser)
 }
 
 void
-parser_meta_values_helper(struct Parser *parser, struct Set *set, const char *var, char *value)
+parser_meta_values_helper(struct Parser *parser, struct Set *set, const char *var, const char *value)
 {
 	if (strcmp(var, "USES") == 0) {
-		char *buf = strchr(value, ':');
+		const char *buf = strchr(value, ':');
 		if (buf != NULL) {
 			char *val = str_ndup(NULL, value, buf - value);
 			if (set_contains(set, val)) {
@@ -1591,49 +2452,36 @@ parser_meta_values(struct Parser *parser, const char *var, struct Set *set)
 {
 	SCOPE_MEMPOOL(pool);
 
-	struct Array *tmp = NULL;
-	if (parser_lookup_variable(parser, var, PARSER_LOOKUP_DEFAULT, pool, &tmp, NULL)) {
-		ARRAY_FOREACH(tmp, char *, value) {
-			parser_meta_values_helper(parser, set, var, value);
-		}
+	PARSER_LOOKUP_FOREACH(parser, var, PARSER_LOOKUP_DEFAULT, value) {
+		parser_meta_values_helper(parser, set, var, value);
 	}
 
+	const char *append = str_printf(pool, "%s+=", var);
+	const char *assign = str_printf(pool, "%s=", var);
 	struct Set *options = parser_metadata(parser, PARSER_METADATA_OPTIONS);
 	SET_FOREACH(options, const char *, opt) {
 		char *buf = str_printf(pool, "%s_VARS", opt);
-		if (parser_lookup_variable(parser, buf, PARSER_LOOKUP_DEFAULT, pool, &tmp, NULL)) {
-			ARRAY_FOREACH(tmp, char *, value) {
-				char *buf = str_printf(pool, "%s+=", var);
-				if (str_startswith(value, buf)) {
-					value += strlen(buf);
-				} else {
-					buf = str_printf(pool, "%s=", var);
-					if (str_startswith(value, buf)) {
-						value += strlen(buf);
-					} else {
-						continue;
-					}
-				}
-				parser_meta_values_helper(parser, set, var, value);
+		PARSER_LOOKUP_FOREACH(parser, buf, PARSER_LOOKUP_DEFAULT, value) {
+			if (str_startswith(value, append)) {
+				value += strlen(append);
+			} else if (str_startswith(value, assign)) {
+				value += strlen(assign);
+			} else {
+				continue;
 			}
+			parser_meta_values_helper(parser, set, var, value);
 		}
 
 		buf = str_printf(pool, "%s_VARS_OFF", opt);
-		if (parser_lookup_variable(parser, buf, PARSER_LOOKUP_DEFAULT, pool, &tmp, NULL)) {
-			ARRAY_FOREACH(tmp, char *, value) {
-				char *buf = str_printf(pool, "%s+=", var);
-				if (str_startswith(value, buf)) {
-					value += strlen(buf);
-				} else {
-					buf = str_printf(pool, "%s=", var);
-					if (str_startswith(value, buf)) {
-						value += strlen(buf);
-					} else {
-						continue;
-					}
-				}
-				parser_meta_values_helper(parser, set, var, value);
+		PARSER_LOOKUP_FOREACH(parser, buf, PARSER_LOOKUP_DEFAULT, value) {
+			if (str_startswith(value, append)) {
+				value += strlen(append);
+			} else if (str_startswith(value, assign)) {
+				value += strlen(assign);
+			} else {
+				continue;
 			}
+			parser_meta_values_helper(parser, set, var, value);
 		}
 
 #if PORTFMT_SUBPACKAGES
@@ -1642,17 +2490,13 @@ parser_meta_values(struct Parser *parser, const char *var, struct Set *set)
 		if (strcmp(var, "USES") == 0) {
 #endif
 			buf = str_printf(pool, "%s_%s", opt, var);
-			if (parser_lookup_variable(parser, buf, PARSER_LOOKUP_DEFAULT, pool, &tmp, NULL)) {
-				ARRAY_FOREACH(tmp, char *, value) {
-					parser_meta_values_helper(parser, set, var, value);
-				}
+			PARSER_LOOKUP_FOREACH(parser, buf, PARSER_LOOKUP_DEFAULT, value) {
+				parser_meta_values_helper(parser, set, var, value);
 			}
 
 			buf = str_printf(pool, "%s_%s_OFF", opt, var);
-			if (parser_lookup_variable(parser, buf, PARSER_LOOKUP_DEFAULT, pool, &tmp, NULL)) {
-				ARRAY_FOREACH(tmp, char *, value) {
-					parser_meta_values_helper(parser, set, var, value);
-				}
+			PARSER_LOOKUP_FOREACH(parser, buf, PARSER_LOOKUP_DEFAULT, value) {
+				parser_meta_values_helper(parser, set, var, value);
 			}
 		}
 	}
@@ -1663,20 +2507,14 @@ parser_port_options_add_from_group(struct Parser *parser, const char *groupname)
 {
 	SCOPE_MEMPOOL(pool);
 
-	struct Array *optmulti = NULL;
-	if (parser_lookup_variable(parser, groupname, PARSER_LOOKUP_DEFAULT, pool, &optmulti, NULL)) {
-		ARRAY_FOREACH(optmulti, char *, optgroupname) {
-			if (!set_contains(parser->metadata[PARSER_METADATA_OPTION_GROUPS], optgroupname)) {
-				set_add(parser->metadata[PARSER_METADATA_OPTION_GROUPS], str_dup(parser->metadata_pool, optgroupname));
-			}
-			char *optgroupvar = str_printf(pool, "%s_%s", groupname, optgroupname);
-			struct Array *opts = NULL;
-			if (parser_lookup_variable(parser, optgroupvar, PARSER_LOOKUP_DEFAULT, pool, &opts, NULL)) {
-				ARRAY_FOREACH(opts, char *, opt) {
-					if (!set_contains(parser->metadata[PARSER_METADATA_OPTIONS], opt)) {
-						set_add(parser->metadata[PARSER_METADATA_OPTIONS], str_dup(parser->metadata_pool, opt));
-					}
-				}
+	PARSER_LOOKUP_FOREACH(parser, groupname, PARSER_LOOKUP_DEFAULT, optgroupname) {
+		if (!set_contains(parser->metadata[PARSER_METADATA_OPTION_GROUPS], optgroupname)) {
+			set_add(parser->metadata[PARSER_METADATA_OPTION_GROUPS], str_dup(parser->metadata_pool, optgroupname));
+		}
+		char *optgroupvar = str_printf(pool, "%s_%s", groupname, optgroupname);
+		PARSER_LOOKUP_FOREACH(parser, optgroupvar, PARSER_LOOKUP_DEFAULT, opt) {
+			if (!set_contains(parser->metadata[PARSER_METADATA_OPTIONS], opt)) {
+				set_add(parser->metadata[PARSER_METADATA_OPTIONS], str_dup(parser->metadata_pool, opt));
 			}
 		}
 	}
@@ -1685,14 +2523,9 @@ parser_port_options_add_from_group(struct Parser *parser, const char *groupname)
 void
 parser_port_options_add_from_var(struct Parser *parser, const char *var)
 {
-	SCOPE_MEMPOOL(pool);
-
-	struct Array *optdefine = NULL;
-	if (parser_lookup_variable(parser, var, PARSER_LOOKUP_DEFAULT, pool, &optdefine, NULL)) {
-		ARRAY_FOREACH(optdefine, char *, opt) {
-			if (!set_contains(parser->metadata[PARSER_METADATA_OPTIONS], opt)) {
-				set_add(parser->metadata[PARSER_METADATA_OPTIONS], str_dup(parser->metadata_pool, opt));
-			}
+	PARSER_LOOKUP_FOREACH(parser, var, PARSER_LOOKUP_DEFAULT, opt) {
+		if (!set_contains(parser->metadata[PARSER_METADATA_OPTIONS], opt)) {
+			set_add(parser->metadata[PARSER_METADATA_OPTIONS], str_dup(parser->metadata_pool, opt));
 		}
 	}
 }
@@ -1846,86 +2679,276 @@ parser_metadata(struct Parser *parser, enum ParserMetadata meta)
 }
 
 enum ASTWalkState
-parser_lookup_target_walker(struct AST *node, const char *name, struct AST **retval)
+parser_line_index_walker(struct AST *node, void *userdata)
 {
-	switch (node->type) {
-	case AST_TARGET:
-		ARRAY_FOREACH(node->target.sources, char *, src) {
-			if (strcmp(src, name) == 0) {
-				*retval = node;
-				return AST_WALK_STOP;
-			}
+	struct ParserLineIndexState *this = userdata;
+	struct ASTLineRange *ranges[] = { &node->line_start, &node->line_end };
+	for (size_t i = 0; i < nitems(ranges); i++) {
+		struct ASTLineRange *range = ranges[i];
+		if (range->a == 0 || range->a >= range->b ||
+		    (i > 0 && range->a == node->line_start.a && range->b == node->line_start.b)) {
+			continue;
 		}
-		break;
-	default:
-		break;
+		struct ParserLineIndexEntry *entry = mempool_alloc(this->pool, sizeof(struct ParserLineIndexEntry));
+		entry->range = range;
+		entry->node = node;
+		entry->depth = this->depth;
+		array_append(this->entries, entry);
 	}
 
-	AST_WALK_DEFAULT(parser_lookup_target_walker, node, name, retval);
+	// Nodes of included files have line numbers of another file
+	if (node->type == AST_INCLUDE) {
+		return AST_WALK_SKIP;
+	}
 
+	this->depth++;
 	return AST_WALK_CONTINUE;
 }
 
+enum ASTWalkState
+parser_line_index_leave(struct AST *node, void *userdata)
+{
+	struct ParserLineIndexState *this = userdata;
+	this->depth--;
+	return AST_WALK_CONTINUE;
+}
+
+DEFINE_COMPARE(compare_line_index_entry, struct ParserLineIndexEntry, void)
+{
+	if (a->range->a < b->range->a) {
+		return -1;
+	} else if (a->range->a > b->range->a) {
+		return 1;
+	} else if (a->depth < b->depth) {
+		return -1;
+	} else if (a->depth > b->depth) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+struct Array *
+parser_line_index(struct Parser *parser)
+{
+	if (parser->line_index) {
+		return parser->line_index;
+	}
+
+	mempool_release_all(parser->line_index_pool);
+	struct ParserLineIndexState this = {
+		.entries = mempool_array(parser->line_index_pool),
+		.pool = parser->line_index_pool,
+		.depth = 0,
+	};
+	ast_walk(parser->ast, &(struct ASTWalker){
+		.pre = parser_line_index_walker,
+		.post = parser_line_index_leave,
+		.userdata = &this,
+	});
+	array_sort(this.entries, &(struct CompareTrait){compare_line_index_entry, NULL});
+
+	size_t max_b = 0;
+	ARRAY_FOREACH(this.entries, struct ParserLineIndexEntry *, entry) {
+		max_b = MAX(max_b, entry->range->b);
+		entry->max_b = max_b;
+	}
+
+	parser->line_index = this.entries;
+	return parser->line_index;
+}
+
 struct AST *
-parser_lookup_target(struct Parser *parser, const char *name)
+parser_lookup_line(struct Parser *parser, size_t line, struct ASTLineRange **retval)
+// Find the innermost node with a line range that contains line
 {
-	struct AST *node = NULL;
-	parser_lookup_target_walker(parser->ast, name, &node);
-	return node;
+	panic_unless(parser->read_finished, "parser_lookup_line() called before parser_read_finish()");
+
+	struct Array *index = parser_line_index(parser);
+
+	// Find the first entry that starts after line.  Only the entries
+	// before it can contain line and only as long as one of them
+	// extends past it.
+	size_t lo = 0;
+	size_t hi = array_len(index);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct ParserLineIndexEntry *entry = array_get(index, mid);
+		if (entry->range->a <= line) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	struct ParserLineIndexEntry *best = NULL;
+	for (size_t i = lo; i > 0; i--) {
+		struct ParserLineIndexEntry *entry = array_get(index, i - 1);
+		if (entry->max_b <= line) {
+			break;
+		}
+		if (line < entry->range->b && (best == NULL || entry->depth > best->depth)) {
+			best = entry;
+		}
+	}
+
+	if (best == NULL) {
+		return NULL;
+	}
+	if (retval) {
+		*retval = best->range;
+	}
+	return best->node;
 }
 
-enum ASTWalkState
-parser_lookup_variable_walker(struct AST *node, struct Mempool *pool, const char *name, enum ParserLookupVariableBehavior behavior, struct Array *tokens, struct Array *comments, struct AST **retval)
+struct Array *
+parser_lookup_lines(struct Parser *parser, struct Mempool *extpool, size_t a, size_t b)
+// All nodes with a line range that overlaps [a,b) sorted by their
+// first line
 {
-	switch (node->type) {
-	case AST_VARIABLE:
-		if (strcmp(node->variable.name, name) == 0) {
-			*retval = node;
-			ARRAY_FOREACH(node->variable.words, const char *, word) {
-				array_append(tokens, str_dup(pool, word));
-			}
-			if (node->variable.comment && strlen(node->variable.comment) > 0) {
-				array_append(comments, str_dup(pool, node->variable.comment));
-			}
-			if (behavior & PARSER_LOOKUP_FIRST) {
-				return AST_WALK_STOP;
-			}
+	SCOPE_MEMPOOL(pool);
+	panic_unless(parser->read_finished, "parser_lookup_lines() called before parser_read_finish()");
+
+	struct Array *index = parser_line_index(parser);
+
+	size_t lo = 0;
+	size_t hi = array_len(index);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct ParserLineIndexEntry *entry = array_get(index, mid);
+		if (entry->range->a < b) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
-		break;
-	case AST_FOR:
-	case AST_IF:
-	case AST_INCLUDE:
-		if (behavior & PARSER_LOOKUP_IGNORE_VARIABLES_IN_CONDITIIONALS) {
-			return AST_WALK_CONTINUE;
+	}
+
+	struct Array *matches = mempool_array(pool);
+	for (size_t i = lo; i > 0; i--) {
+		struct ParserLineIndexEntry *entry = array_get(index, i - 1);
+		if (entry->max_b <= a) {
+			break;
+		}
+		if (entry->range->b > a) {
+			array_append(matches, entry);
 		}
-		break;
-	default:
-		break;
 	}
 
-	AST_WALK_DEFAULT(parser_lookup_variable_walker, node, pool, name, behavior, tokens, comments, retval);
+	struct Array *nodes = mempool_array(extpool);
+	struct Set *seen = mempool_set(pool, id_compare);
+	for (size_t i = array_len(matches); i > 0; i--) {
+		struct ParserLineIndexEntry *entry = array_get(matches, i - 1);
+		unless (set_contains(seen, entry->node)) {
+			set_add(seen, entry->node);
+			array_append(nodes, entry->node);
+		}
+	}
+	return nodes;
+}
+
+enum ASTWalkState
+parser_lookup_target_walker(struct AST *node, void *userdata)
+{
+	struct ParserLookupTargetState *this = userdata;
+	ARRAY_FOREACH(node->target.sources, const char *, src) {
+		if (src == this->name) {
+			this->retval = node;
+			return AST_WALK_STOP;
+		}
+	}
 
 	return AST_WALK_CONTINUE;
 }
 
 struct AST *
-parser_lookup_variable(struct Parser *parser, const char *name, enum ParserLookupVariableBehavior behavior, struct Mempool *extpool, struct Array **retval, struct Array **comment)
+parser_lookup_target(struct Parser *parser, const char *name)
 {
-	SCOPE_MEMPOOL(pool);
-	struct Array *tokens = mempool_array(pool);
-	struct Array *comments = mempool_array(pool);
-	struct AST *node = NULL;
-	parser_lookup_variable_walker(parser->ast, pool, name, behavior, tokens, comments, &node);
-	if (node) {
-		mempool_inherit(extpool, pool);
-		if (comment) {
-			*comment = comments;
+	// Target names in the AST are interned, so a name that was
+	// never interned cannot match any of them.
+	name = intern_find(name);
+	unless (name) {
+		return NULL;
+	}
+	struct ParserLookupTargetState this = {
+		.name = name,
+		.retval = NULL,
+	};
+	ast_walk(parser->ast, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_TARGET),
+		.pre = parser_lookup_target_walker,
+		.userdata = &this,
+	});
+	return this.retval;
+}
+
+void
+parser_lookup_iterator_init(struct Parser *parser, struct ParserLookupIterator *iter, const char *name, enum ParserLookupVariableBehavior behavior)
+{
+	STATS_COUNT(STATS_COUNTER_LOOKUP_VARIABLE);
+
+	unsigned int types = AST_WALK_TYPE(AST_VARIABLE);
+	if (behavior & PARSER_LOOKUP_IGNORE_VARIABLES_IN_CONDITIIONALS) {
+		types |= AST_WALK_TYPE(AST_FOR) | AST_WALK_TYPE(AST_IF) | AST_WALK_TYPE(AST_INCLUDE);
+	}
+	// Variable names in the AST are interned and can be compared
+	// by pointer.  A name that was never interned cannot match.
+	iter->name = intern_find(name);
+	if (iter->name) {
+		ast_cursor_init(&iter->cursor, parser->ast, types);
+	} else {
+		ast_cursor_init(&iter->cursor, NULL, types);
+	}
+	iter->behavior = behavior;
+	iter->node = NULL;
+	iter->index = 0;
+}
+
+struct AST *
+parser_lookup_iterator_next_variable(struct ParserLookupIterator *iter)
+// Return the next assignment of the variable and move the word
+// position to its first word.
+{
+	if (iter->node && (iter->behavior & PARSER_LOOKUP_FIRST)) {
+		ast_cursor_finish(&iter->cursor);
+		iter->node = NULL;
+		return NULL;
+	}
+
+	struct AST *node;
+	while ((node = ast_cursor_next(&iter->cursor))) {
+		if (node->type != AST_VARIABLE) {
+			ast_cursor_skip(&iter->cursor);
+		} else if (node->variable.name == iter->name) {
+			iter->node = node;
+			iter->index = 0;
+			return node;
 		}
-		if (retval) {
-			*retval = tokens;
+	}
+
+	iter->node = NULL;
+	return NULL;
+}
+
+const char *
+parser_lookup_iterator_next(struct ParserLookupIterator *iter)
+{
+	for (;;) {
+		if (iter->node && iter->index < array_len(iter->node->variable.words)) {
+			return array_get(iter->node->variable.words, iter->index++);
 		}
-		return node;
-	} else {
+		unless (parser_lookup_iterator_next_variable(iter)) {
+			return NULL;
+		}
+	}
+}
+
+struct AST *
+parser_lookup_variable(struct Parser *parser, const char *name, enum ParserLookupVariableBehavior behavior, struct Mempool *extpool, struct Array **retval, struct Array **comment)
+{
+	struct ParserLookupIterator iter;
+	parser_lookup_iterator_init(parser, &iter, name, behavior);
+	struct AST *first = parser_lookup_iterator_next_variable(&iter);
+	unless (first) {
 		if (comment) {
 			*comment = NULL;
 		}
@@ -1934,6 +2957,36 @@ parser_lookup_variable(struct Parser *parser, const char *name, enum ParserLooku
 		}
 		return NULL;
 	}
+
+	struct Array *tokens = NULL;
+	struct Array *comments = NULL;
+	if (retval) {
+		tokens = mempool_array(extpool);
+	}
+	if (comment) {
+		comments = mempool_array(extpool);
+	}
+	struct AST *node = first;
+	struct AST *last = NULL;
+	do {
+		last = node;
+		if (tokens) {
+			ARRAY_FOREACH(node->variable.words, const char *, word) {
+				array_append(tokens, str_dup(extpool, word));
+			}
+		}
+		if (comments && node->variable.comment && strlen(node->variable.comment) > 0) {
+			array_append(comments, str_dup(extpool, node->variable.comment));
+		}
+	} while ((node = parser_lookup_iterator_next_variable(&iter)));
+
+	if (comment) {
+		*comment = comments;
+	}
+	if (retval) {
+		*retval = tokens;
+	}
+	return last;
 }
 
 struct AST *
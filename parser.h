@@ -47,6 +47,7 @@ enum ParserBehavior {
 	PARSER_CHECK_VARIABLE_REFERENCES = 1 << 16,
 	PARSER_LOAD_LOCAL_INCLUDES = 1 << 17,
 	PARSER_SANITIZE_CMAKE_ARGS = 1 << 18,
+	PARSER_OUTPUT_CHECK = 1 << 19,
 };
 
 const char *ParserBehavior_tostring(enum ParserBehavior);
@@ -109,6 +110,14 @@ const char *ParserMetadata_tostring(enum ParserMetadata);
 struct ParserSettings {
 	const char *filename;
 	int portsdir;
+	// Directory of filename.  With PARSER_OUTPUT_INPLACE the new
+	// contents are written to a temporary file in it and renamed
+	// over filename.
+	int inplace_dir;
+	// Directory of the AST cache or -1.  Files read with
+	// parser_read_from_file() are only tokenized if there is no
+	// cached AST for their contents yet.
+	int cache_dir;
 	enum ParserBehavior behavior;
 	uint32_t target_command_format_threshold;
 	size_t diff_context;
@@ -117,17 +126,36 @@ struct ParserSettings {
 	size_t if_wrapcol;
 	size_t for_wrapcol;
 	uint32_t debug_level;
+	// Phase timings are added to this sample if set
+	struct ProfileSample *profile;
 };
 
 struct Array;
 struct AST;
+struct ASTLineRange;
 struct Mempool;
 struct Parser;
+struct ProfileSample;
 struct Set;
 struct Token;
 
 typedef void (*ParserEditFn)(struct Parser *, struct AST *, struct Mempool *, void *);
 
+// Iterates over the words of a variable's assignments in order.  The
+// words are views into the AST and not copies, so the AST must not be
+// changed while iterating.  Needs ast.h.
+struct ParserLookupIterator {
+	struct ASTCursor cursor;
+	const char *name;
+	enum ParserLookupVariableBehavior behavior;
+	struct AST *node;
+	size_t index;
+};
+
+#define PARSER_LOOKUP_FOREACH(PARSER, NAME, BEHAVIOR, x) \
+	for (struct ParserLookupIterator x##_iter, *x##_once = (parser_lookup_iterator_init((PARSER), &x##_iter, (NAME), (BEHAVIOR)), &x##_iter); x##_once; x##_once = (ast_cursor_finish(&x##_iter.cursor), NULL)) \
+	for (const char *x; (x = parser_lookup_iterator_next(&x##_iter));)
+
 #define PARSER_EDIT(name) \
 	void name(struct Parser *parser, struct AST *root, struct Mempool *extpool, void *userdata)
 
@@ -136,6 +164,7 @@ void parser_init_settings(struct ParserSettings *);
 enum ParserError parser_read_from_buffer(struct Parser *, const char *, size_t);
 enum ParserError parser_read_from_file(struct Parser *, FILE *);
 enum ParserError parser_read_finish(struct Parser *);
+enum ParserError parser_apply_text_edit(struct Parser *, size_t, size_t, const char *);
 struct AST *parser_ast(struct Parser *);
 char *parser_error_tostring(struct Parser *, struct Mempool *);
 void parser_set_error(struct Parser *, enum ParserError, const char *);
@@ -143,9 +172,14 @@ void parser_free(struct Parser *);
 enum ParserError parser_output_write_to_file(struct Parser *, FILE *);
 enum ParserError parser_edit(struct Parser *, struct Mempool *, ParserEditFn, void *);
 void parser_enqueue_output(struct Parser *, const char *);
+struct AST *parser_lookup_line(struct Parser *, size_t, struct ASTLineRange **);
+struct Array *parser_lookup_lines(struct Parser *, struct Mempool *, size_t, size_t);
 struct AST *parser_lookup_target(struct Parser *, const char *);
 struct AST *parser_lookup_variable(struct Parser *, const char *, enum ParserLookupVariableBehavior, struct Mempool *, struct Array **, struct Array **);
 struct AST *parser_lookup_variable_str(struct Parser *, const char *, enum ParserLookupVariableBehavior, struct Mempool *, char **, char **);
+void parser_lookup_iterator_init(struct Parser *, struct ParserLookupIterator *, const char *, enum ParserLookupVariableBehavior);
+struct AST *parser_lookup_iterator_next_variable(struct ParserLookupIterator *);
+const char *parser_lookup_iterator_next(struct ParserLookupIterator *);
 void *parser_metadata(struct Parser *, enum ParserMetadata);
 enum ParserError parser_merge(struct Parser *, struct Parser *, enum ParserMergeBehavior);
 struct ParserSettings parser_settings(struct Parser *);
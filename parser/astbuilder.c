@@ -44,6 +44,7 @@
 #include <libias/str.h>
 
 #include "ast.h"
+#include "intern.h"
 #include "parser.h"
 #include "parser/astbuilder.h"
 #include "parser/astbuilder/conditional.h"
@@ -52,17 +53,18 @@
 #include "parser/astbuilder/token.h"
 #include "parser/astbuilder/variable.h"
 #include "rules.h"
+#include "stats.h"
 
 // Prototypes
 static bool ParserASTBuilderConditionalType_to_ASTExprType(enum ParserASTBuilderConditionalType, enum ASTExprType *);
 static bool ParserASTBuilderConditionalType_to_ASTIncludeType(enum ParserASTBuilderConditionalType, enum ASTIncludeType *);
 static bool ParserASTBuilderConditionalType_to_ASTIfType(enum ParserASTBuilderConditionalType, enum ASTIfType *);
 static char *split_off_comment(struct Mempool *, struct Array *, ssize_t, ssize_t, struct Array *);
-static void token_to_stream(struct Mempool *, struct Array *, enum ParserASTBuilderTokenType, bool, struct ASTLineRange *, const char *, const char *, const char *, const char *);
+static void token_to_stream(struct ParserASTBuilderTokenArena *, struct Array *, enum ParserASTBuilderTokenType, bool, struct ASTLineRange *, const char *, const char *, const char *, const char *);
 static const char *get_targetname(struct Mempool *, struct ASTTarget *);
 static void ast_from_token_stream_flush_comments(struct AST *, struct Array *);
 static struct AST *ast_from_token_stream(struct Parser *, struct Array *);
-static void ast_to_token_stream(struct AST *, struct Mempool *, struct Array *);
+static void ast_to_token_stream(struct AST *, struct ParserASTBuilderTokenArena *, struct Array *);
 
 bool
 ParserASTBuilderConditionalType_to_ASTExprType(enum ParserASTBuilderConditionalType value, enum ASTExprType *retval)
@@ -196,15 +198,15 @@ split_off_comment(struct Mempool *extpool, struct Array *tokens, ssize_t a, ssiz
 }
 
 void
-token_to_stream(struct Mempool *pool, struct Array *tokens, enum ParserASTBuilderTokenType type, bool edited, struct ASTLineRange *lines, const char *data, const char *varname, const char *condname, const char *targetname)
+token_to_stream(struct ParserASTBuilderTokenArena *arena, struct Array *tokens, enum ParserASTBuilderTokenType type, bool edited, struct ASTLineRange *lines, const char *data, const char *varname, const char *condname, const char *targetname)
 {
-	struct ParserASTBuilderToken *t = parser_astbuilder_token_new(type, lines, data, varname, condname, targetname);
+	struct ParserASTBuilderToken *t = parser_astbuilder_token_new(arena, type, lines, data, varname, condname, targetname);
 	panic_unless(t, "null token?");
 	if (t) {
 		if (edited) {
 			t->edited = true;
 		}
-		array_append(tokens, mempool_add(pool, t, parser_astbuilder_token_free));
+		array_append(tokens, t);
 	}
 }
 
@@ -231,9 +233,11 @@ get_targetname(struct Mempool *pool, struct ASTTarget *target)
 struct ParserASTBuilder *
 parser_astbuilder_new(struct Parser *parser)
 {
+	STATS_SCOPE(STATS_ASTBUILDER);
 	struct ParserASTBuilder *builder = xmalloc(sizeof(struct ParserASTBuilder));
 	builder->pool = mempool_new();
 	builder->parser = parser;
+	builder->arena = parser_astbuilder_token_arena_new(builder->pool);
 	builder->tokens = mempool_array(builder->pool);
 	builder->lines.a = 1;
 	builder->lines.b = 1;
@@ -243,8 +247,9 @@ parser_astbuilder_new(struct Parser *parser)
 struct ParserASTBuilder *
 parser_astbuilder_from_ast(struct Parser *parser, struct AST *node)
 {
+	STATS_SCOPE(STATS_ASTBUILDER);
 	struct ParserASTBuilder *builder = parser_astbuilder_new(parser);
-	ast_to_token_stream(node, builder->pool, builder->tokens);
+	ast_to_token_stream(node, builder->arena, builder->tokens);
 	return builder;
 }
 
@@ -260,24 +265,26 @@ parser_astbuilder_free(struct ParserASTBuilder *builder)
 void
 parser_astbuilder_append_token(struct ParserASTBuilder *builder, enum ParserASTBuilderTokenType type, const char *data)
 {
+	STATS_SCOPE(STATS_ASTBUILDER);
 	panic_unless(builder->tokens, "AST was already built");
-	struct ParserASTBuilderToken *t = parser_astbuilder_token_new(type, &builder->lines, data, builder->varname, builder->condname, builder->targetname);
+	struct ParserASTBuilderToken *t = parser_astbuilder_token_new(builder->arena, type, &builder->lines, data, builder->varname, builder->condname, builder->targetname);
 	if (t == NULL) {
 		if (builder->parser) {
 			parser_set_error(builder->parser, PARSER_ERROR_EXPECTED_TOKEN, ParserASTBuilderTokenType_human(type));
 		}
 		return;
 	}
-	mempool_add(builder->pool, t, parser_astbuilder_token_free);
 	array_append(builder->tokens, t);
 }
 
 struct AST *
 parser_astbuilder_finish(struct ParserASTBuilder *builder)
 {
+	STATS_SCOPE(STATS_ASTBUILDER);
 	panic_unless(builder->tokens, "AST was already built");
 	struct AST *root = ast_from_token_stream(builder->parser, builder->tokens);
 	mempool_release_all(builder->pool);
+	builder->arena = NULL;
 	builder->tokens = NULL;
 	return root;
 }
@@ -289,7 +296,7 @@ ast_from_token_stream_flush_comments(struct AST *parent, struct Array *comments)
 		return;
 	}
 
-	struct AST *node = ast_new(parent->pool, AST_COMMENT, &((struct ParserASTBuilderToken *)array_get(comments, 0))->lines, &(struct ASTComment){
+	struct AST *node = ast_new(parent, AST_COMMENT, &((struct ParserASTBuilderToken *)array_get(comments, 0))->lines, &(struct ASTComment){
 		.type = AST_COMMENT_LINE,
 	});
 	ast_parent_append_sibling(parent, node, 0);
@@ -308,7 +315,7 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 {
 	SCOPE_MEMPOOL(pool);
 
-	struct AST *root = ast_new(mempool_new(), AST_ROOT, NULL, NULL);
+	struct AST *root = ast_new(NULL, AST_ROOT, NULL, NULL);
 	struct Array *current_cond = mempool_array(pool);
 	struct Array *current_comments = mempool_array(pool);
 	struct Array *current_target_cmds = mempool_array(pool);
@@ -334,7 +341,7 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 			array_append(current_cond, t);
 			break;
 		case PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END: {
-			enum ParserASTBuilderConditionalType condtype = t->conditional.type;
+			enum ParserASTBuilderConditionalType condtype = t->conditional->type;
 			switch (condtype) {
 			case PARSER_AST_BUILDER_CONDITIONAL_INVALID:
 				panic("got invalid conditional");
@@ -357,9 +364,9 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 							str_printf(pool, "cannot map %s to ASTIncludeType",
 								ParserASTBuilderConditionalType_tostring(condtype)));
 				}
-				struct AST *node = ast_new(root->pool, AST_INCLUDE, &t->lines, &(struct ASTInclude){
+				struct AST *node = ast_new(root, AST_INCLUDE, &t->lines, &(struct ASTInclude){
 					.type = type,
-					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional.indent,
+					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional->indent,
 				});
 				ast_parent_append_sibling(stack_peek(nodestack), node, 0);
 				node->edited = t->edited;
@@ -431,9 +438,9 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 								ParserASTBuilderConditionalType_tostring(condtype)));
 					return NULL;
 				}
-				struct AST *node = ast_new(root->pool, AST_EXPR, &t->lines, &(struct ASTExpr){
+				struct AST *node = ast_new(root, AST_EXPR, &t->lines, &(struct ASTExpr){
 					.type = type,
-					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional.indent,
+					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional->indent,
 				});
 				ast_parent_append_sibling(stack_peek(nodestack), node, 0);
 				node->edited = t->edited;
@@ -446,8 +453,8 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 								ParserASTBuilderConditionalType_tostring(condtype)));
 					return NULL;
 				}
-				struct AST *node = ast_new(root->pool, AST_FOR, &t->lines, &(struct ASTFor){
-					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional.indent,
+				struct AST *node = ast_new(root, AST_FOR, &t->lines, &(struct ASTFor){
+					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional->indent,
 				});
 				ast_parent_append_sibling(stack_peek(nodestack), node, 0);
 				node->edited = t->edited;
@@ -521,9 +528,9 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 								ParserASTBuilderConditionalType_tostring(condtype)));
 					return NULL;
 				}
-				struct AST *node = ast_new(root->pool, AST_IF, &t->lines, &(struct ASTIf){
+				struct AST *node = ast_new(root, AST_IF, &t->lines, &(struct ASTIf){
 					.type = type,
-					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional.indent,
+					.indent = ((struct ParserASTBuilderToken *)array_get(current_cond, 0))->conditional->indent,
 					.ifparent = ifparent,
 				});
 				ast_parent_append_sibling(parent, node, ifparent != NULL);
@@ -581,19 +588,19 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 				stack_pop(nodestack);
 			}
 
-			node = ast_new(root->pool, AST_TARGET, &t->lines, &(struct ASTTarget){
+			node = ast_new(root, AST_TARGET, &t->lines, &(struct ASTTarget){
 				.type = AST_TARGET_NAMED,
 			});
 			ast_parent_append_sibling(stack_peek(nodestack), node, 0);
 			node->edited = t->edited;
-			if (t->target.comment) {
-				node->target.comment = str_dup(node->pool, t->target.comment);
+			if (t->target->comment) {
+				node->target.comment = str_dup(node->pool, t->target->comment);
 			}
-			ARRAY_FOREACH(t->target.sources, const char *, source) {
-				array_append(node->target.sources, str_dup(node->pool, source));
+			ARRAY_FOREACH(t->target->sources, const char *, source) {
+				array_append(node->target.sources, intern(source));
 			}
-			ARRAY_FOREACH(t->target.dependencies, const char *, dependency) {
-				array_append(node->target.dependencies, str_dup(node->pool, dependency));
+			ARRAY_FOREACH(t->target->dependencies, const char *, dependency) {
+				array_append(node->target.dependencies, intern(dependency));
 			}
 			stack_push(nodestack, node);
 			break;
@@ -629,7 +636,7 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 				}
 			}
 			unless (target) { // Inject new unassociated target
-				struct AST *node = ast_new(root->pool, AST_TARGET, &t->lines, &(struct ASTTarget){
+				struct AST *node = ast_new(root, AST_TARGET, &t->lines, &(struct ASTTarget){
 					.type = AST_TARGET_UNASSOCIATED,
 				});
 				ast_parent_append_sibling(stack_peek(nodestack), node, 0);
@@ -639,7 +646,7 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 			}
 
 			//panic_unless(target, "unassociated target command on input line %zu-%zu", token_lines(t)->start, token_lines(t)->end);
-			struct AST *node = ast_new(root->pool, AST_TARGET_COMMAND, &t->lines, &(struct ASTTargetCommand){
+			struct AST *node = ast_new(root, AST_TARGET_COMMAND, &t->lines, &(struct ASTTargetCommand){
 				.target = target,
 			});
 			ast_parent_append_sibling(stack_peek(nodestack), node, 0);
@@ -685,9 +692,9 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 				parser_set_error(parser, PARSER_ERROR_AST_BUILD_FAILED, "variable has no tokens");
 				return NULL;
 			}
-			struct AST *node = ast_new(root->pool, AST_VARIABLE, &t->lines, &(struct ASTVariable){
-				.name = t->variable.name,
-				.modifier = ((struct ParserASTBuilderToken *)array_get(current_var, 0))->variable.modifier,
+			struct AST *node = ast_new(root, AST_VARIABLE, &t->lines, &(struct ASTVariable){
+				.name = t->variable->name,
+				.modifier = ((struct ParserASTBuilderToken *)array_get(current_var, 0))->variable->modifier,
 			});
 			ast_parent_append_sibling(stack_peek(nodestack), node, 0);
 			node->edited = t->edited;
@@ -714,35 +721,35 @@ ast_from_token_stream(struct Parser *parser, struct Array *tokens)
 }
 
 void
-ast_to_token_stream(struct AST *node, struct Mempool *extpool, struct Array *tokens)
+ast_to_token_stream(struct AST *node, struct ParserASTBuilderTokenArena *arena, struct Array *tokens)
 {
 	SCOPE_MEMPOOL(pool);
 
 	switch (node->type) {
 	case AST_ROOT:
 		ARRAY_FOREACH(node->root.body, struct AST *, child) {
-			ast_to_token_stream(child, extpool, tokens);
+			ast_to_token_stream(child, arena, tokens);
 		}
 		break;
 	case AST_DELETED:
 		break;
 	case AST_COMMENT: {
 		ARRAY_FOREACH(node->comment.lines, const char *, line) {
-			struct ParserASTBuilderToken *t = parser_astbuilder_token_new_comment(&node->line_start, line, PARSER_AST_BUILDER_CONDITIONAL_INVALID);
+			struct ParserASTBuilderToken *t = parser_astbuilder_token_new_comment(arena, &node->line_start, line);
 			t->edited = node->edited;
-			array_append(tokens, mempool_add(extpool, t, parser_astbuilder_token_free));
+			array_append(tokens, t);
 		}
 		break;
 	} case AST_EXPR: {
 		const char *indent = str_repeat(pool, " ", node->expr.indent);
 		const char *data = str_printf(pool, ".%s%s", indent, ASTExprType_identifier(node->expr.type) + 1);
 		const char *exprname = ASTExprType_identifier(node->expr.type);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, exprname, NULL);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, exprname, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, exprname, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, exprname, NULL);
 		ARRAY_FOREACH(node->expr.words, const char *, word) {
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, word, NULL, exprname, NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, word, NULL, exprname, NULL);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, exprname, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, exprname, NULL);
 		break;
 	} case AST_IF: {
 		const char *indent = str_repeat(pool, " ", node->ifexpr.indent);
@@ -753,63 +760,63 @@ ast_to_token_stream(struct AST *node, struct Mempool *extpool, struct Array *tok
 		const char *ifname = str_printf(pool, "%s%s", prefix, ASTIfType_human(node->ifexpr.type));
 		const char *ifnamedot = str_printf(pool, ".%s", ifname);
 		const char *data = str_printf(pool, ".%s%s", indent, ifname);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, ifnamedot, NULL);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, ifnamedot, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, ifnamedot, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, ifnamedot, NULL);
 		ARRAY_FOREACH(node->ifexpr.test, const char *, word) {
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, word, NULL, ifnamedot, NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, word, NULL, ifnamedot, NULL);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, ifnamedot, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, ifnamedot, NULL);
 
 		ARRAY_FOREACH(node->ifexpr.body, struct AST *, child) {
-			ast_to_token_stream(child, extpool, tokens);
+			ast_to_token_stream(child, arena, tokens);
 		}
 
 		if (array_len(node->ifexpr.orelse) > 0) {
 			struct AST *next = array_get(node->ifexpr.orelse, 0);
 			if (next && next->type == AST_IF && next->ifexpr.type == AST_IF_ELSE) {
 				data = str_printf(pool, ".%selse", indent);
-				token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, next->edited, &next->line_start, data, NULL, ".else", NULL);
-				token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, next->edited, &next->line_start, data, NULL, ".else", NULL);
-				token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, next->edited, &next->line_start, data, NULL, ".else", NULL);
+				token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, next->edited, &next->line_start, data, NULL, ".else", NULL);
+				token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, next->edited, &next->line_start, data, NULL, ".else", NULL);
+				token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, next->edited, &next->line_start, data, NULL, ".else", NULL);
 				ARRAY_FOREACH(next->ifexpr.body, struct AST *, child) {
-					ast_to_token_stream(child, extpool, tokens);
+					ast_to_token_stream(child, arena, tokens);
 				}
 			} else {
 				ARRAY_FOREACH(node->ifexpr.orelse, struct AST *, child) {
-					ast_to_token_stream(child, extpool, tokens);
+					ast_to_token_stream(child, arena, tokens);
 				}
 			}
 		}
 
 		unless (node->ifexpr.ifparent) {
 			data = str_printf(pool, ".%sendif", indent);
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_end, data, NULL, ".endif", NULL);
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_end, data, NULL, ".endif", NULL);
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_end, data, NULL, ".endif", NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_end, data, NULL, ".endif", NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_end, data, NULL, ".endif", NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_end, data, NULL, ".endif", NULL);
 		}
 		break;
 	} case AST_FOR: {
 		const char *indent = str_repeat(pool, " ", node->forexpr.indent);
 		const char *data = str_printf(pool, ".%sfor", indent);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, ".for", NULL);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, ".for", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, ".for", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, ".for", NULL);
 		ARRAY_FOREACH(node->forexpr.bindings, const char *, binding) {
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, binding, NULL, ".for", NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, binding, NULL, ".for", NULL);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, "in", NULL, ".for", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, "in", NULL, ".for", NULL);
 		ARRAY_FOREACH(node->forexpr.words, const char *, word) {
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, word, NULL, ".for", NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, word, NULL, ".for", NULL);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, ".for", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, ".for", NULL);
 
 		ARRAY_FOREACH(node->forexpr.body, struct AST *, child) {
-			ast_to_token_stream(child, extpool, tokens);
+			ast_to_token_stream(child, arena, tokens);
 		}
 
 		data = str_printf(pool, ".%sendfor", indent);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_end, data, NULL, ".endfor", NULL);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_end, data, NULL, ".endfor", NULL);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_end, data, NULL, ".endfor", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_end, data, NULL, ".endfor", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_end, data, NULL, ".endfor", NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_end, data, NULL, ".endfor", NULL);
 		break;
 	} case AST_INCLUDE: {
 		const char *exprname = ASTIncludeType_identifier(node->include.type);
@@ -818,8 +825,8 @@ ast_to_token_stream(struct AST *node, struct Mempool *extpool, struct Array *tok
 			const char *indent = str_repeat(pool, " ", node->include.indent);
 			data = str_printf(pool, ".%s%s", indent, exprname + 1);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, exprname, NULL);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, exprname, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, node->edited, &node->line_start, data, NULL, exprname, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, data, NULL, exprname, NULL);
 		if (node->include.path) {
 			const char *path;
 			if (node->include.sys) {
@@ -827,24 +834,24 @@ ast_to_token_stream(struct AST *node, struct Mempool *extpool, struct Array *tok
 			} else {
 				path = str_printf(pool, "\"%s\"", node->include.path);
 			}
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, path, NULL, exprname, NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, path, NULL, exprname, NULL);
 		}
 		if (node->include.comment && strlen(node->include.comment) > 0) {
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, node->include.comment, NULL, exprname, NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, node->edited, &node->line_start, node->include.comment, NULL, exprname, NULL);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, exprname, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, node->edited, &node->line_start, data, NULL, exprname, NULL);
 		break;
 	} case AST_TARGET: {
 		const char *targetname = get_targetname(pool, &node->target);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_START, node->edited, &node->line_start, targetname, NULL, NULL, targetname);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_START, node->edited, &node->line_start, targetname, NULL, NULL, targetname);
 		ARRAY_FOREACH(node->target.body, struct AST *, child) {
-			ast_to_token_stream(child, extpool, tokens);
+			ast_to_token_stream(child, arena, tokens);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_END, node->edited, &node->line_start, NULL, NULL, NULL, targetname);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_END, node->edited, &node->line_start, NULL, NULL, NULL, targetname);
 		break;
 	} case AST_TARGET_COMMAND: {
 		const char *targetname = get_targetname(pool, node->targetcommand.target);
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_START, node->edited, &node->line_start, NULL, NULL, NULL, targetname);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_START, node->edited, &node->line_start, NULL, NULL, NULL, targetname);
 		struct Array *flag_tokens = mempool_array(pool);
 		if (node->targetcommand.flags & AST_TARGET_COMMAND_FLAG_SILENT) {
 			array_append(flag_tokens, ASTTargetCommandFlag_human(AST_TARGET_COMMAND_FLAG_SILENT));
@@ -857,17 +864,17 @@ ast_to_token_stream(struct AST *node, struct Mempool *extpool, struct Array *tok
 		}
 		if (array_len(node->targetcommand.words) == 0 && array_len(flag_tokens) > 0) {
 			const char *flags = str_join(pool, flag_tokens, "");
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN, node->edited, &node->line_start, flags, NULL, NULL, targetname);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN, node->edited, &node->line_start, flags, NULL, NULL, targetname);
 		} else {
 			ARRAY_FOREACH(node->targetcommand.words, const char *, word) {
 				if (word_index == 0 && array_len(flag_tokens) > 0) {
 					array_append(flag_tokens, word);
 					word = str_join(pool, flag_tokens, "");
 				}
-				token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN, node->edited, &node->line_start, word, NULL, NULL, targetname);
+				token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN, node->edited, &node->line_start, word, NULL, NULL, targetname);
 			}
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_END, node->edited, &node->line_start, NULL, NULL, NULL, targetname);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_END, node->edited, &node->line_start, NULL, NULL, NULL, targetname);
 		break;
 	} case AST_VARIABLE: {
 		const char *space = "";
@@ -875,11 +882,11 @@ ast_to_token_stream(struct AST *node, struct Mempool *extpool, struct Array *tok
 			space = " ";
 		}
 		const char *varname = str_printf(pool, "%s%s%s", node->variable.name, space, ASTVariableModifier_human(node->variable.modifier));
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_VARIABLE_START, node->edited, &node->line_start, NULL, varname, NULL, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_VARIABLE_START, node->edited, &node->line_start, NULL, varname, NULL, NULL);
 		ARRAY_FOREACH(node->variable.words, const char *, word) {
-			token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_VARIABLE_TOKEN, node->edited, &node->line_start, word, varname, NULL, NULL);
+			token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_VARIABLE_TOKEN, node->edited, &node->line_start, word, varname, NULL, NULL);
 		}
-		token_to_stream(extpool, tokens, PARSER_AST_BUILDER_TOKEN_VARIABLE_END, node->edited, &node->line_end, NULL, varname, NULL, NULL);
+		token_to_stream(arena, tokens, PARSER_AST_BUILDER_TOKEN_VARIABLE_END, node->edited, &node->line_end, NULL, varname, NULL, NULL);
 		break;
 	} }
 }
@@ -892,9 +899,9 @@ parser_astbuilder_print_token_stream(struct ParserASTBuilder *builder, FILE *f)
 	struct Array *tokens = builder->tokens;
 	size_t maxvarlen = 0;
 	ARRAY_FOREACH(tokens, struct ParserASTBuilderToken *, o) {
-		if (o->type == PARSER_AST_BUILDER_TOKEN_VARIABLE_START && o->variable.name) {
-			maxvarlen = MAX(maxvarlen, strlen(o->variable.name) + strlen(ASTVariableModifier_human(o->variable.modifier)));
-			if (str_endswith(o->variable.name, "+")) {
+		if (o->type == PARSER_AST_BUILDER_TOKEN_VARIABLE_START && o->variable) {
+			maxvarlen = MAX(maxvarlen, strlen(o->variable->name) + strlen(ASTVariableModifier_human(o->variable->modifier)));
+			if (str_endswith(o->variable->name, "+")) {
 				maxvarlen += 1;
 			}
 		}
@@ -902,28 +909,28 @@ parser_astbuilder_print_token_stream(struct ParserASTBuilder *builder, FILE *f)
 	struct Array *vars = mempool_array(pool);
 	ARRAY_FOREACH(tokens, struct ParserASTBuilderToken *, t) {
 		const char *type = ParserASTBuilderTokenType_human(t->type);
-		if (t->variable.name &&
+		if (t->variable &&
 		    (t->type == PARSER_AST_BUILDER_TOKEN_VARIABLE_TOKEN ||
 		     t->type == PARSER_AST_BUILDER_TOKEN_VARIABLE_START ||
 		     t->type == PARSER_AST_BUILDER_TOKEN_VARIABLE_END)) {
 			const char *sep = "";
-			if (str_endswith(t->variable.name, "+")) {
+			if (str_endswith(t->variable->name, "+")) {
 				sep = " ";
 			}
-			array_append(vars, str_printf(pool, "%s%s%s", t->variable.name, sep, ASTVariableModifier_human(t->variable.modifier)));
-		} else if (t->conditional.type != PARSER_AST_BUILDER_CONDITIONAL_INVALID &&
+			array_append(vars, str_printf(pool, "%s%s%s", t->variable->name, sep, ASTVariableModifier_human(t->variable->modifier)));
+		} else if (t->conditional &&
 			   (t->type == PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END ||
 			    t->type == PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START ||
 			    t->type == PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN)) {
-			array_append(vars, ParserASTBuilderConditionalType_human(t->conditional.type));
-		} else if (t->target.sources && t->type == PARSER_AST_BUILDER_TOKEN_TARGET_START) {
-			ARRAY_FOREACH(t->target.sources, const char *, name) {
+			array_append(vars, ParserASTBuilderConditionalType_human(t->conditional->type));
+		} else if (t->target && t->type == PARSER_AST_BUILDER_TOKEN_TARGET_START) {
+			ARRAY_FOREACH(t->target->sources, const char *, name) {
 				array_append(vars, str_dup(pool, name));
 			}
-			ARRAY_FOREACH(t->target.dependencies, const char *, dep) {
+			ARRAY_FOREACH(t->target->dependencies, const char *, dep) {
 				array_append(vars, str_printf(pool, "->%s", dep));
 			}
-		} else if (t->target.sources &&
+		} else if (t->target &&
 			   (t->type == PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_END ||
 			    t->type == PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_START ||
 			    t->type == PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN ||
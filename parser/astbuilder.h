@@ -32,11 +32,13 @@ struct Array;
 struct Mempool;
 enum ParserASTBuilderTokenType;
 struct ASTLineRange;
+struct ParserASTBuilderTokenArena;
 
 struct ParserASTBuilder {
 	struct Parser *parser;
 	struct Array *tokens;
 	struct Mempool *pool;
+	struct ParserASTBuilderTokenArena *arena;
 	struct ASTLineRange lines;
 	char *condname;
 	char *targetname;
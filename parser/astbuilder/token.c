@@ -25,7 +25,6 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
-
 #include "config.h"
 
 #include <inttypes.h>
@@ -46,12 +45,137 @@
 #include "token.h"
 #include "variable.h"
 
+// Tokens and their data are bump allocated in chunks from the
+// builder's pool and are all released at once with it.  The last
+// context of each kind is cached since the tokenizer emits runs of
+// tokens with the same context.
+struct ParserASTBuilderTokenArena {
+	struct Mempool *pool;
+	struct ParserASTBuilderToken *tokens;
+	size_t tokens_left;
+	char *strings;
+	size_t strings_left;
+	struct ParserASTBuilderTokenConditional *conditional;
+	struct ParserASTBuilderTokenTarget *target;
+	struct ParserASTBuilderTokenVariable *variable;
+};
+
+// Prototypes
+static struct ParserASTBuilderToken *token_arena_token(struct ParserASTBuilderTokenArena *);
+static char *token_arena_strdup(struct ParserASTBuilderTokenArena *, const char *);
+static const struct ParserASTBuilderTokenConditional *token_arena_conditional(struct ParserASTBuilderTokenArena *, const char *);
+static const struct ParserASTBuilderTokenTarget *token_arena_target(struct ParserASTBuilderTokenArena *, const char *);
+static const struct ParserASTBuilderTokenVariable *token_arena_variable(struct ParserASTBuilderTokenArena *, const char *);
+
+// Constants
+static const size_t TOKEN_ARENA_TOKENS = 512;
+static const size_t TOKEN_ARENA_STRINGS = 16384;
+
 struct ParserASTBuilderToken *
-parser_astbuilder_token_new(enum ParserASTBuilderTokenType type, struct ASTLineRange *lines, const char *data,
-	  const char *varname, const char *condname, const char *targetname)
+token_arena_token(struct ParserASTBuilderTokenArena *arena)
+{
+	unless (arena->tokens_left) {
+		arena->tokens = mempool_alloc(arena->pool, TOKEN_ARENA_TOKENS * sizeof(struct ParserASTBuilderToken));
+		arena->tokens_left = TOKEN_ARENA_TOKENS;
+	}
+	arena->tokens_left--;
+	return arena->tokens++;
+}
+
+char *
+token_arena_strdup(struct ParserASTBuilderTokenArena *arena, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	if (len > TOKEN_ARENA_STRINGS / 8) {
+		return str_dup(arena->pool, s);
+	}
+	if (len > arena->strings_left) {
+		arena->strings = mempool_alloc(arena->pool, TOKEN_ARENA_STRINGS);
+		arena->strings_left = TOKEN_ARENA_STRINGS;
+	}
+	char *retval = memcpy(arena->strings, s, len);
+	arena->strings += len;
+	arena->strings_left -= len;
+	return retval;
+}
+
+const struct ParserASTBuilderTokenConditional *
+token_arena_conditional(struct ParserASTBuilderTokenArena *arena, const char *condname)
+{
+	if (arena->conditional && strcmp(arena->conditional->context, condname) == 0) {
+		return arena->conditional;
+	}
+
+	size_t indent;
+	enum ParserASTBuilderConditionalType type = parse_conditional(condname, &indent);
+	if (type == PARSER_AST_BUILDER_CONDITIONAL_INVALID) {
+		return NULL;
+	}
+
+	struct ParserASTBuilderTokenConditional *cond = mempool_alloc(arena->pool, sizeof(struct ParserASTBuilderTokenConditional));
+	cond->context = token_arena_strdup(arena, condname);
+	cond->type = type;
+	cond->indent = indent;
+	arena->conditional = cond;
+	return cond;
+}
+
+const struct ParserASTBuilderTokenTarget *
+token_arena_target(struct ParserASTBuilderTokenArena *arena, const char *targetname)
 {
-	SCOPE_MEMPOOL(pool);
+	if (arena->target && strcmp(arena->target->context, targetname) == 0) {
+		return arena->target;
+	}
 
+	struct Array *sources;
+	struct Array *dependencies;
+	const char *comment;
+	unless (parse_target(arena->pool, targetname, &sources, &dependencies, &comment)) {
+		return NULL;
+	}
+
+	struct ParserASTBuilderTokenTarget *target = mempool_alloc(arena->pool, sizeof(struct ParserASTBuilderTokenTarget));
+	target->context = token_arena_strdup(arena, targetname);
+	target->sources = sources;
+	target->dependencies = dependencies;
+	target->comment = comment;
+	arena->target = target;
+	return target;
+}
+
+const struct ParserASTBuilderTokenVariable *
+token_arena_variable(struct ParserASTBuilderTokenArena *arena, const char *varname)
+{
+	if (arena->variable && strcmp(arena->variable->context, varname) == 0) {
+		return arena->variable;
+	}
+
+	const char *name;
+	enum ASTVariableModifier modifier;
+	unless (parse_variable(varname, &name, &modifier)) {
+		return NULL;
+	}
+
+	struct ParserASTBuilderTokenVariable *var = mempool_alloc(arena->pool, sizeof(struct ParserASTBuilderTokenVariable));
+	var->context = token_arena_strdup(arena, varname);
+	var->name = name;
+	var->modifier = modifier;
+	arena->variable = var;
+	return var;
+}
+
+struct ParserASTBuilderTokenArena *
+parser_astbuilder_token_arena_new(struct Mempool *pool)
+{
+	struct ParserASTBuilderTokenArena *arena = mempool_alloc(pool, sizeof(struct ParserASTBuilderTokenArena));
+	arena->pool = pool;
+	return arena;
+}
+
+struct ParserASTBuilderToken *
+parser_astbuilder_token_new(struct ParserASTBuilderTokenArena *arena, enum ParserASTBuilderTokenType type, struct ASTLineRange *lines, const char *data,
+	  const char *varname, const char *condname, const char *targetname)
+{
 	if (((type == PARSER_AST_BUILDER_TOKEN_VARIABLE_END || type == PARSER_AST_BUILDER_TOKEN_VARIABLE_START ||
 	      type == PARSER_AST_BUILDER_TOKEN_VARIABLE_TOKEN) && varname == NULL) ||
 	    ((type == PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END || type == PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START ||
@@ -62,53 +186,48 @@ parser_astbuilder_token_new(enum ParserASTBuilderTokenType type, struct ASTLineR
 		return NULL;
 	}
 
-	struct ParserASTBuilderToken *t = xmalloc(sizeof(struct ParserASTBuilderToken));
-	t->pool = mempool_new();
-	t->type = type;
-	t->lines = *lines;
-
-	if (targetname && !parse_target(t->pool, targetname, &t->target.sources, &t->target.dependencies, &t->target.comment)) {
+	const struct ParserASTBuilderTokenTarget *target = NULL;
+	if (targetname && (target = token_arena_target(arena, targetname)) == NULL) {
 		return NULL;
 	}
 
-	if (condname && (t->conditional.type = parse_conditional(condname, &t->conditional.indent)) == PARSER_AST_BUILDER_CONDITIONAL_INVALID) {
+	const struct ParserASTBuilderTokenConditional *conditional = NULL;
+	if (condname && (conditional = token_arena_conditional(arena, condname)) == NULL) {
 		return NULL;
 	}
 
-	if (varname && !parse_variable(pool, varname, &t->variable.name, &t->variable.modifier)) {
+	const struct ParserASTBuilderTokenVariable *variable = NULL;
+	if (varname && (variable = token_arena_variable(arena, varname)) == NULL) {
 		return NULL;
 	}
 
+	struct ParserASTBuilderToken *t = token_arena_token(arena);
+	*t = (struct ParserASTBuilderToken){
+		.conditional = conditional,
+		.target = target,
+		.variable = variable,
+		.lines = *lines,
+		.type = type,
+	};
 	if (data) {
-		t->data = str_dup(pool, data);
+		t->data = token_arena_strdup(arena, data);
 	}
 
-	mempool_inherit(t->pool, pool);
 	return t;
 }
 
 struct ParserASTBuilderToken *
-parser_astbuilder_token_new_comment(struct ASTLineRange *lines, const char *data, enum ParserASTBuilderConditionalType cond)
+parser_astbuilder_token_new_comment(struct ParserASTBuilderTokenArena *arena, struct ASTLineRange *lines, const char *data)
 {
 	if (lines == NULL || data == NULL) {
 		return NULL;
 	}
 
-	struct ParserASTBuilderToken *t = xmalloc(sizeof(struct ParserASTBuilderToken));
-	t->pool = mempool_new();
-	t->type = PARSER_AST_BUILDER_TOKEN_COMMENT;
-	t->lines = *lines;
-	t->conditional.type = cond;
-	t->data = str_dup(t->pool, data);
+	struct ParserASTBuilderToken *t = token_arena_token(arena);
+	*t = (struct ParserASTBuilderToken){
+		.data = token_arena_strdup(arena, data),
+		.lines = *lines,
+		.type = PARSER_AST_BUILDER_TOKEN_COMMENT,
+	};
 	return t;
 }
-
-void
-parser_astbuilder_token_free(struct ParserASTBuilderToken *token)
-{
-	if (token == NULL) {
-		return;
-	}
-	mempool_free(token->pool);
-	free(token);
-}
@@ -30,28 +30,40 @@
 enum ParserASTBuilderTokenType;
 struct ASTLineRange;
 struct Mempool;
+struct ParserASTBuilderTokenArena;
+
+// Context shared by all tokens of one conditional, target or
+// variable.  The context string is parsed only once when it first
+// appears and tokens point to the result.
+struct ParserASTBuilderTokenConditional {
+	const char *context;
+	enum ParserASTBuilderConditionalType type;
+	size_t indent;
+};
+
+struct ParserASTBuilderTokenTarget {
+	const char *context;
+	struct Array *sources;
+	struct Array *dependencies;
+	const char *comment;
+};
+
+struct ParserASTBuilderTokenVariable {
+	const char *context;
+	const char *name;
+	enum ASTVariableModifier modifier;
+};
 
 struct ParserASTBuilderToken {
-	enum ParserASTBuilderTokenType type;
-	struct Mempool *pool;
 	char *data;
-	struct {
-		enum ParserASTBuilderConditionalType type;
-		size_t indent;
-	} conditional;
-	struct {
-		char *name;
-		enum ASTVariableModifier modifier;
-	} variable;
-	struct {
-		struct Array *sources;
-		struct Array *dependencies;
-		const char *comment;
-	} target;
-	bool edited;
+	const struct ParserASTBuilderTokenConditional *conditional;
+	const struct ParserASTBuilderTokenTarget *target;
+	const struct ParserASTBuilderTokenVariable *variable;
 	struct ASTLineRange lines;
+	enum ParserASTBuilderTokenType type;
+	bool edited;
 };
 
-struct ParserASTBuilderToken *parser_astbuilder_token_new(enum ParserASTBuilderTokenType, struct ASTLineRange *, const char *, const char *, const char *, const char *);
-struct ParserASTBuilderToken *parser_astbuilder_token_new_comment(struct ASTLineRange *, const char *, enum ParserASTBuilderConditionalType);
-void parser_astbuilder_token_free(struct ParserASTBuilderToken *);
+struct ParserASTBuilderTokenArena *parser_astbuilder_token_arena_new(struct Mempool *);
+struct ParserASTBuilderToken *parser_astbuilder_token_new(struct ParserASTBuilderTokenArena *, enum ParserASTBuilderTokenType, struct ASTLineRange *, const char *, const char *, const char *, const char *);
+struct ParserASTBuilderToken *parser_astbuilder_token_new_comment(struct ParserASTBuilderTokenArena *, struct ASTLineRange *, const char *);
@@ -36,10 +36,11 @@
 #include <libias/str.h>
 
 #include "ast.h"
+#include "intern.h"
 #include "variable.h"
 
 bool
-parse_variable(struct Mempool *extpool, const char *buf, char **name, enum ASTVariableModifier *mod)
+parse_variable(const char *buf, const char **name, enum ASTVariableModifier *mod)
 {
 	SCOPE_MEMPOOL(pool);
 
@@ -72,12 +73,12 @@ parse_variable(struct Mempool *extpool, const char *buf, char **name, enum ASTVa
 		break;
 	}
 
-	*name = str_trimr(pool, str_ndup(pool, buf, strlen(buf) - i));
-	if (strcmp(*name, "") == 0) {
+	const char *trimmed = str_trimr(pool, str_ndup(pool, buf, strlen(buf) - i));
+	if (strcmp(trimmed, "") == 0) {
 		*name = NULL;
 		return false;
 	} else {
-		mempool_move(pool, *name, extpool);
+		*name = intern(trimmed);
 		return true;
 	}
 }
@@ -28,6 +28,5 @@
 #pragma once
 
 enum ASTVariableModifier;
-struct Mempool;
 
-bool parse_variable(struct Mempool *, const char *, char **, enum ASTVariableModifier *);
+bool parse_variable(const char *, const char **, enum ASTVariableModifier *);
@@ -0,0 +1,678 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libias/array.h>
+#include <libias/flow.h>
+#include <libias/mempool.h>
+#include <libias/str.h>
+
+#include "ast.h"
+#include "parser/cache.h"
+
+// Layout of a cache file:
+//
+//	struct ParserCacheHeader
+//	struct ParserCacheNode[nodes]	in pre-order
+//	uint64_t[refs]			string references of word lists
+//	char[strings_len]		NUL terminated strings
+//
+// Lists and strings are referenced by offsets into their section so
+// the file does not need any pointer fixups and is mapped as is.  A string reference of 0 is NULL, any other is its offset
+// plus one.  Children directly follow their parent, first the body
+// and then, for .if, the orelse nodes.
+
+struct ParserCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint64_t key;
+	uint64_t lines;
+	uint64_t nodes;
+	uint64_t refs;
+	uint64_t strings_len;
+};
+
+struct ParserCacheNode {
+	uint32_t type;
+	uint32_t subtype;
+	uint32_t flags;
+	uint32_t children;
+	uint32_t orelse;
+	uint32_t list1_len;
+	uint32_t list2_len;
+	uint32_t padding;
+	uint64_t list1;
+	uint64_t list2;
+	uint64_t name;
+	uint64_t comment;
+	uint64_t end_comment;
+	uint64_t indent;
+	uint64_t goalcol;
+	uint64_t line_start_a;
+	uint64_t line_start_b;
+	uint64_t line_end_a;
+	uint64_t line_end_b;
+};
+
+enum ParserCacheNodeFlag {
+	PARSER_CACHE_NODE_EDITED = 1 << 0,
+	PARSER_CACHE_NODE_IFPARENT = 1 << 1,
+	PARSER_CACHE_NODE_INCLUDE_SYS = 1 << 2,
+	PARSER_CACHE_NODE_INCLUDE_LOADED = 1 << 3,
+};
+
+struct ParserCacheReader {
+	struct Mempool *pool;
+	const struct ParserCacheNode *nodes;
+	uint64_t nodes_len;
+	uint64_t next;
+	const uint64_t *refs;
+	uint64_t refs_len;
+	const char *strings;
+	uint64_t strings_len;
+	bool error;
+};
+
+struct ParserCacheWriter {
+	struct Mempool *pool;
+	struct Array *nodes;
+	FILE *refs;
+	uint64_t refs_len;
+	FILE *strings;
+	uint64_t strings_len;
+};
+
+// Prototypes
+static char *parser_cache_filename(struct Mempool *, uint64_t);
+static uint64_t parser_cache_hash(uint64_t, const void *, size_t);
+static struct AST *parser_cache_load_mapped(const char *, size_t, uint64_t, size_t);
+static struct Array *parser_cache_read_list(struct ParserCacheReader *, uint64_t, uint32_t);
+static bool parser_cache_read_node(struct ParserCacheReader *, struct AST *, struct AST *, bool);
+static const char *parser_cache_read_string(struct ParserCacheReader *, uint64_t);
+static bool parser_cache_valid_subtype(const struct ParserCacheNode *);
+static uint64_t parser_cache_write_body(struct ParserCacheWriter *, struct Array *);
+static uint64_t parser_cache_write_list(struct ParserCacheWriter *, struct Array *, uint32_t *);
+static void parser_cache_write_node(struct ParserCacheWriter *, struct AST *);
+static uint64_t parser_cache_write_string(struct ParserCacheWriter *, const char *);
+
+// Constants
+static const char PARSER_CACHE_MAGIC[8] = "PORTFMT";
+// Bump whenever the layout above changes.  Changes to the sources
+// that build the trees are covered by parser_cache_build_id.
+static const uint32_t PARSER_CACHE_VERSION = 1;
+static const uint32_t PARSER_CACHE_BYTEORDER = 0x01020304;
+static const size_t PARSER_CACHE_MAX_SIZE = 64 * 1024 * 1024;
+
+uint64_t
+parser_cache_hash(uint64_t hash, const void *buf, size_t len)
+{
+	// FNV-1a
+	const unsigned char *p = buf;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+uint64_t
+parser_cache_key(struct Array *rawlines, uint64_t behavior)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	hash = parser_cache_hash(hash, &PARSER_CACHE_VERSION, sizeof(PARSER_CACHE_VERSION));
+	hash = parser_cache_hash(hash, &parser_cache_build_id, sizeof(parser_cache_build_id));
+	size_t nodesize = sizeof(struct AST);
+	hash = parser_cache_hash(hash, &nodesize, sizeof(nodesize));
+	hash = parser_cache_hash(hash, &behavior, sizeof(behavior));
+	ARRAY_FOREACH(rawlines, const char *, line) {
+		hash = parser_cache_hash(hash, line, strlen(line) + 1);
+	}
+	return hash;
+}
+
+char *
+parser_cache_filename(struct Mempool *pool, uint64_t key)
+{
+	return str_printf(pool, "%016" PRIx64 ".ast", key);
+}
+
+const char *
+parser_cache_read_string(struct ParserCacheReader *r, uint64_t ref)
+{
+	if (ref == 0) {
+		return NULL;
+	} else if (ref > r->strings_len) {
+		r->error = true;
+		return "";
+	} else {
+		return r->strings + ref - 1;
+	}
+}
+
+struct Array *
+parser_cache_read_list(struct ParserCacheReader *r, uint64_t start, uint32_t len)
+{
+	struct Array *list = mempool_array(r->pool);
+	if (start > r->refs_len || len > r->refs_len - start) {
+		r->error = true;
+		return list;
+	}
+	for (uint64_t i = start; i < start + len; i++) {
+		const char *s = parser_cache_read_string(r, r->refs[i]);
+		if (s == NULL) {
+			r->error = true;
+			return list;
+		}
+		array_append(list, s);
+	}
+	return list;
+}
+
+bool
+parser_cache_valid_subtype(const struct ParserCacheNode *rec)
+{
+	switch ((enum ASTType)rec->type) {
+	case AST_COMMENT:
+		return rec->subtype <= AST_COMMENT_LINE;
+	case AST_EXPR:
+		return rec->subtype <= AST_EXPR_WARNING;
+	case AST_IF:
+		return rec->subtype <= AST_IF_NMAKE;
+	case AST_INCLUDE:
+		return rec->subtype <= AST_INCLUDE_OPTIONAL_S;
+	case AST_TARGET:
+		return rec->subtype <= AST_TARGET_UNASSOCIATED;
+	case AST_TARGET_COMMAND:
+		return rec->subtype <= (AST_TARGET_COMMAND_FLAG_ALWAYS_EXECUTE |
+					AST_TARGET_COMMAND_FLAG_IGNORE_ERROR |
+					AST_TARGET_COMMAND_FLAG_SILENT);
+	case AST_VARIABLE:
+		return rec->subtype <= AST_VARIABLE_MODIFIER_SHELL;
+	case AST_FOR:
+		return true;
+	case AST_ROOT:
+	case AST_DELETED:
+		return false;
+	}
+
+	return false;
+}
+
+bool
+parser_cache_read_node(struct ParserCacheReader *r, struct AST *root, struct AST *parent, bool orelse)
+{
+	if (r->next >= r->nodes_len) {
+		return false;
+	}
+	const struct ParserCacheNode *rec = &r->nodes[r->next++];
+	unless (parser_cache_valid_subtype(rec)) {
+		return false;
+	}
+
+	struct ASTLineRange lines = { rec->line_start_a, rec->line_start_b };
+	struct Array *list1 = parser_cache_read_list(r, rec->list1, rec->list1_len);
+	struct Array *list2 = parser_cache_read_list(r, rec->list2, rec->list2_len);
+	const char *name = parser_cache_read_string(r, rec->name);
+	const char *comment = parser_cache_read_string(r, rec->comment);
+	const char *end_comment = parser_cache_read_string(r, rec->end_comment);
+	if (r->error) {
+		return false;
+	}
+
+	struct AST *node = NULL;
+	bool has_body = false;
+	switch ((enum ASTType)rec->type) {
+	case AST_COMMENT:
+		node = ast_new(root, AST_COMMENT, &lines, &(struct ASTComment){
+			.type = rec->subtype,
+			.lines = list1,
+		});
+		break;
+	case AST_EXPR:
+		node = ast_new(root, AST_EXPR, &lines, &(struct ASTExpr){
+			.type = rec->subtype,
+			.words = list1,
+			.indent = rec->indent,
+		});
+		if (comment) {
+			node->expr.comment = str_dup(node->pool, comment);
+		}
+		break;
+	case AST_FOR:
+		node = ast_new(root, AST_FOR, &lines, &(struct ASTFor){
+			.bindings = list1,
+			.words = list2,
+			.indent = rec->indent,
+		});
+		if (comment) {
+			node->forexpr.comment = str_dup(node->pool, comment);
+		}
+		if (end_comment) {
+			node->forexpr.end_comment = str_dup(node->pool, end_comment);
+		}
+		has_body = true;
+		break;
+	case AST_IF: {
+		struct AST *ifparent = NULL;
+		if (rec->flags & PARSER_CACHE_NODE_IFPARENT) {
+			unless (orelse && parent->type == AST_IF) {
+				return false;
+			}
+			ifparent = parent;
+		}
+		node = ast_new(root, AST_IF, &lines, &(struct ASTIf){
+			.type = rec->subtype,
+			.test = list1,
+			.indent = rec->indent,
+			.ifparent = ifparent,
+		});
+		if (comment) {
+			node->ifexpr.comment = str_dup(node->pool, comment);
+		}
+		if (end_comment) {
+			node->ifexpr.end_comment = str_dup(node->pool, end_comment);
+		}
+		has_body = true;
+		break;
+	} case AST_INCLUDE:
+		node = ast_new(root, AST_INCLUDE, &lines, &(struct ASTInclude){
+			.type = rec->subtype,
+			.indent = rec->indent,
+			.path = name,
+			.sys = rec->flags & PARSER_CACHE_NODE_INCLUDE_SYS,
+			.loaded = rec->flags & PARSER_CACHE_NODE_INCLUDE_LOADED,
+		});
+		if (comment) {
+			node->include.comment = str_dup(node->pool, comment);
+		}
+		has_body = true;
+		break;
+	case AST_TARGET:
+		node = ast_new(root, AST_TARGET, &lines, &(struct ASTTarget){
+			.type = rec->subtype,
+			.sources = list1,
+			.dependencies = list2,
+		});
+		if (comment) {
+			node->target.comment = str_dup(node->pool, comment);
+		}
+		has_body = true;
+		break;
+	case AST_TARGET_COMMAND:
+		node = ast_new(root, AST_TARGET_COMMAND, &lines, &(struct ASTTargetCommand){
+			.target = parent->type == AST_TARGET ? &parent->target : NULL,
+			.words = list1,
+			.flags = rec->subtype,
+		});
+		if (comment) {
+			node->targetcommand.comment = str_dup(node->pool, comment);
+		}
+		break;
+	case AST_VARIABLE:
+		if (name == NULL) {
+			return false;
+		}
+		node = ast_new(root, AST_VARIABLE, &lines, &(struct ASTVariable){
+			.name = name,
+			.modifier = rec->subtype,
+			.words = list1,
+		});
+		if (comment) {
+			node->variable.comment = str_dup(node->pool, comment);
+		}
+		break;
+	case AST_ROOT:
+	case AST_DELETED:
+		return false;
+	}
+
+	node->line_end = (struct ASTLineRange){ rec->line_end_a, rec->line_end_b };
+	node->edited = rec->flags & PARSER_CACHE_NODE_EDITED;
+	node->meta.goalcol = rec->goalcol;
+	ast_parent_append_sibling(parent, node, orelse);
+
+	unless (has_body) {
+		return rec->children == 0 && rec->orelse == 0;
+	}
+	if (rec->orelse > 0 && node->type != AST_IF) {
+		return false;
+	}
+	for (uint32_t i = 0; i < rec->children; i++) {
+		unless (parser_cache_read_node(r, root, node, false)) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < rec->orelse; i++) {
+		unless (parser_cache_read_node(r, root, node, true)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct AST *
+parser_cache_load(int dir, uint64_t key, size_t lines)
+// Returns NULL if there is no valid entry for key
+{
+	SCOPE_MEMPOOL(pool);
+
+	int fd = openat(dir, parser_cache_filename(pool, key), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct ParserCacheHeader) ||
+	    (size_t)st.st_size > PARSER_CACHE_MAX_SIZE) {
+		close(fd);
+		return NULL;
+	}
+	// The mapping is page aligned as needed by the node and ref
+	// sections.  The nodes and strings are copied into the new AST,
+	// so nothing refers to it after loading.
+	size_t len = st.st_size;
+	void *buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		return NULL;
+	}
+	struct AST *root = parser_cache_load_mapped(buf, len, key, lines);
+	munmap(buf, len);
+	return root;
+}
+
+struct AST *
+parser_cache_load_mapped(const char *buf, size_t len, uint64_t key, size_t lines)
+{
+	SCOPE_MEMPOOL(pool);
+
+	const struct ParserCacheHeader *header = (const struct ParserCacheHeader *)buf;
+	if (memcmp(header->magic, PARSER_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != PARSER_CACHE_VERSION ||
+	    header->byteorder != PARSER_CACHE_BYTEORDER ||
+	    header->key != key || header->lines != lines) {
+		return NULL;
+	}
+	size_t avail = len - sizeof(struct ParserCacheHeader);
+	if (header->nodes > avail / sizeof(struct ParserCacheNode)) {
+		return NULL;
+	}
+	avail -= header->nodes * sizeof(struct ParserCacheNode);
+	if (header->refs > avail / sizeof(uint64_t)) {
+		return NULL;
+	}
+	avail -= header->refs * sizeof(uint64_t);
+	if (header->strings_len != avail ||
+	    (header->strings_len > 0 && ((const char *)buf)[len - 1] != 0)) {
+		return NULL;
+	}
+
+	const char *p = (const char *)buf + sizeof(struct ParserCacheHeader);
+	struct ParserCacheReader r = {
+		.pool = pool,
+		.nodes = (const struct ParserCacheNode *)p,
+		.nodes_len = header->nodes,
+	};
+	p += header->nodes * sizeof(struct ParserCacheNode);
+	r.refs = (const uint64_t *)p;
+	r.refs_len = header->refs;
+	p += header->refs * sizeof(uint64_t);
+	r.strings = p;
+	r.strings_len = header->strings_len;
+
+	if (r.nodes_len == 0 || r.nodes[0].type != AST_ROOT) {
+		return NULL;
+	}
+	r.next = 1;
+	struct AST *root = ast_new(NULL, AST_ROOT, NULL, NULL);
+	for (uint32_t i = 0; i < r.nodes[0].children; i++) {
+		unless (parser_cache_read_node(&r, root, root, false)) {
+			ast_free(root);
+			return NULL;
+		}
+	}
+	if (r.next != r.nodes_len) {
+		ast_free(root);
+		return NULL;
+	}
+
+	return root;
+}
+
+uint64_t
+parser_cache_write_string(struct ParserCacheWriter *w, const char *s)
+{
+	if (s == NULL) {
+		return 0;
+	}
+	size_t len = strlen(s) + 1;
+	fwrite(s, 1, len, w->strings);
+	uint64_t ref = w->strings_len + 1;
+	w->strings_len += len;
+	return ref;
+}
+
+uint64_t
+parser_cache_write_list(struct ParserCacheWriter *w, struct Array *list, uint32_t *len)
+{
+	uint64_t start = w->refs_len;
+	*len = 0;
+	if (list) {
+		ARRAY_FOREACH(list, const char *, s) {
+			uint64_t ref = parser_cache_write_string(w, s);
+			fwrite(&ref, sizeof(ref), 1, w->refs);
+			w->refs_len++;
+			(*len)++;
+		}
+	}
+	return start;
+}
+
+uint64_t
+parser_cache_write_body(struct ParserCacheWriter *w, struct Array *body)
+{
+	uint64_t children = 0;
+	ARRAY_FOREACH(body, struct AST *, child) {
+		if (child->type != AST_DELETED) {
+			parser_cache_write_node(w, child);
+			children++;
+		}
+	}
+	return children;
+}
+
+void
+parser_cache_write_node(struct ParserCacheWriter *w, struct AST *node)
+{
+	struct ParserCacheNode *rec = mempool_alloc(w->pool, sizeof(struct ParserCacheNode));
+	array_append(w->nodes, rec);
+	rec->type = node->type;
+	rec->goalcol = node->meta.goalcol;
+	rec->line_start_a = node->line_start.a;
+	rec->line_start_b = node->line_start.b;
+	rec->line_end_a = node->line_end.a;
+	rec->line_end_b = node->line_end.b;
+	if (node->edited) {
+		rec->flags |= PARSER_CACHE_NODE_EDITED;
+	}
+
+	switch (node->type) {
+	case AST_ROOT:
+		rec->children = parser_cache_write_body(w, node->root.body);
+		break;
+	case AST_DELETED:
+		panic("cannot write deleted node");
+		break;
+	case AST_COMMENT:
+		rec->subtype = node->comment.type;
+		rec->list1 = parser_cache_write_list(w, node->comment.lines, &rec->list1_len);
+		break;
+	case AST_EXPR:
+		rec->subtype = node->expr.type;
+		rec->indent = node->expr.indent;
+		rec->list1 = parser_cache_write_list(w, node->expr.words, &rec->list1_len);
+		rec->comment = parser_cache_write_string(w, node->expr.comment);
+		break;
+	case AST_FOR:
+		rec->indent = node->forexpr.indent;
+		rec->list1 = parser_cache_write_list(w, node->forexpr.bindings, &rec->list1_len);
+		rec->list2 = parser_cache_write_list(w, node->forexpr.words, &rec->list2_len);
+		rec->comment = parser_cache_write_string(w, node->forexpr.comment);
+		rec->end_comment = parser_cache_write_string(w, node->forexpr.end_comment);
+		rec->children = parser_cache_write_body(w, node->forexpr.body);
+		break;
+	case AST_IF:
+		rec->subtype = node->ifexpr.type;
+		rec->indent = node->ifexpr.indent;
+		if (node->ifexpr.ifparent) {
+			rec->flags |= PARSER_CACHE_NODE_IFPARENT;
+		}
+		rec->list1 = parser_cache_write_list(w, node->ifexpr.test, &rec->list1_len);
+		rec->comment = parser_cache_write_string(w, node->ifexpr.comment);
+		rec->end_comment = parser_cache_write_string(w, node->ifexpr.end_comment);
+		rec->children = parser_cache_write_body(w, node->ifexpr.body);
+		rec->orelse = parser_cache_write_body(w, node->ifexpr.orelse);
+		break;
+	case AST_INCLUDE:
+		rec->subtype = node->include.type;
+		rec->indent = node->include.indent;
+		if (node->include.sys) {
+			rec->flags |= PARSER_CACHE_NODE_INCLUDE_SYS;
+		}
+		if (node->include.loaded) {
+			rec->flags |= PARSER_CACHE_NODE_INCLUDE_LOADED;
+		}
+		rec->name = parser_cache_write_string(w, node->include.path);
+		rec->comment = parser_cache_write_string(w, node->include.comment);
+		rec->children = parser_cache_write_body(w, node->include.body);
+		break;
+	case AST_TARGET:
+		rec->subtype = node->target.type;
+		rec->list1 = parser_cache_write_list(w, node->target.sources, &rec->list1_len);
+		rec->list2 = parser_cache_write_list(w, node->target.dependencies, &rec->list2_len);
+		rec->comment = parser_cache_write_string(w, node->target.comment);
+		rec->children = parser_cache_write_body(w, node->target.body);
+		break;
+	case AST_TARGET_COMMAND:
+		rec->subtype = node->targetcommand.flags;
+		rec->list1 = parser_cache_write_list(w, node->targetcommand.words, &rec->list1_len);
+		rec->comment = parser_cache_write_string(w, node->targetcommand.comment);
+		break;
+	case AST_VARIABLE:
+		rec->subtype = node->variable.modifier;
+		rec->name = parser_cache_write_string(w, node->variable.name);
+		rec->list1 = parser_cache_write_list(w, node->variable.words, &rec->list1_len);
+		rec->comment = parser_cache_write_string(w, node->variable.comment);
+		break;
+	}
+}
+
+void
+parser_cache_store(int dir, uint64_t key, size_t lines, struct AST *root)
+// Failing to write the cache is not an error; the next run just has
+// to parse the file again.
+{
+	SCOPE_MEMPOOL(pool);
+
+	char *refs_buf = NULL;
+	size_t refs_size = 0;
+	char *strings_buf = NULL;
+	size_t strings_size = 0;
+	struct ParserCacheWriter w = {
+		.pool = pool,
+		.nodes = mempool_array(pool),
+		.refs = open_memstream(&refs_buf, &refs_size),
+		.strings = open_memstream(&strings_buf, &strings_size),
+	};
+	unless (w.refs && w.strings) {
+		if (w.refs) {
+			fclose(w.refs);
+			free(refs_buf);
+		}
+		if (w.strings) {
+			fclose(w.strings);
+			free(strings_buf);
+		}
+		return;
+	}
+	parser_cache_write_node(&w, root);
+	fclose(w.refs);
+	mempool_add(pool, refs_buf, free);
+	fclose(w.strings);
+	mempool_add(pool, strings_buf, free);
+
+	struct ParserCacheHeader header = {
+		.version = PARSER_CACHE_VERSION,
+		.byteorder = PARSER_CACHE_BYTEORDER,
+		.key = key,
+		.lines = lines,
+		.nodes = array_len(w.nodes),
+		.refs = w.refs_len,
+		.strings_len = w.strings_len,
+	};
+	memcpy(header.magic, PARSER_CACHE_MAGIC, sizeof(header.magic));
+
+	// Write to a temporary file first so that concurrent readers
+	// never see a partial entry.
+	const char *filename = parser_cache_filename(pool, key);
+	const char *tmp = str_printf(pool, ".%s.%ld", filename, (long)getpid());
+	int fd = openat(dir, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return;
+	}
+	FILE *f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlinkat(dir, tmp, 0);
+		return;
+	}
+	fwrite(&header, sizeof(header), 1, f);
+	ARRAY_FOREACH(w.nodes, struct ParserCacheNode *, rec) {
+		fwrite(rec, sizeof(*rec), 1, f);
+	}
+	fwrite(refs_buf, 1, refs_size, f);
+	fwrite(strings_buf, 1, strings_size, f);
+	bool failed = ferror(f);
+	if (fclose(f) != 0 || failed || renameat(dir, tmp, dir, filename) < 0) {
+		unlinkat(dir, tmp, 0);
+	}
+}
@@ -0,0 +1,87 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <libias/flow.h>
+
+#include "ast.h"
+#include "parser.h"
+#include "parser/edits.h"
+
+const struct ParserEdits parser_edits[] = {
+	{ "edit.bump-revision", edit_bump_revision, false },
+	{ "edit.merge", edit_merge, false },
+	{ "edit.set-version", edit_set_version, false },
+	{ "kakoune.select-object-on-line", kakoune_select_object_on_line, true },
+	{ "lint.bsd-port", lint_bsd_port, true },
+	{ "lint.clones", lint_clones, true },
+	{ "lint.commented-portrevision", lint_commented_portrevision, true },
+	{ "lint.order", lint_order, true },
+	{ "output.conditional-token", output_conditional_token, true },
+	{ "output.target-command-token", output_target_command_token, true },
+	{ "output.unknown-targets", output_unknown_targets, true },
+	{ "output.unknown-variables", output_unknown_variables, true },
+	{ "output.variable-value", output_variable_value, true },
+	{ "refactor.collapse-adjacent-variables", refactor_collapse_adjacent_variables, false },
+	{ "refactor.dedup-tokens", refactor_dedup_tokens, false },
+	{ "refactor.remove-consecutive-empty-lines", refactor_remove_consecutive_empty_lines, false },
+	{ "refactor.sanitize-append-modifier", refactor_sanitize_append_modifier, false },
+	{ "refactor.sanitize-cmake-args", refactor_sanitize_cmake_args, false },
+	{ "refactor.sanitize-comments", refactor_sanitize_comments, false },
+	{ "refactor.sanitize-eol-comments", refactor_sanitize_eol_comments, false },
+};
+const size_t parser_edits_len = nitems(parser_edits);
+
+ParserEditFn
+parser_edits_lookup(const char *name)
+{
+	for (size_t i = 0; i < parser_edits_len; i++) {
+		if (strcasecmp(parser_edits[i].name, name) == 0) {
+			return parser_edits[i].fn;
+		}
+	}
+	return NULL;
+}
+
+bool
+parser_edits_read_only(ParserEditFn fn)
+{
+	for (size_t i = 0; i < parser_edits_len; i++) {
+		if (parser_edits[i].fn == fn) {
+			return parser_edits[i].read_only;
+		}
+	}
+	return false;
+}
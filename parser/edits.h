@@ -49,6 +49,19 @@ struct ParserEditOutput {
 	bool found;
 };
 
+struct ParserEdits {
+	const char *name;
+	ParserEditFn fn;
+	// The edit only inspects the AST and never modifies it
+	bool read_only;
+};
+
+extern const struct ParserEdits parser_edits[];
+extern const size_t parser_edits_len;
+
+ParserEditFn parser_edits_lookup(const char *);
+bool parser_edits_read_only(ParserEditFn);
+
 PARSER_EDIT(edit_bump_revision);
 PARSER_EDIT(edit_merge);
 PARSER_EDIT(edit_set_version);
@@ -46,13 +46,14 @@
 #include "parser/edits.h"
 
 struct ShouldDeleteVariableWalkerData {
+	const char *variable;
 	struct AST *previous;
 	bool delete_variable;
 };
 
 // Prototypes
 static bool is_empty_line(const char *);
-static enum ASTWalkState should_delete_variable_walker(struct AST *, const char *, struct ShouldDeleteVariableWalkerData *);
+static enum ASTWalkState should_delete_variable_walker(struct AST *, void *);
 static char *get_merge_script(struct Mempool *, struct Parser *, struct AST *, const char *);
 
 bool
@@ -67,11 +68,12 @@ is_empty_line(const char *s)
 }
 
 enum ASTWalkState
-should_delete_variable_walker(struct AST *node, const char *variable, struct ShouldDeleteVariableWalkerData *this)
+should_delete_variable_walker(struct AST *node, void *userdata)
 {
+	struct ShouldDeleteVariableWalkerData *this = userdata;
 	switch (node->type) {
 	case AST_VARIABLE:
-		if (strcmp(node->variable.name, variable) == 0) {
+		if (strcmp(node->variable.name, this->variable) == 0) {
 			if (this->previous && this->previous->type == AST_COMMENT) {
 				this->delete_variable = true;
 				ARRAY_FOREACH(this->previous->comment.lines, const char *, line) {
@@ -88,7 +90,6 @@ should_delete_variable_walker(struct AST *node, const char *variable, struct Sho
 		break;
 	}
 	this->previous = node;
-	AST_WALK_DEFAULT(should_delete_variable_walker, node, variable, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -128,8 +129,15 @@ get_merge_script(struct Mempool *extpool, struct Parser *parser, struct AST *roo
 			// block we do not delete it either since the comment
 			// is probably about the variable and it is natural
 			// to have the comment above the variable.
-			struct ShouldDeleteVariableWalkerData this = { NULL, true };
-			should_delete_variable_walker(root, variable, &this);
+			struct ShouldDeleteVariableWalkerData this = {
+				.variable = variable,
+				.previous = NULL,
+				.delete_variable = true,
+			};
+			ast_walk(root, &(struct ASTWalker){
+				.pre = should_delete_variable_walker,
+				.userdata = &this,
+			});
 
 			// Otherwise we can safely remove it.
 			if (this.delete_variable) {
@@ -54,6 +54,13 @@ struct WalkerData {
 	struct Parser *parser;
 	struct AST *root;
 	enum ParserMergeBehavior merge_behavior;
+	uint32_t level;
+};
+
+struct FindVariableWalkerData {
+	const char *var;
+	uint32_t level;
+	struct AST *retval;
 };
 
 struct VariableMergeParameter {
@@ -67,18 +74,22 @@ struct VariableMergeParameter {
 static struct AST *empty_line(struct AST *);
 static bool insert_empty_line_before_block(enum BlockType, enum BlockType);
 static void prepend_variable(struct Parser *, struct AST *, struct AST *, enum BlockType);
-static enum ASTWalkState delete_variable(struct AST *, struct Parser *, const char *);
+static enum ASTWalkState delete_variable_walker(struct AST *, void *);
+static void delete_variable(struct AST *, const char *);
 static ssize_t find_insert_point_generic(struct Parser *, struct AST *, const char *, enum BlockType *);
 static ssize_t find_insert_point_same_block(struct Parser *, struct AST *, const char *, enum BlockType *);
 static void insert_variable(struct Parser *, struct AST *, struct AST *);
-static enum ASTWalkState find_variable_helper(struct AST *, const char *, uint32_t, struct AST **);
+static bool is_container(struct AST *);
+static enum ASTWalkState find_variable_walker(struct AST *, void *);
+static enum ASTWalkState find_variable_leave(struct AST *, void *);
 static struct AST *find_variable(struct AST *, const char *, uint32_t);
-static enum ASTWalkState edit_merge_walker(struct AST *, struct WalkerData *, uint32_t);
+static enum ASTWalkState edit_merge_walker(struct AST *, void *);
+static enum ASTWalkState edit_merge_leave(struct AST *, void *);
 
 struct AST *
 empty_line(struct AST *parent)
 {
-	struct AST *node = ast_new(parent->pool, AST_COMMENT, &parent->line_start, &(struct ASTComment){
+	struct AST *node = ast_new(parent, AST_COMMENT, &parent->line_start, &(struct ASTComment){
 		.type = AST_COMMENT_LINE,
 	});
 	array_append(node->comment.lines, str_dup(node->pool, ""));
@@ -148,8 +159,9 @@ prepend_variable(struct Parser *parser, struct AST *root, struct AST *node, enum
 }
 
 enum ASTWalkState
-delete_variable(struct AST *node, struct Parser *parser, const char *var)
+delete_variable_walker(struct AST *node, void *userdata)
 {
+	const char *var = userdata;
 	switch (node->type) {
 	case AST_INCLUDE:
 		if (is_include_bsd_port_mk(node)) {
@@ -158,17 +170,26 @@ delete_variable(struct AST *node, struct Parser *parser, const char *var)
 		break;
 	case AST_VARIABLE:
 		if (strcmp(var, node->variable.name) == 0) {
-			node->type = AST_DELETED;
+			ast_delete(node);
 		}
 		break;
 	default:
 		break;
 	}
 
-	AST_WALK_DEFAULT(delete_variable, node, parser, var);
 	return AST_WALK_CONTINUE;
 }
 
+void
+delete_variable(struct AST *root, const char *var)
+{
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_INCLUDE) | AST_WALK_TYPE(AST_VARIABLE),
+		.pre = delete_variable_walker,
+		.userdata = (void *)var,
+	});
+}
+
 ssize_t
 find_insert_point_generic(struct Parser *parser, struct AST *root, const char *var, enum BlockType *block_before_var)
 {
@@ -261,7 +282,7 @@ insert_variable(struct Parser *parser, struct AST *root, struct AST *template)
 {
 	SCOPE_MEMPOOL(pool);
 
-	struct AST *node = ast_clone(root->pool, template);
+	struct AST *node = ast_clone(root, template);
 	node->edited = true;
 
 	enum BlockType block_var = variable_order_block(parser, node->variable.name, NULL, NULL);
@@ -324,10 +345,26 @@ insert_variable(struct Parser *parser, struct AST *root, struct AST *template)
 	ast_parent_append_sibling(root, node, false);
 }
 
+bool
+is_container(struct AST *node)
+{
+	switch (node->type) {
+	case AST_ROOT:
+	case AST_FOR:
+	case AST_IF:
+	case AST_INCLUDE:
+	case AST_TARGET:
+		return true;
+	default:
+		return false;
+	}
+}
+
 enum ASTWalkState
-find_variable_helper(struct AST *node, const char *var, uint32_t level, struct AST **retval)
+find_variable_walker(struct AST *node, void *userdata)
 {
-	if (level > 1) {
+	struct FindVariableWalkerData *this = userdata;
+	if (this->level > 1) {
 		return AST_WALK_STOP;
 	}
 
@@ -337,33 +374,51 @@ find_variable_helper(struct AST *node, const char *var, uint32_t level, struct A
 	case AST_IF:
 	case AST_INCLUDE:
 	case AST_TARGET:
-		level++;
+		this->level++;
 		break;
 	case AST_VARIABLE:
-		if (strcmp(node->variable.name, var) == 0) {
-			*retval = node;
+		if (strcmp(node->variable.name, this->var) == 0) {
+			this->retval = node;
 			return AST_WALK_STOP;
 		}
 		break;
 	default:
 		break;
 	}
-	AST_WALK_DEFAULT(find_variable_helper, node, var, level, retval);
+	return AST_WALK_CONTINUE;
+}
+
+enum ASTWalkState
+find_variable_leave(struct AST *node, void *userdata)
+{
+	struct FindVariableWalkerData *this = userdata;
+	if (is_container(node)) {
+		this->level--;
+	}
 	return AST_WALK_CONTINUE;
 }
 
 struct AST *
 find_variable(struct AST *root, const char *var, uint32_t level)
 {
-	struct AST *node = NULL;
-	find_variable_helper(root, var, level, &node);
-	return node;
+	struct FindVariableWalkerData this = {
+		.var = var,
+		.level = level,
+		.retval = NULL,
+	};
+	ast_walk(root, &(struct ASTWalker){
+		.pre = find_variable_walker,
+		.post = find_variable_leave,
+		.userdata = &this,
+	});
+	return this.retval;
 }
 
 enum ASTWalkState
-edit_merge_walker(struct AST *node, struct WalkerData *this, uint32_t level)
+edit_merge_walker(struct AST *node, void *userdata)
 {
-	if (level > 1) {
+	struct WalkerData *this = userdata;
+	if (this->level > 1) {
 		return AST_WALK_STOP;
 	}
 
@@ -373,13 +428,13 @@ edit_merge_walker(struct AST *node, struct WalkerData *this, uint32_t level)
 	case AST_IF:
 	case AST_INCLUDE:
 	case AST_TARGET:
-		level++;
+		this->level++;
 		break;
 	case AST_VARIABLE: {
 		struct AST *mergenode = NULL;
 		if (node->variable.modifier == AST_VARIABLE_MODIFIER_SHELL &&
 		    (this->merge_behavior & PARSER_MERGE_SHELL_IS_DELETE)) {
-			delete_variable(this->root, this->parser, node->variable.name);
+			delete_variable(this->root, node->variable.name);
 			return AST_WALK_CONTINUE;
 		} else if ((mergenode = find_variable(this->root, node->variable.name, 0))) {
 			switch (node->variable.modifier) {
@@ -431,7 +486,16 @@ edit_merge_walker(struct AST *node, struct WalkerData *this, uint32_t level)
 		break;
 	}
 
-	AST_WALK_DEFAULT(edit_merge_walker, node, this, level);
+	return AST_WALK_CONTINUE;
+}
+
+enum ASTWalkState
+edit_merge_leave(struct AST *node, void *userdata)
+{
+	struct WalkerData *this = userdata;
+	if (is_container(node)) {
+		this->level--;
+	}
 	return AST_WALK_CONTINUE;
 }
 
@@ -458,11 +522,16 @@ PARSER_EDIT(edit_merge)
 	// fputs("\nbefore:\n", stderr);
 	// ast_print(root, stderr);
 
-	edit_merge_walker(mergetree, &(struct WalkerData){
-		.parser = parser,
-		.root = root,
-		.merge_behavior = params->merge_behavior,
-	}, 0);
+	ast_walk(mergetree, &(struct ASTWalker){
+		.pre = edit_merge_walker,
+		.post = edit_merge_leave,
+		.userdata = &(struct WalkerData){
+			.parser = parser,
+			.root = root,
+			.merge_behavior = params->merge_behavior,
+			.level = 0,
+		},
+	});
 
 	// fputs("\nafter:\n", stderr);
 	// ast_print(root, stderr);
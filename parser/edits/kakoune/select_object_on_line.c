@@ -44,14 +44,8 @@
 #include "parser.h"
 #include "parser/edits.h"
 
-struct WalkerData {
-	size_t kak_cursor_line;
-	struct ASTLineRange *range;
-};
-
 // Prototypes
 static void kak_error(struct Parser *, const char *);
-static enum ASTWalkState kakoune_select_object_on_line_walker(struct AST *, struct WalkerData *);
 
 void
 kak_error(struct Parser *parser, const char *errstr)
@@ -62,19 +56,6 @@ kak_error(struct Parser *parser, const char *errstr)
 	parser_set_error(parser, PARSER_ERROR_INVALID_ARGUMENT, errstr);
 }
 
-enum ASTWalkState
-kakoune_select_object_on_line_walker(struct AST *node, struct WalkerData *this)
-{
-	AST_WALK_DEFAULT(kakoune_select_object_on_line_walker, node, this);
-
-	if (this->kak_cursor_line >= node->line_start.a && this->kak_cursor_line < node->line_start.b) {
-		this->range = &node->line_start;
-		return AST_WALK_STOP;
-	} else {
-		return AST_WALK_CONTINUE;
-	}
-}
-
 
 PARSER_EDIT(kakoune_select_object_on_line)
 {
@@ -85,18 +66,20 @@ PARSER_EDIT(kakoune_select_object_on_line)
 		return;
 	}
 
-	const char *kak_cursor_line_buf = getenv("kak_cursor_line");
+	// The cursor line can be passed in via userdata, otherwise it
+	// comes from Kakoune's environment
+	const char *kak_cursor_line_buf = userdata;
+	if (!kak_cursor_line_buf) {
+		kak_cursor_line_buf = getenv("kak_cursor_line");
+	}
 	if (!kak_cursor_line_buf) {
 		kak_error(parser, "could not find kak_cursor_line");
 		return;
 	}
 
 	const char *errstr;
-	struct WalkerData this = {
-		.range = NULL,
-		.kak_cursor_line = strtonum(kak_cursor_line_buf, 1, INT_MAX, &errstr),
-	};
-	if (this.kak_cursor_line == 0) {
+	size_t kak_cursor_line = strtonum(kak_cursor_line_buf, 1, INT_MAX, &errstr);
+	if (kak_cursor_line == 0) {
 		const char *error_msg;
 		if (errstr) {
 			error_msg = str_printf(pool, "could not parse kak_cursor_line: %s", errstr);
@@ -107,8 +90,10 @@ PARSER_EDIT(kakoune_select_object_on_line)
 		return;
 	}
 
-	if (AST_WALK_STOP == kakoune_select_object_on_line_walker(root, &this)) {
-		parser_enqueue_output(parser, str_printf(pool, "select %zu.1,%zu.10000000\n", this.range->a, this.range->b - 1));
+	struct ASTLineRange *range = NULL;
+	struct AST *node = parser_lookup_line(parser, kak_cursor_line, &range);
+	if (node && range == &node->line_start) {
+		parser_enqueue_output(parser, str_printf(pool, "select %zu.1,%zu.10000000\n", range->a, range->b - 1));
 	} else {
 		kak_error(parser, "no selectable object found on this line");
 	}
@@ -47,11 +47,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState lint_bsd_port_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState lint_bsd_port_walker(struct AST *, void *);
 
 enum ASTWalkState
-lint_bsd_port_walker(struct AST *node, struct WalkerData *this)
+lint_bsd_port_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_INCLUDE:
 		if (is_include_bsd_port_mk(node)) {
@@ -63,7 +64,6 @@ lint_bsd_port_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(lint_bsd_port_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -76,7 +76,11 @@ PARSER_EDIT(lint_bsd_port)
 	struct WalkerData this = {
 		.found = false,
 	};
-	lint_bsd_port_walker(root, &this);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_INCLUDE),
+		.pre = lint_bsd_port_walker,
+		.userdata = &this,
+	});
 
 	unless (this.found) {
 		parser_set_error(parser, PARSER_ERROR_EDIT_FAILED, "not a FreeBSD Ports Makefile");
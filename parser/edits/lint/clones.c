@@ -39,6 +39,7 @@
 #include <libias/mempool.h>
 #include <libias/set.h>
 #include <libias/str.h>
+#include <libias/trait/compare.h>
 
 #include "ast.h"
 #include "parser.h"
@@ -49,11 +50,13 @@ struct WalkerData {
 	struct Set *seen_in_cond;
 	struct Set *clones;
 	struct Mempool *clones_pool;
+	uint32_t in_conditional;
 };
 
 // Prototypes
 static void add_clones(struct WalkerData *);
-static enum ASTWalkState lint_clones_walker(struct AST *, struct WalkerData *, uint32_t);
+static enum ASTWalkState lint_clones_walker(struct AST *, void *);
+static enum ASTWalkState lint_clones_leave(struct AST *, void *);
 
 void
 add_clones(struct WalkerData *this)
@@ -67,17 +70,18 @@ add_clones(struct WalkerData *this)
 }
 
 enum ASTWalkState
-lint_clones_walker(struct AST *node, struct WalkerData *this, uint32_t in_conditional)
+lint_clones_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_FOR:
 	case AST_IF:
 	case AST_INCLUDE:
-		in_conditional++;
+		this->in_conditional++;
 		break;
 	case AST_VARIABLE:
 		if (node->variable.modifier == AST_VARIABLE_MODIFIER_ASSIGN) {
-			if (in_conditional > 0) {
+			if (this->in_conditional > 0) {
 				set_add(this->seen_in_cond, node->variable.name);
 			} else if (set_contains(this->seen, node->variable.name)) {
 				if (!set_contains(this->clones, node->variable.name)) {
@@ -92,10 +96,24 @@ lint_clones_walker(struct AST *node, struct WalkerData *this, uint32_t in_condit
 		break;
 	}
 
-	AST_WALK_DEFAULT(lint_clones_walker, node, this, in_conditional);
+	return AST_WALK_CONTINUE;
+}
 
-	if (in_conditional == 0) {
-		add_clones(this);
+enum ASTWalkState
+lint_clones_leave(struct AST *node, void *userdata)
+{
+	struct WalkerData *this = userdata;
+	switch (node->type) {
+	case AST_FOR:
+	case AST_IF:
+	case AST_INCLUDE:
+		this->in_conditional--;
+		break;
+	default:
+		if (this->in_conditional == 0) {
+			add_clones(this);
+		}
+		break;
 	}
 
 	return AST_WALK_CONTINUE;
@@ -110,12 +128,16 @@ PARSER_EDIT(lint_clones)
 
 	struct Mempool *clones_pool = mempool_pool(extpool);
 	struct WalkerData this = {
-		.seen = mempool_set(pool, str_compare),
-		.seen_in_cond = mempool_set(pool, str_compare),
+		.seen = mempool_set(pool, id_compare),
+		.seen_in_cond = mempool_set(pool, id_compare),
 		.clones_pool = clones_pool,
 		.clones = mempool_set(clones_pool, str_compare),
 	};
-	lint_clones_walker(root, &this, 0);
+	ast_walk(root, &(struct ASTWalker){
+		.pre = lint_clones_walker,
+		.post = lint_clones_leave,
+		.userdata = &this,
+	});
 
 	if (clones_ret == NULL && set_len(this.clones) > 0) {
 		if (!no_color) {
@@ -51,15 +51,15 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState lint_commented_portrevision_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState lint_commented_portrevision_walker(struct AST *, void *);
 
 enum ASTWalkState
-lint_commented_portrevision_walker(struct AST *node, struct WalkerData *this)
+lint_commented_portrevision_walker(struct AST *node, void *userdata)
 {
-	SCOPE_MEMPOOL(pool);
-
+	struct WalkerData *this = userdata;
 	switch (node->type) {
-	case AST_COMMENT:
+	case AST_COMMENT: {
+		SCOPE_MEMPOOL(pool);
 		ARRAY_FOREACH(node->comment.lines, const char *, line) {
 			const char *comment = str_trim(pool, line);
 			if (strlen(comment) <= 1) {
@@ -85,11 +85,10 @@ lint_commented_portrevision_walker(struct AST *node, struct WalkerData *this)
 			}
 		}
 		break;
-	default:
+	} default:
 		break;
 	}
 
-	AST_WALK_DEFAULT(lint_commented_portrevision_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -100,7 +99,11 @@ PARSER_EDIT(lint_commented_portrevision)
 		.comments_pool = comments_pool,
 		.comments = mempool_set(comments_pool, str_compare),
 	};
-	lint_commented_portrevision_walker(root, &this);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_COMMENT),
+		.pre = lint_commented_portrevision_walker,
+		.userdata = &this,
+	});
 
 	struct Set **retval = userdata;
 	bool no_color = parser_settings(parser).behavior & PARSER_OUTPUT_NO_COLOR;
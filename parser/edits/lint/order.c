@@ -77,13 +77,13 @@ static DECLARE_COMPARE(compare_get_all_unknown_variables_row);
 static DECLARE_COMPARE(compare_row);
 static void row_free(struct Row *);
 static void row(struct Mempool *, struct Array *, const char *, const char *);
-static enum ASTWalkState get_variables(struct AST *, struct GetVariablesWalkerData *);
+static enum ASTWalkState get_variables(struct AST *, void *);
 static void get_all_unknown_variables_helper(struct Mempool *, const char *, const char *, const char *, void *);
 static bool get_all_unknown_variables_filter(struct Parser *, const char *, void *);
 static struct Set *get_all_unknown_variables(struct Mempool *, struct Parser *);
 static char *get_hint(struct Mempool *, struct Parser *, const char *, enum BlockType, struct Set *);
 static struct Array *variable_list(struct Mempool *, struct Parser *, struct AST *);
-static enum ASTWalkState target_list(struct AST *, struct TargetListWalkData *);
+static enum ASTWalkState target_list(struct AST *, void *);
 static enum OutputDiffResult check_variable_order(struct Parser *, struct AST *, bool);
 static enum OutputDiffResult check_target_order(struct Parser *, struct AST *, bool, enum OutputDiffResult);
 static void output_row(struct Parser *, struct Row *, size_t);
@@ -127,13 +127,14 @@ DEFINE_COMPARE(compare_row, struct Row, void)
 }
 
 enum ASTWalkState
-get_variables(struct AST *node, struct GetVariablesWalkerData *this)
+get_variables(struct AST *node, void *userdata)
 {
+	struct GetVariablesWalkerData *this = userdata;
 	switch (node->type) {
 	case AST_IF:
 		if (node->ifexpr.type == AST_IF_NMAKE && array_len(node->ifexpr.test) == 1) {
 			if (strcmp(array_get(node->ifexpr.test, 0), "portclippy") == 0) {
-				return AST_WALK_CONTINUE;
+				return AST_WALK_SKIP;
 			}
 		} else if (node->ifexpr.type == AST_IF_IF && array_len(node->ifexpr.test) == 3) {
 			const char *word0 = array_get(node->ifexpr.test, 0);
@@ -142,9 +143,9 @@ get_variables(struct AST *node, struct GetVariablesWalkerData *this)
 			if (strcmp(word0, "defined(") == 0 &&
 			    (strcmp(word1, "DEVELOPER") == 0 || strcmp(word1, "MAINTAINER_MODE") == 0) &&
 			    strcmp(word2, ")") == 0) {
-				return AST_WALK_CONTINUE;
+				return AST_WALK_SKIP;
 			} else if (strcmp(word0, "make(") == 0 && strcmp(word1, "makesum") == 0 && strcmp(word2, ")") == 0) {
-				return AST_WALK_CONTINUE;
+				return AST_WALK_SKIP;
 			}
 		}
 		break;
@@ -153,7 +154,7 @@ get_variables(struct AST *node, struct GetVariablesWalkerData *this)
 			return AST_WALK_STOP;
 		} else {
 			// XXX: Should we recurse down into includes?
-			return AST_WALK_CONTINUE;
+			return AST_WALK_SKIP;
 		}
 		break;
 	case AST_VARIABLE:
@@ -172,7 +173,6 @@ get_variables(struct AST *node, struct GetVariablesWalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(get_variables, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -249,9 +249,12 @@ variable_list(struct Mempool *pool, struct Parser *parser, struct AST *root)
 {
 	struct Array *output = mempool_array(pool);
 	struct Array *vars = mempool_array(pool);
-	get_variables(root, &(struct GetVariablesWalkerData){
-		.parser = parser,
-		.vars = vars,
+	ast_walk(root, &(struct ASTWalker){
+		.pre = get_variables,
+		.userdata = &(struct GetVariablesWalkerData){
+			.parser = parser,
+			.vars = vars,
+		},
 	});
 
 	enum BlockType block = BLOCK_UNKNOWN;
@@ -276,13 +279,14 @@ variable_list(struct Mempool *pool, struct Parser *parser, struct AST *root)
 }
 
 enum ASTWalkState
-target_list(struct AST *node, struct TargetListWalkData *this)
+target_list(struct AST *node, void *userdata)
 {
+	struct TargetListWalkData *this = userdata;
 	switch (node->type) {
 	case AST_IF:
 		if (node->ifexpr.type == AST_IF_NMAKE && array_len(node->ifexpr.test) == 1) {
 			if (strcmp(array_get(node->ifexpr.test, 0), "portclippy") == 0) {
-				return AST_WALK_CONTINUE;
+				return AST_WALK_SKIP;
 			}
 		} else if (node->ifexpr.type == AST_IF_IF && array_len(node->ifexpr.test) == 3) {
 			const char *word0 = array_get(node->ifexpr.test, 0);
@@ -291,9 +295,9 @@ target_list(struct AST *node, struct TargetListWalkData *this)
 			if (strcmp(word0, "defined(") == 0 &&
 			    (strcmp(word1, "DEVELOPER") == 0 || strcmp(word1, "MAINTAINER_MODE") == 0) &&
 			    strcmp(word2, ")") == 0) {
-				return AST_WALK_CONTINUE;
+				return AST_WALK_SKIP;
 			} else if (strcmp(word0, "make(") == 0 && strcmp(word1, "makesum") == 0 && strcmp(word2, ")") == 0) {
-				return AST_WALK_CONTINUE;
+				return AST_WALK_SKIP;
 			}
 		}
 		break;
@@ -302,7 +306,7 @@ target_list(struct AST *node, struct TargetListWalkData *this)
 			return AST_WALK_STOP;
 		} else {
 			// XXX: Should we recurse down into includes?
-			return AST_WALK_CONTINUE;
+			return AST_WALK_SKIP;
 		}
 		break;
 	case AST_TARGET:
@@ -317,7 +321,6 @@ target_list(struct AST *node, struct TargetListWalkData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(target_list, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -328,9 +331,12 @@ check_variable_order(struct Parser *parser, struct AST *root, bool no_color)
 	struct Array *origin = variable_list(pool, parser, root);
 
 	struct Array *vars = mempool_array(pool);
-	get_variables(root, &(struct GetVariablesWalkerData){
-		.parser = parser,
-		.vars = vars,
+	ast_walk(root, &(struct ASTWalker){
+		.pre = get_variables,
+		.userdata = &(struct GetVariablesWalkerData){
+			.parser = parser,
+			.vars = vars,
+		},
 	});
 	array_sort(vars, &(struct CompareTrait){compare_order, parser});
 
@@ -449,8 +455,11 @@ check_target_order(struct Parser *parser, struct AST *root, bool no_color, enum
 	SCOPE_MEMPOOL(pool);
 
 	struct Array *targets = mempool_array(pool);
-	target_list(root, &(struct TargetListWalkData){
-		.targets = targets,
+	ast_walk(root, &(struct ASTWalker){
+		.pre = target_list,
+		.userdata = &(struct TargetListWalkData){
+			.targets = targets,
+		},
 	});
 
 	struct Array *origin = mempool_array(pool);
@@ -50,7 +50,7 @@ struct WalkerData {
 
 // Prototypes
 static void add_word(struct WalkerData *, const char *);
-static enum ASTWalkState output_conditional_token_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState output_conditional_token_walker(struct AST *, void *);
 
 void
 add_word(struct WalkerData *this, const char *word)
@@ -64,8 +64,9 @@ add_word(struct WalkerData *this, const char *word)
 }
 
 enum ASTWalkState
-output_conditional_token_walker(struct AST *node, struct WalkerData *this)
+output_conditional_token_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_EXPR:
 		ARRAY_FOREACH(node->expr.words, const char *, word) {
@@ -139,7 +140,6 @@ output_conditional_token_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(output_conditional_token_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -152,9 +152,13 @@ PARSER_EDIT(output_conditional_token)
 	}
 
 	param->found = false;
-	output_conditional_token_walker(root, &(struct WalkerData){
-		.parser = parser,
-		.pool = extpool,
-		.param = param,
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_EXPR) | AST_WALK_TYPE(AST_FOR) | AST_WALK_TYPE(AST_IF) | AST_WALK_TYPE(AST_INCLUDE),
+		.pre = output_conditional_token_walker,
+		.userdata = &(struct WalkerData){
+			.parser = parser,
+			.pool = extpool,
+			.param = param,
+		},
 	});
 }
@@ -48,11 +48,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState output_target_command_token_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState output_target_command_token_walker(struct AST *, void *);
 
 enum ASTWalkState
-output_target_command_token_walker(struct AST *node, struct WalkerData *this)
+output_target_command_token_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_TARGET:
 		ARRAY_FOREACH(node->target.sources, const char *, src) {
@@ -77,7 +78,6 @@ output_target_command_token_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(output_target_command_token_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -90,10 +90,14 @@ PARSER_EDIT(output_target_command_token)
 	}
 
 	param->found = false;
-	output_target_command_token_walker(root, &(struct WalkerData){
-		.parser = parser,
-		.pool = extpool,
-		.param = param,
-		.target = NULL,
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_TARGET) | AST_WALK_TYPE(AST_TARGET_COMMAND),
+		.pre = output_target_command_token_walker,
+		.userdata = &(struct WalkerData){
+			.parser = parser,
+			.pool = extpool,
+			.param = param,
+			.target = NULL,
+		},
 	});
 }
@@ -55,7 +55,7 @@ struct WalkerData {
 
 // Prototypes
 static void check_target(struct WalkerData *, const char *, bool);
-static enum ASTWalkState output_unknown_targets_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState output_unknown_targets_walker(struct AST *, void *);
 
 void
 check_target(struct WalkerData *this, const char *name, bool deps)
@@ -97,8 +97,9 @@ check_target(struct WalkerData *this, const char *name, bool deps)
 }
 
 enum ASTWalkState
-output_unknown_targets_walker(struct AST *node, struct WalkerData *this) 
+output_unknown_targets_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_TARGET: {
 		bool skip_deps = false;
@@ -118,7 +119,6 @@ output_unknown_targets_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(output_unknown_targets_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -141,7 +141,11 @@ PARSER_EDIT(output_unknown_targets)
 		.deps = mempool_set(pool, str_compare),
 		.post_plist_targets = parser_metadata(parser, PARSER_METADATA_POST_PLIST_TARGETS),
 	};
-	output_unknown_targets_walker(root, &this);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_TARGET),
+		.pre = output_unknown_targets_walker,
+		.userdata = &this,
+	});
 
 	SET_FOREACH(this.targets, const char *, name) {
 		check_target(&this, name, false);
@@ -66,7 +66,7 @@ static struct UnknownVariable *var_new(struct Mempool *, const char *, const cha
 static void var_free(struct UnknownVariable *);
 static DECLARE_COMPARE(compare_var);
 static void check_opthelper(struct WalkerData *, const char *, bool, bool);
-static enum ASTWalkState output_unknown_variables_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState output_unknown_variables_walker(struct AST *, void *);
 
 // Constants
 static struct CompareTrait *var_compare = &(struct CompareTrait){
@@ -128,13 +128,8 @@ check_opthelper(struct WalkerData *this, const char *option, bool optuse, bool o
 	} else {
 		var = str_printf(pool, "%s_VARS%s", option, suffix);
 	}
-	struct Array *optvars;
-	if (!parser_lookup_variable(this->parser, var, PARSER_LOOKUP_DEFAULT, pool, &optvars, NULL)) {
-		return;
-	}
-
-	ARRAY_FOREACH(optvars, const char *, token) {
-		char *suffix = strchr(token, '+');
+	PARSER_LOOKUP_FOREACH(this->parser, var, PARSER_LOOKUP_DEFAULT, token) {
+		const char *suffix = strchr(token, '+');
 		if (!suffix) {
 			suffix = strchr(token, '=');
 			if (!suffix) {
@@ -161,8 +156,9 @@ check_opthelper(struct WalkerData *this, const char *option, bool optuse, bool o
 }
 
 enum ASTWalkState
-output_unknown_variables_walker(struct AST *node, struct WalkerData *this)
+output_unknown_variables_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_VARIABLE: {
 		const char *name = node->variable.name;
@@ -182,7 +178,6 @@ output_unknown_variables_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(output_unknown_variables_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -205,7 +200,11 @@ PARSER_EDIT(output_unknown_variables)
 		.vars_pool = pool,
 		.vars = mempool_set(pool, var_compare),
 	};
-	output_unknown_variables_walker(root, &this);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_VARIABLE),
+		.pre = output_unknown_variables_walker,
+		.userdata = &this,
+	});
 
 	struct Set *options = parser_metadata(parser, PARSER_METADATA_OPTIONS);
 	SET_FOREACH (options, const char *, option) {
@@ -47,11 +47,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState output_variable_value_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState output_variable_value_walker(struct AST *, void *);
 
 enum ASTWalkState
-output_variable_value_walker(struct AST *node, struct WalkerData *this)
+output_variable_value_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_VARIABLE:
 		if ((this->param->keyfilter == NULL || this->param->keyfilter(this->parser, node->variable.name, this->param->keyuserdata))) {
@@ -69,7 +70,6 @@ output_variable_value_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(output_variable_value_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -82,9 +82,13 @@ PARSER_EDIT(output_variable_value)
 	}
 
 	param->found = false;
-	output_variable_value_walker(root, &(struct WalkerData){
-		.parser = parser,
-		.pool = extpool,
-		.param = param,
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_VARIABLE),
+		.pre = output_variable_value_walker,
+		.userdata = &(struct WalkerData){
+			.parser = parser,
+			.pool = extpool,
+			.param = param,
+		},
 	});
 }
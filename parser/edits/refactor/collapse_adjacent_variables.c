@@ -109,6 +109,7 @@ merge_variables(struct Array *nodelist, struct Array *group)
 	}
 	array_truncate(nodelist);
 	ARRAY_JOIN(nodelist, newnodelist);
+	ast_mark_dirty(first->parent);
 }
 
 void
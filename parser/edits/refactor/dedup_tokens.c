@@ -55,13 +55,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState refactor_dedup_tokens_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState refactor_dedup_tokens_walker(struct AST *, void *);
 
 enum ASTWalkState
-refactor_dedup_tokens_walker(struct AST *node, struct WalkerData *this)
+refactor_dedup_tokens_walker(struct AST *node, void *userdata)
 {
-	SCOPE_MEMPOOL(pool);
-
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_VARIABLE:
 		if ((parser_settings(this->parser).behavior & PARSER_OUTPUT_EDITED) && !node->edited) {
@@ -69,6 +68,7 @@ refactor_dedup_tokens_walker(struct AST *node, struct WalkerData *this)
 		} else if (skip_dedup(this->parser, node->variable.name, node->variable.modifier)) {
 			return AST_WALK_CONTINUE;
 		} else {
+			SCOPE_MEMPOOL(pool);
 			struct Set *seen = mempool_set(pool, str_compare);
 			struct Set *uses = mempool_set(pool, str_compare);
 			enum DedupAction action = DEFAULT;
@@ -121,7 +121,6 @@ refactor_dedup_tokens_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(refactor_dedup_tokens_walker, node, this);
 
 	return AST_WALK_CONTINUE;
 }
@@ -133,7 +132,11 @@ PARSER_EDIT(refactor_dedup_tokens)
 		return;
 	}
 
-	refactor_dedup_tokens_walker(root, &(struct WalkerData){
-		.parser = parser,
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_VARIABLE),
+		.pre = refactor_dedup_tokens_walker,
+		.userdata = &(struct WalkerData){
+			.parser = parser,
+		},
 	});
 }
@@ -47,7 +47,7 @@ struct WalkerData {
 
 // Prototypes
 static bool is_empty_line(const char *);
-static enum ASTWalkState refactor_remove_consecutive_empty_lines_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState refactor_remove_consecutive_empty_lines_walker(struct AST *, void *);
 
 bool
 is_empty_line(const char *s)
@@ -61,14 +61,14 @@ is_empty_line(const char *s)
 }
 
 enum ASTWalkState
-refactor_remove_consecutive_empty_lines_walker(struct AST *node, struct WalkerData *this)
+refactor_remove_consecutive_empty_lines_walker(struct AST *node, void *userdata)
 {
-	SCOPE_MEMPOOL(pool);
-
+	struct WalkerData *this = userdata;
 	this->counter++;
 
 	switch (node->type) {
 	case AST_COMMENT: {
+		SCOPE_MEMPOOL(pool);
 		uint32_t empty = 0;
 		struct Array *lines = mempool_array(pool);
 		ARRAY_FOREACH(node->comment.lines, const char *, line) {
@@ -93,7 +93,6 @@ refactor_remove_consecutive_empty_lines_walker(struct AST *node, struct WalkerDa
 		break;
 	}
 
-	AST_WALK_DEFAULT(refactor_remove_consecutive_empty_lines_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -104,7 +103,13 @@ PARSER_EDIT(refactor_remove_consecutive_empty_lines)
 		return;
 	}
 
-	refactor_remove_consecutive_empty_lines_walker(root, &(struct WalkerData){
-		.counter = 0,
+	// Empty lines are only dropped completely at the start of the
+	// file.  Any node below the root that is not the first one is past
+	// it, so start counting there for other subtrees.
+	ast_walk(root, &(struct ASTWalker){
+		.pre = refactor_remove_consecutive_empty_lines_walker,
+		.userdata = &(struct WalkerData){
+			.counter = root->type == AST_ROOT ? 0 : 2,
+		},
 	});
 }
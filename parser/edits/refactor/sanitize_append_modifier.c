@@ -38,6 +38,7 @@
 #include <libias/mempool.h>
 #include <libias/set.h>
 #include <libias/str.h>
+#include <libias/trait/compare.h>
 
 #include "ast.h"
 #include "parser.h"
@@ -49,11 +50,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState refactor_sanitize_append_modifier_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState refactor_sanitize_append_modifier_walker(struct AST *, void *);
 
 enum ASTWalkState
-refactor_sanitize_append_modifier_walker(struct AST *node, struct WalkerData *this)
+refactor_sanitize_append_modifier_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_INCLUDE:
 		if (is_include_bsd_port_mk(node)) {
@@ -85,7 +87,6 @@ refactor_sanitize_append_modifier_walker(struct AST *node, struct WalkerData *th
 		break;
 	}
 
-	AST_WALK_DEFAULT(refactor_sanitize_append_modifier_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
@@ -99,7 +100,11 @@ PARSER_EDIT(refactor_sanitize_append_modifier)
 	}
 
 	/* Sanitize += before bsd.options.mk */
-	refactor_sanitize_append_modifier_walker(root, &(struct WalkerData){
-		.seen = mempool_set(pool, str_compare),
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_INCLUDE) | AST_WALK_TYPE(AST_VARIABLE),
+		.pre = refactor_sanitize_append_modifier_walker,
+		.userdata = &(struct WalkerData){
+			.seen = mempool_set(pool, id_compare),
+		},
 	});
 }
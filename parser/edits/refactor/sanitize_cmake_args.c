@@ -55,11 +55,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState refactor_sanitize_cmake_args_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState refactor_sanitize_cmake_args_walker(struct AST *, void *);
 
 enum ASTWalkState
-refactor_sanitize_cmake_args_walker(struct AST *node, struct WalkerData *this)
+refactor_sanitize_cmake_args_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_VARIABLE: {
 		SCOPE_MEMPOOL(pool);
@@ -98,8 +99,6 @@ refactor_sanitize_cmake_args_walker(struct AST *node, struct WalkerData *this)
 		break;
 	}
 
-	AST_WALK_DEFAULT(refactor_sanitize_cmake_args_walker, node, this);
-
 	return AST_WALK_CONTINUE;
 }
 
@@ -110,7 +109,11 @@ PARSER_EDIT(refactor_sanitize_cmake_args)
 		return;
 	}
 
-	refactor_sanitize_cmake_args_walker(root, &(struct WalkerData){
-		.parser = parser,
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_VARIABLE),
+		.pre = refactor_sanitize_cmake_args_walker,
+		.userdata = &(struct WalkerData){
+			.parser = parser,
+		},
 	});
 }
@@ -42,15 +42,21 @@
 #include "parser.h"
 #include "parser/edits.h"
 
+struct WalkerData {
+	uint32_t in_target;
+};
+
 // Prototypes
-static enum ASTWalkState refactor_sanitize_comments_walker(struct AST *, bool);
+static enum ASTWalkState refactor_sanitize_comments_walker(struct AST *, void *);
+static enum ASTWalkState refactor_sanitize_comments_leave(struct AST *, void *);
 
 enum ASTWalkState
-refactor_sanitize_comments_walker(struct AST *node, bool in_target)
+refactor_sanitize_comments_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_COMMENT:
-		if (in_target) {
+		if (this->in_target > 0) {
 			SCOPE_MEMPOOL(pool);
 			node->edited = true;
 			struct Array *lines = mempool_array(pool);
@@ -62,13 +68,22 @@ refactor_sanitize_comments_walker(struct AST *node, bool in_target)
 		}
 		break;
 	case AST_TARGET:
-		in_target = true;
+		this->in_target++;
 		break;
 	default:
 		break;
 	}
 
-	AST_WALK_DEFAULT(refactor_sanitize_comments_walker, node, in_target);
+	return AST_WALK_CONTINUE;
+}
+
+enum ASTWalkState
+refactor_sanitize_comments_leave(struct AST *node, void *userdata)
+{
+	struct WalkerData *this = userdata;
+	if (node->type == AST_TARGET) {
+		this->in_target--;
+	}
 	return AST_WALK_CONTINUE;
 }
 
@@ -79,5 +94,12 @@ PARSER_EDIT(refactor_sanitize_comments)
 		return;
 	}
 
-	refactor_sanitize_comments_walker(root, false);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_COMMENT) | AST_WALK_TYPE(AST_TARGET),
+		.pre = refactor_sanitize_comments_walker,
+		.post = refactor_sanitize_comments_leave,
+		.userdata = &(struct WalkerData){
+			.in_target = 0,
+		},
+	});
 }
@@ -47,7 +47,7 @@
 
 // Prototypes
 static bool preserve_eol_comment(const char *);
-static enum ASTWalkState refactor_sanitize_eol_comments_walker(struct AST *);
+static enum ASTWalkState refactor_sanitize_eol_comments_walker(struct AST *, void *);
 
 bool
 preserve_eol_comment(const char *word)
@@ -70,7 +70,7 @@ preserve_eol_comment(const char *word)
 }
 
 enum ASTWalkState
-refactor_sanitize_eol_comments_walker(struct AST *node)
+refactor_sanitize_eol_comments_walker(struct AST *node, void *userdata)
 {
 	switch (node->type) {
 	/* Try to push end of line comments out of the way above
@@ -83,7 +83,7 @@ refactor_sanitize_eol_comments_walker(struct AST *node)
 		if (preserve_eol_comment(node->variable.comment)) {
 			return AST_WALK_CONTINUE;
 		}
-		struct AST *comment = ast_new(node->pool, AST_COMMENT, &node->line_start, &(struct ASTComment){
+		struct AST *comment = ast_new(node, AST_COMMENT, &node->line_start, &(struct ASTComment){
 			.type = AST_COMMENT_LINE,
 		});
 		array_append(comment->comment.lines, node->variable.comment);
@@ -96,7 +96,6 @@ refactor_sanitize_eol_comments_walker(struct AST *node)
 		break;
 	}
 
-	AST_WALK_DEFAULT(refactor_sanitize_eol_comments_walker, node);
 	return AST_WALK_CONTINUE;
 }
 
@@ -107,5 +106,8 @@ PARSER_EDIT(refactor_sanitize_eol_comments)
 		return;
 	}
 
-	refactor_sanitize_eol_comments_walker(root);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_VARIABLE),
+		.pre = refactor_sanitize_eol_comments_walker,
+	});
 }
@@ -43,11 +43,12 @@ struct WalkerData {
 };
 
 // Prototypes
-static enum ASTWalkState %%name%%_walker(struct AST *, struct WalkerData *);
+static enum ASTWalkState %%name%%_walker(struct AST *, void *);
 
 enum ASTWalkState
-%%name%%_walker(struct AST *node, struct WalkerData *this)
+%%name%%_walker(struct AST *node, void *userdata)
 {
+	struct WalkerData *this = userdata;
 	switch (node->type) {
 	case AST_ROOT:
 	case AST_COMMENT:
@@ -62,13 +63,15 @@ enum ASTWalkState
 		break;
 	}
 
-	AST_WALK_DEFAULT(%%name%%_walker, node, this);
 	return AST_WALK_CONTINUE;
 }
 
 PARSER_EDIT(%%name%%)
 {
-	%%name%%_walker(root, &(struct WalkerData){
+	ast_walk(root, &(struct ASTWalker){
+		.pre = %%name%%_walker,
+		.userdata = &(struct WalkerData){
+		},
 	});
 
 	return 1;
@@ -45,8 +45,8 @@
 #include "ast.h"
 #include "astbuilder.h"
 #include "astbuilder/enum.h"
-#include "astbuilder/conditional.h"
 #include "parser.h"
+#include "stats.h"
 #include "tokenizer.h"
 
 struct ParserTokenizer {
@@ -71,25 +71,130 @@ struct ParserTokenizeData {
 	size_t i;
 	size_t start;
 	const char *line;
+	size_t len;
+	char *scratch;
+	bool condtokens;
 	enum ParserASTBuilderTokenType type;
 };
 
+// Character classes used by the consume_* routines instead of
+// repeated ctype(3) calls and character comparisons.
+enum ParserTokenizerCharClass {
+	// isspace(3) in the C locale
+	CHAR_SPACE = 1 << 0,
+	// Ends the name of a .-directive
+	CHAR_DIRECTIVE_END = 1 << 1,
+	// Does not start a new token after a '\'
+	CHAR_ESCAPED = 1 << 2,
+	// Valid after '$' as a one character variable name
+	CHAR_EXPANSION = 1 << 3,
+	// Might start one of the operators in parser_tokenize_conditional()
+	CHAR_CONDTOKEN = 1 << 4,
+};
+
+#define CHAR_IS(c, class) (char_class[(unsigned char)(c)] & (class))
+
+struct ParserTokenizerDirective {
+	const char *name;
+	size_t len;
+	enum ParserASTBuilderConditionalType type;
+};
+
 // Prototypes
-static size_t consume_comment(const char *);
-static size_t consume_conditional(const char *);
-static size_t consume_target(const char *);
+static bool consume_comment(const char *);
+static size_t consume_conditional(const char *, enum ParserASTBuilderConditionalType *);
+static enum ParserASTBuilderConditionalType consume_directive(const char *, size_t);
+static size_t consume_target(const char *, size_t);
 static size_t consume_token(struct ParserTokenizeData *, size_t, char, char, bool);
 static size_t consume_var(const char *);
-static bool is_empty_line(const char *);
+static void consume_expansion(struct ParserTokenizeData *);
 static const char *parser_tokenize_conditional(struct ParserTokenizeData *);
+static void parser_tokenize_emit(struct ParserTokenizeData *, size_t, size_t, bool);
 static void parser_tokenize_helper(struct ParserTokenizeData *);
-static void parser_tokenize(struct ParserTokenizer *, const char *, enum ParserASTBuilderTokenType, size_t);
+static void parser_tokenize(struct ParserTokenizer *, const char *, enum ParserASTBuilderTokenType, size_t, bool);
 static void parser_tokenizer_create_token(struct ParserTokenizer *, enum ParserASTBuilderTokenType, const char *);
 static void parser_tokenizer_read_internal(struct ParserTokenizer *);
 
+// Constants
+// The ranges like ['a' ... 'z'] are a GNU extension that all the
+// compilers we build with support.
+static const uint8_t char_class[256] = {
+	[0] = CHAR_DIRECTIVE_END,
+	['\t'] = CHAR_SPACE | CHAR_DIRECTIVE_END | CHAR_ESCAPED,
+	['\n'] = CHAR_SPACE | CHAR_DIRECTIVE_END | CHAR_ESCAPED,
+	['\v'] = CHAR_SPACE | CHAR_DIRECTIVE_END | CHAR_ESCAPED,
+	['\f'] = CHAR_SPACE | CHAR_DIRECTIVE_END | CHAR_ESCAPED,
+	['\r'] = CHAR_SPACE | CHAR_DIRECTIVE_END | CHAR_ESCAPED,
+	[' '] = CHAR_SPACE | CHAR_DIRECTIVE_END | CHAR_ESCAPED,
+	['!'] = CHAR_DIRECTIVE_END | CHAR_CONDTOKEN,
+	['"'] = CHAR_ESCAPED,
+	['#'] = CHAR_ESCAPED,
+	['$'] = CHAR_ESCAPED,
+	['&'] = CHAR_CONDTOKEN,
+	['\''] = CHAR_ESCAPED,
+	['('] = CHAR_DIRECTIVE_END | CHAR_CONDTOKEN,
+	[')'] = CHAR_EXPANSION | CHAR_CONDTOKEN,
+	['*'] = CHAR_EXPANSION,
+	['-'] = CHAR_EXPANSION,
+	['/'] = CHAR_EXPANSION,
+	['0' ... '9'] = CHAR_EXPANSION,
+	['<'] = CHAR_DIRECTIVE_END | CHAR_EXPANSION | CHAR_CONDTOKEN,
+	['='] = CHAR_CONDTOKEN,
+	['>'] = CHAR_EXPANSION | CHAR_CONDTOKEN,
+	['?'] = CHAR_EXPANSION,
+	['@'] = CHAR_EXPANSION,
+	['A' ... 'Z'] = CHAR_EXPANSION,
+	['\\'] = CHAR_ESCAPED,
+	['^'] = CHAR_EXPANSION,
+	['_'] = CHAR_EXPANSION,
+	['a' ... 'b'] = CHAR_EXPANSION,
+	['c' ... 'e'] = CHAR_EXPANSION | CHAR_CONDTOKEN,
+	['f' ... 'l'] = CHAR_EXPANSION,
+	['m'] = CHAR_EXPANSION | CHAR_CONDTOKEN,
+	['n' ... 's'] = CHAR_EXPANSION,
+	['t'] = CHAR_EXPANSION | CHAR_CONDTOKEN,
+	['u' ... 'z'] = CHAR_EXPANSION,
+	['|'] = CHAR_CONDTOKEN,
+};
+
+// Perfect hash table of .-directives.  Slots are the top 6 bits of
+// the 32-bit FNV-1a hash of the name with an offset basis of 257.
+// The offset basis was chosen so that no two names collide.
+static const uint32_t DIRECTIVE_HASH_BASIS = 257;
+static const uint32_t DIRECTIVE_HASH_PRIME = 16777619;
+static const struct ParserTokenizerDirective directives[64] = {
+	[2] = { "include", 7, PARSER_AST_BUILDER_CONDITIONAL_INCLUDE },
+	[4] = { "unexport", 8, PARSER_AST_BUILDER_CONDITIONAL_UNEXPORT },
+	[5] = { "export-env", 10, PARSER_AST_BUILDER_CONDITIONAL_EXPORT_ENV },
+	[6] = { "elifndef", 8, PARSER_AST_BUILDER_CONDITIONAL_ELIFNDEF },
+	[7] = { "export.env", 10, PARSER_AST_BUILDER_CONDITIONAL_EXPORT_ENV },
+	[9] = { "elifmake", 8, PARSER_AST_BUILDER_CONDITIONAL_ELIFMAKE },
+	[11] = { "export", 6, PARSER_AST_BUILDER_CONDITIONAL_EXPORT },
+	[16] = { "for", 3, PARSER_AST_BUILDER_CONDITIONAL_FOR },
+	[24] = { "endif", 5, PARSER_AST_BUILDER_CONDITIONAL_ENDIF },
+	[26] = { "else", 4, PARSER_AST_BUILDER_CONDITIONAL_ELSE },
+	[27] = { "elif", 4, PARSER_AST_BUILDER_CONDITIONAL_ELIF },
+	[32] = { "ifdef", 5, PARSER_AST_BUILDER_CONDITIONAL_IFDEF },
+	[35] = { "ifmake", 6, PARSER_AST_BUILDER_CONDITIONAL_IFMAKE },
+	[38] = { "if", 2, PARSER_AST_BUILDER_CONDITIONAL_IF },
+	[39] = { "elifdef", 7, PARSER_AST_BUILDER_CONDITIONAL_ELIFDEF },
+	[40] = { "unexport-env", 12, PARSER_AST_BUILDER_CONDITIONAL_UNEXPORT_ENV },
+	[41] = { "warning", 7, PARSER_AST_BUILDER_CONDITIONAL_WARNING },
+	[42] = { "ifndef", 6, PARSER_AST_BUILDER_CONDITIONAL_IFNDEF },
+	[43] = { "error", 5, PARSER_AST_BUILDER_CONDITIONAL_ERROR },
+	[44] = { "elifnmake", 9, PARSER_AST_BUILDER_CONDITIONAL_ELIFNMAKE },
+	[46] = { "undef", 5, PARSER_AST_BUILDER_CONDITIONAL_UNDEF },
+	[52] = { "export-literal", 14, PARSER_AST_BUILDER_CONDITIONAL_EXPORT_LITERAL },
+	[56] = { "sinclude", 8, PARSER_AST_BUILDER_CONDITIONAL_INCLUDE_OPTIONAL_S },
+	[58] = { "endfor", 6, PARSER_AST_BUILDER_CONDITIONAL_ENDFOR },
+	[59] = { "ifnmake", 7, PARSER_AST_BUILDER_CONDITIONAL_IFNMAKE },
+	[63] = { "info", 4, PARSER_AST_BUILDER_CONDITIONAL_INFO },
+};
+
 struct ParserTokenizer *
 parser_tokenizer_new(struct Parser *parser, const enum ParserError *error, struct ParserASTBuilder *builder)
 {
+	STATS_SCOPE(STATS_TOKENIZER);
 	struct ParserTokenizer *tokenizer = xmalloc(sizeof(struct ParserTokenizer));
 	tokenizer->parser = parser;
 	tokenizer->builder = builder;
@@ -115,93 +220,91 @@ parser_tokenizer_create_token(struct ParserTokenizer *tokenizer, enum ParserASTB
 	parser_astbuilder_append_token(tokenizer->builder, type, token);
 }
 
-size_t
+bool
 consume_comment(const char *buf)
 {
-	for (const char *bufp = buf; *bufp != 0; bufp++) {
-		if (*bufp == '#') {
-			return strlen(buf);
-		} else if (!isspace((unsigned char)*bufp)) {
-			break;
-		}
+	// Empty lines are passed on as comments too
+	for (; CHAR_IS(*buf, CHAR_SPACE); buf++);
+	return *buf == '#' || *buf == 0;
+}
+
+enum ParserASTBuilderConditionalType
+consume_directive(const char *name, size_t len)
+{
+	uint32_t h = DIRECTIVE_HASH_BASIS;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)name[i]) * DIRECTIVE_HASH_PRIME;
+	}
+
+	const struct ParserTokenizerDirective *directive = &directives[h >> 26];
+	if (directive->name && directive->len == len && memcmp(directive->name, name, len) == 0) {
+		return directive->type;
+	} else {
+		return PARSER_AST_BUILDER_CONDITIONAL_INVALID;
 	}
-	return 0;
 }
 
 size_t
-consume_conditional(const char *buf)
+consume_conditional(const char *buf, enum ParserASTBuilderConditionalType *type)
 {
-	static const char *conditionals[] = {
-		"error", "export-env", "export.env", "export-literal", "export",
-		"unexport-env", "unexport", "undef", "info", "for", "endfor",
-		"warning", "ifdef", "ifndef", "include", "ifmake", "ifnmake",
-		"if", "else", "elifdef", "elifndef", "elifmake", "elifnmake",
-		"elif", "endif", "sinclude",
-	};
-
 	size_t pos = 0;
 	if (*buf == '.') {
 		pos++;
-		for (; isspace((unsigned char)buf[pos]); pos++);
-		for (size_t i = 0; i < nitems(conditionals); i++) {
-			if (str_startswith(buf + pos, conditionals[i])) {
-				pos += strlen(conditionals[i]);
-				size_t origpos = pos;
-				for (; isspace((unsigned char)buf[pos]); pos++);
-				if (buf[pos] == 0 || pos > origpos) {
-					return pos;
-				} else if (buf[pos] == '(' || buf[pos] == '<' || buf[pos] == '!') {
-					return pos;
-				}
-			}
+		for (; CHAR_IS(buf[pos], CHAR_SPACE); pos++);
+		size_t start = pos;
+		for (; !CHAR_IS(buf[pos], CHAR_DIRECTIVE_END); pos++);
+		*type = consume_directive(buf + start, pos - start);
+		if (*type == PARSER_AST_BUILDER_CONDITIONAL_INVALID) {
+			return 0;
 		}
-	} else if (str_startswith(buf, "include")) {
+		for (; CHAR_IS(buf[pos], CHAR_SPACE); pos++);
+		return pos;
+	}
+
+	if (str_startswith(buf, "include")) {
 		pos += strlen("include");
-		bool space = false;
-		for (; isspace((unsigned char)buf[pos]); pos++, space = true);
-		if (space) {
-			return pos;
-		}
-	} else if (str_startswith(buf, "-include") || str_startswith(buf, "sinclude")) {
+		*type = PARSER_AST_BUILDER_CONDITIONAL_INCLUDE_POSIX;
+	} else if (str_startswith(buf, "-include")) {
 		pos += strlen("-include");
-		bool space = false;
-		for (; isspace((unsigned char)buf[pos]); pos++, space = true);
-		if (space) {
-			return pos;
-		}
+		*type = PARSER_AST_BUILDER_CONDITIONAL_INCLUDE_POSIX_OPTIONAL;
+	} else if (str_startswith(buf, "sinclude")) {
+		pos += strlen("sinclude");
+		*type = PARSER_AST_BUILDER_CONDITIONAL_INCLUDE_POSIX_OPTIONAL_S;
+	} else {
+		return 0;
 	}
 
-	return 0;
+	size_t origpos = pos;
+	for (; CHAR_IS(buf[pos], CHAR_SPACE); pos++);
+	if (pos > origpos) {
+		return pos;
+	} else {
+		return 0;
+	}
 }
 
 size_t
-consume_target(const char *buf)
+consume_target(const char *buf, size_t varpos)
 {
 	// Variable assignments are prioritized and can be ambigious
 	// due to :=, so check for it first.  Targets can also not
 	// start with a tab which implies a conditional.
-	if (consume_var(buf) > 0 || *buf == '\t') {
+	if (varpos > 0 || *buf == '\t') {
 		return 0;
 	}
 
 	// ^[^:]+(::?|!)
 	// We are more strict than make(1) and do not accept something
 	// like just ":".
-	size_t len = strlen(buf);
-	for (size_t i = 0; i < len; i++) {
-		if (buf[i] == ':' || buf[i] == '!') {
-			if (i == 0) {
-				return 0;
-			}
-			// Consume the next ':' too if any
-			if (buf[i] == ':' && i < len - 1 && buf[i + 1] == ':') {
-				i++;
-			}
-			return i;
-		}
+	size_t i = strcspn(buf, ":!");
+	if (i == 0 || buf[i] == 0) {
+		return 0;
 	}
-
-	return 0;
+	// Consume the next ':' too if any
+	if (buf[i] == ':' && buf[i + 1] == ':') {
+		i++;
+	}
+	return i;
 }
 
 size_t
@@ -210,7 +313,7 @@ consume_token(struct ParserTokenizeData *this, size_t pos, char startchar, char
 	int counter = 0;
 	bool escape = false;
 	size_t i = pos;
-	for (; i < strlen(this->line); i++) {
+	for (; i < this->len; i++) {
 		char c = this->line[i];
 		if (escape) {
 			escape = false;
@@ -258,14 +361,14 @@ consume_var(const char *buf)
 
 	// [^[:space:]=]+
 	size_t i;
-	for (i = pos; i < len && !(isspace((unsigned char)buf[i]) || buf[i] == '='); i++);
+	for (i = pos; i < len && !(CHAR_IS(buf[i], CHAR_SPACE) || buf[i] == '='); i++);
 	if (pos == i) {
 		return 0;
 	}
 	pos = i;
 
 	// [[:space:]]*
-	for (; pos < len && isspace((unsigned char)buf[pos]); pos++);
+	for (; pos < len && CHAR_IS(buf[pos], CHAR_SPACE); pos++);
 
 	// [+!?:]?
 	switch (buf[pos]) {
@@ -288,22 +391,9 @@ consume_var(const char *buf)
 	return pos + 1;
 }
 
-bool
-is_empty_line(const char *buf)
-{
-	for (const char *p = buf; *p != 0; p++) {
-		if (!isspace((unsigned char)*p)) {
-			return false;
-		}
-	}
-
-	return true;
-}
-
-static void
+void
 consume_expansion(struct ParserTokenizeData *this)
 {
-	SCOPE_MEMPOOL(pool);
 	panic_unless(this->dollar, "not in '$' state");
 	char c = this->line[this->i];
 	if (this->dollar > 1) {
@@ -316,10 +406,7 @@ consume_expansion(struct ParserTokenizeData *this)
 		} else if (c == '$') {
 			this->dollar++;
 		} else if (c == ' ' || c == '\t') {
-			const char *token = str_trim(pool, str_slice(pool, this->line, this->start, this->i));
-			if (strcmp(token, "") != 0 && strcmp(token, "\\") != 0) {
-				parser_tokenizer_create_token(this->tokenizer, this->type, token);
-			}
+			parser_tokenize_emit(this, this->start, this->i, false);
 			this->start = this->i;
 			this->dollar = 0;
 		} else {
@@ -331,9 +418,7 @@ consume_expansion(struct ParserTokenizeData *this)
 	} else if (c == '(') {
 		this->i = consume_token(this, this->i, '(', ')', false);
 		this->dollar = 0;
-	} else if (isalnum((unsigned char)c) || c == '@' || c == '<' || c == '>' || c == '/' ||
-		   c == '?' || c == '*' || c == '^' || c == '-' || c == '_' ||
-		   c == ')') {
+	} else if (CHAR_IS(c, CHAR_EXPANSION)) {
 		this->dollar = 0;
 	} else if (c == ' ' || c == '\\') {
 		/* '$ ' or '$\' are ignored by make for some reason instead of making
@@ -350,19 +435,10 @@ consume_expansion(struct ParserTokenizeData *this)
 	}
 }
 
-static const char *
+const char *
 parser_tokenize_conditional(struct ParserTokenizeData *this)
 {
-	unless (this->type == PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN && this->tokenizer->builder->condname) {
-		return NULL;
-	}
-
-	size_t indent = 0;
-	switch (parse_conditional(this->tokenizer->builder->condname, &indent)) {
-	case PARSER_AST_BUILDER_CONDITIONAL_ELIF:
-	case PARSER_AST_BUILDER_CONDITIONAL_IF:
-		break;
-	default:
+	unless (this->condtokens && CHAR_IS(this->line[this->i], CHAR_CONDTOKEN)) {
 		return NULL;
 	}
 
@@ -396,16 +472,33 @@ parser_tokenize_conditional(struct ParserTokenizeData *this)
 }
 
 void
-parser_tokenize_helper(struct ParserTokenizeData *this)
+parser_tokenize_emit(struct ParserTokenizeData *this, size_t a, size_t b, bool backslash)
 {
-	SCOPE_MEMPOOL(pool);
+	// Trim line[a..b) in place and pass it on through the scratch
+	// buffer.  The builder makes its own copy.
+	if (b > this->len) {
+		b = this->len;
+	}
+	for (; a < b && CHAR_IS(this->line[a], CHAR_SPACE); a++);
+	for (; b > a && CHAR_IS(this->line[b - 1], CHAR_SPACE); b--);
+	if (a >= b || (!backslash && b - a == 1 && this->line[a] == '\\')) {
+		return;
+	}
 
-	for (; this->i < strlen(this->line); this->i++) {
+	memcpy(this->scratch, this->line + a, b - a);
+	this->scratch[b - a] = 0;
+	parser_tokenizer_create_token(this->tokenizer, this->type, this->scratch);
+}
+
+void
+parser_tokenize_helper(struct ParserTokenizeData *this)
+{
+	for (; this->i < this->len; this->i++) {
 		panic_if(this->i < this->start, "index went before start");
 		char c = this->line[this->i];
 		if (this->escape) {
 			this->escape = 0;
-			if (c == '#' || c == '"' || c == '\'' || c == '\\' || c == '$' || isspace((unsigned char)c)) {
+			if (CHAR_IS(c, CHAR_ESCAPED)) {
 				continue;
 			}
 		}
@@ -413,10 +506,7 @@ parser_tokenize_helper(struct ParserTokenizeData *this)
 		if (this->dollar) {
 			consume_expansion(this);
 		} else if (c == ' ' || c == '\t') {
-			const char *token = str_trim(pool, str_slice(pool, this->line, this->start, this->i));
-			if (strcmp(token, "") != 0 && strcmp(token, "\\") != 0) {
-				parser_tokenizer_create_token(this->tokenizer, this->type, token);
-			}
+			parser_tokenize_emit(this, this->start, this->i, false);
 			this->start = this->i;
 		} else if (c == '"') {
 			this->i = consume_token(this, this->i, '"', '"', true);
@@ -429,19 +519,12 @@ parser_tokenize_helper(struct ParserTokenizeData *this)
 		} else if (c == '\\') {
 			this->escape = 1;
 		} else if (c == '#') {
-			const char *token = str_trim(pool, str_slice(pool, this->line, this->start, this->i));
-			if (strcmp(token, "") != 0) {
-				parser_tokenizer_create_token(this->tokenizer, this->type, token);
-			}
-			token = str_trim(pool, str_slice(pool, this->line, this->i, -1));
-			parser_tokenizer_create_token(this->tokenizer, this->type, token);
+			parser_tokenize_emit(this, this->start, this->i, true);
+			parser_tokenize_emit(this, this->i, this->len, true);
 			parser_set_error(this->tokenizer->parser, PARSER_ERROR_OK, NULL);
 			return;
 		} else if ((condtoken = parser_tokenize_conditional(this))) {
-			const char *token = str_trim(pool, str_slice(pool, this->line, this->start, this->i));
-			if (strcmp(token, "") != 0 && strcmp(token, "\\") != 0) {
-				parser_tokenizer_create_token(this->tokenizer, this->type, token);
-			}
+			parser_tokenize_emit(this, this->start, this->i, false);
 			parser_tokenizer_create_token(this->tokenizer, this->type, condtoken);
 			this->start = this->i + strlen(condtoken);
 			this->i += strlen(condtoken) - 1;
@@ -451,16 +534,16 @@ parser_tokenize_helper(struct ParserTokenizeData *this)
 		}
 	}
 
-	const char *token = str_trim(pool, str_slice(pool, this->line, this->start, this->i));
-	if (strcmp(token, "") != 0) {
-		parser_tokenizer_create_token(this->tokenizer, this->type, token);
-	}
+	parser_tokenize_emit(this, this->start, this->i, true);
 	parser_set_error(this->tokenizer->parser, PARSER_ERROR_OK, NULL);
 }
 
 void
-parser_tokenize(struct ParserTokenizer *tokenizer, const char *line, enum ParserASTBuilderTokenType type, size_t start)
+parser_tokenize(struct ParserTokenizer *tokenizer, const char *line, enum ParserASTBuilderTokenType type, size_t start, bool condtokens)
 {
+	SCOPE_MEMPOOL(pool);
+
+	size_t len = strlen(line);
 	parser_tokenize_helper(&(struct ParserTokenizeData){
 		.tokenizer = tokenizer,
 		.dollar = 0,
@@ -468,6 +551,9 @@ parser_tokenize(struct ParserTokenizer *tokenizer, const char *line, enum Parser
 		.i = start,
 		.start = start,
 		.line = line,
+		.len = len,
+		.scratch = mempool_alloc(pool, len + 1),
+		.condtokens = condtokens,
 		.type = type,
 	});
 }
@@ -475,6 +561,7 @@ parser_tokenize(struct ParserTokenizer *tokenizer, const char *line, enum Parser
 void
 parser_tokenizer_feed_line(struct ParserTokenizer *tokenizer, const char *inputline, const size_t linelen)
 {
+	STATS_SCOPE(STATS_TOKENIZER);
 	SCOPE_MEMPOOL(pool);
 	panic_if(tokenizer->finished, "tokenizer is in finished state");
 
@@ -555,53 +642,45 @@ parser_tokenizer_read_internal(struct ParserTokenizer *tokenizer)
 	}
 
 	char *buf = str_trimr(pool, tokenizer->inbuf.buf);
-	size_t pos;
-
-	pos = consume_comment(buf);
-	if (pos > 0) {
-		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_COMMENT, buf);
-		goto next;
-	} else if (is_empty_line(buf)) {
+	if (consume_comment(buf)) {
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_COMMENT, buf);
 		goto next;
 	}
 
-	if (tokenizer->in_target) {
-		pos = consume_conditional(buf);
-		if (pos > 0) {
-			tokenizer->builder->condname = str_trimr(tokenizer->builder->pool, str_ndup(tokenizer->builder->pool, buf, pos));
-			parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, tokenizer->builder->condname);
-			parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, tokenizer->builder->condname);
-			parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, pos);
-			parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, tokenizer->builder->condname);
-			goto next;
-		}
-		if (consume_var(buf) == 0 && consume_target(buf) == 0 &&
-		    *buf != 0 && *buf == '\t') {
+	// Classify the line once.  Everything below only looks at
+	// these positions.
+	enum ParserASTBuilderConditionalType condtype = PARSER_AST_BUILDER_CONDITIONAL_INVALID;
+	size_t condpos = consume_conditional(buf, &condtype);
+	size_t varpos = consume_var(buf);
+	size_t targetpos = consume_target(buf, varpos);
+
+	if (tokenizer->in_target && condpos == 0) {
+		if (varpos == 0 && targetpos == 0 && *buf == '\t') {
 			parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_START, NULL);
-			parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN, 0);
+			parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_TOKEN, 0, false);
 			parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_TARGET_COMMAND_END, NULL);
 			goto next;
 		}
-		if (consume_var(buf) > 0) {
+		if (varpos > 0) {
 			goto var;
 		}
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_TARGET_END, NULL);
 		tokenizer->in_target = false;
 	}
 
-	pos = consume_conditional(buf);
-	if (pos > 0) {
-		tokenizer->builder->condname = str_trimr(tokenizer->builder->pool, str_ndup(tokenizer->builder->pool, buf, pos));
+	if (condpos > 0) {
+		size_t condlen = condpos;
+		for (; condlen > 0 && CHAR_IS(buf[condlen - 1], CHAR_SPACE); condlen--);
+		tokenizer->builder->condname = str_ndup(tokenizer->builder->pool, buf, condlen);
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_START, tokenizer->builder->condname);
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, tokenizer->builder->condname);
-		parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, pos);
+		parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_TOKEN, condpos,
+			condtype == PARSER_AST_BUILDER_CONDITIONAL_IF || condtype == PARSER_AST_BUILDER_CONDITIONAL_ELIF);
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_CONDITIONAL_END, tokenizer->builder->condname);
 		goto next;
 	}
 
-	pos = consume_target(buf);
-	if (pos > 0) {
+	if (targetpos > 0) {
 		tokenizer->in_target = true;
 		tokenizer->builder->targetname = str_dup(tokenizer->builder->pool, buf);
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_TARGET_START, buf);
@@ -609,16 +688,19 @@ parser_tokenizer_read_internal(struct ParserTokenizer *tokenizer)
 	}
 
 var:
-	pos = consume_var(buf);
-	if (pos != 0) {
-		if (pos > strlen(buf)) {
+	if (varpos != 0) {
+		if (varpos > strlen(buf)) {
 			parser_set_error(tokenizer->parser, PARSER_ERROR_UNSPECIFIED, "inbuf overflow");
 			goto next;
 		}
-		tokenizer->builder->varname = str_trim(tokenizer->builder->pool, str_ndup(tokenizer->builder->pool, buf, pos));
+		size_t varstart = 0;
+		size_t varlen = varpos;
+		for (; varstart < varlen && CHAR_IS(buf[varstart], CHAR_SPACE); varstart++);
+		for (; varlen > varstart && CHAR_IS(buf[varlen - 1], CHAR_SPACE); varlen--);
+		tokenizer->builder->varname = str_ndup(tokenizer->builder->pool, buf + varstart, varlen - varstart);
 		parser_tokenizer_create_token(tokenizer, PARSER_AST_BUILDER_TOKEN_VARIABLE_START, NULL);
 	}
-	parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_VARIABLE_TOKEN, pos);
+	parser_tokenize(tokenizer, buf, PARSER_AST_BUILDER_TOKEN_VARIABLE_TOKEN, varpos, false);
 	if (tokenizer->builder->varname == NULL) {
 		parser_set_error(tokenizer->parser, PARSER_ERROR_UNSPECIFIED, NULL);
 	}
@@ -632,6 +714,7 @@ next:
 enum ParserError
 parser_tokenizer_finish(struct ParserTokenizer *tokenizer)
 {
+	STATS_SCOPE(STATS_TOKENIZER);
 	SCOPE_MEMPOOL(pool);
 	panic_if(tokenizer->finished, "tokenizer is in finished state");
 
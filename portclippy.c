@@ -45,9 +45,11 @@
 #include <libias/io.h>
 #include <libias/mempool.h>
 
+#include "ast.h"
 #include "mainutils.h"
 #include "parser.h"
 #include "parser/edits.h"
+#include "profile.h"
 
 // Prototypes
 static void usage(void);
@@ -55,7 +57,7 @@ static void usage(void);
 void
 usage()
 {
-	fprintf(stderr, "usage: portclippy [--strict] [Makefile]\n");
+	fprintf(stderr, "usage: portclippy [--profile] [--strict] [Makefile]\n");
 	exit(EX_USAGE);
 }
 
@@ -69,8 +71,10 @@ main(int argc, char *argv[])
 	parser_init_settings(&settings);
 	settings.behavior = PARSER_OUTPUT_RAWLINES | PARSER_CHECK_VARIABLE_REFERENCES;
 
+	int profile = 0;
 	int strict = 0;
 	struct option longopts[] = {
+		{ "profile", no_argument, &profile, 1 },
 		{ "strict", no_argument, &strict, 1 },
 		{ NULL, 0, NULL, 0 },
 	};
@@ -89,18 +93,27 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	struct ProfileSample *profile_sample = NULL;
+	if (profile) {
+		profile_sample = profile_sample_new(pool, argc > 0 ? argv[0] : "/dev/stdin");
+		settings.profile = profile_sample;
+	}
+
 	FILE *fp_in = stdin;
 	FILE *fp_out = stdout;
-	if (!open_file(MAINUTILS_OPEN_FILE_DEFAULT, &argc, &argv, pool, &fp_in, &fp_out, &settings.filename)) {
+	uint64_t start = profile_clock();
+	if (!open_file(MAINUTILS_OPEN_FILE_DEFAULT, &argc, &argv, pool, &fp_in, &fp_out, &settings.filename, NULL)) {
 		if (fp_in == NULL) {
 			err(1, "open_file");
 		} else {
 			usage();
 		}
 	}
+	profile_sample_add(profile_sample, PROFILE_PHASE_OPEN, NULL, profile_clock() - start);
 	if (!can_use_colors(fp_out)) {
 		settings.behavior |= PARSER_OUTPUT_NO_COLOR;
 	}
+	settings.cache_dir = open_cache_dir();
 	enter_sandbox();
 
 	struct Parser *parser = parser_new(pool, &settings);
@@ -113,21 +126,32 @@ main(int argc, char *argv[])
 		errx(1, "%s", parser_error_tostring(parser, pool));
 	}
 
+	start = profile_clock();
 	error = parser_edit(parser, pool, lint_bsd_port, NULL);
 	if (error != PARSER_ERROR_OK) {
 		errx(1, "%s", parser_error_tostring(parser, pool));
 	}
+	profile_sample_add(profile_sample, PROFILE_PHASE_EDIT, "lint.bsd-port", profile_clock() - start);
 
 	int status = 0;
+	start = profile_clock();
 	error = parser_edit(parser, pool, lint_order, &status);
 	if (error != PARSER_ERROR_OK) {
 		errx(1, "%s", parser_error_tostring(parser, pool));
 	}
+	profile_sample_add(profile_sample, PROFILE_PHASE_EDIT, "lint.order", profile_clock() - start);
 
 	error = parser_output_write_to_file(parser, fp_out);
 	if (error != PARSER_ERROR_OK) {
 		errx(1, "%s", parser_error_tostring(parser, pool));
 	}
 
+	if (profile_sample) {
+		struct Profile *profile = profile_new(pool);
+		profile_add_sample(profile, profile_sample);
+		profile_report(profile, stderr, 1);
+		profile_dump(profile, stderr);
+	}
+
 	return status;
 }
@@ -49,6 +49,7 @@
 #include <libias/set.h>
 #include <libias/str.h>
 
+#include "ast.h"
 #include "mainutils.h"
 #include "parser.h"
 #include "parser/edits.h"
@@ -95,33 +96,6 @@ static struct PorteditCommand cmds[] = {
 	{ "set-version", set_version },
 };
 
-struct ParserEdits {
-	const char *name;
-	ParserEditFn fn;
-};
-static struct ParserEdits parser_edits[] = {
-	{ "edit.bump-revision", edit_bump_revision },
-	{ "edit.merge", edit_merge },
-	{ "edit.set-version", edit_set_version },
-	{ "kakoune.select-object-on-line", kakoune_select_object_on_line },
-	{ "lint.bsd-port", lint_bsd_port },
-	{ "lint.clones", lint_clones },
-	{ "lint.commented-portrevision", lint_commented_portrevision },
-	{ "lint.order", lint_order },
-	{ "output.conditional-token", output_conditional_token },
-	{ "output.target-command-token", output_target_command_token },
-	{ "output.unknown-targets", output_unknown_targets },
-	{ "output.unknown-variables", output_unknown_variables },
-	{ "output.variable-value", output_variable_value },
-	{ "refactor.collapse-adjacent-variables", refactor_collapse_adjacent_variables },
-	{ "refactor.dedup-tokens", refactor_dedup_tokens },
-	{ "refactor.remove-consecutive-empty-lines", refactor_remove_consecutive_empty_lines },
-	{ "refactor.sanitize-append-modifier", refactor_sanitize_append_modifier },
-	{ "refactor.sanitize-cmake-args", refactor_sanitize_cmake_args },
-	{ "refactor.sanitize-comments", refactor_sanitize_comments },
-	{ "refactor.sanitize-eol-comments", refactor_sanitize_eol_comments },
-};
-
 void
 enqueue_output(struct Mempool *extpool, const char *key, const char *value, const char *hint, void *userdata)
 {
@@ -148,7 +122,7 @@ apply(struct ParserSettings *settings, int argc, char *argv[])
 			if (argc != 2) {
 				apply_usage();
 			}
-			for (size_t i = 0; i < nitems(parser_edits); i++) {
+			for (size_t i = 0; i < parser_edits_len; i++) {
 				printf("%s\n", parser_edits[i].name);
 			}
 			return 0;
@@ -161,13 +135,7 @@ apply(struct ParserSettings *settings, int argc, char *argv[])
 	argv++;
 	argc--;
 
-	ParserEditFn editfn = NULL;
-	for (size_t i = 0; i < nitems(parser_edits); i++) {
-		if (strcasecmp(parser_edits[i].name, apply_edit) == 0) {
-			editfn = parser_edits[i].fn;
-			break;
-		}
-	}
+	ParserEditFn editfn = parser_edits_lookup(apply_edit);
 	if (editfn == NULL) {
 		errx(1, "%s not found. Use 'portedit apply list' to list all available edits.", apply_edit);
 	}
@@ -648,7 +616,7 @@ read_file(struct ParserSettings *settings, enum MainutilsOpenFileBehavior behavi
 	if (settings->behavior & PARSER_OUTPUT_INPLACE) {
 		behavior |= MAINUTILS_OPEN_FILE_INPLACE;
 	}
-	if (!open_file(behavior, argc, argv, pool, fp_in, fp_out, &settings->filename)) {
+	if (!open_file(behavior, argc, argv, pool, fp_in, fp_out, &settings->filename, &settings->inplace_dir)) {
 		if (*fp_in == NULL) {
 			err(1, "fopen");
 		} else {
@@ -658,6 +626,7 @@ read_file(struct ParserSettings *settings, enum MainutilsOpenFileBehavior behavi
 	if (!can_use_colors(*fp_out)) {
 		settings->behavior |= PARSER_OUTPUT_NO_COLOR;
 	}
+	settings->cache_dir = open_cache_dir();
 
 	enter_sandbox();
 
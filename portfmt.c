@@ -31,6 +31,7 @@
 #if HAVE_ERR
 # include <err.h>
 #endif
+#include <getopt.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -42,8 +43,10 @@
 #include <libias/io.h>
 #include <libias/mempool.h>
 
+#include "ast.h"
 #include "mainutils.h"
 #include "parser.h"
+#include "portfmt/server.h"
 
 // Prototypes
 static void usage(void);
@@ -51,7 +54,8 @@ static void usage(void);
 void
 usage()
 {
-	fprintf(stderr, "usage: portfmt [-D[context]] [-dituU] [-w wrapcol] [Makefile]\n");
+	fprintf(stderr, "usage: portfmt [-D[context]] [-cdituU] [-w wrapcol] [Makefile]\n");
+	fprintf(stderr, "       portfmt [-tuU] [-w wrapcol] --server socket\n");
 	exit(EX_USAGE);
 }
 
@@ -68,8 +72,31 @@ main(int argc, char *argv[])
 		PARSER_ALLOW_FUZZY_MATCHING | PARSER_SANITIZE_COMMENTS |
 		PARSER_SANITIZE_CMAKE_ARGS;
 
-	if (!read_common_args(&argc, &argv, &settings, "D::dituUw:", pool, NULL)) {
-		usage();
+	const struct option longopts[] = {
+		{ "server", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 },
+	};
+	const char *server = NULL;
+	int ch;
+	while ((ch = getopt_long(argc, argv, "cD::dituUw:", longopts, NULL)) != -1) {
+		if (ch == 'S') {
+			server = optarg;
+		} else if (!read_common_arg(&settings, ch, optarg, pool, NULL)) {
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	finish_common_args(&settings);
+
+	if (server) {
+		if (argc > 0 || (settings.behavior & (PARSER_OUTPUT_CHECK |
+						     PARSER_OUTPUT_DIFF |
+						     PARSER_OUTPUT_DUMP_TOKENS |
+						     PARSER_OUTPUT_INPLACE))) {
+			usage();
+		}
+		return portfmt_server_run(server, &settings);
 	}
 
 	FILE *fp_in = stdin;
@@ -78,7 +105,7 @@ main(int argc, char *argv[])
 	if (settings.behavior & PARSER_OUTPUT_INPLACE) {
 		behavior |= MAINUTILS_OPEN_FILE_INPLACE;
 	}
-	if (!open_file(behavior, &argc, &argv, pool, &fp_in, &fp_out, &settings.filename)) {
+	if (!open_file(behavior, &argc, &argv, pool, &fp_in, &fp_out, &settings.filename, &settings.inplace_dir)) {
 		if (fp_in == NULL) {
 			err(1, "fopen");
 		} else {
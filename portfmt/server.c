@@ -0,0 +1,801 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libias/array.h>
+#include <libias/flow.h>
+#include <libias/map.h>
+#include <libias/mem.h>
+#include <libias/mempool.h>
+#include <libias/str.h>
+#include <libias/trait/compare.h>
+
+#include "ast.h"
+#include "capsicum_helpers.h"
+#include "parser.h"
+#include "parser/edits.h"
+#include "portfmt/server.h"
+#include "regexp.h"
+
+// Each message is a 32-bit length in network byte order followed by
+// that many bytes.  A request consists of the command, the path of
+// the file, and an argument, each terminated by a NUL byte, followed
+// by the contents of the editor buffer.  A response consists of the
+// exit status of the equivalent portfmt or portedit command as a
+// NUL-terminated decimal string, followed by the output.  For
+// text-edit the buffer holds the lines that replace the lines given
+// by the argument in the buffer of the last request for the path.  A
+// length over PORTFMT_SERVER_MAX_MESSAGE_SIZE is answered with an
+// error and the connection is closed.
+
+enum PortfmtServerParser {
+	PORTFMT_SERVER_PARSER_FORMAT,
+	PORTFMT_SERVER_PARSER_DIFF,
+	PORTFMT_SERVER_PARSER_RAWLINES,
+	PORTFMT_SERVER_PARSER_EDIT,
+	PORTFMT_SERVER_PARSER__N,
+};
+
+struct PortfmtServerRequest {
+	const char *command;
+	const char *path;
+	const char *arg;
+	const char *buf;
+	size_t len;
+};
+
+struct PortfmtServerCommand {
+	const char *name;
+	enum PortfmtServerParser parser;
+	// Returns the exit status or -1 if the parser has an error
+	int (*run)(struct Parser *, struct PortfmtServerRequest *, struct Mempool *);
+};
+
+// The last parse of every file for each of the parser settings.  A
+// parser is only kept as long as it has not been modified by an edit.
+// Only the PORTFMT_SERVER_MAX_FILES most recently used files are kept.
+struct PortfmtServerFile {
+	struct Mempool *pool;
+	const char *path;
+	uint64_t used;
+	uint64_t hash;
+	char *buf;
+	size_t len;
+	// The diff parser only matches requests for the same context
+	size_t diff_context;
+	struct Parser *parsers[PORTFMT_SERVER_PARSER__N];
+};
+
+struct PortfmtServerBuffer {
+	char *buf;
+	size_t len;
+	size_t cap;
+};
+
+// Clients are non-blocking, so requests and responses are buffered
+// until they are complete or written.
+struct PortfmtServerClient {
+	int fd;
+	// No more requests are read and the connection is closed once
+	// the pending output is written.
+	bool closing;
+	struct PortfmtServerBuffer in;
+	struct PortfmtServerBuffer out;
+	size_t out_off;
+};
+
+struct PortfmtServer {
+	struct Mempool *pool;
+	struct ParserSettings settings;
+	struct Map *files;
+	uint64_t clock;
+};
+
+// Prototypes
+static int portfmt_server_apply_edit(struct Parser *, struct PortfmtServerRequest *, struct Mempool *);
+static void portfmt_server_enqueue_output(struct Mempool *, const char *, const char *, const char *, void *);
+static int portfmt_server_format(struct Parser *, struct PortfmtServerRequest *, struct Mempool *);
+static bool portfmt_server_get_variable_filter(struct Parser *, const char *, void *);
+static int portfmt_server_get_variable(struct Parser *, struct PortfmtServerRequest *, struct Mempool *);
+static int portfmt_server_select_object_on_line(struct Parser *, struct PortfmtServerRequest *, struct Mempool *);
+static uint64_t portfmt_server_hash(const char *, size_t);
+static struct PortfmtServerFile *portfmt_server_file(struct PortfmtServer *, struct PortfmtServerRequest *);
+static size_t portfmt_server_file_line_offset(struct PortfmtServerFile *, size_t);
+static struct PortfmtServerFile *portfmt_server_text_edit(struct PortfmtServer *, struct PortfmtServerRequest *, struct Mempool *, const char **);
+static void portfmt_server_file_free(struct PortfmtServerFile *);
+static void portfmt_server_file_evict(struct PortfmtServer *);
+static struct Parser *portfmt_server_parser(struct PortfmtServer *, struct PortfmtServerFile *, enum PortfmtServerParser, struct PortfmtServerRequest *, struct Mempool *, const char **);
+static void portfmt_server_forget_parser(struct PortfmtServerFile *, enum PortfmtServerParser);
+static void portfmt_server_buffer_append(struct PortfmtServerBuffer *, const void *, size_t);
+static void portfmt_server_reply(struct PortfmtServerClient *, int, const char *, size_t);
+static void portfmt_server_handle(struct PortfmtServer *, struct PortfmtServerClient *, const char *, size_t);
+static bool portfmt_server_client_read(struct PortfmtServer *, struct PortfmtServerClient *);
+static bool portfmt_server_client_write(struct PortfmtServerClient *);
+static void portfmt_server_client_close(struct PortfmtServerClient *);
+
+// Constants
+static const uint32_t PORTFMT_SERVER_MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+static const size_t PORTFMT_SERVER_MAX_FILES = 64;
+static const struct PortfmtServerCommand commands[] = {
+	{ "apply-edit", PORTFMT_SERVER_PARSER_EDIT, portfmt_server_apply_edit },
+	{ "diff", PORTFMT_SERVER_PARSER_DIFF, portfmt_server_format },
+	{ "format", PORTFMT_SERVER_PARSER_FORMAT, portfmt_server_format },
+	{ "get-variable", PORTFMT_SERVER_PARSER_RAWLINES, portfmt_server_get_variable },
+	{ "select-object-on-line", PORTFMT_SERVER_PARSER_RAWLINES, portfmt_server_select_object_on_line },
+	{ "text-edit", PORTFMT_SERVER_PARSER_FORMAT, portfmt_server_format },
+};
+
+int
+portfmt_server_apply_edit(struct Parser *parser, struct PortfmtServerRequest *req, struct Mempool *pool)
+{
+	ParserEditFn editfn = parser_edits_lookup(req->arg);
+	if (editfn == NULL) {
+		parser_set_error(parser, PARSER_ERROR_INVALID_ARGUMENT,
+				 str_printf(pool, "%s not found", req->arg));
+		return -1;
+	}
+
+	void *userdata = NULL;
+	if (str_startswith(req->arg, "output.")) {
+		struct ParserEditOutput *data = mempool_alloc(pool, sizeof(struct ParserEditOutput));
+		data->callback = portfmt_server_enqueue_output;
+		data->callbackuserdata = parser;
+		userdata = data;
+	}
+
+	if (parser_edit(parser, pool, editfn, userdata) != PARSER_ERROR_OK) {
+		return -1;
+	}
+	return 0;
+}
+
+void
+portfmt_server_enqueue_output(struct Mempool *extpool, const char *key, const char *value, const char *hint, void *userdata)
+{
+	struct Parser *parser = userdata;
+	parser_enqueue_output(parser, value);
+	parser_enqueue_output(parser, "\n");
+}
+
+int
+portfmt_server_format(struct Parser *parser, struct PortfmtServerRequest *req, struct Mempool *pool)
+{
+	// The output is generated by parser_output_write_to_file()
+	return 0;
+}
+
+bool
+portfmt_server_get_variable_filter(struct Parser *parser, const char *key, void *userdata)
+{
+	struct Regexp *regexp = userdata;
+	return regexp_exec(regexp, key) == 0;
+}
+
+int
+portfmt_server_get_variable(struct Parser *parser, struct PortfmtServerRequest *req, struct Mempool *pool)
+{
+	struct Regexp *regexp = regexp_new_from_str(pool, req->arg, REG_EXTENDED);
+	if (regexp == NULL) {
+		parser_set_error(parser, PARSER_ERROR_INVALID_ARGUMENT, "invalid regexp");
+		return -1;
+	}
+
+	struct ParserEditOutput param = { portfmt_server_get_variable_filter, regexp, NULL, NULL, portfmt_server_enqueue_output, parser, 0 };
+	if (parser_edit(parser, pool, output_variable_value, &param) != PARSER_ERROR_OK) {
+		return -1;
+	} else if (param.found) {
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+int
+portfmt_server_select_object_on_line(struct Parser *parser, struct PortfmtServerRequest *req, struct Mempool *pool)
+{
+	if (parser_edit(parser, pool, kakoune_select_object_on_line, (void *)req->arg) != PARSER_ERROR_OK) {
+		return -1;
+	}
+	return 0;
+}
+
+uint64_t
+portfmt_server_hash(const char *buf, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)buf[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+struct PortfmtServerFile *
+portfmt_server_file(struct PortfmtServer *server, struct PortfmtServerRequest *req)
+{
+	uint64_t hash = portfmt_server_hash(req->buf, req->len);
+	struct PortfmtServerFile *file = map_get(server->files, req->path);
+	if (file && file->hash == hash && file->len == req->len &&
+	    memcmp(file->buf, req->buf, req->len) == 0) {
+		file->used = ++server->clock;
+		return file;
+	} else if (file) {
+		map_remove(server->files, file->path);
+		portfmt_server_file_free(file);
+	}
+
+	portfmt_server_file_evict(server);
+	file = xmalloc(sizeof(struct PortfmtServerFile));
+	file->pool = mempool_new();
+	file->path = str_dup(file->pool, req->path);
+	file->used = ++server->clock;
+	file->hash = hash;
+	file->buf = xmalloc(req->len + 1);
+	memcpy(file->buf, req->buf, req->len);
+	file->len = req->len;
+	map_add(server->files, file->path, file);
+	return file;
+}
+
+void
+portfmt_server_file_free(struct PortfmtServerFile *file)
+{
+	if (file == NULL) {
+		return;
+	}
+
+	mempool_free(file->pool);
+	free(file->buf);
+	free(file);
+}
+
+void
+portfmt_server_file_evict(struct PortfmtServer *server)
+// Make room for another file by dropping the least recently used ones
+{
+	while (map_len(server->files) >= PORTFMT_SERVER_MAX_FILES) {
+		struct PortfmtServerFile *lru = NULL;
+		MAP_FOREACH(server->files, const char *, path, struct PortfmtServerFile *, file) {
+			if (lru == NULL || file->used < lru->used) {
+				lru = file;
+			}
+		}
+		map_remove(server->files, lru->path);
+		portfmt_server_file_free(lru);
+	}
+}
+
+size_t
+portfmt_server_file_line_offset(struct PortfmtServerFile *file, size_t line)
+// Offset of the first byte of line in the buffer or its length if
+// there are fewer lines.  Lines start at 1.
+{
+	size_t off = 0;
+	for (size_t i = 1; i < line && off < file->len; i++) {
+		const char *nl = memchr(file->buf + off, '\n', file->len - off);
+		if (nl == NULL) {
+			return file->len;
+		}
+		off = nl - file->buf + 1;
+	}
+	return off;
+}
+
+struct PortfmtServerFile *
+portfmt_server_text_edit(struct PortfmtServer *server, struct PortfmtServerRequest *req, struct Mempool *extpool, const char **error)
+// Replace the lines [a,b) given as "a,b" in the argument with the
+// buffer of the request.  The cached parsers are updated with
+// parser_apply_text_edit() instead of parsing the file again.
+{
+	SCOPE_MEMPOOL(pool);
+
+	struct PortfmtServerFile *file = map_get(server->files, req->path);
+	if (file == NULL) {
+		*error = str_printf(extpool, "no buffer for %s", req->path);
+		return NULL;
+	}
+	file->used = ++server->clock;
+
+	struct Array *range = str_split(pool, req->arg, ",");
+	const char *errstr = NULL;
+	size_t a = 0;
+	size_t b = 0;
+	if (array_len(range) == 2) {
+		a = strtonum(array_get(range, 0), 1, INT_MAX, &errstr);
+		if (errstr == NULL) {
+			b = strtonum(array_get(range, 1), a, INT_MAX, &errstr);
+		}
+	} else {
+		errstr = "invalid";
+	}
+	size_t lines = 0;
+	for (size_t i = 0; i < file->len; i++) {
+		if (file->buf[i] == '\n' || i == file->len - 1) {
+			lines++;
+		}
+	}
+	if (errstr || b > lines + 1) {
+		*error = str_printf(extpool, "line range %s is %s", req->arg, errstr ? errstr : "out of range");
+		return NULL;
+	}
+
+	// The parser treats the edit as whole lines, so keep the buffer
+	// in line with it
+	size_t start = portfmt_server_file_line_offset(file, a);
+	size_t end = portfmt_server_file_line_offset(file, b);
+	bool newline_before = start == file->len && start > 0 && file->buf[start - 1] != '\n';
+	bool newline_after = req->len > 0 && req->buf[req->len - 1] != '\n' && end < file->len;
+	size_t len = start + newline_before + req->len + newline_after + file->len - end;
+	char *buf = xmalloc(len + 1);
+	char *p = buf;
+	memcpy(p, file->buf, start);
+	p += start;
+	if (newline_before) {
+		*p++ = '\n';
+	}
+	memcpy(p, req->buf, req->len);
+	p += req->len;
+	if (newline_after) {
+		*p++ = '\n';
+	}
+	memcpy(p, file->buf + end, file->len - end);
+	free(file->buf);
+	file->buf = buf;
+	file->len = len;
+	file->hash = portfmt_server_hash(buf, len);
+
+	const char *text = str_ndup(pool, req->buf, req->len);
+	for (size_t kind = 0; kind < PORTFMT_SERVER_PARSER__N; kind++) {
+		if (file->parsers[kind] &&
+		    parser_apply_text_edit(file->parsers[kind], a, b, text) != PARSER_ERROR_OK) {
+			portfmt_server_forget_parser(file, kind);
+		}
+	}
+
+	req->buf = file->buf;
+	req->len = file->len;
+	return file;
+}
+
+struct Parser *
+portfmt_server_parser(struct PortfmtServer *server, struct PortfmtServerFile *file, enum PortfmtServerParser kind, struct PortfmtServerRequest *req, struct Mempool *extpool, const char **error)
+{
+	struct ParserSettings settings = server->settings;
+	settings.filename = file->path;
+	if (kind == PORTFMT_SERVER_PARSER_DIFF && *req->arg) {
+		const char *errstr = NULL;
+		settings.diff_context = strtonum(req->arg, 0, INT_MAX, &errstr);
+		if (errstr != NULL) {
+			*error = str_printf(extpool, "context %s is %s", req->arg, errstr);
+			return NULL;
+		}
+	}
+
+	if (file->parsers[kind]) {
+		if (kind != PORTFMT_SERVER_PARSER_DIFF ||
+		    file->diff_context == settings.diff_context) {
+			return file->parsers[kind];
+		}
+		portfmt_server_forget_parser(file, kind);
+	}
+
+	switch (kind) {
+	case PORTFMT_SERVER_PARSER_FORMAT:
+		break;
+	case PORTFMT_SERVER_PARSER_DIFF:
+		settings.behavior |= PARSER_OUTPUT_DIFF | PARSER_OUTPUT_NO_COLOR;
+		break;
+	case PORTFMT_SERVER_PARSER_RAWLINES:
+	case PORTFMT_SERVER_PARSER_EDIT:
+		settings.behavior = PARSER_COLLAPSE_ADJACENT_VARIABLES | PARSER_DEDUP_TOKENS |
+			PARSER_OUTPUT_REFORMAT | PARSER_OUTPUT_EDITED | PARSER_ALLOW_FUZZY_MATCHING;
+		if (kind == PORTFMT_SERVER_PARSER_RAWLINES) {
+			settings.behavior |= PARSER_OUTPUT_RAWLINES;
+		}
+		break;
+	case PORTFMT_SERVER_PARSER__N:
+		panic("invalid parser");
+	}
+
+	struct Parser *parser = parser_new(file->pool, &settings);
+	if (parser_read_from_buffer(parser, req->buf, req->len) != PARSER_ERROR_OK ||
+	    parser_read_finish(parser) != PARSER_ERROR_OK) {
+		*error = parser_error_tostring(parser, extpool);
+		mempool_release(file->pool, parser);
+		return NULL;
+	}
+
+	if (kind == PORTFMT_SERVER_PARSER_DIFF) {
+		file->diff_context = settings.diff_context;
+	}
+	file->parsers[kind] = parser;
+	return parser;
+}
+
+void
+portfmt_server_forget_parser(struct PortfmtServerFile *file, enum PortfmtServerParser kind)
+{
+	if (file->parsers[kind]) {
+		mempool_release(file->pool, file->parsers[kind]);
+		file->parsers[kind] = NULL;
+	}
+}
+
+void
+portfmt_server_buffer_append(struct PortfmtServerBuffer *buffer, const void *data, size_t len)
+{
+	if (buffer->cap - buffer->len < len) {
+		size_t cap = MAX(buffer->cap * 2, 65536);
+		while (cap - buffer->len < len) {
+			cap *= 2;
+		}
+		buffer->buf = xrecallocarray(buffer->buf, buffer->cap, cap, 1);
+		buffer->cap = cap;
+	}
+	memcpy(buffer->buf + buffer->len, data, len);
+	buffer->len += len;
+}
+
+void
+portfmt_server_reply(struct PortfmtServerClient *client, int status, const char *output, size_t len)
+{
+	SCOPE_MEMPOOL(pool);
+
+	const char *header = str_printf(pool, "%d", status);
+	size_t header_len = strlen(header) + 1;
+	if (len > PORTFMT_SERVER_MAX_MESSAGE_SIZE - header_len) {
+		header = "1";
+		header_len = 2;
+		output = "output too large";
+		len = strlen(output);
+	}
+	uint32_t msglen = htonl(header_len + len);
+	portfmt_server_buffer_append(&client->out, &msglen, sizeof(msglen));
+	portfmt_server_buffer_append(&client->out, header, header_len);
+	portfmt_server_buffer_append(&client->out, output, len);
+}
+
+void
+portfmt_server_handle(struct PortfmtServer *server, struct PortfmtServerClient *client, const char *data, size_t len)
+{
+	SCOPE_MEMPOOL(pool);
+
+	char *msg = mempool_alloc(pool, len + 1);
+	memcpy(msg, data, len);
+	msg[len] = 0;
+
+	const char *fields[3];
+	size_t off = 0;
+	for (size_t i = 0; i < nitems(fields); i++) {
+		const char *end = memchr(msg + off, 0, len - off);
+		if (end == NULL) {
+			const char *error = "malformed request";
+			portfmt_server_reply(client, 1, error, strlen(error));
+			return;
+		}
+		fields[i] = msg + off;
+		off = end - msg + 1;
+	}
+	struct PortfmtServerRequest req = {
+		.command = fields[0],
+		.path = fields[1],
+		.arg = fields[2],
+		.buf = msg + off,
+		.len = len - off,
+	};
+
+	const struct PortfmtServerCommand *cmd = NULL;
+	for (size_t i = 0; i < nitems(commands); i++) {
+		if (strcmp(commands[i].name, req.command) == 0) {
+			cmd = &commands[i];
+			break;
+		}
+	}
+	if (cmd == NULL) {
+		const char *error = str_printf(pool, "unknown command: %s", req.command);
+		portfmt_server_reply(client, 1, error, strlen(error));
+		return;
+	}
+
+	// Edits that only produce output do not modify the AST and
+	// can share the parser of get-variable.
+	enum PortfmtServerParser kind = cmd->parser;
+	if (kind == PORTFMT_SERVER_PARSER_EDIT &&
+	    (str_startswith(req.arg, "kakoune.") ||
+	     str_startswith(req.arg, "lint.") ||
+	     str_startswith(req.arg, "output."))) {
+		kind = PORTFMT_SERVER_PARSER_RAWLINES;
+	}
+
+	const char *error = NULL;
+	struct PortfmtServerFile *file = NULL;
+	if (strcmp(cmd->name, "text-edit") == 0) {
+		file = portfmt_server_text_edit(server, &req, pool, &error);
+		if (file == NULL) {
+			portfmt_server_reply(client, 1, error, strlen(error));
+			return;
+		}
+		req.arg = "";
+	} else {
+		file = portfmt_server_file(server, &req);
+	}
+	struct Parser *parser = portfmt_server_parser(server, file, kind, &req, pool, &error);
+	if (parser == NULL) {
+		portfmt_server_reply(client, 1, error, strlen(error));
+		return;
+	}
+
+	int status = cmd->run(parser, &req, pool);
+	char *output = NULL;
+	size_t output_len = 0;
+	FILE *f = open_memstream(&output, &output_len);
+	panic_unless(f, "open_memstream: %s", strerror(errno));
+	enum ParserError parser_error = PARSER_ERROR_OK;
+	if (status >= 0) {
+		parser_error = parser_output_write_to_file(parser, f);
+	}
+	fclose(f);
+	mempool_add(pool, output, free);
+
+	bool failed = status < 0 || (parser_error != PARSER_ERROR_OK &&
+				     parser_error != PARSER_ERROR_DIFFERENCES_FOUND);
+	if (failed) {
+		status = 1;
+		output = parser_error_tostring(parser, pool);
+		output_len = strlen(output);
+	} else if (parser_error == PARSER_ERROR_DIFFERENCES_FOUND) {
+		status = 2;
+	}
+
+	// Errors are sticky and edits modify the AST, so the parser
+	// cannot be reused for the next request.
+	if (failed || parser_error != PARSER_ERROR_OK ||
+	    kind == PORTFMT_SERVER_PARSER_EDIT) {
+		portfmt_server_forget_parser(file, kind);
+	}
+
+	portfmt_server_reply(client, status, output, output_len);
+}
+
+bool
+portfmt_server_client_read(struct PortfmtServer *server, struct PortfmtServerClient *client)
+{
+	for (;;) {
+		if (client->in.cap - client->in.len < 65536) {
+			size_t cap = MAX(client->in.cap * 2, 65536);
+			client->in.buf = xrecallocarray(client->in.buf, client->in.cap, cap, 1);
+			client->in.cap = cap;
+		}
+		ssize_t n = read(client->fd, client->in.buf + client->in.len, client->in.cap - client->in.len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else if (n < 0) {
+			return false;
+		} else if (n == 0) {
+			// Answer the requests we already have before
+			// closing the connection.
+			client->closing = true;
+			break;
+		}
+		client->in.len += n;
+	}
+
+	size_t off = 0;
+	while (client->in.len - off >= sizeof(uint32_t)) {
+		uint32_t len;
+		memcpy(&len, client->in.buf + off, sizeof(len));
+		len = ntohl(len);
+		if (len > PORTFMT_SERVER_MAX_MESSAGE_SIZE) {
+			const char *error = "malformed request";
+			portfmt_server_reply(client, 1, error, strlen(error));
+			client->closing = true;
+			off = client->in.len;
+			break;
+		} else if (client->in.len - off - sizeof(len) < len) {
+			break;
+		}
+		portfmt_server_handle(server, client, client->in.buf + off + sizeof(len), len);
+		off += sizeof(len) + len;
+	}
+	memmove(client->in.buf, client->in.buf + off, client->in.len - off);
+	client->in.len -= off;
+
+	return true;
+}
+
+bool
+portfmt_server_client_write(struct PortfmtServerClient *client)
+{
+	while (client->out_off < client->out.len) {
+		ssize_t n = write(client->fd, client->out.buf + client->out_off, client->out.len - client->out_off);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		} else if (n < 0) {
+			return false;
+		}
+		client->out_off += n;
+	}
+	client->out.len = 0;
+	client->out_off = 0;
+	return true;
+}
+
+void
+portfmt_server_client_close(struct PortfmtServerClient *client)
+{
+	close(client->fd);
+	free(client->in.buf);
+	free(client->out.buf);
+}
+
+int
+portfmt_server_run(const char *path, struct ParserSettings *settings)
+{
+	SCOPE_MEMPOOL(pool);
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errx(1, "%s: socket path too long", path);
+	}
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		err(1, "socket");
+	}
+	if (unlink(path) < 0 && errno != ENOENT) {
+		err(1, "unlink: %s", path);
+	}
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err(1, "bind: %s", path);
+	}
+	if (listen(sock, 16) < 0) {
+		err(1, "listen: %s", path);
+	}
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+		err(1, "fcntl");
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+#if HAVE_CAPSICUM
+	if (caph_limit_stdio() < 0) {
+		err(1, "caph_limit_stdio");
+	}
+	if (caph_enter() < 0) {
+		err(1, "caph_enter");
+	}
+#endif
+#if HAVE_PLEDGE
+	if (pledge("stdio unix", NULL) == -1) {
+		err(1, "pledge");
+	}
+#endif
+
+	struct PortfmtServer server = {
+		.pool = pool,
+		.settings = *settings,
+		.files = mempool_map(pool, str_compare),
+	};
+
+	// fds[i] belongs to clients[i]; fds[0] is the listening socket.
+	// Both grow with the number of connected clients.
+	size_t cap = 16;
+	struct pollfd *fds = xrecallocarray(NULL, 0, cap, sizeof(struct pollfd));
+	struct PortfmtServerClient *clients = xrecallocarray(NULL, 0, cap, sizeof(struct PortfmtServerClient));
+	size_t nfds = 1;
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	for (;;) {
+		for (size_t i = 1; i < nfds; i++) {
+			fds[i].events = 0;
+			unless (clients[i].closing) {
+				fds[i].events |= POLLIN;
+			}
+			if (clients[i].out.len > 0) {
+				fds[i].events |= POLLOUT;
+			}
+		}
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(1, "poll");
+		}
+
+		for (size_t i = nfds - 1; i > 0; i--) {
+			struct PortfmtServerClient *client = &clients[i];
+			bool ok = true;
+			if (fds[i].revents & (POLLIN | POLLHUP)) {
+				ok = portfmt_server_client_read(&server, client);
+			} else if (fds[i].revents & (POLLERR | POLLNVAL)) {
+				ok = false;
+			}
+			if (ok && client->out.len > 0) {
+				ok = portfmt_server_client_write(client);
+			}
+			if (!ok || (client->closing && client->out.len == 0)) {
+				portfmt_server_client_close(client);
+				nfds--;
+				fds[i] = fds[nfds];
+				clients[i] = clients[nfds];
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(sock, NULL, NULL);
+			if (fd < 0) {
+				if (errno != EINTR && errno != EAGAIN &&
+				    errno != EWOULDBLOCK && errno != ECONNABORTED) {
+					warn("accept");
+				}
+			} else if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+				warn("fcntl");
+				close(fd);
+			} else {
+				if (nfds == cap) {
+					size_t newcap = 2 * cap;
+					fds = xrecallocarray(fds, cap, newcap, sizeof(struct pollfd));
+					clients = xrecallocarray(clients, cap, newcap, sizeof(struct PortfmtServerClient));
+					cap = newcap;
+				}
+				fds[nfds].fd = fd;
+				fds[nfds].revents = 0;
+				clients[nfds] = (struct PortfmtServerClient){ .fd = fd };
+				nfds++;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -71,7 +71,9 @@
 #include "parser/edits.h"
 #include "portscan/log.h"
 #include "portscan/status.h"
+#include "profile.h"
 #include "regexp.h"
+#include "trace.h"
 
 enum ScanFlags {
 	SCAN_NOTHING = 0,
@@ -91,10 +93,15 @@ enum ScanLongopts {
 	SCAN_LONGOPT_CATEGORIES,
 	SCAN_LONGOPT_CLONES,
 	SCAN_LONGOPT_COMMENTS,
+	SCAN_LONGOPT_MERGE,
+	SCAN_LONGOPT_METRICS,
 	SCAN_LONGOPT_OPTION_DEFAULT_DESCRIPTIONS,
 	SCAN_LONGOPT_OPTIONS,
+	SCAN_LONGOPT_PROFILE,
 	SCAN_LONGOPT_PROGRESS,
+	SCAN_LONGOPT_SHARD,
 	SCAN_LONGOPT_STRICT,
+	SCAN_LONGOPT_TRACE,
 	SCAN_LONGOPT_UNKNOWN_TARGETS,
 	SCAN_LONGOPT_UNKNOWN_VARIABLES,
 	SCAN_LONGOPT_VARIABLE_VALUES,
@@ -125,16 +132,19 @@ struct CategoryReaderState {
 struct PortReaderState {
 	// Input
 	int portsdir;
+	int cachedir;
 	const char *origin;
 	struct Regexp *keyquery;
 	struct Regexp *query;
 	ssize_t editdist;
 	enum ScanFlags flags;
 	struct Map *default_option_descriptions;
+	bool profile;
 
 	// Output
 	struct Mempool *pool;
 	const char *path;
+	struct ProfileSample *profile_sample;
 	struct Set *comments;
 	struct Set *errors;
 	struct Set *unknown_variables;
@@ -146,6 +156,11 @@ struct PortReaderState {
 	struct Set *variable_values;
 };
 
+struct DefaultOptionDescriptionsState {
+	struct Map *descriptions;
+	struct Mempool *pool;
+};
+
 // Prototypes
 static void add_error(struct Set *, char *);
 static void lookup_subdirs(int, const char *, const char *, enum ScanFlags, struct Mempool *, struct Array *, struct Array *, struct Array *, struct Array *, struct Array *, struct Array *);
@@ -156,24 +171,34 @@ static int char_cmp(const void *, const void *, void *);
 static ssize_t edit_distance(const char *, const char *);
 static void collect_output_unknowns(struct Mempool *, const char *, const char *, const char *, void *);
 static void collect_output_variable_values(struct Mempool *, const char *, const char *, const char *, void *);
+static enum ParserError scan_port_edit(struct PortReaderState *, struct Parser *, struct Mempool *, const char *, ParserEditFn, void *);
+static void scan_port(int, struct PortReaderState *);
 static void scan_port_worker(int, void *);
 static void lookup_origins_worker(int, void *);
 static struct Array *lookup_origins(struct Mempool *, struct Workqueue *, int, enum ScanFlags, struct PortscanLog *);
-static enum ASTWalkState get_default_option_descriptions_walker(struct AST *, struct Map *, struct Mempool *);
+static enum ASTWalkState get_default_option_descriptions_walker(struct AST *, void *);
 static PARSER_EDIT(get_default_option_descriptions);
-static void scan_ports(struct Workqueue *, int, struct Array *, enum ScanFlags, struct Regexp *, struct Regexp *, ssize_t, struct PortscanLog *);
+static void scan_ports(struct Workqueue *, int, int, struct Array *, enum ScanFlags, struct Regexp *, struct Regexp *, ssize_t, struct PortscanLog *, struct Profile *);
+static void parse_shard(const char *, uint32_t *, uint32_t *);
+static int open_metrics(const char *);
 static void usage(void);
 
 // Constants
 static const uint32_t DEFAULT_PROGRESSINTERVAL = 1;
+static const size_t PROFILE_SLOWEST_ORIGINS = 10;
 static struct option longopts[SCAN_LONGOPT__N + 1] = {
 	[SCAN_LONGOPT_CATEGORIES] = { "categories", no_argument, NULL, 1 },
 	[SCAN_LONGOPT_CLONES] = { "clones", no_argument, NULL, 1 },
 	[SCAN_LONGOPT_COMMENTS] = { "comments", no_argument, NULL, 1 },
+	[SCAN_LONGOPT_MERGE] = { "merge", no_argument, NULL, 1 },
+	[SCAN_LONGOPT_METRICS] = { "metrics", required_argument, NULL, 1 },
 	[SCAN_LONGOPT_OPTION_DEFAULT_DESCRIPTIONS] = { "option-default-descriptions", optional_argument, NULL, 1 },
 	[SCAN_LONGOPT_OPTIONS] = { "options", no_argument, NULL, 1 },
+	[SCAN_LONGOPT_PROFILE] = { "profile", optional_argument, NULL, 1 },
 	[SCAN_LONGOPT_PROGRESS] = { "progress", optional_argument, NULL, 1 },
+	[SCAN_LONGOPT_SHARD] = { "shard", required_argument, NULL, 1 },
 	[SCAN_LONGOPT_STRICT] = { "strict", no_argument, NULL, 1 },
+	[SCAN_LONGOPT_TRACE] = { "trace", required_argument, NULL, 1 },
 	[SCAN_LONGOPT_UNKNOWN_TARGETS] = { "unknown-targets", no_argument, NULL, 1 },
 	[SCAN_LONGOPT_UNKNOWN_VARIABLES] = { "unknown-variables", no_argument, NULL, 1 },
 	[SCAN_LONGOPT_VARIABLE_VALUES] = { "variable-values", optional_argument, NULL, 1 },
@@ -202,7 +227,7 @@ lookup_subdirs(int portsdir, const char *category, const char *path, enum ScanFl
 	struct ParserSettings settings;
 	parser_init_settings(&settings);
 	if (flags & SCAN_CATEGORIES) {
-		settings.behavior |= PARSER_OUTPUT_REFORMAT | PARSER_OUTPUT_DIFF;
+		settings.behavior |= PARSER_OUTPUT_REFORMAT | PARSER_OUTPUT_CHECK;
 	}
 
 	struct Parser *parser = parser_new(pool, &settings);
@@ -343,15 +368,35 @@ collect_output_variable_values(struct Mempool *extpool, const char *key, const c
 	}
 }
 
+enum ParserError
+scan_port_edit(struct PortReaderState *this, struct Parser *parser, struct Mempool *extpool, const char *name, ParserEditFn f, void *userdata)
+{
+	TRACE_BEGIN(name, this->origin);
+	uint64_t start = profile_clock();
+	enum ParserError error = parser_edit(parser, extpool, f, userdata);
+	profile_sample_add(this->profile_sample, PROFILE_PHASE_EDIT, name, profile_clock() - start);
+	TRACE_END(name, this->origin);
+	return error;
+}
+
 void
 scan_port_worker(int tid, void *userdata)
+{
+	struct PortReaderState *this = userdata;
+	const char *origin = this->origin;
+	TRACE_BEGIN("scan_port_worker", origin);
+	scan_port(tid, this);
+	TRACE_END("scan_port_worker", origin);
+}
+
+void
+scan_port(int tid, struct PortReaderState *this)
 {
 	SCOPE_MEMPOOL(pool);
 
-	struct PortReaderState *this = userdata;
 	this->pool = mempool_new();
 	this->origin = str_dup(this->pool, this->origin);
-	portscan_status_print(this->origin);
+	portscan_status_begin(tid, this->origin);
 	this->path = str_printf(this->pool, "%s/Makefile", this->origin);
 
 	this->comments = mempool_set(this->pool, str_compare);
@@ -368,15 +413,23 @@ scan_port_worker(int tid, void *userdata)
 	settings.behavior = PARSER_OUTPUT_RAWLINES | PARSER_LOAD_LOCAL_INCLUDES;
 	settings.filename = this->path;
 	settings.portsdir = this->portsdir;
+	settings.cache_dir = this->cachedir;
 
 	if (!(this->flags & SCAN_STRICT_VARIABLES)) {
 		settings.behavior |= PARSER_CHECK_VARIABLE_REFERENCES;
 	}
 
+	if (this->profile) {
+		this->profile_sample = profile_sample_new(this->pool, this->origin);
+		settings.profile = this->profile_sample;
+	}
+
+	uint64_t start = profile_clock();
 	FILE *in = fileopenat(pool, this->portsdir, this->path);
+	profile_sample_add(this->profile_sample, PROFILE_PHASE_OPEN, NULL, profile_clock() - start);
 	if (in == NULL) {
 		add_error(this->errors, str_printf(pool, "fileopenat: %s", strerror(errno)));
-		portscan_status_inc();
+		portscan_status_inc(tid);
 		return;
 	}
 
@@ -384,52 +437,52 @@ scan_port_worker(int tid, void *userdata)
 	enum ParserError error = parser_read_from_file(parser, in);
 	if (error != PARSER_ERROR_OK) {
 		add_error(this->errors, parser_error_tostring(parser, pool));
-		portscan_status_inc();
+		portscan_status_inc(tid);
 		return;
 	}
 
 	error = parser_read_finish(parser);
 	if (error != PARSER_ERROR_OK) {
 		add_error(this->errors, parser_error_tostring(parser, pool));
-		portscan_status_inc();
+		portscan_status_inc(tid);
 		return;
 	}
 
 	if (this->flags & SCAN_PARTIAL) {
-		error = parser_edit(parser, pool, lint_bsd_port, NULL);
+		error = scan_port_edit(this, parser, pool, "lint.bsd-port", lint_bsd_port, NULL);
 		if (error != PARSER_ERROR_OK) {
 			add_error(this->errors, parser_error_tostring(parser, pool));
-			portscan_status_inc();
+			portscan_status_inc(tid);
 			return;
 		}
 	}
 
 	if (this->flags & SCAN_UNKNOWN_VARIABLES) {
 		struct ParserEditOutput param = { unknown_variables_filter, this->query, NULL, NULL, collect_output_unknowns, this->unknown_variables, 0 };
-		error = parser_edit(parser, pool, output_unknown_variables, &param);
+		error = scan_port_edit(this, parser, pool, "output.unknown-variables", output_unknown_variables, &param);
 		if (error != PARSER_ERROR_OK) {
 			add_error(this->errors, str_printf(pool, "output.unknown-variables: %s", parser_error_tostring(parser, pool)));
-			portscan_status_inc();
+			portscan_status_inc(tid);
 			return;
 		}
 	}
 
 	if (this->flags & SCAN_UNKNOWN_TARGETS) {
 		struct ParserEditOutput param = { unknown_targets_filter, this->query, NULL, NULL, collect_output_unknowns, this->unknown_targets, 0 };
-		error = parser_edit(parser, pool, output_unknown_targets, &param);
+		error = scan_port_edit(this, parser, pool, "output.unknown-targets", output_unknown_targets, &param);
 		if (error != PARSER_ERROR_OK) {
 			add_error(this->errors, str_printf(pool, "output.unknown-targets: %s", parser_error_tostring(parser, pool)));
-			portscan_status_inc();
+			portscan_status_inc(tid);
 			return;
 		}
 	}
 
 	if (this->flags & SCAN_CLONES) {
 		// XXX: Limit by query?
-		error = parser_edit(parser, this->pool, lint_clones, &this->clones);
+		error = scan_port_edit(this, parser, this->pool, "lint.clones", lint_clones, &this->clones);
 		if (error != PARSER_ERROR_OK) {
 			add_error(this->errors, str_printf(pool, "lint.clones: %s", parser_error_tostring(parser, pool)));
-			portscan_status_inc();
+			portscan_status_inc(tid);
 			return;
 		}
 	}
@@ -469,20 +522,20 @@ scan_port_worker(int tid, void *userdata)
 
 	if (this->flags & SCAN_VARIABLE_VALUES) {
 		struct ParserEditOutput param = { variable_value_filter, this->keyquery, variable_value_filter, this->query, collect_output_variable_values, this->variable_values, 0 };
-		error = parser_edit(parser, pool, output_variable_value, &param);
+		error = scan_port_edit(this, parser, pool, "output.variable-value", output_variable_value, &param);
 		if (error != PARSER_ERROR_OK) {
 			add_error(this->errors, str_printf(pool, "output.variable-value: %s", parser_error_tostring(parser, pool)));
-			portscan_status_inc();
+			portscan_status_inc(tid);
 			return;
 		}
 	}
 
 	if (this->flags & SCAN_COMMENTS) {
 		struct Set *commented_portrevision = NULL;
-		error = parser_edit(parser, pool, lint_commented_portrevision, &commented_portrevision);
+		error = scan_port_edit(this, parser, pool, "lint.commented-portrevision", lint_commented_portrevision, &commented_portrevision);
 		if (error != PARSER_ERROR_OK) {
 			add_error(this->errors, str_printf(pool, "lint.commented-portrevision: %s", parser_error_tostring(parser, pool)));
-			portscan_status_inc();
+			portscan_status_inc(tid);
 			return;
 		}
 		SET_FOREACH(commented_portrevision, char *, comment) {
@@ -493,7 +546,7 @@ scan_port_worker(int tid, void *userdata)
 		}
 	}
 
-	portscan_status_inc();
+	portscan_status_inc(tid);
 }
 
 void
@@ -509,10 +562,12 @@ lookup_origins_worker(int tid, void *userdata)
 	this->unsorted = mempool_array(pool);
 	this->origins = mempool_array(pool);
 
-	portscan_status_print(this->category);
+	TRACE_BEGIN("lookup_origins_worker", this->category);
+	portscan_status_begin(tid, this->category);
 	char *path = str_printf(pool, "%s/Makefile", this->category);
 	lookup_subdirs(this->portsdir, this->category, path, this->flags, this->pool, this->origins, this->nonexistent, this->unhooked, this->unsorted, this->error_origins, this->error_msgs);
-	portscan_status_inc();
+	portscan_status_inc(tid);
+	TRACE_END("lookup_origins_worker", this->category);
 }
 
 struct Array *
@@ -541,7 +596,9 @@ lookup_origins(struct Mempool *extpool, struct Workqueue *workqueue, int portsdi
 		workqueue_push(workqueue, lookup_origins_worker, this);
 		array_append(results, this);
 	}
+	TRACE_BEGIN("workqueue_wait", NULL);
 	workqueue_wait(workqueue);
+	TRACE_END("workqueue_wait", NULL);
 	ARRAY_FOREACH(results, struct CategoryReaderState *, result) {
 		ARRAY_FOREACH(result->error_origins, char *, origin) {
 			char *msg = array_get(result->error_msgs, origin_index);
@@ -570,33 +627,34 @@ lookup_origins(struct Mempool *extpool, struct Workqueue *workqueue, int portsdi
 }
 
 enum ASTWalkState
-get_default_option_descriptions_walker(struct AST *node, struct Map *this, struct Mempool *pool)
+get_default_option_descriptions_walker(struct AST *node, void *userdata)
 {
-	switch (node->type) {
-	case AST_VARIABLE:
-		if (str_endswith(node->variable.name, "_DESC") &&
-		    !map_contains(this, node->variable.name)) {
-			map_add(this, str_dup(pool, node->variable.name), str_join(pool, node->variable.words, " "));
-		}
-		break;
-	default:
-		break;
+	struct DefaultOptionDescriptionsState *this = userdata;
+	if (str_endswith(node->variable.name, "_DESC") &&
+	    !map_contains(this->descriptions, node->variable.name)) {
+		map_add(this->descriptions, str_dup(this->pool, node->variable.name), str_join(this->pool, node->variable.words, " "));
 	}
 
-	AST_WALK_DEFAULT(get_default_option_descriptions_walker, node, this, pool);
 	return AST_WALK_CONTINUE;
 }
 
 PARSER_EDIT(get_default_option_descriptions)
 {
 	struct Map *default_option_descriptions = mempool_map(extpool, str_compare);
-	get_default_option_descriptions_walker(root, default_option_descriptions, extpool);
+	ast_walk(root, &(struct ASTWalker){
+		.types = AST_WALK_TYPE(AST_VARIABLE),
+		.pre = get_default_option_descriptions_walker,
+		.userdata = &(struct DefaultOptionDescriptionsState){
+			.descriptions = default_option_descriptions,
+			.pool = extpool,
+		},
+	});
 	struct Map **retval = (struct Map **)userdata;
 	*retval = default_option_descriptions;
 }
 
 void
-scan_ports(struct Workqueue *workqueue, int portsdir, struct Array *origins, enum ScanFlags flags, struct Regexp *keyquery, struct Regexp *query, ssize_t editdist, struct PortscanLog *retval)
+scan_ports(struct Workqueue *workqueue, int portsdir, int cachedir, struct Array *origins, enum ScanFlags flags, struct Regexp *keyquery, struct Regexp *query, ssize_t editdist, struct PortscanLog *retval, struct Profile *profile)
 {
 	SCOPE_MEMPOOL(pool);
 
@@ -642,18 +700,22 @@ scan_ports(struct Workqueue *workqueue, int portsdir, struct Array *origins, enu
 	ARRAY_FOREACH(origins, const char *, origin) {
 		struct PortReaderState *this = mempool_alloc(pool, sizeof(struct PortReaderState));
 		this->portsdir = portsdir;
+		this->cachedir = cachedir;
 		this->origin = origin;
 		this->keyquery = keyquery;
 		this->query = query;
 		this->editdist = editdist;
 		this->flags = flags;
 		this->default_option_descriptions = default_option_descriptions;
+		this->profile = profile != NULL;
 		workqueue_push(workqueue, scan_port_worker, this);
 		array_append(results, this);
 	}
+	TRACE_BEGIN("workqueue_wait", NULL);
 	workqueue_wait(workqueue);
+	TRACE_END("workqueue_wait", NULL);
 	ARRAY_FOREACH(results, struct PortReaderState *, this) {
-		portscan_status_print(NULL);
+		portscan_status_print();
 		portscan_log_add_entries(retval, PORTSCAN_LOG_ENTRY_ERROR, this->origin, this->errors);
 		portscan_log_add_entries(retval, PORTSCAN_LOG_ENTRY_UNKNOWN_VAR, this->origin, this->unknown_variables);
 		portscan_log_add_entries(retval, PORTSCAN_LOG_ENTRY_UNKNOWN_TARGET, this->origin, this->unknown_targets);
@@ -663,14 +725,62 @@ scan_ports(struct Workqueue *workqueue, int portsdir, struct Array *origins, enu
 		portscan_log_add_entries(retval, PORTSCAN_LOG_ENTRY_OPTION, this->origin, this->options);
 		portscan_log_add_entries(retval, PORTSCAN_LOG_ENTRY_VARIABLE_VALUE, this->origin, this->variable_values);
 		portscan_log_add_entries(retval, PORTSCAN_LOG_ENTRY_COMMENT, this->origin, this->comments);
+		profile_add_sample(profile, this->profile_sample);
 		mempool_free(this->pool);
 	}
 }
 
+void
+parse_shard(const char *s, uint32_t *shard, uint32_t *shards)
+{
+	SCOPE_MEMPOOL(pool);
+
+	const char *sep = strchr(s, '/');
+	if (sep == NULL) {
+		errx(1, "--shard=%s: expected <i>/<n>", s);
+	}
+
+	const char *error;
+	char *count = str_dup(pool, sep + 1);
+	*shards = strtonum(count, 1, UINT32_MAX, &error);
+	if (error) {
+		errx(1, "--shard=%s: shard count is %s (must be >=1)", s, error);
+	}
+	char *index = str_ndup(pool, s, sep - s);
+	*shard = strtonum(index, 1, *shards, &error);
+	if (error) {
+		errx(1, "--shard=%s: shard index is %s (must be between 1 and %" PRIu32 ")", s, error, *shards);
+	}
+	// Shards are numbered from 1 on the command line
+	*shard -= 1;
+}
+
+int
+open_metrics(const char *path)
+{
+	// A plain number refers to an already open file descriptor
+	const char *error;
+	int fd = strtonum(path, 0, INT_MAX, &error);
+	if (error == NULL) {
+		fd = dup(fd);
+		if (fd == -1) {
+			err(1, "--metrics=%s", path);
+		}
+		return fd;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		err(1, "--metrics=%s", path);
+	}
+	return fd;
+}
+
 void
 usage()
 {
-	fprintf(stderr, "usage: portscan [-l <logdir>] [-p <portsdir>] [-q <regexp>] [--<check> ...] [<origin1> ...]\n");
+	fprintf(stderr, "usage: portscan [-l <logdir>] [-p <portsdir>] [-q <regexp>] [--metrics=<fd|file>] [--profile[=<file>]] [--shard=<i>/<n>] [--trace=<file>] [--<check> ...] [<origin1> ...]\n");
+	fprintf(stderr, "       portscan [-l <logdir>] [-p <portsdir>] --merge <log1> ...\n");
 	exit(EX_USAGE);
 }
 
@@ -683,7 +793,14 @@ main(int argc, char *argv[])
 	const char *logdir_path = NULL;
 	const char *keyquery = NULL;
 	const char *query = NULL;
+	const char *metrics_path = NULL;
+	const char *trace_path = NULL;
 	uint32_t progressinterval = 0;
+	uint32_t shard = 0;
+	uint32_t shards = 1;
+	bool merge = false;
+	bool profile = false;
+	const char *profile_table_path = NULL;
 
 	struct ScanLongoptsState opts[SCAN_LONGOPT__N] = {};
 	for (enum ScanLongopts i = 0; i < SCAN_LONGOPT__N; i++) {
@@ -756,18 +873,34 @@ main(int argc, char *argv[])
 		case SCAN_LONGOPT_COMMENTS:
 			flags |= SCAN_COMMENTS;
 			break;
+		case SCAN_LONGOPT_MERGE:
+			merge = true;
+			break;
+		case SCAN_LONGOPT_METRICS:
+			metrics_path = opts[i].optarg;
+			break;
 		case SCAN_LONGOPT_OPTION_DEFAULT_DESCRIPTIONS:
 			flags |= SCAN_OPTION_DEFAULT_DESCRIPTIONS;
 			break;
 		case SCAN_LONGOPT_OPTIONS:
 			flags |= SCAN_OPTIONS;
 			break;
+		case SCAN_LONGOPT_PROFILE:
+			profile = true;
+			profile_table_path = opts[i].optarg;
+			break;
 		case SCAN_LONGOPT_PROGRESS:
 			progressinterval = DEFAULT_PROGRESSINTERVAL;
 			break;
+		case SCAN_LONGOPT_SHARD:
+			parse_shard(opts[i].optarg, &shard, &shards);
+			break;
 		case SCAN_LONGOPT_STRICT:
 			strict_variables = true;
 			break;
+		case SCAN_LONGOPT_TRACE:
+			trace_path = opts[i].optarg;
+			break;
 		case SCAN_LONGOPT_UNKNOWN_TARGETS:
 			flags |= SCAN_UNKNOWN_TARGETS;
 			break;
@@ -800,18 +933,101 @@ main(int argc, char *argv[])
 		progressinterval = DEFAULT_PROGRESSINTERVAL;
 	}
 
+	if (merge && shards > 1) {
+		errx(1, "--merge and --shard are mutually exclusive");
+	}
+	if (merge && argc == 0) {
+		usage();
+	}
+
+	int metrics_fd = -1;
+	if (metrics_path) {
+		metrics_fd = open_metrics(metrics_path);
+	}
+
 #if HAVE_CAPSICUM
 	if (caph_limit_stdio() < 0) {
 		err(1, "caph_limit_stdio");
 	}
 
-	closefrom(STDERR_FILENO + 1);
+	if (metrics_fd != -1) {
+		// Keep the metrics stream open right after stderr
+		if (metrics_fd != STDERR_FILENO + 1) {
+			if (dup2(metrics_fd, STDERR_FILENO + 1) == -1) {
+				err(1, "dup2");
+			}
+			metrics_fd = STDERR_FILENO + 1;
+		}
+		closefrom(STDERR_FILENO + 2);
+		if (caph_limit_stream(metrics_fd, CAPH_WRITE) < 0) {
+			err(1, "caph_limit_stream");
+		}
+	} else {
+		closefrom(STDERR_FILENO + 1);
+	}
 	close(STDIN_FILENO);
 #endif
 
-	int portsdir = open(portsdir_path, O_DIRECTORY);
-	if (portsdir == -1) {
-		err(1, "open: %s", portsdir_path);
+	FILE *metrics = NULL;
+	if (metrics_fd != -1) {
+		metrics = fdopen(metrics_fd, "w");
+		if (metrics == NULL) {
+			err(1, "fdopen");
+		}
+		mempool_add(pool, metrics, fclose);
+	}
+
+	// The ports tree is only needed by --merge to look up the
+	// commit hash for the log directory
+	int portsdir = -1;
+	if (!merge || logdir_path != NULL) {
+		portsdir = open(portsdir_path, O_DIRECTORY);
+		if (portsdir == -1) {
+			err(1, "open: %s", portsdir_path);
+		}
+	}
+
+	// Open the shard logs before entering the sandbox
+	struct Array *merge_inputs = mempool_array(pool);
+	if (merge) {
+		for (int i = 0; i < argc; i++) {
+			FILE *fp = mempool_fopenat(pool, AT_FDCWD, argv[i], "r", 0);
+			if (fp == NULL) {
+				err(1, "open: %s", argv[i]);
+			}
+#if HAVE_CAPSICUM
+			if (caph_limit_stream(fileno(fp), CAPH_READ) < 0) {
+				err(1, "caph_limit_stream: %s", argv[i]);
+			}
+#endif
+			array_append(merge_inputs, fp);
+		}
+	}
+
+	if (trace_path) {
+		FILE *trace = mempool_fopenat(pool, AT_FDCWD, trace_path, "w", 0644);
+		if (trace == NULL) {
+			err(1, "open: %s", trace_path);
+		}
+#if HAVE_CAPSICUM
+		if (caph_limit_stream(fileno(trace), CAPH_WRITE) < 0) {
+			err(1, "caph_limit_stream: %s", trace_path);
+		}
+#endif
+		trace_start(trace);
+	}
+
+	FILE *profile_table = NULL;
+	if (profile_table_path) {
+		profile_table = mempool_fopenat(pool, AT_FDCWD, profile_table_path, "w", 0644);
+		if (profile_table == NULL) {
+			err(1, "open: %s", profile_table_path);
+		}
+#if HAVE_CAPSICUM
+		if (caph_limit_stream(fileno(profile_table), CAPH_WRITE) < 0) {
+			err(1, "caph_limit_stream: %s", profile_table_path);
+		}
+#endif
 	}
 
 	struct PortscanLogDir *logdir = NULL;
@@ -825,8 +1041,11 @@ main(int argc, char *argv[])
 		out = NULL;
 	}
 
+	int cachedir = open_cache_dir();
+
 #if HAVE_CAPSICUM
-	if (caph_limit_stream(portsdir, CAPH_LOOKUP | CAPH_READ | CAPH_READDIR) < 0) {
+	if (portsdir != -1 &&
+	    caph_limit_stream(portsdir, CAPH_LOOKUP | CAPH_READ | CAPH_READDIR) < 0) {
 		err(1, "caph_limit_stream");
 	}
 
@@ -842,7 +1061,7 @@ main(int argc, char *argv[])
 			errx(1, "--progress=%s is %s (must be >=1)", opts[SCAN_LONGOPT_PROGRESS].optarg, error);
 		}
 	}
-	portscan_status_init(progressinterval);
+	portscan_status_init(progressinterval, metrics);
 
 	struct Regexp *keyquery_regexp = NULL;
 	if (keyquery) {
@@ -868,51 +1087,89 @@ main(int argc, char *argv[])
 		}
 	}
 
-	struct Workqueue *workqueue = mempool_workqueue(pool, 0);
-	struct PortscanLog *result = portscan_log_new(pool);
-	struct Array *origins = NULL;
-	if (argc == 0) {
-		origins = lookup_origins(pool, workqueue, portsdir, flags, result);
+	struct PortscanLog *result = NULL;
+	if (merge) {
+		struct Array *logs = mempool_array(pool);
+		ARRAY_FOREACH(merge_inputs, FILE *, fp) {
+			array_append(logs, portscan_log_read_from_file(pool, fp));
+		}
+		result = portscan_log_merge(pool, logs);
 	} else {
-		flags |= SCAN_PARTIAL;
-		origins = mempool_array(pool);
-		for (int i = 0; i < argc; i++) {
-			array_append(origins, str_dup(pool, argv[i]));
+		struct Workqueue *workqueue = mempool_workqueue(pool, 0);
+		result = portscan_log_new(pool);
+		struct Array *origins = NULL;
+		if (argc == 0) {
+			origins = lookup_origins(pool, workqueue, portsdir, flags, result);
+		} else {
+			flags |= SCAN_PARTIAL;
+			origins = mempool_array(pool);
+			for (int i = 0; i < argc; i++) {
+				array_append(origins, str_dup(pool, argv[i]));
+			}
 		}
+
+		if (shards > 1) {
+			struct Array *shard_origins = mempool_array(pool);
+			ARRAY_FOREACH(origins, char *, origin) {
+				if (portscan_log_origin_in_shard(origin, shard, shards)) {
+					array_append(shard_origins, origin);
+				}
+			}
+			origins = shard_origins;
+		}
+
+		struct Profile *scan_profile = NULL;
+		if (profile) {
+			scan_profile = profile_new(pool);
+		}
+
+		portscan_status_reset(PORTSCAN_STATUS_PORTS, array_len(origins));
+		scan_ports(workqueue, portsdir, cachedir, origins, flags, keyquery_regexp, query_regexp, editdist, result, scan_profile);
+		if (scan_profile) {
+			profile_report(scan_profile, stderr, PROFILE_SLOWEST_ORIGINS);
+			if (profile_table) {
+				profile_dump(scan_profile, profile_table);
+			}
+		}
+
+		// Entries not tied to a scanned port (category checks, errors
+		// in Mk/) are produced by every shard.  Keep only the ones
+		// whose origin belongs to this shard so that merging all
+		// shard logs yields the same log as an unsharded run.
+		portscan_log_shard(result, shard, shards);
+		trace_stop();
 	}
 
-	portscan_status_reset(PORTSCAN_STATUS_PORTS, array_len(origins));
-	scan_ports(workqueue, portsdir, origins, flags, keyquery_regexp, query_regexp, editdist, result);
 	if (portscan_log_len(result) > 0) {
 		if (logdir != NULL) {
 			struct PortscanLog *prev_result = portscan_log_read_all(pool, logdir, PORTSCAN_LOG_LATEST);
 			if (portscan_log_compare(prev_result, result)) {
-				if (progressinterval) {
+				if (progressinterval || metrics) {
 					portscan_status_reset(PORTSCAN_STATUS_FINISHED, 0);
-					portscan_status_print(NULL);
+					portscan_status_print();
 				}
 				warnx("no changes compared to previous result");
 				return 2;
 			}
-			if (progressinterval) {
+			if (progressinterval || metrics) {
 				portscan_status_reset(PORTSCAN_STATUS_FINISHED, 0);
-				portscan_status_print(NULL);
+				portscan_status_print();
 			}
 			if (!portscan_log_serialize_to_dir(result, logdir)) {
 				err(1, "portscan_log_serialize_to_dir");
 			}
 		} else {
-			if (progressinterval) {
+			if (progressinterval || metrics) {
 				portscan_status_reset(PORTSCAN_STATUS_FINISHED, 0);
-				portscan_status_print(NULL);
+				portscan_status_print();
 			}
 			if (!portscan_log_serialize_to_file(result, out)) {
 				err(1, "portscan_log_serialize");
 			}
 		}
-	} else if (progressinterval) {
+	} else if (progressinterval || metrics) {
 		portscan_status_reset(PORTSCAN_STATUS_FINISHED, 0);
-		portscan_status_print(NULL);
+		portscan_status_print();
 	}
 
 	return 0;
@@ -60,6 +60,7 @@
 
 #include "capsicum_helpers.h"
 #include "portscan/log.h"
+#include "stats.h"
 
 struct PortscanLogDir {
 	int fd;
@@ -87,6 +88,7 @@ static struct PortscanLogEntry *log_entry_parse(struct Mempool *, const char *);
 static int log_update_latest(struct PortscanLogDir *, const char *);
 static char *log_filename(const char *, struct Mempool *);
 static char *log_commit(int, struct Mempool *);
+static uint32_t log_origin_hash(const char *);
 
 // Constants
 static const char *PORTSCAN_LOG_DATE_FORMAT = "portscan-%Y%m%d%H%M%S";
@@ -99,6 +101,7 @@ static struct CompareTrait *log_entry_compare = &(struct CompareTrait){
 struct PortscanLog *
 portscan_log_new(struct Mempool *extpool)
 {
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
 	struct Mempool *pool = mempool_new();
 	struct PortscanLog *log = mempool_alloc(pool, sizeof(struct PortscanLog));
 	log->pool = pool;
@@ -175,6 +178,7 @@ portscan_log_add_entries(struct PortscanLog *log, enum PortscanLogEntryType type
 void
 portscan_log_add_entry(struct PortscanLog *log, enum PortscanLogEntryType type, const char *origin, const char *value)
 {
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
 	struct PortscanLogEntry *entry = mempool_alloc(log->pool, sizeof(struct PortscanLogEntry));
 	entry->type = type;
 	entry->index = array_len(log->entries);
@@ -272,9 +276,87 @@ DEFINE_COMPARE(compare_log_entry, struct PortscanLogEntry, void)
 	return retval;
 }
 
+uint32_t
+log_origin_hash(const char *origin)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261U;
+	for (const char *s = origin; *s != 0; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+bool
+portscan_log_origin_in_shard(const char *origin, uint32_t shard, uint32_t shards)
+{
+	if (shards <= 1) {
+		return true;
+	}
+	return log_origin_hash(origin) % shards == shard;
+}
+
+void
+portscan_log_shard(struct PortscanLog *log, uint32_t shard, uint32_t shards)
+{
+	if (shards <= 1) {
+		return;
+	}
+
+	struct Array *entries = mempool_array(log->pool);
+	ARRAY_FOREACH(log->entries, struct PortscanLogEntry *, entry) {
+		if (portscan_log_origin_in_shard(entry->origin, shard, shards)) {
+			entry->index = array_len(entries);
+			array_append(entries, entry);
+		}
+	}
+	log->entries = entries;
+}
+
+struct PortscanLog *
+portscan_log_merge(struct Mempool *extpool, struct Array *logs)
+{
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
+	SCOPE_MEMPOOL(pool);
+
+	struct PortscanLog *log = portscan_log_new(extpool);
+
+	// k-way merge of the sorted input logs.  The number of logs
+	// is small (one per shard) so a linear scan for the smallest
+	// head entry is good enough.
+	size_t *heads = mempool_alloc(pool, (array_len(logs) + 1) * sizeof(size_t));
+	ARRAY_FOREACH(logs, struct PortscanLog *, input) {
+		portscan_log_sort(input);
+		heads[input_index] = 0;
+	}
+	for (;;) {
+		struct PortscanLogEntry *min = NULL;
+		size_t min_index = 0;
+		ARRAY_FOREACH(logs, struct PortscanLog *, input) {
+			struct PortscanLogEntry *entry = array_get(input->entries, heads[input_index]);
+			if (entry == NULL) {
+				continue;
+			}
+			if (min == NULL || compare_log_entry(&entry, &min, NULL) < 0) {
+				min = entry;
+				min_index = input_index;
+			}
+		}
+		if (min == NULL) {
+			break;
+		}
+		heads[min_index]++;
+		portscan_log_add_entry(log, min->type, min->origin, min->value);
+	}
+
+	return log;
+}
+
 int
 portscan_log_compare(struct PortscanLog *prev, struct PortscanLog *log)
 {
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
 	SCOPE_MEMPOOL(pool);
 
 	portscan_log_sort(prev);
@@ -298,6 +380,7 @@ portscan_log_compare(struct PortscanLog *prev, struct PortscanLog *log)
 int
 portscan_log_serialize_to_file(struct PortscanLog *log, FILE *out)
 {
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
 	SCOPE_MEMPOOL(pool);
 
 	portscan_log_sort(log);
@@ -455,41 +538,49 @@ portscan_log_dir_close(struct PortscanLogDir *dir)
 	free(dir);
 }
 
+struct PortscanLog *
+portscan_log_read_from_file(struct Mempool *extpool, FILE *fp)
+{
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
+	struct PortscanLog *log = portscan_log_new(extpool);
+
+	LINE_FOREACH(fp, line) {
+		struct PortscanLogEntry *entry = log_entry_parse(log->pool, line);
+		if (entry != NULL) {
+			entry->index = array_len(log->entries);
+			array_append(log->entries, entry);
+		}
+	}
+
+	portscan_log_sort(log);
+
+	return log;
+}
+
 struct PortscanLog *
 portscan_log_read_all(struct Mempool *extpool, struct PortscanLogDir *logdir, const char *log_path)
 {
+	STATS_SCOPE(STATS_PORTSCAN_LOG);
 	SCOPE_MEMPOOL(pool);
 
-	struct PortscanLog *log = portscan_log_new(extpool);
-
 	char *buf = symlink_read(logdir->fd, log_path, pool);
 	if (buf == NULL) {
 		if (errno == ENOENT) {
-			return log;
+			return portscan_log_new(extpool);
 		} else if (errno != EINVAL) {
 			err(1, "symlink_read: %s", log_path);
 		}
 	} else if (strcmp(buf, PORTSCAN_LOG_INIT) == 0) {
-		return log;
+		return portscan_log_new(extpool);
 	}
 
 	FILE *fp = mempool_fopenat(pool, logdir->fd, log_path, "r", 0);
 	if (fp == NULL) {
 		if (errno == ENOENT) {
-			return log;
+			return portscan_log_new(extpool);
 		}
 		err(1, "openat: %s", log_path);
 	}
 
-	LINE_FOREACH(fp, line) {
-		struct PortscanLogEntry *entry = log_entry_parse(log->pool, line);
-		if (entry != NULL) {
-			array_append(log->entries, entry);
-		}
-	}
-
-	portscan_log_sort(log);
-
-	return log;
+	return portscan_log_read_from_file(extpool, fp);
 }
-
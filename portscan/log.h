@@ -27,6 +27,7 @@
  */
 #pragma once
 
+struct Array;
 struct Mempool;
 struct PortscanLog;
 struct PortscanLogDir;
@@ -57,6 +58,8 @@ void portscan_log_dir_close(struct PortscanLogDir *);
 
 struct PortscanLog *portscan_log_new(struct Mempool *);
 struct PortscanLog *portscan_log_read_all(struct Mempool *, struct PortscanLogDir *, const char *);
+struct PortscanLog *portscan_log_read_from_file(struct Mempool *, FILE *);
+struct PortscanLog *portscan_log_merge(struct Mempool *, struct Array *);
 void portscan_log_free(struct PortscanLog *);
 
 size_t portscan_log_len(struct PortscanLog *);
@@ -65,3 +68,6 @@ void portscan_log_add_entry(struct PortscanLog *, enum PortscanLogEntryType, con
 int portscan_log_compare(struct PortscanLog *, struct PortscanLog *);
 int portscan_log_serialize_to_file(struct PortscanLog *, FILE *);
 int portscan_log_serialize_to_dir(struct PortscanLog *, struct PortscanLogDir *);
+
+bool portscan_log_origin_in_shard(const char *, uint32_t, uint32_t);
+void portscan_log_shard(struct PortscanLog *, uint32_t, uint32_t);
@@ -29,14 +29,18 @@
 #include "config.h"
 
 #include <sys/param.h>
+#include <sys/resource.h>
 #if HAVE_ERR
 # include <err.h>
 #endif
+#include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,42 +48,72 @@
 #include <unistd.h>
 
 #include <libias/array.h>
+#include <libias/mem.h>
 #include <libias/mempool.h>
 #include <libias/str.h>
 
 #include "portscan/status.h"
 
+struct PortscanStatusWorker {
+	_Atomic(const char *) path;
+	atomic_uint_least64_t busy_start;
+	atomic_uint_least64_t busy;
+	atomic_size_t tasks;
+};
+
 // Prototypes
+static uint64_t portscan_status_now(void);
 static void portscan_status_signal_handler(int);
 static void portscan_status_print_progress(void);
+static void portscan_status_print_metrics(void);
+static void portscan_status_report(bool);
+static void portscan_status_report_locked(bool);
+static void *portscan_status_timer(void *);
+static void json_string(FILE *, const char *);
 
-static enum PortscanState state = PORTSCAN_STATUS_START;
+static _Atomic(enum PortscanState) state = PORTSCAN_STATUS_START;
 static struct timespec tic;
 static uint32_t interval;
+static uint32_t timer_interval;
+static pthread_mutex_t report_mtx = PTHREAD_MUTEX_INITIALIZER;
+static FILE *metrics;
 static atomic_int status_requested = ATOMIC_VAR_INIT(0);
 static atomic_size_t scanned = ATOMIC_VAR_INIT(0);
+static atomic_size_t started = ATOMIC_VAR_INIT(0);
+static atomic_uint_least64_t state_tic = ATOMIC_VAR_INIT(0);
 static size_t max_scanned;
 
 static struct {
-	char buf[32][PATH_MAX];
+	struct PortscanStatusWorker *buf;
 	size_t len;
-	atomic_size_t i;
-} current_paths;
+} workers;
 static const char *endline = "\n";
 static const char *startline = "";
 
 void
-portscan_status_init(uint32_t progress_interval)
+portscan_status_init(uint32_t progress_interval, FILE *metrics_out)
 {
 	ssize_t n_threads = sysconf(_SC_NPROCESSORS_ONLN);
 	if (n_threads < 0) {
 		err(1, "sysconf");
 	}
-	current_paths.len = MIN(32, n_threads);
-	current_paths.i = 0;
+	workers.len = n_threads;
+	workers.buf = xmalloc(workers.len * sizeof(struct PortscanStatusWorker));
+	for (size_t i = 0; i < workers.len; i++) {
+		atomic_init(&workers.buf[i].path, NULL);
+		atomic_init(&workers.buf[i].busy_start, 0);
+		atomic_init(&workers.buf[i].busy, 0);
+		atomic_init(&workers.buf[i].tasks, 0);
+	}
 
 	interval = progress_interval;
+	metrics = metrics_out;
+	timer_interval = interval;
+	if (metrics && timer_interval == 0) {
+		timer_interval = 1;
+	}
 	clock_gettime(CLOCK_MONOTONIC, &tic);
+	state_tic = portscan_status_now();
 
 	if (isatty(STDERR_FILENO)) {
 		endline = "";
@@ -94,17 +128,48 @@ portscan_status_init(uint32_t progress_interval)
 	if (signal(SIGUSR2, portscan_status_signal_handler)) {
 		err(1, "signal");
 	}
-	if (interval) {
-		if (signal(SIGALRM, portscan_status_signal_handler)) {
-			err(1, "signal");
+	if (timer_interval) {
+		pthread_t timer;
+		if ((errno = pthread_create(&timer, NULL, portscan_status_timer, NULL)) != 0) {
+			err(1, "pthread_create");
 		}
-		alarm(interval);
+		pthread_detach(timer);
 	}
 }
 
+uint64_t
+portscan_status_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 void
-portscan_status_inc()
+portscan_status_begin(int tid, const char *path)
 {
+	started++;
+	if (tid >= 0 && (size_t)tid < workers.len) {
+		struct PortscanStatusWorker *worker = &workers.buf[tid];
+		worker->path = path;
+		worker->busy_start = portscan_status_now();
+	}
+
+	portscan_status_print();
+}
+
+void
+portscan_status_inc(int tid)
+{
+	if (tid >= 0 && (size_t)tid < workers.len) {
+		struct PortscanStatusWorker *worker = &workers.buf[tid];
+		uint64_t start = atomic_exchange(&worker->busy_start, 0);
+		if (start > 0) {
+			worker->busy += portscan_status_now() - start;
+		}
+		worker->path = NULL;
+		worker->tasks++;
+	}
 	scanned++;
 }
 
@@ -113,13 +178,12 @@ portscan_status_reset(enum PortscanState new_state, size_t max)
 {
 	state = new_state;
 	scanned = 0;
+	started = 0;
+	state_tic = portscan_status_now();
 	max_scanned = max;
-	if (interval) {
+	if (timer_interval) {
 		status_requested = SIGALRM;
 	}
-	for (size_t i = 0; i < current_paths.len; i++) {
-		current_paths.buf[i][0] = 0;
-	}
 }
 
 void
@@ -137,30 +201,138 @@ portscan_status_print_progress()
 		fprintf(stderr, "%s[  0%%] starting (%ds)%s", startline, seconds, endline);
 		break;
 	case PORTSCAN_STATUS_CATEGORIES:
-		fprintf(stderr, "%s[%3d%%] scanning categories %zu/%zu (%ds)%s", startline, percent, scanned, max_scanned, seconds, endline);
+		fprintf(stderr, "%s[%3d%%] scanning categories %zu/%zu (%ds)%s", startline, percent, (size_t)scanned, max_scanned, seconds, endline);
 		break;
 	case PORTSCAN_STATUS_PORTS:
-		fprintf(stderr, "%s[%3d%%] scanning ports %zu/%zu (%ds)%s", startline, percent, scanned, max_scanned, seconds, endline);
+		fprintf(stderr, "%s[%3d%%] scanning ports %zu/%zu (%ds)%s", startline, percent, (size_t)scanned, max_scanned, seconds, endline);
 		break;
 	case PORTSCAN_STATUS_FINISHED:
 		// End output with newline
 		fprintf(stderr, "%s[100%%] finished in %ds\n", startline, seconds);
 		break;
 	}
-	if (interval) {
-		alarm(interval);
-	}
 
 	fflush(stderr);
 }
 
 void
-portscan_status_print(const char *port)
+json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s != 0; s++) {
+		if (*s == '"' || *s == '\\') {
+			fprintf(out, "\\%c", *s);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		} else {
+			fputc(*s, out);
+		}
+	}
+	fputc('"', out);
+}
+
+void
+portscan_status_print_metrics()
 {
-	if (port) {
-		strlcpy(current_paths.buf[current_paths.i++ % current_paths.len], port, PATH_MAX);
+	uint64_t now = portscan_status_now();
+	uint64_t start = (uint64_t)tic.tv_sec * 1000000000 + tic.tv_nsec;
+	double elapsed = (now - start) / 1000000000.0;
+	double state_elapsed = (now - state_tic) / 1000000000.0;
+	size_t done = scanned;
+	size_t queued = started;
+	if (queued < max_scanned) {
+		queued = max_scanned - queued;
+	} else {
+		queued = 0;
 	}
 
+	double rate = 0;
+	if (state_elapsed > 0) {
+		rate = done / state_elapsed;
+	}
+	double eta = -1;
+	if (rate > 0 && done <= max_scanned) {
+		eta = (max_scanned - done) / rate;
+	} else if (state == PORTSCAN_STATUS_FINISHED) {
+		eta = 0;
+	}
+
+	long maxrss = 0;
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		maxrss = ru.ru_maxrss;
+	}
+
+	fprintf(metrics, "{\"time\":%.3f,\"phase\":\"%s\",\"scanned\":%zu,\"total\":%zu,"
+		"\"rate\":%.3f,\"eta\":%.3f,\"queue\":%zu,\"maxrss\":%ld,\"workers\":[",
+		elapsed, PortscanState_human(state), done, max_scanned,
+		rate, eta, queued, maxrss);
+	for (size_t i = 0; i < workers.len; i++) {
+		struct PortscanStatusWorker *worker = &workers.buf[i];
+		uint64_t busy = worker->busy;
+		uint64_t busy_start = worker->busy_start;
+		if (busy_start > 0 && busy_start < now) {
+			busy += now - busy_start;
+		}
+		double busy_seconds = busy / 1000000000.0;
+		double idle_seconds = elapsed - busy_seconds;
+		if (idle_seconds < 0) {
+			idle_seconds = 0;
+		}
+		fprintf(metrics, "%s{\"id\":%zu,\"busy\":%.3f,\"idle\":%.3f,\"tasks\":%zu,\"current\":",
+			i > 0 ? "," : "", i, busy_seconds, idle_seconds, (size_t)worker->tasks);
+		const char *path = worker->path;
+		if (path) {
+			json_string(metrics, path);
+		} else {
+			fputs("null", metrics);
+		}
+		fputc('}', metrics);
+	}
+	fputs("]}\n", metrics);
+	fflush(metrics);
+}
+
+void
+portscan_status_report(bool progress)
+{
+	pthread_mutex_lock(&report_mtx);
+	portscan_status_report_locked(progress);
+	pthread_mutex_unlock(&report_mtx);
+}
+
+void
+portscan_status_report_locked(bool progress)
+{
+	if (progress) {
+		portscan_status_print_progress();
+	}
+	if (metrics) {
+		portscan_status_print_metrics();
+	}
+}
+
+void *
+portscan_status_timer(void *userdata)
+// Periodic reports are written from their own thread so that they
+// keep coming while all workers are busy with slow ports.  The last
+// report after the scan has finished is up to the main thread.
+{
+	for (;;) {
+		sleep(timer_interval);
+		pthread_mutex_lock(&report_mtx);
+		if (state == PORTSCAN_STATUS_FINISHED) {
+			pthread_mutex_unlock(&report_mtx);
+			return NULL;
+		}
+		portscan_status_report_locked(interval > 0);
+		pthread_mutex_unlock(&report_mtx);
+	}
+}
+
+void
+portscan_status_print()
+{
 	int expected = SIGUSR2;
 	if (atomic_compare_exchange_strong(&status_requested, &expected, 0)) {
 		const char *name = NULL;
@@ -171,35 +343,29 @@ portscan_status_print(const char *port)
 		}
 		if (name) {
 			SCOPE_MEMPOOL(pool);
-			struct Array *ports = mempool_array(pool);
-			for (size_t i = 0; i < current_paths.len; i++) {
-				if (*current_paths.buf[i] != 0) {
-					array_append(ports, current_paths.buf[i]);
+			struct Array *paths = mempool_array(pool);
+			for (size_t i = 0; i < workers.len; i++) {
+				const char *path = workers.buf[i].path;
+				if (path) {
+					array_append(paths, path);
 				}
 			}
-			fprintf(stderr, "Current %s: %s\n", name, str_join(pool, ports, ", "));
+			fprintf(stderr, "Current %s: %s\n", name, str_join(pool, paths, ", "));
 		}
 
-		portscan_status_print_progress();
+		portscan_status_report(true);
 		return;
 	}
 
 	expected = SIGALRM;
 	if (atomic_compare_exchange_strong(&status_requested, &expected, 0)) {
-		portscan_status_print_progress();
+		portscan_status_report(interval > 0);
 	}
 }
 
 void
 portscan_status_signal_handler(int si)
 {
-	if (si == SIGALRM) {
-		status_requested = SIGALRM;
-#ifdef SIGINFO
-	} else if (si == SIGINFO) {
-		status_requested = SIGUSR2;
-#endif
-	} else if (si == SIGUSR2) {
-		status_requested = SIGUSR2;
-	}
+	// Only installed for SIGINFO and SIGUSR2
+	status_requested = SIGUSR2;
 }
@@ -29,15 +29,17 @@
 #pragma once
 
 enum PortscanState {
-	PORTSCAN_STATUS_START,
-	PORTSCAN_STATUS_CATEGORIES,
-	PORTSCAN_STATUS_PORTS,
-	PORTSCAN_STATUS_FINISHED,
+	PORTSCAN_STATUS_START,		// human:"start"
+	PORTSCAN_STATUS_CATEGORIES,	// human:"categories"
+	PORTSCAN_STATUS_PORTS,		// human:"ports"
+	PORTSCAN_STATUS_FINISHED,	// human:"finished"
 };
 
+const char *PortscanState_human(enum PortscanState);
 const char *PortscanState_tostring(enum PortscanState);
 
-void portscan_status_init(uint32_t);
-void portscan_status_inc(void);
+void portscan_status_init(uint32_t, FILE *);
+void portscan_status_begin(int, const char *);
+void portscan_status_inc(int);
 void portscan_status_reset(enum PortscanState, size_t);
-void portscan_status_print(const char *);
+void portscan_status_print(void);
@@ -0,0 +1,292 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libias/array.h>
+#include <libias/flow.h>
+#include <libias/map.h>
+#include <libias/mempool.h>
+#include <libias/str.h>
+#include <libias/trait/compare.h>
+
+#include "profile.h"
+
+#define PROFILE_PHASES (PROFILE_PHASE_EDIT + 1)
+#define PROFILE_HISTOGRAM_BUCKETS 24
+
+struct ProfileEdit {
+	char *name;
+	uint64_t elapsed;
+	size_t count;
+	uint64_t max;
+};
+
+struct ProfileSample {
+	struct Mempool *pool;
+	char *origin;
+	uint64_t phases[PROFILE_PHASES];
+	struct Array *edits;
+};
+
+struct Profile {
+	struct Mempool *pool;
+	struct Array *samples;
+	struct Map *edits;
+};
+
+// Prototypes
+static DECLARE_COMPARE(compare_sample_total);
+static uint64_t profile_sample_total(struct ProfileSample *);
+static size_t profile_histogram_bucket(uint64_t);
+static void profile_report_row(FILE *, const char *, uint64_t, size_t, uint64_t);
+
+// Constants
+static struct CompareTrait *sample_total_compare = &(struct CompareTrait){
+	.compare = compare_sample_total,
+	.compare_userdata = NULL,
+};
+
+uint64_t
+profile_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct ProfileSample *
+profile_sample_new(struct Mempool *pool, const char *origin)
+{
+	struct ProfileSample *sample = mempool_alloc(pool, sizeof(struct ProfileSample));
+	sample->pool = pool;
+	sample->origin = str_dup(pool, origin);
+	sample->edits = mempool_array(pool);
+	return sample;
+}
+
+void
+profile_sample_add(struct ProfileSample *sample, enum ProfilePhase phase, const char *name, uint64_t elapsed)
+{
+	if (sample == NULL) {
+		return;
+	}
+
+	sample->phases[phase] += elapsed;
+	if (phase != PROFILE_PHASE_EDIT || name == NULL) {
+		return;
+	}
+
+	ARRAY_FOREACH(sample->edits, struct ProfileEdit *, edit) {
+		if (strcmp(edit->name, name) == 0) {
+			edit->elapsed += elapsed;
+			return;
+		}
+	}
+	struct ProfileEdit *edit = mempool_alloc(sample->pool, sizeof(struct ProfileEdit));
+	edit->name = str_dup(sample->pool, name);
+	edit->elapsed = elapsed;
+	array_append(sample->edits, edit);
+}
+
+uint64_t
+profile_sample_get(struct ProfileSample *sample, enum ProfilePhase phase)
+{
+	if (sample == NULL) {
+		return 0;
+	}
+	return sample->phases[phase];
+}
+
+uint64_t
+profile_sample_total(struct ProfileSample *sample)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < PROFILE_PHASES; i++) {
+		total += sample->phases[i];
+	}
+	return total;
+}
+
+DEFINE_COMPARE(compare_sample_total, struct ProfileSample, void)
+{
+	uint64_t atotal = profile_sample_total((struct ProfileSample *)a);
+	uint64_t btotal = profile_sample_total((struct ProfileSample *)b);
+	if (atotal > btotal) {
+		return -1;
+	} else if (atotal < btotal) {
+		return 1;
+	} else {
+		return strcmp(a->origin, b->origin);
+	}
+}
+
+struct Profile *
+profile_new(struct Mempool *extpool)
+{
+	struct Profile *profile = mempool_alloc(extpool, sizeof(struct Profile));
+	profile->pool = extpool;
+	profile->samples = mempool_array(extpool);
+	profile->edits = mempool_map(extpool, str_compare);
+	return profile;
+}
+
+void
+profile_add_sample(struct Profile *profile, struct ProfileSample *sample)
+{
+	if (sample == NULL) {
+		return;
+	}
+
+	struct ProfileSample *copy = profile_sample_new(profile->pool, sample->origin);
+	for (size_t i = 0; i < PROFILE_PHASES; i++) {
+		copy->phases[i] = sample->phases[i];
+	}
+	ARRAY_FOREACH(sample->edits, struct ProfileEdit *, edit) {
+		struct ProfileEdit *total = map_get(profile->edits, edit->name);
+		if (total == NULL) {
+			total = mempool_alloc(profile->pool, sizeof(struct ProfileEdit));
+			total->name = str_dup(profile->pool, edit->name);
+			map_add(profile->edits, total->name, total);
+		}
+		total->elapsed += edit->elapsed;
+		total->count++;
+		if (edit->elapsed > total->max) {
+			total->max = edit->elapsed;
+		}
+	}
+	array_append(profile->samples, copy);
+}
+
+size_t
+profile_histogram_bucket(uint64_t elapsed)
+{
+	// Bucket i holds samples in [2^(i-1), 2^i) microseconds
+	uint64_t us = elapsed / 1000;
+	size_t bucket = 0;
+	while (us > 0 && bucket < PROFILE_HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+void
+profile_report_row(FILE *out, const char *name, uint64_t total, size_t count, uint64_t max)
+{
+	double mean = 0;
+	if (count > 0) {
+		mean = total / 1000000.0 / count;
+	}
+	fprintf(out, "%-40s %12.3f %8zu %10.3f %10.3f\n", name, total / 1000000.0, count, mean, max / 1000000.0);
+}
+
+void
+profile_report(struct Profile *profile, FILE *out, size_t top)
+{
+	SCOPE_MEMPOOL(pool);
+
+	uint64_t totals[PROFILE_PHASES] = {};
+	uint64_t maxs[PROFILE_PHASES] = {};
+	size_t counts[PROFILE_PHASES] = {};
+	size_t histogram[PROFILE_PHASES][PROFILE_HISTOGRAM_BUCKETS] = {};
+	ARRAY_FOREACH(profile->samples, struct ProfileSample *, sample) {
+		for (size_t i = 0; i < PROFILE_PHASES; i++) {
+			uint64_t elapsed = sample->phases[i];
+			if (elapsed == 0) {
+				continue;
+			}
+			totals[i] += elapsed;
+			counts[i]++;
+			if (elapsed > maxs[i]) {
+				maxs[i] = elapsed;
+			}
+			histogram[i][profile_histogram_bucket(elapsed)]++;
+		}
+	}
+
+	fprintf(out, "%-40s %12s %8s %10s %10s\n", "phase", "total (ms)", "count", "mean (ms)", "max (ms)");
+	for (size_t i = 0; i < PROFILE_PHASES; i++) {
+		profile_report_row(out, ProfilePhase_human(i), totals[i], counts[i], maxs[i]);
+	}
+	MAP_FOREACH(profile->edits, const char *, name, struct ProfileEdit *, edit) {
+		profile_report_row(out, str_printf(pool, "edit %s", name), edit->elapsed, edit->count, edit->max);
+	}
+
+	for (size_t i = 0; i < PROFILE_PHASES; i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		fprintf(out, "\n%s latency:\n", ProfilePhase_human(i));
+		for (size_t bucket = 0; bucket < PROFILE_HISTOGRAM_BUCKETS; bucket++) {
+			if (histogram[i][bucket] == 0) {
+				continue;
+			}
+			uint64_t upper = (uint64_t)1 << bucket;
+			fprintf(out, "  < %10" PRIu64 " us %8zu %s\n", upper, histogram[i][bucket],
+				str_repeat(pool, "#", histogram[i][bucket] * 40 / counts[i]));
+		}
+	}
+
+	if (top > 0 && array_len(profile->samples) > 0) {
+		array_sort(profile->samples, sample_total_compare);
+		fprintf(out, "\nslowest origins:\n");
+		ARRAY_FOREACH(profile->samples, struct ProfileSample *, sample) {
+			if (sample_index >= top) {
+				break;
+			}
+			fprintf(out, "  %10.3f ms  %s\n", profile_sample_total(sample) / 1000000.0, sample->origin);
+		}
+	}
+}
+
+void
+profile_dump(struct Profile *profile, FILE *out)
+{
+	fprintf(out, "# origin\ttotal");
+	for (size_t i = 0; i < PROFILE_PHASES; i++) {
+		fprintf(out, "\t%s", ProfilePhase_human(i));
+	}
+	fputs("\n", out);
+
+	ARRAY_FOREACH(profile->samples, struct ProfileSample *, sample) {
+		fprintf(out, "%s\t%" PRIu64, sample->origin, profile_sample_total(sample));
+		for (size_t i = 0; i < PROFILE_PHASES; i++) {
+			fprintf(out, "\t%" PRIu64, sample->phases[i]);
+		}
+		fputs("\n", out);
+	}
+}
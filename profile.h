@@ -0,0 +1,54 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#pragma once
+
+enum ProfilePhase {
+	PROFILE_PHASE_OPEN,	// human:"open"
+	PROFILE_PHASE_READ,	// human:"read"
+	PROFILE_PHASE_FINISH,	// human:"finish"
+	PROFILE_PHASE_INCLUDES,	// human:"includes"
+	PROFILE_PHASE_EDIT,	// human:"edit"
+};
+
+const char *ProfilePhase_human(enum ProfilePhase);
+const char *ProfilePhase_tostring(enum ProfilePhase);
+
+struct Mempool;
+struct Profile;
+struct ProfileSample;
+
+uint64_t profile_clock(void);
+
+struct ProfileSample *profile_sample_new(struct Mempool *, const char *);
+void profile_sample_add(struct ProfileSample *, enum ProfilePhase, const char *, uint64_t);
+uint64_t profile_sample_get(struct ProfileSample *, enum ProfilePhase);
+
+struct Profile *profile_new(struct Mempool *);
+void profile_add_sample(struct Profile *, struct ProfileSample *);
+void profile_report(struct Profile *, FILE *, size_t);
+void profile_dump(struct Profile *, FILE *);
@@ -49,10 +49,10 @@
 #include "rules.h"
 #include "parser.h"
 #include "parser/edits.h"
+#include "stats.h"
 
 // Prototypes
 static bool variable_has_flag(struct Parser *, const char *, int);
-static bool extract_arch_prefix(struct Mempool *, const char *, char **, char **);
 static bool extract_osrel_prefix(struct Mempool *, const char *, char **);
 static void is_referenced_var_cb(struct Mempool *, const char *, const char *, const char *, void *);
 static void add_referenced_var_candidates(struct Mempool *, struct Array *, struct Array *, const char *, const char *);
@@ -1234,6 +1234,7 @@ static struct VariableOrderEntry special_variables_[] = {
 bool
 variable_has_flag(struct Parser *parser, const char *var, int flag)
 {
+	STATS_SCOPE(STATS_RULES);
 	SCOPE_MEMPOOL(pool);
 
 	char *helper;
@@ -1375,6 +1376,7 @@ add_referenced_var_candidates(struct Mempool *pool, struct Array *candidates, st
 bool
 is_referenced_var(struct Parser *parser, const char *var)
 {
+	STATS_SCOPE(STATS_RULES);
 	if (!(parser_settings(parser).behavior & PARSER_CHECK_VARIABLE_REFERENCES)) {
 		return false;
 	}
@@ -1661,6 +1663,7 @@ compare_rel(const char *rel[], size_t rellen, const char *a, const char *b)
 int
 compare_tokens(const void *ap, const void *bp, void *userdata)
 {
+	STATS_SCOPE(STATS_RULES);
 	struct CompareTokensData *data = userdata;
 	const char *a = *(const char**)ap;
 	const char *b = *(const char**)bp;
@@ -1921,6 +1924,7 @@ extract_subpkg(struct Mempool *pool, struct Parser *parser, const char *var_, ch
 bool
 is_options_helper(struct Mempool *pool, struct Parser *parser, const char *var_, char **prefix_ret, char **helper_ret, char **subpkg_ret)
 {
+	STATS_SCOPE(STATS_RULES);
 	char *subpkg;
 	char *var;
 	if ((var = extract_subpkg(pool, parser, var_, &subpkg)) == NULL) {
@@ -2200,6 +2204,7 @@ is_shebang_lang(struct Mempool *pool, struct Parser *parser, const char *var, ch
 enum BlockType
 variable_order_block(struct Parser *parser, const char *var, struct Mempool *extpool, struct Set **uses_candidates)
 {
+	STATS_SCOPE(STATS_RULES);
 	SCOPE_MEMPOOL(pool);
 
 	if (uses_candidates) {
@@ -2309,6 +2314,7 @@ variable_order_block(struct Parser *parser, const char *var, struct Mempool *ext
 int
 compare_order(const void *ap, const void *bp, void *userdata)
 {
+	STATS_SCOPE(STATS_RULES);
 	SCOPE_MEMPOOL(pool);
 	struct Parser *parser = userdata;
 	const char *a = *(const char **)ap;
@@ -2646,6 +2652,7 @@ target_extract_opt(struct Mempool *pool, struct Parser *parser, const char *targ
 bool
 is_known_target(struct Parser *parser, const char *target)
 {
+	STATS_SCOPE(STATS_RULES);
 	SCOPE_MEMPOOL(pool);
 
 	char *root;
@@ -2686,6 +2693,7 @@ is_special_target(const char *target)
 int
 compare_target_order(const void *ap, const void *bp, void *userdata)
 {
+	STATS_SCOPE(STATS_RULES);
 	SCOPE_MEMPOOL(pool);
 
 	struct Parser *parser = userdata;
@@ -90,6 +90,7 @@ struct AST;
 int compare_order(const void *, const void *, void *);
 int compare_target_order(const void *, const void *, void *);
 int compare_tokens(const void *, const void *, void *);
+bool extract_arch_prefix(struct Mempool *, const char *, char **, char **);
 bool ignore_wrap_col(struct Parser *, const char *, enum ASTVariableModifier);
 uint32_t indent_goalcol(const char *, enum ASTVariableModifier);
 bool is_comment(const char *);
@@ -0,0 +1,27 @@
+# Hash the sources that shape the trees stored in the AST cache.
+# The cache key includes the result, so entries written by a build
+# from other sources are never loaded.
+BEGIN {
+	for (i = 1; i < 256; i++) {
+		ord[sprintf("%c", i)] = i
+	}
+	# Two independent hashes modulo primes below 2^31 stay exact
+	# in awk's floating point numbers.
+	a = 1
+	b = 0
+}
+
+{
+	for (i = 1; i <= length($0); i++) {
+		c = ord[substr($0, i, 1)]
+		a = (a * 31 + c) % 2147483647
+		b = (b * 131 + c) % 2147483629
+	}
+	a = (a * 31 + 10) % 2147483647
+	b = (b * 131 + 10) % 2147483629
+}
+
+END {
+	printf("// Generated file. Do not edit.\n\n#include \"config.h\"\n#include <stddef.h>\n#include <stdint.h>\n\n#include \"parser/cache.h\"\n\n")
+	printf("const uint64_t parser_cache_build_id = (UINT64_C(%d) << 32) | UINT64_C(%d);\n", a, b)
+}
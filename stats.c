@@ -0,0 +1,335 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#if PORTFMT_STATS
+
+#if defined(__FreeBSD__)
+# include <malloc_np.h>
+#else
+# include <malloc.h>
+#endif
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+// The binaries are linked with -Wl,--wrap for these when the stats
+// feature is enabled, so every allocation in portfmt and libias is
+// routed through the __wrap_ functions below.
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+void __real_free(void *);
+struct Mempool *__real_mempool_new(void);
+void *__wrap_malloc(size_t);
+void *__wrap_calloc(size_t, size_t);
+void *__wrap_realloc(void *, size_t);
+void __wrap_free(void *);
+struct Mempool *__wrap_mempool_new(void);
+
+#define STATS_SUBSYSTEMS (STATS_PORTSCAN_LOG + 1)
+#define STATS_COUNTERS (STATS_COUNTER_LOOKUP_VARIABLE + 1)
+
+struct StatsCounters {
+	atomic_size_t allocs;
+	atomic_size_t bytes;
+	atomic_size_t frees;
+	atomic_size_t pools;
+};
+
+// Blocks handed out by the wrappers.  Only these count towards the
+// live bytes: code in libc allocates with its internal malloc, but
+// buffers from getline(3), open_memstream(3) or stdio are still
+// released through our free().
+struct StatsBlock {
+	void *p;
+	size_t size;
+};
+
+// Prototypes
+static size_t stats_block_slot(void *);
+static void stats_block_grow(void);
+static size_t stats_block_track(void *, size_t);
+static bool stats_block_untrack(void *, size_t *);
+static void stats_alloc(void *);
+static void stats_free(void *);
+static void stats_atexit(void);
+static void stats_init(void) __attribute__((constructor));
+
+static struct StatsCounters counters[STATS_SUBSYSTEMS];
+static atomic_size_t events[STATS_COUNTERS];
+static atomic_size_t live_bytes = ATOMIC_VAR_INIT(0);
+static atomic_size_t peak_live_bytes = ATOMIC_VAR_INIT(0);
+static _Thread_local enum StatsSubsystem current = STATS_OTHER;
+static atomic_flag blocks_lock = ATOMIC_FLAG_INIT;
+static struct StatsBlock *blocks;
+static size_t blocks_cap;
+static size_t blocks_len;
+
+void
+stats_init()
+{
+	const char *env = getenv("PORTFMT_STATS");
+	if (env && strcmp(env, "1") == 0) {
+		atexit(stats_atexit);
+	}
+}
+
+void
+stats_atexit()
+{
+	stats_print(stderr);
+}
+
+enum StatsSubsystem
+stats_enter(enum StatsSubsystem subsystem)
+{
+	enum StatsSubsystem prev = current;
+	current = subsystem;
+	return prev;
+}
+
+void
+stats_leave(enum StatsSubsystem *prev)
+{
+	current = *prev;
+}
+
+void
+stats_count(enum StatsCounter counter)
+{
+	atomic_fetch_add_explicit(&events[counter], 1, memory_order_relaxed);
+}
+
+size_t
+stats_block_slot(void *p)
+{
+	uint64_t h = (uintptr_t)p >> 4;
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return h & (blocks_cap - 1);
+}
+
+void
+stats_block_grow()
+{
+	struct StatsBlock *old = blocks;
+	size_t oldcap = blocks_cap;
+	blocks_cap = oldcap ? oldcap * 2 : 4096;
+	blocks = __real_calloc(blocks_cap, sizeof(struct StatsBlock));
+	if (blocks == NULL) {
+		abort();
+	}
+	for (size_t i = 0; i < oldcap; i++) {
+		if (old[i].p) {
+			size_t slot = stats_block_slot(old[i].p);
+			while (blocks[slot].p) {
+				slot = (slot + 1) & (blocks_cap - 1);
+			}
+			blocks[slot] = old[i];
+		}
+	}
+	__real_free(old);
+}
+
+size_t
+stats_block_track(void *p, size_t size)
+// Returns the size of a stale entry for p if there was one.  That
+// block was released behind our back, e.g., by realloc(3) inside
+// getline(3), and its address was reused.
+{
+	size_t stale = 0;
+	while (atomic_flag_test_and_set_explicit(&blocks_lock, memory_order_acquire));
+	if ((blocks_len + 1) * 4 > blocks_cap * 3) {
+		stats_block_grow();
+	}
+	size_t slot = stats_block_slot(p);
+	while (blocks[slot].p && blocks[slot].p != p) {
+		slot = (slot + 1) & (blocks_cap - 1);
+	}
+	if (blocks[slot].p) {
+		stale = blocks[slot].size;
+	} else {
+		blocks[slot].p = p;
+		blocks_len++;
+	}
+	blocks[slot].size = size;
+	atomic_flag_clear_explicit(&blocks_lock, memory_order_release);
+	return stale;
+}
+
+bool
+stats_block_untrack(void *p, size_t *size)
+{
+	bool found = false;
+	while (atomic_flag_test_and_set_explicit(&blocks_lock, memory_order_acquire));
+	if (blocks_cap > 0) {
+		size_t slot = stats_block_slot(p);
+		while (blocks[slot].p && blocks[slot].p != p) {
+			slot = (slot + 1) & (blocks_cap - 1);
+		}
+		if (blocks[slot].p) {
+			found = true;
+			*size = blocks[slot].size;
+			blocks_len--;
+			// Shift the following entries of the probe
+			// sequence back so that lookups need no
+			// tombstones.
+			size_t hole = slot;
+			for (size_t next = (hole + 1) & (blocks_cap - 1); blocks[next].p; next = (next + 1) & (blocks_cap - 1)) {
+				size_t home = stats_block_slot(blocks[next].p);
+				if (((next - home) & (blocks_cap - 1)) >= ((next - hole) & (blocks_cap - 1))) {
+					blocks[hole] = blocks[next];
+					hole = next;
+				}
+			}
+			blocks[hole].p = NULL;
+			blocks[hole].size = 0;
+		}
+	}
+	atomic_flag_clear_explicit(&blocks_lock, memory_order_release);
+	return found;
+}
+
+void
+stats_alloc(void *p)
+{
+	if (p == NULL) {
+		return;
+	}
+
+	size_t size = malloc_usable_size(p);
+	struct StatsCounters *c = &counters[current];
+	atomic_fetch_add_explicit(&c->allocs, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&c->bytes, size, memory_order_relaxed);
+
+	size_t stale = stats_block_track(p, size);
+	size_t live = atomic_fetch_add_explicit(&live_bytes, size, memory_order_relaxed) + size;
+	if (stale > 0) {
+		live = atomic_fetch_sub_explicit(&live_bytes, stale, memory_order_relaxed) - stale;
+	}
+	size_t peak = atomic_load_explicit(&peak_live_bytes, memory_order_relaxed);
+	while (live > peak &&
+	       !atomic_compare_exchange_weak_explicit(&peak_live_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed));
+}
+
+void
+stats_free(void *p)
+{
+	if (p == NULL) {
+		return;
+	}
+
+	atomic_fetch_add_explicit(&counters[current].frees, 1, memory_order_relaxed);
+	size_t size;
+	if (stats_block_untrack(p, &size)) {
+		atomic_fetch_sub_explicit(&live_bytes, size, memory_order_relaxed);
+	}
+}
+
+void *
+__wrap_malloc(size_t size)
+{
+	void *p = __real_malloc(size);
+	stats_alloc(p);
+	return p;
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	void *p = __real_calloc(nmemb, size);
+	stats_alloc(p);
+	return p;
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	stats_free(ptr);
+	void *p = __real_realloc(ptr, size);
+	stats_alloc(p);
+	return p;
+}
+
+void
+__wrap_free(void *ptr)
+{
+	stats_free(ptr);
+	__real_free(ptr);
+}
+
+struct Mempool *
+__wrap_mempool_new()
+{
+	atomic_fetch_add_explicit(&counters[current].pools, 1, memory_order_relaxed);
+	return __real_mempool_new();
+}
+
+size_t
+stats_allocations()
+{
+	size_t allocs = 0;
+	for (size_t i = 0; i < STATS_SUBSYSTEMS; i++) {
+		allocs += atomic_load_explicit(&counters[i].allocs, memory_order_relaxed);
+	}
+	return allocs;
+}
+
+void
+stats_print(FILE *out)
+{
+	size_t allocs = 0;
+	size_t bytes = 0;
+	fprintf(out, "%-16s %12s %16s %12s %10s\n", "subsystem", "allocs", "bytes", "frees", "pools");
+	for (size_t i = 0; i < STATS_SUBSYSTEMS; i++) {
+		struct StatsCounters *c = &counters[i];
+		fprintf(out, "%-16s %12zu %16zu %12zu %10zu\n", StatsSubsystem_human(i),
+			(size_t)c->allocs, (size_t)c->bytes, (size_t)c->frees, (size_t)c->pools);
+		allocs += c->allocs;
+		bytes += c->bytes;
+	}
+
+	// One counter per line from here on so that tests/perf can
+	// pick them up
+	fprintf(out, "\n%-24s %zu\n", "allocs", allocs);
+	fprintf(out, "%-24s %zu\n", "bytes", bytes);
+	for (size_t i = 0; i < STATS_COUNTERS; i++) {
+		fprintf(out, "%-24s %zu\n", StatsCounter_human(i), (size_t)events[i]);
+	}
+	fprintf(out, "%-24s %zu\n", "peak-live-bytes", (size_t)peak_live_bytes);
+}
+
+#endif
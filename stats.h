@@ -0,0 +1,69 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#pragma once
+
+enum StatsSubsystem {
+	STATS_OTHER,		// human:"other"
+	STATS_TOKENIZER,	// human:"tokenizer"
+	STATS_ASTBUILDER,	// human:"astbuilder"
+	STATS_RULES,		// human:"rules"
+	STATS_EDITS,		// human:"edits"
+	STATS_PORTSCAN_LOG,	// human:"portscan-log"
+};
+
+const char *StatsSubsystem_human(enum StatsSubsystem);
+const char *StatsSubsystem_tostring(enum StatsSubsystem);
+
+enum StatsCounter {
+	STATS_COUNTER_AST_NODES_VISITED,	// human:"ast-nodes-visited"
+	STATS_COUNTER_LOOKUP_VARIABLE,		// human:"lookup-variable"
+};
+
+const char *StatsCounter_human(enum StatsCounter);
+const char *StatsCounter_tostring(enum StatsCounter);
+
+// Allocations made until the end of the current block are accounted
+// to the given subsystem.  Only active when built with the stats
+// feature; the counters are printed on exit when PORTFMT_STATS=1
+// is set in the environment.
+#if PORTFMT_STATS
+# define STATS_CONCAT_(a, b) a##b
+# define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+# define STATS_SCOPE(subsystem) \
+	enum StatsSubsystem STATS_CONCAT(stats_scope_, __LINE__) __attribute__((cleanup(stats_leave))) = stats_enter(subsystem)
+# define STATS_COUNT(counter) stats_count(counter)
+#else
+# define STATS_SCOPE(subsystem)
+# define STATS_COUNT(counter)
+#endif
+
+enum StatsSubsystem stats_enter(enum StatsSubsystem);
+void stats_leave(enum StatsSubsystem *);
+void stats_count(enum StatsCounter);
+void stats_print(FILE *);
+size_t stats_allocations(void);
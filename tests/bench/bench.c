@@ -0,0 +1,349 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <libias/array.h>
+#include <libias/flow.h>
+#include <libias/io.h>
+#include <libias/mempool.h>
+#include <libias/mempool/file.h>
+#include <libias/str.h>
+
+#include "ast.h"
+#include "parser.h"
+#include "parser/edits.h"
+#include "profile.h"
+
+struct BenchPort {
+	const char *origin;
+	const char *buf;
+	size_t len;
+};
+
+struct Bench {
+	const char *portsdir;
+	const char *portscan;
+	struct Array *ports;
+	size_t bytes;
+	uint32_t repeat;
+	FILE *out;
+	size_t nphases;
+};
+
+typedef void (*BenchPhaseFn)(struct Bench *);
+
+// Prototypes
+static void bench_load(struct Bench *, struct Mempool *);
+static void bench_phase(struct Bench *, const char *, BenchPhaseFn, const char *);
+static void bench_parse(struct Bench *, struct ParserSettings *, bool);
+static void phase_tokenize(struct Bench *);
+static void phase_parse(struct Bench *);
+static void phase_format(struct Bench *);
+static void phase_portclippy(struct Bench *);
+static void usage(void);
+
+// Constants
+static const char *portscan_checks[] = {
+	"categories",
+	"clones",
+	"comments",
+	"option-default-descriptions",
+	"options",
+	"unknown-targets",
+	"unknown-variables",
+	"variable-values",
+};
+
+void
+bench_load(struct Bench *bench, struct Mempool *pool)
+{
+	int portsdir = open(bench->portsdir, O_DIRECTORY);
+	if (portsdir == -1) {
+		err(1, "open: %s", bench->portsdir);
+	}
+	FILE *f = mempool_fopenat(pool, portsdir, "INDEX", "r", 0);
+	unless (f) {
+		err(1, "%s/INDEX", bench->portsdir);
+	}
+	const char *index = slurp(f, pool);
+	unless (index) {
+		err(1, "%s/INDEX", bench->portsdir);
+	}
+
+	ARRAY_FOREACH(str_split(pool, index, "\n"), const char *, origin) {
+		if (*origin == 0) {
+			continue;
+		}
+		const char *path = str_printf(pool, "%s/Makefile", origin);
+		FILE *makefile = mempool_fopenat(pool, portsdir, path, "r", 0);
+		unless (makefile) {
+			err(1, "%s/%s", bench->portsdir, path);
+		}
+		struct BenchPort *port = mempool_alloc(pool, sizeof(struct BenchPort));
+		port->origin = origin;
+		port->buf = slurp(makefile, pool);
+		unless (port->buf) {
+			err(1, "%s/%s", bench->portsdir, path);
+		}
+		port->len = strlen(port->buf);
+		bench->bytes += port->len;
+		array_append(bench->ports, port);
+	}
+
+	close(portsdir);
+}
+
+// Runs a phase in a child process so that its peak RSS can be
+// measured in isolation.  fn runs the phase in-process, otherwise
+// portscan is executed with --<check>.
+void
+bench_phase(struct Bench *bench, const char *name, BenchPhaseFn fn, const char *check)
+{
+	uint64_t best = UINT64_MAX;
+	long maxrss = 0;
+	for (uint32_t i = 0; i < bench->repeat; i++) {
+		uint64_t start = profile_clock();
+		pid_t pid = fork();
+		if (pid == -1) {
+			err(1, "fork");
+		} else if (pid == 0) {
+			if (fn) {
+				fn(bench);
+				_exit(0);
+			}
+			int null = open("/dev/null", O_WRONLY);
+			if (null == -1 || dup2(null, STDOUT_FILENO) == -1 || dup2(null, STDERR_FILENO) == -1) {
+				_exit(127);
+			}
+			const char *flag = str_printf(NULL, "--%s", check);
+			execl(bench->portscan, "portscan", "-p", bench->portsdir, flag, (char *)NULL);
+			_exit(127);
+		}
+
+		int status;
+		struct rusage ru;
+		if (wait4(pid, &status, 0, &ru) == -1) {
+			err(1, "wait4");
+		}
+		uint64_t elapsed = profile_clock() - start;
+		// portscan exits with 2 when it found something to report
+		unless (WIFEXITED(status) && (WEXITSTATUS(status) == 0 || (check && WEXITSTATUS(status) == 2))) {
+			errx(1, "%s: phase failed", name);
+		}
+		if (elapsed < best) {
+			best = elapsed;
+		}
+		if (ru.ru_maxrss > maxrss) {
+			maxrss = ru.ru_maxrss;
+		}
+	}
+
+	double seconds = best / 1e9;
+	size_t nports = array_len(bench->ports);
+	fprintf(bench->out, "%s\n    {\"phase\": \"%s\", \"seconds\": %.6f, \"ports_per_sec\": %.1f, \"mb_per_sec\": %.3f, \"peak_rss_kb\": %ld}",
+		bench->nphases > 0 ? "," : "",
+		name,
+		seconds,
+		seconds > 0 ? nports / seconds : 0,
+		seconds > 0 ? bench->bytes / seconds / (1024 * 1024) : 0,
+		maxrss);
+	fflush(bench->out);
+	bench->nphases++;
+}
+
+void
+bench_parse(struct Bench *bench, struct ParserSettings *settings, bool finish)
+{
+	ARRAY_FOREACH(bench->ports, struct BenchPort *, port) {
+		SCOPE_MEMPOOL(pool);
+		settings->filename = port->origin;
+		struct Parser *parser = parser_new(pool, settings);
+		enum ParserError error = parser_read_from_buffer(parser, port->buf, port->len);
+		if (error == PARSER_ERROR_OK && finish) {
+			error = parser_read_finish(parser);
+		}
+		if (error != PARSER_ERROR_OK) {
+			errx(1, "%s: %s", port->origin, parser_error_tostring(parser, pool));
+		}
+	}
+}
+
+void
+phase_tokenize(struct Bench *bench)
+{
+	struct ParserSettings settings;
+	parser_init_settings(&settings);
+	bench_parse(bench, &settings, false);
+}
+
+void
+phase_parse(struct Bench *bench)
+{
+	struct ParserSettings settings;
+	parser_init_settings(&settings);
+	bench_parse(bench, &settings, true);
+}
+
+void
+phase_format(struct Bench *bench)
+{
+	FILE *null = fopen("/dev/null", "w");
+	unless (null) {
+		err(1, "/dev/null");
+	}
+	struct ParserSettings settings;
+	parser_init_settings(&settings);
+	settings.behavior = PARSER_OUTPUT_REFORMAT | PARSER_OUTPUT_NO_COLOR;
+	ARRAY_FOREACH(bench->ports, struct BenchPort *, port) {
+		SCOPE_MEMPOOL(pool);
+		settings.filename = port->origin;
+		struct Parser *parser = parser_new(pool, &settings);
+		enum ParserError error = parser_read_from_buffer(parser, port->buf, port->len);
+		if (error == PARSER_ERROR_OK) {
+			error = parser_read_finish(parser);
+		}
+		if (error == PARSER_ERROR_OK) {
+			error = parser_output_write_to_file(parser, null);
+		}
+		if (error != PARSER_ERROR_OK) {
+			errx(1, "%s: %s", port->origin, parser_error_tostring(parser, pool));
+		}
+	}
+	fclose(null);
+}
+
+void
+phase_portclippy(struct Bench *bench)
+{
+	FILE *null = fopen("/dev/null", "w");
+	unless (null) {
+		err(1, "/dev/null");
+	}
+	struct ParserSettings settings;
+	parser_init_settings(&settings);
+	settings.behavior = PARSER_OUTPUT_RAWLINES | PARSER_CHECK_VARIABLE_REFERENCES | PARSER_OUTPUT_NO_COLOR;
+	ARRAY_FOREACH(bench->ports, struct BenchPort *, port) {
+		SCOPE_MEMPOOL(pool);
+		settings.filename = port->origin;
+		struct Parser *parser = parser_new(pool, &settings);
+		enum ParserError error = parser_read_from_buffer(parser, port->buf, port->len);
+		if (error == PARSER_ERROR_OK) {
+			error = parser_read_finish(parser);
+		}
+		if (error == PARSER_ERROR_OK) {
+			error = parser_edit(parser, pool, lint_bsd_port, NULL);
+		}
+		int status = 0;
+		if (error == PARSER_ERROR_OK) {
+			error = parser_edit(parser, pool, lint_order, &status);
+		}
+		if (error == PARSER_ERROR_OK) {
+			error = parser_output_write_to_file(parser, null);
+		}
+		if (error != PARSER_ERROR_OK) {
+			errx(1, "%s: %s", port->origin, parser_error_tostring(parser, pool));
+		}
+	}
+	fclose(null);
+}
+
+void
+usage()
+{
+	fprintf(stderr, "usage: bench [-n <repeat>] [-s <portscan>] <portsdir>\n");
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	SCOPE_MEMPOOL(pool);
+
+	struct Bench bench = {
+		.ports = mempool_array(pool),
+		.repeat = 3,
+		.out = stdout,
+	};
+
+	const char *error;
+	int ch;
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			bench.repeat = strtonum(optarg, 1, 1000, &error);
+			if (error) {
+				errx(1, "-n %s: %s", optarg, error);
+			}
+			break;
+		case 's':
+			bench.portscan = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1) {
+		usage();
+	}
+	bench.portsdir = argv[0];
+
+	bench_load(&bench, pool);
+
+	fprintf(bench.out, "{\n  \"ports\": %zu,\n  \"bytes\": %zu,\n  \"repeat\": %" PRIu32 ",\n  \"phases\": [",
+		array_len(bench.ports), bench.bytes, bench.repeat);
+	bench_phase(&bench, "tokenize", phase_tokenize, NULL);
+	bench_phase(&bench, "parse", phase_parse, NULL);
+	bench_phase(&bench, "format", phase_format, NULL);
+	bench_phase(&bench, "portclippy", phase_portclippy, NULL);
+	if (bench.portscan) {
+		for (size_t i = 0; i < nitems(portscan_checks); i++) {
+			const char *name = str_printf(pool, "portscan.%s", portscan_checks[i]);
+			bench_phase(&bench, name, NULL, portscan_checks[i]);
+		}
+	}
+	fprintf(bench.out, "\n  ]\n}\n");
+
+	return 0;
+}
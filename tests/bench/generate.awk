@@ -0,0 +1,175 @@
+# Generate a synthetic ports tree for benchmarking.
+#
+# usage: awk -f generate.awk -v dir=<path> [-v categories=N] [-v ports=N]
+#            [-v slaves=PERCENT] [-v depth=N] [-v options=N]
+#            [-v crates=N] [-v giant=PERCENT] [-v seed=N] /dev/null
+#
+# The output only depends on the parameters, so two runs with the same
+# settings produce byte-identical trees.  Besides the usual top-level,
+# category and port Makefiles an INDEX file with one origin per line
+# is written for the benchmark harness.
+
+function rand31() {
+	# Park-Miller minimal standard generator.  All intermediate
+	# values stay below 2^53 so the sequence is the same with every
+	# awk implementation.
+	state = (state * 16807) % 2147483647
+	return state
+}
+
+function pick(n) {
+	return rand31() % n
+}
+
+function mkdir(path) {
+	if (system("mkdir -p '" path "'") != 0) {
+		printf("generate.awk: cannot create %s\n", path) > "/dev/stderr"
+		exit 1
+	}
+}
+
+function write_list(file, name, prefix, n, suffix,	i) {
+	if (n == 0) {
+		return
+	}
+	printf("%s=\t", name) > file
+	for (i = 0; i < n; i++) {
+		printf("%s%d%s", prefix, i, suffix) > file
+		if (i < n - 1) {
+			printf(" \\\n\t\t") > file
+		}
+	}
+	printf("\n") > file
+}
+
+function write_includes(portdir, level,	file) {
+	if (level > depth) {
+		return
+	}
+	file = portdir "/Makefile.inc" level
+	printf("# Included at depth %d\n\n", level) > file
+	printf("CONFIGURE_ARGS+=\t--enable-level%d\n", level) > file
+	printf("MAKE_ENV+=\tLEVEL%d=yes\n", level) > file
+	if (level < depth) {
+		printf("\n.include \"${.CURDIR}/Makefile.inc%d\"\n", level + 1) > file
+	}
+	close(file)
+	write_includes(portdir, level + 1)
+}
+
+function write_master(category, name, n,	file, i, nopts, portdir) {
+	portdir = dir "/" category "/" name
+	mkdir(portdir)
+	file = portdir "/Makefile"
+	printf("PORTNAME=\t%s\n", name) > file
+	printf("PORTVERSION=\t%d.%d.%d\n", pick(10), pick(100), pick(1000)) > file
+	if (pick(4) == 0) {
+		printf("PORTREVISION=\t%d\n", 1 + pick(5)) > file
+	}
+	printf("CATEGORIES=\t%s\n", category) > file
+	printf("MASTER_SITES=\thttps://example.org/dist/%s/\n\n", name) > file
+	printf("MAINTAINER=\tports@example.org\n") > file
+	printf("COMMENT=\tSynthetic port number %d\n\n", n) > file
+	printf("LICENSE=\tBSD2CLAUSE\n\n") > file
+	printf("LIB_DEPENDS=\tlibfoo%d.so:devel/foo%d \\\n\t\tlibbar%d.so:devel/bar%d\n", pick(50), pick(50), pick(50), pick(50)) > file
+	printf("RUN_DEPENDS=\tbaz%d>0:devel/baz%d\n\n", pick(50), pick(50)) > file
+	printf("USES=\t\tcompiler:c++11-lang gmake pkgconfig\n") > file
+	printf("USE_GITHUB=\tyes\n") > file
+	printf("GH_ACCOUNT=\texample\n\n") > file
+	printf("GNU_CONFIGURE=\tyes\n") > file
+	printf("CONFIGURE_ENV=\tFOO=bar\n\n") > file
+
+	if (giant > 0 && crates > 0 && pick(100) < giant) {
+		printf("USES+=\t\tcargo\n") > file
+		write_list(file, "CARGO_CRATES", "crate", crates, "-0.1.0")
+		printf("\n") > file
+	}
+
+	nopts = options > 0 ? 1 + pick(options) : 0
+	if (nopts > 0) {
+		write_list(file, "OPTIONS_DEFINE", "OPT", nopts, "")
+		printf("OPTIONS_DEFAULT=\tOPT0\n\n") > file
+		for (i = 0; i < nopts; i++) {
+			printf("OPT%d_DESC=\tSynthetic option %d\n", i, i) > file
+			printf("OPT%d_CONFIGURE_ENABLE=\topt%d\n", i, i) > file
+			printf("OPT%d_LIB_DEPENDS=\tlibopt%d.so:devel/opt%d\n", i, i, i) > file
+		}
+		printf("\n.include <bsd.port.options.mk>\n\n") > file
+		printf(".if ${PORT_OPTIONS:MOPT0}\n") > file
+		printf("CFLAGS+=\t-DOPT0\n") > file
+		printf(".endif\n\n") > file
+	}
+
+	if (depth > 0) {
+		printf(".include \"${.CURDIR}/Makefile.inc1\"\n\n") > file
+		write_includes(portdir, 1)
+	}
+
+	printf("post-install:\n") > file
+	printf("\t${INSTALL_DATA} ${WRKSRC}/README ${STAGEDIR}${DOCSDIR}\n\n") > file
+	printf(".include <bsd.port.mk>\n") > file
+	close(file)
+}
+
+function write_slave(category, name, master,	file, portdir) {
+	portdir = dir "/" category "/" name
+	mkdir(portdir)
+	file = portdir "/Makefile"
+	printf("PKGNAMESUFFIX=\t-%s\n\n", name) > file
+	printf("COMMENT=\tSlave of %s\n\n", master) > file
+	printf("MASTERDIR=\t${.CURDIR}/../%s\n\n", master) > file
+	printf(".include \"${MASTERDIR}/Makefile\"\n") > file
+	close(file)
+}
+
+BEGIN {
+	if (dir == "") {
+		print "generate.awk: dir not set" > "/dev/stderr"
+		exit 1
+	}
+	if (categories == "") categories = 8
+	if (ports == "") ports = 64
+	if (slaves == "") slaves = 10
+	if (depth == "") depth = 2
+	if (options == "") options = 8
+	if (crates == "") crates = 500
+	if (giant == "") giant = 5
+	if (seed == "") seed = 1
+	state = seed % 2147483647
+	if (state <= 0) {
+		state += 2147483646
+	}
+
+	mkdir(dir "/Mk")
+	file = dir "/Mk/bsd.options.desc.mk"
+	printf("DOCS_DESC=\tBuild and/or install documentation\n") > file
+	printf("EXAMPLES_DESC=\tBuild and/or install examples\n") > file
+	close(file)
+
+	index_file = dir "/INDEX"
+	top = dir "/Makefile"
+	for (c = 0; c < categories; c++) {
+		category = sprintf("cat%03d", c)
+		printf("SUBDIR += %s\n", category) > top
+		mkdir(dir "/" category)
+		catfile = dir "/" category "/Makefile"
+		printf("COMMENT = Synthetic category %d\n\n", c) > catfile
+		master = ""
+		for (p = 0; p < ports; p++) {
+			name = sprintf("port%05d", c * ports + p)
+			if (master != "" && pick(100) < slaves) {
+				write_slave(category, name, master)
+			} else {
+				write_master(category, name, c * ports + p)
+				master = name
+			}
+			printf("    SUBDIR += %s\n", name) > catfile
+			printf("%s/%s\n", category, name) > index_file
+		}
+		printf("\n.include <bsd.port.subdir.mk>\n") > catfile
+		close(catfile)
+	}
+	printf("\n.include <bsd.port.subdir.mk>\n") > top
+	close(top)
+	close(index_file)
+}
@@ -0,0 +1,311 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <libias/array.h>
+#include <libias/flow.h>
+#include <libias/mempool.h>
+#include <libias/str.h>
+
+#include "ast.h"
+#include "parser.h"
+#include "profile.h"
+#include "rules.h"
+#include "stats.h"
+
+struct RulesBench {
+	struct Parser *parser;
+	uint32_t passes;
+	size_t sink;
+};
+
+typedef size_t (*RulesBenchFn)(struct RulesBench *, struct Mempool *);
+
+// Prototypes
+static void rules_bench_run(struct RulesBench *, const char *, RulesBenchFn);
+static size_t bench_variable_order_block(struct RulesBench *, struct Mempool *);
+static size_t bench_variable_has_flag(struct RulesBench *, struct Mempool *);
+static size_t bench_compare_order(struct RulesBench *, struct Mempool *);
+static size_t bench_compare_tokens(struct RulesBench *, struct Mempool *);
+static size_t bench_is_options_helper(struct RulesBench *, struct Mempool *);
+static size_t bench_is_referenced_var(struct RulesBench *, struct Mempool *);
+static size_t bench_extract_arch_prefix(struct RulesBench *, struct Mempool *);
+static size_t bench_indent_goalcol(struct RulesBench *, struct Mempool *);
+static void usage(void);
+
+// Constants
+
+// Options and references used by the variables below so that
+// is_options_helper() and is_referenced_var() see realistic input.
+static const char *makefile =
+	"PORTNAME=	corpus\n"
+	"DISTVERSION=	1.0\n"
+	"CATEGORIES=	devel\n"
+	"FLAVORS=	default lite\n"
+	"OPTIONS_DEFINE=	DOCS EXAMPLES NLS X11\n"
+	"OPTIONS_GROUP=	BACKEND\n"
+	"OPTIONS_GROUP_BACKEND=	PGSQL SQLITE\n"
+	"OPTIONS_SINGLE=	SSL\n"
+	"OPTIONS_SINGLE_SSL=	GNUTLS OPENSSL\n"
+	"FOO_CONFIGURE_ARGS=	--with-foo=${FOO_PREFIX}\n"
+	".if ${ARCH} == aarch64\n"
+	"CFLAGS+=	${CFLAGS_${ARCH}}\n"
+	".endif\n"
+	".include <bsd.port.mk>\n";
+
+// Variable names as they appear in the ports tree, in source order
+// of a typical Makefile plus option helpers, arch/osrel variants,
+// and unknown variables.
+static const char *variables[] = {
+	"PORTNAME", "PORTVERSION", "DISTVERSION", "PORTREVISION", "CATEGORIES",
+	"MASTER_SITES", "MASTER_SITE_SUBDIR", "PKGNAMEPREFIX", "DISTFILES",
+	"DIST_SUBDIR", "EXTRACT_ONLY", "PATCH_SITES", "PATCHFILES",
+	"MAINTAINER", "COMMENT", "WWW",
+	"LICENSE", "LICENSE_COMB", "LICENSE_FILE", "LICENSE_PERMS",
+	"BROKEN", "BROKEN_aarch64", "BROKEN_FreeBSD_13", "DEPRECATED",
+	"EXPIRATION_DATE", "IGNORE", "ONLY_FOR_ARCHS", "NOT_FOR_ARCHS",
+	"BUILD_DEPENDS", "LIB_DEPENDS", "RUN_DEPENDS", "TEST_DEPENDS",
+	"FLAVORS", "lite_PKGNAMESUFFIX", "USES", "USE_GITHUB", "GH_ACCOUNT",
+	"GH_PROJECT", "GH_TAGNAME", "USE_GNOME", "USE_QT", "USE_XORG",
+	"SHEBANG_FILES", "CMAKE_ARGS", "CMAKE_ON", "CMAKE_OFF",
+	"GNU_CONFIGURE", "CONFIGURE_ARGS", "CONFIGURE_ENV", "CONFIGURE_ENV_i386",
+	"CARGO_CRATES", "CARGO_FEATURES", "GO_MODULE", "GO_TARGET",
+	"MAKE_ENV", "MAKE_ARGS", "ALL_TARGET", "INSTALL_TARGET",
+	"CFLAGS", "CFLAGS_aarch64", "CXXFLAGS", "LDFLAGS", "LDFLAGS_i386_13",
+	"CONFLICTS_INSTALL", "NO_ARCH", "WRKSRC", "WRKSRC_SUBDIR",
+	"USERS", "GROUPS", "PLIST_FILES", "PLIST_SUB", "PORTDOCS", "PORTEXAMPLES",
+	"OPTIONS_DEFINE", "OPTIONS_DEFINE_amd64", "OPTIONS_DEFAULT",
+	"OPTIONS_GROUP", "OPTIONS_GROUP_BACKEND", "OPTIONS_SINGLE", "OPTIONS_SINGLE_SSL",
+	"OPTIONS_SUB", "DOCS_DESC", "NLS_DESC", "X11_DESC", "BACKEND_DESC",
+	"DOCS_BUILD_DEPENDS", "NLS_USES", "NLS_CONFIGURE_ENABLE", "X11_USE",
+	"X11_CMAKE_BOOL", "PGSQL_LIB_DEPENDS", "SQLITE_USES", "GNUTLS_CONFIGURE_ON",
+	"OPENSSL_USES", "EXAMPLES_PLIST_FILES", "DOCS_PORTDOCS",
+	"FOO_CONFIGURE_ARGS", "FOO_PREFIX", "UNKNOWN_VARIABLE", "_PRIVATE_VARIABLE",
+};
+
+// Pairs of tokens compared while sorting the value of var.
+static const struct {
+	const char *var;
+	const char *a;
+	const char *b;
+} tokens[] = {
+	{ "USES", "cmake", "compiler:c++11-lang" },
+	{ "USES", "gmake", "pkgconfig" },
+	{ "USES", "python:3.8+", "shebangfix" },
+	{ "LICENSE_PERMS", "dist-mirror", "pkg-sell" },
+	{ "LICENSE_PERMS", "no-auto-accept", "dist-sell" },
+	{ "PLIST_FILES", "bin/foo", "\"@sample etc/foo.conf.sample\"" },
+	{ "PLIST_FILES", "share/man/man1/foo.1.gz", "lib/libfoo.so" },
+	{ "USE_GNOME", "glib20", "gtk30" },
+	{ "USE_GNOME", "cairo", "gdkpixbuf2" },
+	{ "USE_QT", "core", "buildtools:build" },
+	{ "USE_QT", "gui", "qmake:build" },
+	{ "LIB_DEPENDS", "libfoo.so:devel/foo", "libbar.so:devel/bar" },
+	{ "CONFIGURE_ARGS", "--disable-static", "--enable-shared" },
+	{ "CARGO_CRATES", "aho-corasick-0.7.18", "autocfg-1.1.0" },
+};
+
+void
+rules_bench_run(struct RulesBench *bench, const char *name, RulesBenchFn fn)
+{
+	size_t calls = 0;
+#if PORTFMT_STATS
+	size_t allocs = stats_allocations();
+#endif
+	uint64_t start = profile_clock();
+	for (uint32_t i = 0; i < bench->passes; i++) {
+		SCOPE_MEMPOOL(pool);
+		calls += fn(bench, pool);
+	}
+	uint64_t elapsed = profile_clock() - start;
+
+#if PORTFMT_STATS
+	allocs = stats_allocations() - allocs;
+	printf("%-24s %12zu %12.1f %12.2f\n", name, calls, (double)elapsed / calls, (double)allocs / calls);
+#else
+	printf("%-24s %12zu %12.1f %12s\n", name, calls, (double)elapsed / calls, "-");
+#endif
+}
+
+size_t
+bench_variable_order_block(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(variables); i++) {
+		bench->sink += variable_order_block(bench->parser, variables[i], NULL, NULL);
+	}
+	return nitems(variables);
+}
+
+// variable_has_flag() is private to rules.c; print_as_newlines() is
+// a plain wrapper around it.
+size_t
+bench_variable_has_flag(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(variables); i++) {
+		bench->sink += print_as_newlines(bench->parser, variables[i]);
+	}
+	return nitems(variables);
+}
+
+size_t
+bench_compare_order(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 1; i < nitems(variables); i++) {
+		bench->sink += compare_order(&variables[i - 1], &variables[i], bench->parser) < 0;
+	}
+	return nitems(variables) - 1;
+}
+
+size_t
+bench_compare_tokens(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(tokens); i++) {
+		struct CompareTokensData data = {
+			.parser = bench->parser,
+			.var = tokens[i].var,
+		};
+		bench->sink += compare_tokens(&tokens[i].a, &tokens[i].b, &data) < 0;
+	}
+	return nitems(tokens);
+}
+
+size_t
+bench_is_options_helper(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(variables); i++) {
+		char *prefix = NULL;
+		char *helper = NULL;
+		char *subpkg = NULL;
+		bench->sink += is_options_helper(pool, bench->parser, variables[i], &prefix, &helper, &subpkg);
+	}
+	return nitems(variables);
+}
+
+size_t
+bench_is_referenced_var(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(variables); i++) {
+		bench->sink += is_referenced_var(bench->parser, variables[i]);
+	}
+	return nitems(variables);
+}
+
+size_t
+bench_extract_arch_prefix(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(variables); i++) {
+		char *prefix = NULL;
+		char *prefix_osrel = NULL;
+		bench->sink += extract_arch_prefix(pool, variables[i], &prefix, &prefix_osrel);
+	}
+	return nitems(variables);
+}
+
+size_t
+bench_indent_goalcol(struct RulesBench *bench, struct Mempool *pool)
+{
+	for (size_t i = 0; i < nitems(variables); i++) {
+		bench->sink += indent_goalcol(variables[i], AST_VARIABLE_MODIFIER_ASSIGN);
+	}
+	return nitems(variables);
+}
+
+void
+usage()
+{
+	fprintf(stderr, "usage: rules_bench [-n <passes>]\n");
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	SCOPE_MEMPOOL(pool);
+
+	struct RulesBench bench = {
+		.passes = 1000,
+	};
+
+	const char *error;
+	int ch;
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			bench.passes = strtonum(optarg, 1, UINT32_MAX, &error);
+			if (error) {
+				errx(1, "-n %s: %s", optarg, error);
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 0) {
+		usage();
+	}
+
+	struct ParserSettings settings;
+	parser_init_settings(&settings);
+	settings.behavior = PARSER_CHECK_VARIABLE_REFERENCES;
+	bench.parser = parser_new(pool, &settings);
+	if (parser_read_from_buffer(bench.parser, makefile, strlen(makefile)) != PARSER_ERROR_OK ||
+	    parser_read_finish(bench.parser) != PARSER_ERROR_OK) {
+		errx(1, "%s", parser_error_tostring(bench.parser, pool));
+	}
+
+	printf("%-24s %12s %12s %12s\n", "function", "calls", "ns/call", "allocs/call");
+	rules_bench_run(&bench, "variable_order_block", bench_variable_order_block);
+	rules_bench_run(&bench, "variable_has_flag", bench_variable_has_flag);
+	rules_bench_run(&bench, "compare_order", bench_compare_order);
+	rules_bench_run(&bench, "compare_tokens", bench_compare_tokens);
+	rules_bench_run(&bench, "is_options_helper", bench_is_options_helper);
+	rules_bench_run(&bench, "is_referenced_var", bench_is_referenced_var);
+	rules_bench_run(&bench, "extract_arch_prefix", bench_extract_arch_prefix);
+	rules_bench_run(&bench, "indent_goalcol", bench_indent_goalcol);
+
+	// Keep the compiler from optimizing the calls away
+	if (bench.sink == 0) {
+		fprintf(stderr, "\n");
+	}
+
+	return 0;
+}
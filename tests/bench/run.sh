@@ -0,0 +1,35 @@
+#!/bin/sh
+# Generate a synthetic ports tree and benchmark portfmt against it.
+# The tree size can be tuned with the BENCH_* variables below.  The
+# results are written as JSON to stdout and to ${BUILDDIR}/bench/results.json.
+set -eu
+ROOT="${PWD}"
+BUILDDIR="$(readlink -f "$1" 2>/dev/null || realpath "$1")"
+: ${AWK:=awk}
+: ${BENCH_CATEGORIES:=8}
+: ${BENCH_PORTS:=64}
+: ${BENCH_SLAVES:=10}
+: ${BENCH_DEPTH:=2}
+: ${BENCH_OPTIONS:=8}
+: ${BENCH_CRATES:=500}
+: ${BENCH_GIANT:=5}
+: ${BENCH_SEED:=1}
+: ${BENCH_REPEAT:=3}
+
+tree="${BUILDDIR}/bench/tree"
+rm -rf "${tree}"
+mkdir -p "${tree}"
+${AWK} -f "${ROOT}/tests/bench/generate.awk" \
+	-v dir="${tree}" \
+	-v categories="${BENCH_CATEGORIES}" \
+	-v ports="${BENCH_PORTS}" \
+	-v slaves="${BENCH_SLAVES}" \
+	-v depth="${BENCH_DEPTH}" \
+	-v options="${BENCH_OPTIONS}" \
+	-v crates="${BENCH_CRATES}" \
+	-v giant="${BENCH_GIANT}" \
+	-v seed="${BENCH_SEED}" \
+	/dev/null
+
+"${BUILDDIR}/.tool/tests/bench/bench" -n "${BENCH_REPEAT}" -s "${BUILDDIR}/.bin/portscan" "${tree}" \
+	| tee "${BUILDDIR}/bench/results.json"
@@ -0,0 +1,15 @@
+for line in 1 2 3 4; do
+	kak_cursor_line=${line} ${PORTEDIT} apply kakoune.select-object-on-line $input
+done | diff -L $expected -L $actual -u $expected -
+! kak_cursor_line=5 ${PORTEDIT} apply kakoune.select-object-on-line $input >/dev/null 2>&1
+<<<<<<<<<
+PORTNAME=	foo
+.if 1
+USES=	a \
+	b
+.endif
+<<<<<<<<<
+select 1.1,1.10000000
+select 2.1,2.10000000
+select 3.1,4.10000000
+select 3.1,4.10000000
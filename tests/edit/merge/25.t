@@ -0,0 +1,49 @@
+printf 'V1!=\nV2!=\nV3!=\nV4!=\nV5!=\nV6!=\nV7!=\nV8!=\nV9!=\nV10!=\nV11!=\nV12!=\nV13!=\nV14!=\nV15!=\nV16!=\nV17!=\nV18!=\nV19!=\nV20!=\nV21!=\nV22!=\nV23!=\nV24!=\nV25!=\nV26!=\nV27!=\nV28!=\nV29!=\nV30!=\nV31!=\nV32!=\nV33!=\nV34!=\nV35!=\nV36!=\nV37!=\nV38!=\nV39!=\nV40!=\n' | ${PORTEDIT} merge $input | diff -L $expected -L $actual -u $expected -
+<<<<<<<<<
+PORTNAME=	foo
+V1=	x
+V2=	x
+V3=	x
+V4=	x
+V5=	x
+V6=	x
+V7=	x
+V8=	x
+V9=	x
+V10=	x
+V11=	x
+V12=	x
+V13=	x
+V14=	x
+V15=	x
+V16=	x
+V17=	x
+V18=	x
+V19=	x
+V20=	x
+V21=	x
+V22=	x
+V23=	x
+V24=	x
+V25=	x
+V26=	x
+V27=	x
+V28=	x
+V29=	x
+V30=	x
+V31=	x
+V32=	x
+V33=	x
+V34=	x
+V35=	x
+V36=	x
+V37=	x
+V38=	x
+V39=	x
+V40=	x
+
+KEEP=		yes
+<<<<<<<<<
+PORTNAME=	foo
+
+KEEP=		yes
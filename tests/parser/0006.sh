@@ -0,0 +1,12 @@
+# portfmt -c prints nothing and exits with 2 only if formatting
+# would change the input
+formatted="$(printf 'PORTNAME=\tfoo\nUSES=\t\tcmake gmake\n')"
+unformatted="$(printf 'PORTNAME=foo\nUSES=gmake cmake\n')"
+
+[ -z "$(echo "${formatted}" | ${PORTFMT} -c)" ]
+echo "${formatted}" | ${PORTFMT} -c
+
+status=0
+output="$(echo "${unformatted}" | ${PORTFMT} -c)" || status=$?
+[ "${status}" -eq 2 ]
+[ -z "${output}" ]
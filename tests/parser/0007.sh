@@ -0,0 +1,34 @@
+# portfmt -i leaves already formatted files alone and replaces
+# changed files instead of rewriting them
+dir="$(mktemp -d)"
+trap 'rm -rf "${dir}"' EXIT
+printf 'PORTNAME=\tfoo\nUSES=\t\tcmake gmake\n' >"${dir}/formatted"
+printf 'PORTNAME=foo\nUSES=gmake cmake\n' >"${dir}/Makefile"
+cp "${dir}/Makefile" "${dir}/unformatted"
+chmod 640 "${dir}/Makefile"
+touch -t 200001010000 "${dir}/Makefile"
+touch -t 200001020000 "${dir}/ref"
+
+${PORTFMT} -i "${dir}/Makefile"
+cmp -s "${dir}/formatted" "${dir}/Makefile"
+[ -n "$(find "${dir}/Makefile" -newer "${dir}/ref")" ]
+[ "$(ls -l "${dir}/Makefile" | cut -c1-10)" = "-rw-r-----" ]
+[ -z "$(find "${dir}" -name '.Makefile.*')" ]
+
+touch -t 200001010000 "${dir}/Makefile"
+${PORTFMT} -i "${dir}/Makefile"
+cmp -s "${dir}/formatted" "${dir}/Makefile"
+[ -z "$(find "${dir}/Makefile" -newer "${dir}/ref")" ]
+
+# Hard links and symlinks still point to the formatted file afterwards
+cp "${dir}/unformatted" "${dir}/Makefile"
+ln "${dir}/Makefile" "${dir}/hardlink"
+ln -s Makefile "${dir}/symlink"
+${PORTFMT} -i "${dir}/symlink"
+[ -L "${dir}/symlink" ]
+cmp -s "${dir}/formatted" "${dir}/Makefile"
+cmp -s "${dir}/formatted" "${dir}/hardlink"
+cp "${dir}/unformatted" "${dir}/hardlink"
+${PORTFMT} -i "${dir}/hardlink"
+cmp -s "${dir}/formatted" "${dir}/Makefile"
+[ -z "$(find "${dir}" -name '.Makefile.*' -o -name '.hardlink.*')" ]
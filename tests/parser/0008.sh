@@ -0,0 +1,55 @@
+# Reading a Makefile through the AST cache yields the same results
+# as parsing it, and broken cache entries are ignored
+dir="$(mktemp -d)"
+trap 'rm -rf "${dir}"' EXIT
+mkdir "${dir}/cache"
+cat <<'MAKEFILE' >"${dir}/Makefile"
+PORTNAME=	foo
+DISTVERSION=	1.0
+CATEGORIES=	devel # comment
+
+MAINTAINER=	ports@FreeBSD.org
+COMMENT=	Foo
+
+USES=		gmake
+
+.include <bsd.port.options.mk>
+
+.if ${ARCH} == amd64
+CFLAGS+=	-O2
+.elif ${ARCH} == i386
+CFLAGS+=	-O1
+.else
+# other
+.endif
+
+.for f in a b
+PLIST_FILES+=	bin/${f}
+.endfor
+
+post-install:
+	@${ECHO} done
+
+.include <bsd.port.mk>
+MAKEFILE
+
+${PORTCLIPPY} "${dir}/Makefile" >"${dir}/expected.clippy" || true
+${PORTEDIT} get 'CFLAGS|PLIST_FILES|USES' "${dir}/Makefile" >"${dir}/expected.get"
+
+export PORTFMT_CACHE_DIR="${dir}/cache"
+${PORTCLIPPY} "${dir}/Makefile" >"${dir}/actual.clippy" || true
+[ -n "$(find "${dir}/cache" -name '*.ast')" ]
+${PORTCLIPPY} "${dir}/Makefile" >"${dir}/cached.clippy" || true
+${PORTEDIT} get 'CFLAGS|PLIST_FILES|USES' "${dir}/Makefile" >"${dir}/actual.get"
+${PORTEDIT} get 'CFLAGS|PLIST_FILES|USES' "${dir}/Makefile" >"${dir}/cached.get"
+cmp -s "${dir}/expected.clippy" "${dir}/actual.clippy"
+cmp -s "${dir}/expected.clippy" "${dir}/cached.clippy"
+cmp -s "${dir}/expected.get" "${dir}/actual.get"
+cmp -s "${dir}/expected.get" "${dir}/cached.get"
+
+for f in "${dir}"/cache/*.ast; do
+	head -c 100 "${f}" >"${f}.tmp"
+	mv "${f}.tmp" "${f}"
+done
+${PORTCLIPPY} "${dir}/Makefile" >"${dir}/broken.clippy" || true
+cmp -s "${dir}/expected.clippy" "${dir}/broken.clippy"
@@ -0,0 +1,58 @@
+# portfmt -D and portedit -D produce patches that turn the input into
+# the output, with hunk headers for changes at the start and the end
+# of the file
+dir="$(mktemp -d)"
+trap 'rm -rf "${dir}"' EXIT
+printf 'PORTNAME=foo\nDISTVERSION=\t1.0\nCATEGORIES=\tdevel\n\nMAINTAINER=\tports@FreeBSD.org\nCOMMENT=\tFoo\nWWW=\t\thttps://example.org/\n\nUSES=\t\tgmake\n\nNO_ARCH=\tyes\nPLIST_FILES=bin/foo\n' >"${dir}/Makefile"
+
+# Split a patch with full context back into the original and the new
+# file after skipping the ---/+++ header
+old() {
+	sed -n '3,$s/^[ -]//p' "$1"
+}
+new() {
+	sed -n '3,$s/^[ +]//p' "$1"
+}
+hunks() {
+	grep '^@@' "$1" | tr '\n' ' '
+}
+
+status=0
+${PORTFMT} "${dir}/Makefile" >"${dir}/formatted" || status=$?
+[ "${status}" -eq 0 ]
+[ "$(diff "${dir}/Makefile" "${dir}/formatted" | grep -v '^[<>-]' | tr '\n' ' ')" = "1c1 12c12 " ]
+
+for context in "" 0 3; do
+	status=0
+	${PORTFMT} -D${context} "${dir}/Makefile" >"${dir}/diff${context}" || status=$?
+	[ "${status}" -eq 2 ]
+done
+cmp -s "${dir}/diff" "${dir}/diff3"
+[ "$(hunks "${dir}/diff0")" = "@@ -1,12 +1,12 @@ " ]
+[ "$(hunks "${dir}/diff3")" = "@@ -1,4 +1,4 @@ @@ -9,4 +9,4 @@ " ]
+old "${dir}/diff0" | cmp -s "${dir}/Makefile" -
+new "${dir}/diff0" | cmp -s "${dir}/formatted" -
+
+# Formatted input has no differences and no patch
+${PORTFMT} -D "${dir}/formatted" >"${dir}/nodiff"
+[ ! -s "${dir}/nodiff" ]
+
+# Edits at the start and the end of the file
+${PORTEDIT} bump-revision "${dir}/formatted" >"${dir}/bumped"
+${PORTEDIT} merge -e 'PLIST_FILES=bin/bar' "${dir}/formatted" >"${dir}/merged"
+for context in "" 0 3; do
+	status=0
+	${PORTEDIT} bump-revision -D${context} "${dir}/formatted" >"${dir}/bump${context}" || status=$?
+	[ "${status}" -eq 2 ]
+	status=0
+	${PORTEDIT} merge -D${context} -e 'PLIST_FILES=bin/bar' "${dir}/formatted" >"${dir}/merge${context}" || status=$?
+	[ "${status}" -eq 2 ]
+done
+cmp -s "${dir}/bump" "${dir}/bump3"
+cmp -s "${dir}/merge" "${dir}/merge3"
+[ "$(hunks "${dir}/bump3")" = "@@ -1,5 +1,6 @@ " ]
+[ "$(hunks "${dir}/merge3")" = "@@ -9,4 +9,4 @@ " ]
+old "${dir}/bump0" | cmp -s "${dir}/formatted" -
+new "${dir}/bump0" | cmp -s "${dir}/bumped" -
+old "${dir}/merge0" | cmp -s "${dir}/formatted" -
+new "${dir}/merge0" | cmp -s "${dir}/merged" -
@@ -0,0 +1,85 @@
+# portfmt --server answers requests like the equivalent portfmt and
+# portedit commands and rejects malformed length prefixes
+if ! command -v nc >/dev/null; then
+	echo "nc not found, skipping" >&2
+	exit 0
+fi
+dir="$(mktemp -d)"
+${PORTFMT} --server "${dir}/sock" &
+pid=$!
+trap 'kill ${pid}; rm -rf "${dir}"' EXIT
+cd "${dir}"
+printf 'PORTNAME=foo\nDISTVERSION=\t1.0\nCATEGORIES=\tdevel\n\nUSES=gmake\n' >Makefile
+
+# Prefix a message with its length as a 32-bit integer in network
+# byte order
+frame() {
+	len=$(wc -c <"$1")
+	printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $((len >> 24 & 255)) $((len >> 16 & 255)) $((len >> 8 & 255)) $((len & 255)))"
+	cat "$1"
+}
+# request command path argument
+request() {
+	{ printf '%s\000%s\000%s\000' "$1" "$2" "$3"; cat Makefile; } >body
+	frame body
+}
+# response status command...
+response() {
+	status="$1"
+	shift
+	"$@" >output || true
+	{ printf '%s\000' "${status}"; cat output; } >body
+	frame body
+}
+send() {
+	nc -N -w 10 -U sock >actual
+}
+
+i=0
+while [ ! -S sock ]; do
+	i=$((i + 1))
+	[ "${i}" -lt 100 ]
+	sleep 0.1
+done
+
+request format Makefile "" | send
+response 0 ${PORTFMT} Makefile >expected
+cmp -s expected actual
+
+# Several requests on one connection, a cached diff parser must not be
+# reused for a different context
+{
+	request diff Makefile ""
+	request diff Makefile 0
+	request diff Makefile ""
+} | send
+{
+	response 2 ${PORTFMT} -D Makefile
+	response 2 ${PORTFMT} -D0 Makefile
+	response 2 ${PORTFMT} -D Makefile
+} >expected
+cmp -s expected actual
+
+{
+	request apply-edit Makefile edit.bump-revision
+	request get-variable Makefile '^PORTNAME$'
+	request apply-edit Makefile edit.bump-revision
+} | send
+{
+	response 0 ${PORTEDIT} apply edit.bump-revision Makefile
+	response 0 ${PORTEDIT} get '^PORTNAME$' Makefile
+	response 0 ${PORTEDIT} apply edit.bump-revision Makefile
+} >expected
+cmp -s expected actual
+
+# A length over the limit closes the connection after an error
+printf 'malformed request' >error
+{ printf '1\000'; cat error; } >body
+frame body >expected
+printf '\377\377\377\377' | send
+cmp -s expected actual
+
+# The server is still running
+request format Makefile "" | send
+response 0 ${PORTFMT} Makefile >expected
+cmp -s expected actual
@@ -0,0 +1,93 @@
+# text-edit requests of portfmt --server only parse the changed lines
+# again but produce the same output as formatting the whole file
+if ! command -v nc >/dev/null; then
+	echo "nc not found, skipping" >&2
+	exit 0
+fi
+dir="$(mktemp -d)"
+${PORTFMT} --server "${dir}/sock" &
+pid=$!
+trap 'kill ${pid}; rm -rf "${dir}"' EXIT
+cd "${dir}"
+printf 'PORTNAME=foo\nDISTVERSION=\t1.0\nCATEGORIES=\tdevel\n\nUSES=\tgmake\n\n# comment\npost-install:\n\t@${ECHO} done\n' >Makefile
+
+# Prefix a message with its length as a 32-bit integer in network
+# byte order
+frame() {
+	len=$(wc -c <"$1")
+	printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $((len >> 24 & 255)) $((len >> 16 & 255)) $((len >> 8 & 255)) $((len & 255)))"
+	cat "$1"
+}
+# request command path argument file
+request() {
+	{ printf '%s\000%s\000%s\000' "$1" "$2" "$3"; cat "$4"; } >body
+	frame body
+}
+# response status command...
+response() {
+	status="$1"
+	shift
+	"$@" >output || true
+	{ printf '%s\000' "${status}"; cat output; } >body
+	frame body
+}
+send() {
+	nc -N -w 10 -U sock >actual
+}
+# Replace the lines [a,b) with text in Makefile and through the server
+edit() {
+	printf "$3" >text
+	awk -v a="$1" -v b="$2" '
+BEGIN {
+	while ((getline line < "text") > 0) {
+		text = text line "\n"
+	}
+}
+FNR == a {
+	printf "%s", text
+	done = 1
+}
+FNR < a || FNR >= b {
+	print
+}
+END {
+	if (!done) {
+		printf "%s", text
+	}
+}' Makefile >Makefile.new
+	mv Makefile.new Makefile
+	request text-edit Makefile "$1,$2" text | send
+	response 0 ${PORTFMT} Makefile >expected
+	cmp -s expected actual
+}
+
+i=0
+while [ ! -S sock ]; do
+	i=$((i + 1))
+	[ "${i}" -lt 100 ]
+	sleep 0.1
+done
+
+request format Makefile "" Makefile | send
+response 0 ${PORTFMT} Makefile >expected
+cmp -s expected actual
+
+# Insert at the start, next to a variable it is merged with, replace
+# and delete lines, append at the end and edit a target command
+edit 1 1 '# header\n'
+edit 7 7 'USES+=\tcmake\n'
+edit 3 4 'DISTVERSION=2.0\n'
+edit 9 10 ''
+edit 11 11 '\n.include <bsd.port.mk>\n'
+edit 10 11 '\t@${TRUE}\n'
+
+# The server has the same buffer as we do
+request format Makefile "" Makefile | send
+response 0 ${PORTFMT} Makefile >expected
+cmp -s expected actual
+
+printf '' >text
+request text-edit Makefile "5,100" text | send
+[ "$(tail -c +5 actual | head -c 1)" = "1" ]
+request text-edit unknown "1,1" text | send
+[ "$(tail -c +5 actual | head -c 1)" = "1" ]
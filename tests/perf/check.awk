@@ -0,0 +1,73 @@
+# usage: awk [-v record=1] -f check.awk <budget> <stats>
+#
+# Each budget line names a counter printed by a stats build (see
+# stats_print() in stats.c) and the most the tool may use for its
+# input.  A count over the budget by more than the tolerance (in
+# percent, 10 unless the budget sets it with a `tolerance` line)
+# fails.  A count below half its budget is reported so that the budget
+# can be tightened.
+#
+# With -v record=1 the budget is printed with the measured counts in
+# place of its values instead of being checked.
+
+# Tabs that align a value after s at column 24
+function pad(s,	col, tabs) {
+	tabs = ""
+	for (col = length(s); col < 24; col += 8 - col % 8) {
+		tabs = tabs "\t"
+	}
+	return tabs
+}
+
+BEGIN {
+	tolerance = 10
+}
+
+FILENAME == ARGV[1] && $1 == "tolerance" && NF == 2 {
+	tolerance = $2
+	order[++n] = $0
+	next
+}
+
+FILENAME == ARGV[1] && NF >= 2 && $1 !~ /^#/ {
+	budget[$1] = $2
+	order[++n] = $1
+	next
+}
+
+# Comments are kept for record mode
+FILENAME == ARGV[1] {
+	order[++n] = $0
+	next
+}
+
+FILENAME == ARGV[2] && NF == 2 {
+	actual[$1] = $2
+	next
+}
+
+END {
+	status = 0
+	for (i = 1; i <= n; i++) {
+		counter = order[i]
+		if (!(counter in budget)) {
+			if (record) {
+				print counter
+			}
+		} else if (!(counter in actual)) {
+			printf("%s: unknown counter\n", counter)
+			status = 1
+		} else if (record) {
+			printf("%s%s%.0f\n", counter, pad(counter), actual[counter])
+		} else if (actual[counter] > budget[counter] * (1 + tolerance / 100)) {
+			printf("%s: %.0f is over the budget of %.0f by %.1f%%, tolerance is %s%%\n", counter,
+				actual[counter], budget[counter],
+				(actual[counter] / budget[counter] - 1) * 100, tolerance)
+			status = 1
+		} else if (actual[counter] < budget[counter] / 2) {
+			printf("%s: %.0f is well under the budget of %.0f\n", counter,
+				actual[counter], budget[counter])
+		}
+	}
+	exit status
+}
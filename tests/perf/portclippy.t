@@ -0,0 +1,101 @@
+# portclippy exits with 1 when it has something to report
+status=0
+${PORTCLIPPY} "${input}" || status=$?
+[ "${status}" -le 1 ]
+<<<<<<<<<
+# Port with variables out of order, in the wrong blocks and unknown to
+# portclippy so that every check has something to report
+PORTNAME=	perf-clippy
+CATEGORIES=	net www
+DISTVERSION=	0.9.12
+MASTER_SITES=	https://example.org/releases/
+DISTFILES=	${DISTNAME}${EXTRACT_SUFX} ${DISTNAME}-docs${EXTRACT_SUFX}
+
+COMMENT=	Port used by the portclippy operation count test
+MAINTAINER=	ports@example.org
+WWW=		https://example.org/perf-clippy/
+
+LICENSE=	GPLv2+
+LICENSE_FILE=	${WRKSRC}/COPYING
+
+USES=		autoreconf gmake libtool pkgconfig ssl
+GNU_CONFIGURE=	yes
+CONFIGURE_ARGS=	--disable-static --with-ssl=${OPENSSLBASE}
+INSTALL_TARGET=	install-strip
+USE_RC_SUBR=	perf_clippy
+
+LIB_DEPENDS=	libevent.so:devel/libevent \
+		libuv.so:devel/libuv
+BUILD_DEPENDS=	gperf:devel/gperf
+RUN_DEPENDS=	ca_root_nss>0:security/ca_root_nss
+
+PERF_CLIPPY_USER=	perfclippy
+PERF_CLIPPY_GROUP=	perfclippy
+USERS=		${PERF_CLIPPY_USER}
+GROUPS=		${PERF_CLIPPY_GROUP}
+SUB_LIST=	USER=${PERF_CLIPPY_USER} GROUP=${PERF_CLIPPY_GROUP}
+SUB_FILES=	pkg-message
+
+PORTDOCS=	NEWS README.md
+PORTEXAMPLES=	*.conf
+
+UNKNOWN_A=	a
+UNKNOWN_B=	${UNKNOWN_A} b
+_INTERNAL=	c
+
+FLAVORS=	default lite
+lite_PKGNAMESUFFIX=	-lite
+FLAVOR?=	${FLAVORS:[1]}
+
+OPTIONS_DEFINE=	DOCS EXAMPLES IPV6 LUA
+OPTIONS_RADIO=	DNS
+OPTIONS_RADIO_DNS=	CARES UNBOUND
+OPTIONS_DEFAULT=	CARES IPV6
+OPTIONS_SUB=	yes
+
+CARES_DESC=	Resolve names with c-ares
+UNBOUND_DESC=	Resolve names with libunbound
+
+IPV6_CONFIGURE_ENABLE=	ipv6
+LUA_USES=	lua:53
+LUA_CONFIGURE_WITH=	lua
+CARES_LIB_DEPENDS=	libcares.so:dns/c-ares
+CARES_CONFIGURE_ON=	--with-resolver=c-ares
+UNBOUND_LIB_DEPENDS=	libunbound.so:dns/unbound
+UNBOUND_CONFIGURE_ON=	--with-resolver=unbound
+DOCS_CONFIGURE_ENABLE=	docs
+UNKNOWN_CONFIGURE_ENABLE=	unknown
+
+.include <bsd.port.options.mk>
+
+.if ${FLAVOR} == lite
+CONFIGURE_ARGS+=	--disable-plugins
+OPTIONS_EXCLUDE=	LUA
+.endif
+
+post-install-DOCS-on:
+	@${MKDIR} ${STAGEDIR}${DOCSDIR}
+	${INSTALL_DATA} ${PORTDOCS:S|^|${WRKSRC}/|} ${STAGEDIR}${DOCSDIR}
+
+post-install-EXAMPLES-on:
+	@${MKDIR} ${STAGEDIR}${EXAMPLESDIR}
+	${INSTALL_DATA} ${WRKSRC}/examples/*.conf ${STAGEDIR}${EXAMPLESDIR}
+
+post-install:
+	${INSTALL_DATA} ${WRKSRC}/perf-clippy.conf ${STAGEDIR}${PREFIX}/etc/perf-clippy.conf.sample
+
+pre-configure:
+	${REINPLACE_CMD} -e 's|/etc|${PREFIX}/etc|' ${WRKSRC}/src/paths.h
+
+.include <bsd.port.mk>
+<<<<<<<<<
+# Budgets for checking this input once.  Rerun the test with
+# PORTFMT_PERF_RECORD=1 on a build with the stats feature to measure
+# new counts after an intended change.
+#
+# counter		max
+tolerance		10
+allocs			15000
+bytes			2000000
+ast-nodes-visited	20000
+lookup-variable		600
@@ -0,0 +1,110 @@
+${PORTFMT} "${input}"
+<<<<<<<<<
+# Unformatted port with long dependency lists, options helpers and
+# targets so that every refactor and formatting pass has work to do
+PORTNAME=	perf-format
+DISTVERSIONPREFIX=v
+DISTVERSION=	2.4.1
+PORTREVISION= 3
+CATEGORIES=	devel    textproc   python
+MASTER_SITES= https://example.org/dist/ \
+	https://mirror.example.org/dist/
+PKGNAMEPREFIX=${PYTHON_PKGNAMEPREFIX}
+
+MAINTAINER=	ports@example.org
+COMMENT= Port used by the portfmt operation count test
+WWW=	https://example.org/perf-format/
+
+LICENSE=	APACHE20 MIT
+LICENSE_COMB=dual
+LICENSE_FILE_APACHE20=	${WRKSRC}/LICENSE-APACHE
+LICENSE_FILE_MIT=${WRKSRC}/LICENSE-MIT
+
+BUILD_DEPENDS= ${PYTHON_PKGNAMEPREFIX}setuptools>0:devel/py-setuptools@${PY_FLAVOR} ${PYTHON_PKGNAMEPREFIX}wheel>0:devel/py-wheel@${PY_FLAVOR} cmake:devel/cmake-core
+LIB_DEPENDS=	libzstd.so:archivers/zstd libxml2.so:textproc/libxml2 libpcre2-8.so:devel/pcre2 libcurl.so:ftp/curl libexpat.so:textproc/expat2 libyaml.so:textproc/libyaml
+RUN_DEPENDS=	${PYTHON_PKGNAMEPREFIX}attrs>=21:devel/py-attrs@${PY_FLAVOR} \
+	${PYTHON_PKGNAMEPREFIX}click>=8:devel/py-click@${PY_FLAVOR} ${PYTHON_PKGNAMEPREFIX}jinja2>=3:devel/py-Jinja2@${PY_FLAVOR} \
+		${PYTHON_PKGNAMEPREFIX}packaging>0:devel/py-packaging@${PY_FLAVOR} ${PYTHON_PKGNAMEPREFIX}pyyaml>=6:devel/py-pyyaml@${PY_FLAVOR}
+TEST_DEPENDS=	${PYTHON_PKGNAMEPREFIX}pytest>0:devel/py-pytest@${PY_FLAVOR} ${PYTHON_PKGNAMEPREFIX}pytest-xdist>0:devel/py-pytest-xdist@${PY_FLAVOR}
+
+USES=	python:3.8+ pkgconfig compiler:c++17-lang cmake:noninja shebangfix localbase:ldflags gettext-runtime iconv
+USE_GITHUB=yes
+GH_ACCOUNT=	example
+GH_PROJECT=  perf-format
+GH_TUPLE= example:vendored-a:0123456789abcdef:a/vendor/a \
+	example:vendored-b:fedcba9876543210:b/vendor/b
+USE_PYTHON=	autoplist concurrent distutils pytest
+USE_LDCONFIG=yes
+
+SHEBANG_FILES=	scripts/*.py tools/*.sh
+
+CMAKE_ARGS=	-DBUILD_TESTING=OFF -DUSE_SYSTEM_ZSTD=ON -DUSE_SYSTEM_LIBXML2=ON -DUSE_SYSTEM_PCRE2=ON -DCMAKE_INSTALL_DATAROOTDIR=${PREFIX}/share
+CMAKE_ON=	BUILD_SHARED_LIBS ENABLE_CURL
+CMAKE_OFF=	ENABLE_WERROR ENABLE_COVERAGE
+CFLAGS+=	-fno-strict-aliasing
+CXXFLAGS+= -Wno-deprecated-declarations
+LDFLAGS+=	-lpthread
+
+PLIST_FILES=	bin/perf-format lib/libperf-format.so lib/libperf-format.so.2 lib/libperf-format.so.2.4.1 include/perf-format.h
+
+OPTIONS_DEFINE=	DOCS EXAMPLES NLS X11 MANPAGES
+OPTIONS_DEFAULT=NLS MANPAGES
+OPTIONS_GROUP=	BACKEND
+OPTIONS_GROUP_BACKEND=	LMDB SQLITE
+OPTIONS_SUB=yes
+
+BACKEND_DESC=	Storage backends
+LMDB_DESC=	LMDB storage backend
+SQLITE_DESC= SQLite storage backend
+
+DOCS_BUILD_DEPENDS=	${PYTHON_PKGNAMEPREFIX}sphinx>=5,1:textproc/py-sphinx@${PY_FLAVOR} ${PYTHON_PKGNAMEPREFIX}sphinx_rtd_theme>0:textproc/py-sphinx_rtd_theme@${PY_FLAVOR}
+DOCS_CMAKE_BOOL=	BUILD_DOCS
+EXAMPLES_CMAKE_BOOL=BUILD_EXAMPLES
+LMDB_LIB_DEPENDS=	liblmdb.so:databases/lmdb
+LMDB_CMAKE_BOOL=	ENABLE_LMDB
+MANPAGES_BUILD_DEPENDS=	scdoc:textproc/scdoc
+MANPAGES_CMAKE_BOOL=	BUILD_MANPAGES
+NLS_USES=	gettext
+NLS_CMAKE_BOOL_OFF=	DISABLE_NLS
+SQLITE_USES=	sqlite:3
+SQLITE_CMAKE_BOOL=	ENABLE_SQLITE
+X11_USE=	XORG=x11,xext,xrender,xft
+X11_CMAKE_BOOL=ENABLE_X11
+
+.include <bsd.port.options.mk>
+
+.if ${ARCH} == i386 || ${ARCH} == armv7
+CMAKE_ARGS+=	-DENABLE_SIMD=OFF
+.elif ${ARCH} == amd64
+CMAKE_ARGS+=	-DENABLE_SIMD=ON
+.endif
+
+.if ${OPSYS} == FreeBSD && ${OSVERSION} < 1300000
+EXTRA_PATCHES+=${FILESDIR}/extra-patch-src_compat.c
+.endif
+
+post-patch:
+	@${REINPLACE_CMD} -e 's|/usr/local|${PREFIX}|g' \
+		${WRKSRC}/src/config.h.in ${WRKSRC}/scripts/install.sh
+	@${REINPLACE_CMD} -e 's|python3|${PYTHON_CMD}|' ${WRKSRC}/tools/build.sh
+
+post-install:
+	${STRIP_CMD} ${STAGEDIR}${PREFIX}/bin/perf-format ${STAGEDIR}${PREFIX}/lib/libperf-format.so.2.4.1
+	${INSTALL_DATA} ${WRKSRC}/etc/perf-format.conf ${STAGEDIR}${PREFIX}/etc/perf-format.conf.sample
+
+post-install-EXAMPLES-on:
+	@${MKDIR} ${STAGEDIR}${EXAMPLESDIR}
+	cd ${WRKSRC}/examples && ${COPYTREE_SHARE} . ${STAGEDIR}${EXAMPLESDIR}
+
+.include <bsd.port.mk>
+<<<<<<<<<
+# Budgets for formatting this input once.  Rerun the test with
+# PORTFMT_PERF_RECORD=1 on a build with the stats feature to measure
+# new counts after an intended change.
+#
+# counter		max
+tolerance		10
+allocs			20000
+bytes			2500000
+ast-nodes-visited	25000
+lookup-variable		400
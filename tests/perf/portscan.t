@@ -0,0 +1,78 @@
+# Scan a small tree of ports made from the input with a master port, its
+# slave port and options descriptions for every check to look at
+tree="${input}.tree"
+rm -rf "${tree}"
+mkdir -p "${tree}/Mk" "${tree}/devel" "${tree}/net"
+printf 'SUBDIR += devel\nSUBDIR += net\n' >"${tree}/Makefile"
+printf 'DOCS_DESC=\tBuild and/or install documentation\nNLS_DESC=\tNative Language Support\nX11_DESC=\tX11 (graphics) support\n' >"${tree}/Mk/bsd.options.desc.mk"
+for category in devel net; do
+	for i in 1 2 3 4; do
+		port="perf-scan${i}"
+		echo "SUBDIR += ${port}" >>"${tree}/${category}/Makefile"
+		mkdir -p "${tree}/${category}/${port}"
+		sed -e "s|@PORTNAME@|${port}|" -e "s|@CATEGORY@|${category}|" "${input}" >"${tree}/${category}/${port}/Makefile"
+	done
+	echo "SUBDIR += perf-scan-slave" >>"${tree}/${category}/Makefile"
+	mkdir -p "${tree}/${category}/perf-scan-slave"
+	printf 'PKGNAMESUFFIX=\t-slave\nMASTERDIR=\t${.CURDIR}/../perf-scan1\n\n.include "${MASTERDIR}/Makefile"\n' >"${tree}/${category}/perf-scan-slave/Makefile"
+done
+${PORTSCAN} -p "${tree}" --unknown-variables --unknown-targets --options --option-default-descriptions --variable-values
+<<<<<<<<<
+PORTNAME=	@PORTNAME@
+DISTVERSION=	1.0.0
+CATEGORIES=	@CATEGORY@
+MASTER_SITES=	https://example.org/dist/
+
+MAINTAINER=	ports@example.org
+COMMENT=	Port used by the portscan operation count test
+WWW=		https://example.org/
+
+LICENSE=	BSD2CLAUSE
+
+LIB_DEPENDS=	libfoo.so:devel/foo \
+		libbar.so:devel/bar
+RUN_DEPENDS=	baz>0:devel/baz
+
+USES=		cmake compiler:c++11-lang pkgconfig
+USE_GITHUB=	yes
+GH_ACCOUNT=	example
+
+CMAKE_ARGS=	-DBUILD_TESTING=OFF
+CMAKE_ON=	BUILD_SHARED_LIBS
+
+UNKNOWN_A=	a
+UNKNOWN_B=	${UNKNOWN_A}
+
+OPTIONS_DEFINE=	DOCS NLS X11
+OPTIONS_DEFAULT=	NLS
+
+DOCS_DESC=	Build and/or install documentation
+NLS_USES=	gettext
+NLS_CMAKE_BOOL=	ENABLE_NLS
+X11_USE=	XORG=x11,xext
+X11_CMAKE_BOOL=	ENABLE_X11
+
+.include <bsd.port.options.mk>
+
+.if ${PORT_OPTIONS:MDOCS}
+PORTDOCS=	README
+.endif
+
+post-install:
+	${INSTALL_DATA} ${WRKSRC}/README ${STAGEDIR}${DOCSDIR}
+
+unknown-target:
+	@${TRUE}
+
+.include <bsd.port.mk>
+<<<<<<<<<
+# Budgets for scanning the tree of 10 ports once.  Rerun the test with
+# PORTFMT_PERF_RECORD=1 on a build with the stats feature to measure
+# new counts after an intended change.
+#
+# counter		max
+tolerance		10
+allocs			60000
+bytes			8000000
+ast-nodes-visited	80000
+lookup-variable		3000
@@ -0,0 +1,7 @@
+# Merging the logs of a sharded scan gives the same result as a full scan
+${PORTSCAN} --categories -p 0005 > "${logdir}/full.log"
+${PORTSCAN} --categories -p 0005 --shard=1/2 > "${logdir}/shard1.log"
+${PORTSCAN} --categories -p 0005 --shard=2/2 > "${logdir}/shard2.log"
+${PORTSCAN} --merge "${logdir}/shard2.log" "${logdir}/shard1.log" | diff -u "${logdir}/full.log" -
+${PORTSCAN} -l "${logdir}/log" --merge "${logdir}/shard1.log" "${logdir}/shard2.log"
+diff -u "${logdir}/full.log" "${logdir}/log/portscan-latest.log"
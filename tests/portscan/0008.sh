@@ -0,0 +1,10 @@
+# --metrics writes one JSON object per line and the last one is for
+# the finished scan
+${PORTSCAN} -p 0005 -l "${logdir}/log" --metrics="${logdir}/metrics" >/dev/null 2>&1
+[ -s "${logdir}/metrics" ]
+record='^{"time":[0-9.]*,"phase":"[a-z]*","scanned":[0-9]*,"total":[0-9]*,"rate":[0-9.]*,"eta":-\{0,1\}[0-9.]*,"queue":[0-9]*,"maxrss":[0-9]*,"workers":\[.*\]}$'
+if grep -v "${record}" "${logdir}/metrics"; then
+	exit 1
+fi
+tail -n 1 "${logdir}/metrics" | grep -q '"phase":"finished","scanned":0,"total":0,'
+grep -q '"phase":"ports"' "${logdir}/metrics"
@@ -84,6 +84,29 @@ tests/clippy/*.t)
 		fail
 	fi
 	;;
+tests/perf/*.t)
+	split_test
+	if ! input="$t.in" PORTFMT_STATS=1 ${SH} -o pipefail -eu "$t.sh" >/dev/null 2>"$t.stats"; then
+		fail
+	fi
+	# Operation counts are only available with the stats feature.  CI
+	# sets PORTFMT_REQUIRE_STATS=1 for its stats build so that the
+	# checks cannot be skipped there by accident.
+	if ! grep -q '^peak-live-bytes ' "$t.stats"; then
+		if [ "${PORTFMT_REQUIRE_STATS:-0}" != 0 ]; then
+			echo "$t:1:1: operation counts missing, was the stats feature enabled?" >&2
+			fail
+		fi
+		echo "$t: SKIP: operation counts need a build with the stats feature" >&2
+	elif [ "${PORTFMT_PERF_RECORD:-0}" != 0 ]; then
+		# Write the measured counts as a new budget to replace the
+		# last section of the test with
+		${AWK:-awk} -v record=1 -f "${ROOT}/tests/perf/check.awk" "$t.expected" "$t.stats" >"$t.budget"
+		echo "$t: recorded budget in ${BUILDDIR}/$t.budget" >&2
+	elif ! ${AWK:-awk} -f "${ROOT}/tests/perf/check.awk" "$t.expected" "$t.stats"; then
+		fail
+	fi
+	;;
 tests/reject/*.in)
 	if ${PORTFMT} "$t" 2>/dev/null; then
 		fail
@@ -0,0 +1,130 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2022 Tobias Kortkamp <tobik@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libias/mempool.h>
+#include <libias/str.h>
+
+#include "trace.h"
+
+// Prototypes
+static char *trace_escape(struct Mempool *, const char *);
+static int trace_thread_id(void);
+
+bool trace_enabled = false;
+static FILE *trace_out = NULL;
+static pid_t trace_pid;
+static atomic_int trace_next_tid = ATOMIC_VAR_INIT(0);
+static _Thread_local int trace_tid = -1;
+
+void
+trace_start(FILE *out)
+{
+	trace_out = out;
+	trace_pid = getpid();
+	// The array is opened with a metadata event so that every other
+	// event can be prefixed with a comma
+	fprintf(trace_out, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"portfmt\"}}", (int)trace_pid);
+	trace_enabled = true;
+}
+
+void
+trace_stop()
+{
+	if (!trace_enabled) {
+		return;
+	}
+	trace_enabled = false;
+	fputs("\n]\n", trace_out);
+	fflush(trace_out);
+	trace_out = NULL;
+}
+
+int
+trace_thread_id()
+{
+	if (trace_tid < 0) {
+		trace_tid = trace_next_tid++;
+	}
+	return trace_tid;
+}
+
+char *
+trace_escape(struct Mempool *pool, const char *s)
+{
+	size_t len = 0;
+	char *buf = mempool_alloc(pool, 6 * strlen(s) + 1);
+	for (; *s != 0; s++) {
+		if (*s == '"' || *s == '\\') {
+			buf[len++] = '\\';
+			buf[len++] = *s;
+		} else if ((unsigned char)*s < 0x20) {
+			len += sprintf(buf + len, "\\u%04x", (unsigned char)*s);
+		} else {
+			buf[len++] = *s;
+		}
+	}
+	buf[len] = 0;
+	return buf;
+}
+
+void
+trace_event(char phase, const char *name, const char *arg)
+{
+	SCOPE_MEMPOOL(pool);
+
+	FILE *out = trace_out;
+	if (out == NULL) {
+		return;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	double us = ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+
+	char *event;
+	if (arg) {
+		event = str_printf(pool, ",\n{\"name\":\"%s\",\"cat\":\"portfmt\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"origin\":\"%s\"}}",
+			name, phase, us, (int)trace_pid, trace_thread_id(), trace_escape(pool, arg));
+	} else {
+		event = str_printf(pool, ",\n{\"name\":\"%s\",\"cat\":\"portfmt\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+			name, phase, us, (int)trace_pid, trace_thread_id());
+	}
+	// A single stdio call is atomic with respect to other threads
+	fputs(event, out);
+}